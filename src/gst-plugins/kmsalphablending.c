@@ -23,6 +23,7 @@
 #include <commons/kms-core-marshal.h>
 #include <commons/kmshubport.h>
 #include <commons/kmsloop.h>
+#include "kmshousekeeping.h"
 #include <commons/kmsutils.h>
 #include <commons/kmsrefstruct.h>
 
@@ -501,8 +502,8 @@ cb_EOS_received (GstPad * pad, GstPadProbeInfo * info,
   event = gst_event_new_eos ();
   gst_pad_send_event (pad, event);
 
-  kms_loop_idle_add_full (self->priv->loop, G_PRIORITY_DEFAULT,
-      (GSourceFunc) remove_elements_from_pipeline,
+  kms_housekeeping_idle_add_full (self->priv->loop, self,
+      G_PRIORITY_DEFAULT, (GSourceFunc) remove_elements_from_pipeline,
       KMS_ALPHA_BLENDING_REF (port_data),
       (GDestroyNotify) kms_ref_struct_unref);
 
@@ -574,10 +575,11 @@ kms_alpha_blending_port_data_destroy (KmsAlphaBlendingData * port_data)
 
       KMS_ALPHA_BLENDING_UNLOCK (self);
 
-      if (remove) {
+      /* Pending removals are discarded once the element is disposed */
+      if (remove && self->priv->loop != NULL) {
         /* Remove pipeline without helding the mutex */
-        kms_loop_idle_add_full (self->priv->loop, G_PRIORITY_DEFAULT,
-            (GSourceFunc) remove_elements_from_pipeline,
+        kms_housekeeping_idle_add_full (self->priv->loop, self,
+            G_PRIORITY_DEFAULT, (GSourceFunc) remove_elements_from_pipeline,
             KMS_ALPHA_BLENDING_REF (port_data),
             (GDestroyNotify) kms_ref_struct_unref);
       }
@@ -971,9 +973,12 @@ kms_alpha_blending_dispose (GObject * object)
   KmsAlphaBlending *self = KMS_ALPHA_BLENDING (object);
 
   KMS_ALPHA_BLENDING_LOCK (self);
+  if (self->priv->loop != NULL) {
+    kms_housekeeping_release_loop (self->priv->loop);
+    self->priv->loop = NULL;
+  }
   g_hash_table_remove_all (self->priv->ports);
   KMS_ALPHA_BLENDING_UNLOCK (self);
-  g_clear_object (&self->priv->loop);
 
   G_OBJECT_CLASS (kms_alpha_blending_parent_class)->dispose (object);
 }
@@ -1058,7 +1063,7 @@ kms_alpha_blending_init (KmsAlphaBlending * self)
   self->priv->output_height = 480;
   self->priv->output_width = 640;
 
-  self->priv->loop = kms_loop_new ();
+  self->priv->loop = kms_housekeeping_acquire_loop ();
 }
 
 gboolean
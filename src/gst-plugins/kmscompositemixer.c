@@ -22,6 +22,7 @@
 #include <commons/kmsagnosticcaps.h>
 #include <commons/kmshubport.h>
 #include <commons/kmsloop.h>
+#include "kmshousekeeping.h"
 #include <commons/kmsrefstruct.h>
 #include <math.h>
 
@@ -283,8 +284,8 @@ cb_EOS_received (GstPad * pad, GstPadProbeInfo * info, gpointer data)
   event = gst_event_new_eos ();
   gst_pad_send_event (pad, event);
 
-  kms_loop_idle_add_full (self->priv->loop, G_PRIORITY_DEFAULT,
-      (GSourceFunc) remove_elements_from_pipeline,
+  kms_housekeeping_idle_add_full (self->priv->loop, self,
+      G_PRIORITY_DEFAULT, (GSourceFunc) remove_elements_from_pipeline,
       KMS_COMPOSITE_MIXER_REF (port_data),
       (GDestroyNotify) kms_ref_struct_unref);
 
@@ -366,10 +367,11 @@ kms_composite_mixer_port_data_destroy (gpointer data)
       remove = port_data->eos_managed;
       KMS_COMPOSITE_MIXER_UNLOCK (self);
 
-      if (remove) {
+      /* Pending removals are discarded once the element is disposed */
+      if (remove && self->priv->loop != NULL) {
         /* Remove pipeline without helding the mutex */
-        kms_loop_idle_add_full (self->priv->loop, G_PRIORITY_DEFAULT,
-            (GSourceFunc) remove_elements_from_pipeline,
+        kms_housekeeping_idle_add_full (self->priv->loop, self,
+            G_PRIORITY_DEFAULT, (GSourceFunc) remove_elements_from_pipeline,
             KMS_COMPOSITE_MIXER_REF (port_data),
             (GDestroyNotify) kms_ref_struct_unref);
       }
@@ -735,9 +737,12 @@ kms_composite_mixer_dispose (GObject * object)
   KmsCompositeMixer *self = KMS_COMPOSITE_MIXER (object);
 
   KMS_COMPOSITE_MIXER_LOCK (self);
+  if (self->priv->loop != NULL) {
+    kms_housekeeping_release_loop (self->priv->loop);
+    self->priv->loop = NULL;
+  }
   g_hash_table_remove_all (self->priv->ports);
   KMS_COMPOSITE_MIXER_UNLOCK (self);
-  g_clear_object (&self->priv->loop);
 
   G_OBJECT_CLASS (kms_composite_mixer_parent_class)->dispose (object);
 }
@@ -803,7 +808,7 @@ kms_composite_mixer_init (KmsCompositeMixer * self)
   self->priv->output_width = 800;
   self->priv->n_elems = 0;
 
-  self->priv->loop = kms_loop_new ();
+  self->priv->loop = kms_housekeeping_acquire_loop ();
 }
 
 gboolean
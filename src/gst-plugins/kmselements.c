@@ -19,12 +19,14 @@
 
 #include "kmshttpendpoint.h"
 #include "kmshttppostendpoint.h"
+#include "kmshttpgetendpoint.h"
 #include "kmsplayerendpoint.h"
 #include "kmsdispatcher.h"
 #include "kmsdispatcheronetomany.h"
 #include "kmsselectablemixer.h"
 #include "kmscompositemixer.h"
 #include "kmsalphablending.h"
+#include "kmsmmapfilesrc.h"
 
 static gboolean
 kurento_init (GstPlugin * kurento)
@@ -37,10 +39,18 @@ kurento_init (GstPlugin * kurento)
     return FALSE;
   }
 
+  if (!kms_http_get_endpoint_plugin_init (kurento)) {
+    return FALSE;
+  }
+
   if (!kms_player_endpoint_plugin_init (kurento)) {
     return FALSE;
   }
 
+  if (!kms_mmap_file_src_plugin_init (kurento)) {
+    return FALSE;
+  }
+
   if (!kms_dispatcher_plugin_init (kurento)) {
     return FALSE;
   }
@@ -0,0 +1,111 @@
+/*
+ * (C) Copyright 2016 Kurento (http://kurento.org/)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "kmshousekeeping.h"
+#include "looppool/kmslooppool.h"
+
+#define POOL_NAME "housekeeping"
+
+typedef struct _KmsHousekeepingData
+{
+  gpointer owner;
+  GSourceFunc function;
+  gpointer data;
+  GDestroyNotify notify;
+} KmsHousekeepingData;
+
+static KmsLoopPool *
+kms_housekeeping_get_pool (void)
+{
+  static gsize pool = 0;
+
+  if (g_once_init_enter (&pool)) {
+    g_once_init_leave (&pool, (gsize) kms_loop_pool_new (POOL_NAME,
+            KMS_LOOP_POOL_DEFAULT_SIZE));
+  }
+
+  return (KmsLoopPool *) pool;
+}
+
+KmsLoop *
+kms_housekeeping_acquire_loop (void)
+{
+  return kms_loop_pool_acquire (kms_housekeeping_get_pool ());
+}
+
+void
+kms_housekeeping_release_loop (KmsLoop * loop)
+{
+  kms_loop_pool_release (kms_housekeeping_get_pool (), loop);
+}
+
+static gboolean
+kms_housekeeping_dispatch (gpointer user_data)
+{
+  KmsHousekeepingData *hdata = user_data;
+
+  return hdata->function (hdata->data);
+}
+
+static void
+kms_housekeeping_data_destroy (KmsHousekeepingData * hdata)
+{
+  if (hdata->notify != NULL) {
+    hdata->notify (hdata->data);
+  }
+
+  g_object_unref (hdata->owner);
+
+  g_slice_free (KmsHousekeepingData, hdata);
+}
+
+guint
+kms_housekeeping_idle_add_full (KmsLoop * loop, gpointer owner,
+    gint priority, GSourceFunc function, gpointer data, GDestroyNotify notify)
+{
+  KmsHousekeepingData *hdata;
+
+  g_return_val_if_fail (G_IS_OBJECT (owner), 0);
+
+  hdata = g_slice_new (KmsHousekeepingData);
+  hdata->owner = g_object_ref (owner);
+  hdata->function = function;
+  hdata->data = data;
+  hdata->notify = notify;
+
+  return kms_loop_pool_idle_add_full (kms_housekeeping_get_pool (), loop,
+      priority, kms_housekeeping_dispatch, hdata,
+      (GDestroyNotify) kms_housekeeping_data_destroy);
+}
+
+void
+kms_housekeeping_add_stats (GstStructure * stats, const gchar * selector)
+{
+  GstStructure *loop_stats;
+
+  if (selector != NULL) {
+    return;
+  }
+
+  loop_stats = kms_loop_pool_get_stats (kms_housekeeping_get_pool ());
+  gst_structure_set (stats, KMS_LOOP_POOL_STATISTICS_FIELD,
+      GST_TYPE_STRUCTURE, loop_stats, NULL);
+  gst_structure_free (loop_stats);
+}
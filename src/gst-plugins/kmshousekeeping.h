@@ -0,0 +1,41 @@
+/*
+ * (C) Copyright 2016 Kurento (http://kurento.org/)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef __KMS_HOUSEKEEPING_H__
+#define __KMS_HOUSEKEEPING_H__
+
+#include <gst/gst.h>
+#include <commons/kmsloop.h>
+
+G_BEGIN_DECLS
+
+/* Deferred work (teardown, error posting...) of the elements of this plugin
+ * runs in a process-wide bounded set of loops. Each element sticks to the loop
+ * it acquires, so its callbacks keep the order in which they were added. */
+
+KmsLoop * kms_housekeeping_acquire_loop (void);
+void kms_housekeeping_release_loop (KmsLoop * loop);
+
+/* @owner is kept alive until @function has been dispatched or removed */
+guint kms_housekeeping_idle_add_full (KmsLoop * loop, gpointer owner,
+    gint priority, GSourceFunc function, gpointer data, GDestroyNotify notify);
+
+/* Adds the backlog of every housekeeping loop to @stats */
+void kms_housekeeping_add_stats (GstStructure * stats, const gchar * selector);
+
+G_END_DECLS
+#endif /* __KMS_HOUSEKEEPING_H__ */
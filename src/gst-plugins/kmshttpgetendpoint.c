@@ -0,0 +1,549 @@
+/*
+ * (C) Copyright 2016 Kurento (http://kurento.org/)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <gst/gst.h>
+#include <gst/pbutils/encoding-profile.h>
+#include <gst/app/gstappsrc.h>
+#include <gst/app/gstappsink.h>
+#include <commons/kmsrecordingprofile.h>
+#include <commons/kms-core-enumtypes.h>
+
+#include "kmshttpgetendpoint.h"
+
+#define PLUGIN_NAME "httpgetendpoint"
+
+#define APPSRC_DATA "appsrc-data"
+G_DEFINE_QUARK (APPSRC_DATA, appsrc_data);
+
+#define GET_PIPELINE "get-pipeline"
+
+#define DEFAULT_RECORDING_PROFILE KMS_RECORDING_PROFILE_NONE
+#define DEFAULT_DROP_SLOW_CLIENTS FALSE
+#define DEFAULT_MAX_CLIENT_BUFFERING (4 * 1024 * 1024)  /* bytes */
+
+#define MP4_FRAGMENT_DURATION 1000      /* ms */
+
+GST_DEBUG_CATEGORY_STATIC (kms_http_get_endpoint_debug_category);
+#define GST_CAT_DEFAULT kms_http_get_endpoint_debug_category
+
+#define KMS_HTTP_GET_ENDPOINT_GET_PRIVATE(obj) (  \
+  G_TYPE_INSTANCE_GET_PRIVATE (                   \
+    (obj),                                        \
+    KMS_TYPE_HTTP_GET_ENDPOINT,                   \
+    KmsHttpGetEndpointPrivate                     \
+  )                                               \
+)
+
+struct _KmsHttpGetEndpointPrivate
+{
+  KmsRecordingProfile profile;
+  gboolean drop_slow_clients;
+  guint max_client_buffering;
+
+  /* Media is only pushed to the muxer while there are clients */
+  gint streaming;
+  GstClockTime base_time;
+};
+
+/* Object properties */
+enum
+{
+  PROP_0,
+  PROP_PROFILE,
+  PROP_MIME_TYPE,
+  PROP_DROP_SLOW_CLIENTS,
+  PROP_MAX_CLIENT_BUFFERING,
+  N_PROPERTIES
+};
+
+static GParamSpec *obj_properties[N_PROPERTIES] = { NULL, };
+
+/* Object signals */
+enum
+{
+  /* signals */
+  SIGNAL_NEW_BUFFER,
+  LAST_SIGNAL
+};
+
+static guint http_get_ep_signals[LAST_SIGNAL] = { 0 };
+
+G_DEFINE_TYPE_WITH_CODE (KmsHttpGetEndpoint, kms_http_get_endpoint,
+    KMS_TYPE_HTTP_ENDPOINT,
+    GST_DEBUG_CATEGORY_INIT (kms_http_get_endpoint_debug_category, PLUGIN_NAME,
+        0, "debug category for http get endpoint plugin"));
+
+static const gchar *
+kms_http_get_endpoint_get_mime_type (KmsHttpGetEndpoint * self)
+{
+  switch (self->priv->profile) {
+    case KMS_RECORDING_PROFILE_WEBM:
+    case KMS_RECORDING_PROFILE_WEBM_VIDEO_ONLY:
+      return "video/webm";
+    case KMS_RECORDING_PROFILE_WEBM_AUDIO_ONLY:
+      return "audio/webm";
+    case KMS_RECORDING_PROFILE_MP4:
+    case KMS_RECORDING_PROFILE_MP4_VIDEO_ONLY:
+      return "video/mp4";
+    case KMS_RECORDING_PROFILE_MP4_AUDIO_ONLY:
+      return "audio/mp4";
+    default:
+      return NULL;
+  }
+}
+
+static GstElement *
+kms_http_get_endpoint_create_muxer (KmsHttpGetEndpoint * self)
+{
+  GstElement *mux;
+
+  switch (self->priv->profile) {
+    case KMS_RECORDING_PROFILE_WEBM:
+    case KMS_RECORDING_PROFILE_WEBM_VIDEO_ONLY:
+    case KMS_RECORDING_PROFILE_WEBM_AUDIO_ONLY:
+      /* Headers are flagged so they can be resent to late clients */
+      mux = gst_element_factory_make ("webmmux", NULL);
+      g_object_set (mux, "streamable", TRUE, NULL);
+      return mux;
+    case KMS_RECORDING_PROFILE_MP4:
+    case KMS_RECORDING_PROFILE_MP4_VIDEO_ONLY:
+    case KMS_RECORDING_PROFILE_MP4_AUDIO_ONLY:
+      mux = gst_element_factory_make ("mp4mux", NULL);
+      g_object_set (mux, "streamable", TRUE, "fragment-duration",
+          MP4_FRAGMENT_DURATION, NULL);
+      return mux;
+    default:
+      GST_ERROR_OBJECT (self, "Profile %d can not be streamed",
+          self->priv->profile);
+      return NULL;
+  }
+}
+
+static GstCaps *
+kms_http_get_endpoint_get_caps_from_profile (KmsHttpGetEndpoint * self,
+    KmsElementPadType type)
+{
+  GstEncodingContainerProfile *cprof;
+  const GList *profiles, *l;
+  GstCaps *caps = NULL;
+
+  cprof = kms_recording_profile_create_profile (self->priv->profile,
+      type == KMS_ELEMENT_PAD_TYPE_AUDIO, type == KMS_ELEMENT_PAD_TYPE_VIDEO);
+
+  profiles = gst_encoding_container_profile_get_profiles (cprof);
+
+  for (l = profiles; l != NULL; l = l->next) {
+    GstEncodingProfile *prof = l->data;
+
+    if ((GST_IS_ENCODING_AUDIO_PROFILE (prof) &&
+            type == KMS_ELEMENT_PAD_TYPE_AUDIO) ||
+        (GST_IS_ENCODING_VIDEO_PROFILE (prof) &&
+            type == KMS_ELEMENT_PAD_TYPE_VIDEO)) {
+      caps = gst_encoding_profile_get_input_caps (prof);
+      break;
+    }
+  }
+
+  gst_encoding_profile_unref (cprof);
+  return caps;
+}
+
+static GstFlowReturn
+recv_sample (GstAppSink * appsink, gpointer user_data)
+{
+  KmsHttpGetEndpoint *self = KMS_HTTP_GET_ENDPOINT (user_data);
+  GstFlowReturn ret = GST_FLOW_OK;
+  GstSegment *segment;
+  GstSample *sample;
+  GstBuffer *buffer;
+  GstAppSrc *appsrc;
+
+  appsrc = g_object_get_qdata (G_OBJECT (appsink), appsrc_data_quark ());
+
+  sample = gst_app_sink_pull_sample (appsink);
+  if (sample == NULL) {
+    return GST_FLOW_OK;
+  }
+
+  buffer = gst_sample_get_buffer (sample);
+  if (buffer == NULL || !g_atomic_int_get (&self->priv->streaming)) {
+    goto end;
+  }
+
+  segment = gst_sample_get_segment (sample);
+
+  gst_buffer_ref (buffer);
+  buffer = gst_buffer_make_writable (buffer);
+
+  if (GST_BUFFER_PTS_IS_VALID (buffer))
+    GST_BUFFER_PTS (buffer) =
+        gst_segment_to_running_time (segment, GST_FORMAT_TIME,
+        GST_BUFFER_PTS (buffer));
+  if (GST_BUFFER_DTS_IS_VALID (buffer))
+    GST_BUFFER_DTS (buffer) =
+        gst_segment_to_running_time (segment, GST_FORMAT_TIME,
+        GST_BUFFER_DTS (buffer));
+
+  /* Streams start at 0 each time clients arrive */
+  BASE_TIME_LOCK (self);
+
+  if (!GST_CLOCK_TIME_IS_VALID (self->priv->base_time)) {
+    self->priv->base_time = GST_BUFFER_DTS_OR_PTS (buffer);
+    GST_DEBUG_OBJECT (self, "Setting base time to: %" G_GUINT64_FORMAT,
+        self->priv->base_time);
+  }
+
+  if (GST_CLOCK_TIME_IS_VALID (self->priv->base_time)) {
+    if (GST_BUFFER_PTS_IS_VALID (buffer))
+      GST_BUFFER_PTS (buffer) = GST_BUFFER_PTS (buffer) > self->priv->base_time ?
+          GST_BUFFER_PTS (buffer) - self->priv->base_time : 0;
+    if (GST_BUFFER_DTS_IS_VALID (buffer))
+      GST_BUFFER_DTS (buffer) = GST_BUFFER_DTS (buffer) > self->priv->base_time ?
+          GST_BUFFER_DTS (buffer) - self->priv->base_time : 0;
+  }
+
+  BASE_TIME_UNLOCK (self);
+
+  ret = gst_app_src_push_buffer (appsrc, buffer);
+
+  if (ret != GST_FLOW_OK) {
+    /* Do not stop media flowing to other elements */
+    GST_WARNING_OBJECT (self, "Could not send buffer to %s. Cause: %s",
+        GST_ELEMENT_NAME (appsrc), gst_flow_get_name (ret));
+    ret = GST_FLOW_OK;
+  }
+
+end:
+  gst_sample_unref (sample);
+
+  return ret;
+}
+
+/* A client can only join where a WebM cluster or an MP4 fragment (moof box)
+ * starts, as the muxer may not flag audio or mid-fragment buffers as deltas */
+static gboolean
+kms_http_get_endpoint_is_fragment_start (GstBuffer * buffer)
+{
+  guint8 data[8];
+
+  if (GST_BUFFER_FLAG_IS_SET (buffer, GST_BUFFER_FLAG_DELTA_UNIT)) {
+    return FALSE;
+  }
+
+  if (gst_buffer_extract (buffer, 0, data, sizeof (data)) != sizeof (data)) {
+    return FALSE;
+  }
+
+  /* EBML Cluster element ID */
+  if (GST_READ_UINT32_BE (data) == 0x1F43B675) {
+    return TRUE;
+  }
+
+  /* ISO BMFF box header: 32 bits size followed by the box type */
+  return GST_READ_UINT32_LE (data + 4) == GST_MAKE_FOURCC ('m', 'o', 'o', 'f');
+}
+
+static GstFlowReturn
+new_muxed_sample (GstAppSink * appsink, gpointer user_data)
+{
+  KmsHttpGetEndpoint *self = KMS_HTTP_GET_ENDPOINT (user_data);
+  GstSample *sample;
+  GstBuffer *buffer;
+
+  sample = gst_app_sink_pull_sample (appsink);
+  if (sample == NULL) {
+    return GST_FLOW_OK;
+  }
+
+  /* Muxed once, whoever is listening shares this buffer */
+  buffer = gst_sample_get_buffer (sample);
+  if (buffer != NULL) {
+    /* Only buffers starting a fragment are left as non delta units */
+    buffer = gst_buffer_make_writable (gst_buffer_ref (buffer));
+
+    if (GST_BUFFER_FLAG_IS_SET (buffer, GST_BUFFER_FLAG_HEADER) ||
+        kms_http_get_endpoint_is_fragment_start (buffer)) {
+      GST_BUFFER_FLAG_UNSET (buffer, GST_BUFFER_FLAG_DELTA_UNIT);
+    } else {
+      GST_BUFFER_FLAG_SET (buffer, GST_BUFFER_FLAG_DELTA_UNIT);
+    }
+
+    g_signal_emit (self, http_get_ep_signals[SIGNAL_NEW_BUFFER], 0, buffer);
+    gst_buffer_unref (buffer);
+  }
+
+  gst_sample_unref (sample);
+
+  return GST_FLOW_OK;
+}
+
+static GstPadProbeReturn
+set_appsrc_caps (GstPad * pad, GstPadProbeInfo * info, gpointer user_data)
+{
+  GstEvent *event = GST_PAD_PROBE_INFO_EVENT (info);
+  GstElement *appsink, *appsrc;
+  GstCaps *caps;
+
+  if (GST_EVENT_TYPE (event) != GST_EVENT_CAPS) {
+    return GST_PAD_PROBE_OK;
+  }
+
+  gst_event_parse_caps (event, &caps);
+
+  appsink = gst_pad_get_parent_element (pad);
+  appsrc = g_object_get_qdata (G_OBJECT (appsink), appsrc_data_quark ());
+  g_object_unref (appsink);
+
+  GST_DEBUG_OBJECT (appsrc, "Setting caps %" GST_PTR_FORMAT, caps);
+  g_object_set (appsrc, "caps", caps, NULL);
+
+  return GST_PAD_PROBE_OK;
+}
+
+static void
+kms_http_get_endpoint_add_stream (KmsHttpGetEndpoint * self,
+    GstElement * mux, KmsElementPadType type)
+{
+  GstAppSinkCallbacks callbacks = { NULL, NULL, recv_sample };
+  GstElement *appsink, *appsrc;
+  const gchar *pad_name;
+  GstCaps *caps;
+  GstPad *sinkpad;
+
+  pad_name = type == KMS_ELEMENT_PAD_TYPE_VIDEO ? "video_%u" : "audio_%u";
+
+  appsrc = gst_element_factory_make ("appsrc", NULL);
+  g_object_set (appsrc, "is-live", TRUE, "do-timestamp", FALSE,
+      "min-latency", G_GUINT64_CONSTANT (0), "max-latency",
+      G_GUINT64_CONSTANT (0), "format", GST_FORMAT_TIME, NULL);
+
+  gst_bin_add (GST_BIN (KMS_HTTP_ENDPOINT (self)->pipeline), appsrc);
+
+  if (!gst_element_link_pads (appsrc, "src", mux, pad_name)) {
+    GST_ERROR_OBJECT (self, "Could not link %" GST_PTR_FORMAT " to %"
+        GST_PTR_FORMAT, appsrc, mux);
+  }
+
+  /* Agnosticbin negotiates the encoding set by the profile with appsink */
+  appsink = gst_element_factory_make ("appsink", NULL);
+  caps = kms_http_get_endpoint_get_caps_from_profile (self, type);
+  g_object_set (appsink, "emit-signals", FALSE, "async", FALSE, "sync", FALSE,
+      "qos", FALSE, "caps", caps, NULL);
+
+  if (caps != NULL) {
+    gst_caps_unref (caps);
+  }
+
+  g_object_set_qdata (G_OBJECT (appsink), appsrc_data_quark (), appsrc);
+  gst_app_sink_set_callbacks (GST_APP_SINK (appsink), &callbacks, self, NULL);
+
+  gst_bin_add (GST_BIN (self), appsink);
+
+  sinkpad = gst_element_get_static_pad (appsink, "sink");
+  gst_pad_add_probe (sinkpad, GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM,
+      set_appsrc_caps, NULL, NULL);
+  kms_element_connect_sink_target (KMS_ELEMENT (self), sinkpad, type);
+  g_object_unref (sinkpad);
+
+  gst_element_sync_state_with_parent (appsink);
+}
+
+static void
+kms_http_get_endpoint_init_pipeline (KmsHttpGetEndpoint * self)
+{
+  GstAppSinkCallbacks callbacks = { NULL, NULL, new_muxed_sample };
+  GstElement *mux, *appsink;
+
+  mux = kms_http_get_endpoint_create_muxer (self);
+
+  if (mux == NULL) {
+    return;
+  }
+
+  KMS_HTTP_ENDPOINT (self)->pipeline = gst_pipeline_new (GET_PIPELINE);
+
+  appsink = gst_element_factory_make ("appsink", NULL);
+  g_object_set (appsink, "emit-signals", FALSE, "async", FALSE, "sync", FALSE,
+      "qos", FALSE, NULL);
+  gst_app_sink_set_callbacks (GST_APP_SINK (appsink), &callbacks, self, NULL);
+
+  gst_bin_add_many (GST_BIN (KMS_HTTP_ENDPOINT (self)->pipeline), mux,
+      appsink, NULL);
+  gst_element_link (mux, appsink);
+
+  if (kms_recording_profile_supports_type (self->priv->profile,
+          KMS_ELEMENT_PAD_TYPE_AUDIO)) {
+    kms_http_get_endpoint_add_stream (self, mux, KMS_ELEMENT_PAD_TYPE_AUDIO);
+  }
+
+  if (kms_recording_profile_supports_type (self->priv->profile,
+          KMS_ELEMENT_PAD_TYPE_VIDEO)) {
+    kms_http_get_endpoint_add_stream (self, mux, KMS_ELEMENT_PAD_TYPE_VIDEO);
+  }
+}
+
+static void
+kms_http_get_endpoint_start (KmsHttpEndpoint * obj, gboolean start)
+{
+  KmsHttpGetEndpoint *self = KMS_HTTP_GET_ENDPOINT (obj);
+
+  if (obj->pipeline == NULL) {
+    GST_WARNING_OBJECT (self, "No profile configured");
+    return;
+  }
+
+  obj->start = start;
+
+  if (start) {
+    BASE_TIME_LOCK (self);
+    self->priv->base_time = GST_CLOCK_TIME_NONE;
+    BASE_TIME_UNLOCK (self);
+
+    gst_element_set_state (obj->pipeline, GST_STATE_PLAYING);
+    g_atomic_int_set (&self->priv->streaming, TRUE);
+  } else {
+    /* Muxer will send headers again when restarted */
+    g_atomic_int_set (&self->priv->streaming, FALSE);
+    gst_element_set_state (obj->pipeline, GST_STATE_NULL);
+  }
+}
+
+static void
+kms_http_get_endpoint_set_property (GObject * object, guint property_id,
+    const GValue * value, GParamSpec * pspec)
+{
+  KmsHttpGetEndpoint *self = KMS_HTTP_GET_ENDPOINT (object);
+
+  KMS_ELEMENT_LOCK (KMS_ELEMENT (self));
+  switch (property_id) {
+    case PROP_PROFILE:
+      if (self->priv->profile == KMS_RECORDING_PROFILE_NONE) {
+        self->priv->profile = g_value_get_enum (value);
+        kms_http_get_endpoint_init_pipeline (self);
+      } else {
+        GST_ERROR_OBJECT (self, "Profile can only be configured once");
+      }
+      break;
+    case PROP_DROP_SLOW_CLIENTS:
+      self->priv->drop_slow_clients = g_value_get_boolean (value);
+      break;
+    case PROP_MAX_CLIENT_BUFFERING:
+      self->priv->max_client_buffering = g_value_get_uint (value);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+      break;
+  }
+  KMS_ELEMENT_UNLOCK (KMS_ELEMENT (self));
+}
+
+static void
+kms_http_get_endpoint_get_property (GObject * object, guint property_id,
+    GValue * value, GParamSpec * pspec)
+{
+  KmsHttpGetEndpoint *self = KMS_HTTP_GET_ENDPOINT (object);
+
+  KMS_ELEMENT_LOCK (KMS_ELEMENT (self));
+  switch (property_id) {
+    case PROP_PROFILE:
+      g_value_set_enum (value, self->priv->profile);
+      break;
+    case PROP_MIME_TYPE:
+      g_value_set_string (value, kms_http_get_endpoint_get_mime_type (self));
+      break;
+    case PROP_DROP_SLOW_CLIENTS:
+      g_value_set_boolean (value, self->priv->drop_slow_clients);
+      break;
+    case PROP_MAX_CLIENT_BUFFERING:
+      g_value_set_uint (value, self->priv->max_client_buffering);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+      break;
+  }
+  KMS_ELEMENT_UNLOCK (KMS_ELEMENT (self));
+}
+
+static void
+kms_http_get_endpoint_class_init (KmsHttpGetEndpointClass * klass)
+{
+  GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
+  KmsHttpEndpointClass *http_class = KMS_HTTP_ENDPOINT_CLASS (klass);
+
+  gobject_class->set_property = kms_http_get_endpoint_set_property;
+  gobject_class->get_property = kms_http_get_endpoint_get_property;
+
+  http_class->start = GST_DEBUG_FUNCPTR (kms_http_get_endpoint_start);
+
+  /* Install properties */
+  obj_properties[PROP_PROFILE] = g_param_spec_enum ("profile",
+      "Streaming profile",
+      "The profile used to encapsulate media served to clients",
+      KMS_TYPE_RECORDING_PROFILE, DEFAULT_RECORDING_PROFILE,
+      G_PARAM_READWRITE);
+
+  obj_properties[PROP_MIME_TYPE] = g_param_spec_string ("mime-type",
+      "Mime type", "Content type of the stream served to clients",
+      NULL, G_PARAM_READABLE);
+
+  obj_properties[PROP_DROP_SLOW_CLIENTS] = g_param_spec_boolean
+      ("drop-slow-clients", "Drop slow clients",
+      "Disconnect clients that can not keep up instead of making them skip "
+      "media up to the next key frame", DEFAULT_DROP_SLOW_CLIENTS,
+      G_PARAM_READWRITE);
+
+  obj_properties[PROP_MAX_CLIENT_BUFFERING] = g_param_spec_uint
+      ("max-client-buffering", "Max client buffering",
+      "Bytes queued for a client before it is considered slow", 0, G_MAXUINT,
+      DEFAULT_MAX_CLIENT_BUFFERING, G_PARAM_READWRITE);
+
+  g_object_class_install_properties (gobject_class,
+      N_PROPERTIES, obj_properties);
+
+  /* set signals */
+  http_get_ep_signals[SIGNAL_NEW_BUFFER] =
+      g_signal_new ("new-buffer", G_TYPE_FROM_CLASS (klass),
+      G_SIGNAL_RUN_LAST,
+      G_STRUCT_OFFSET (KmsHttpGetEndpointClass, new_buffer), NULL, NULL,
+      g_cclosure_marshal_VOID__BOXED, G_TYPE_NONE, 1,
+      GST_TYPE_BUFFER | G_SIGNAL_TYPE_STATIC_SCOPE);
+
+  g_type_class_add_private (klass, sizeof (KmsHttpGetEndpointPrivate));
+}
+
+static void
+kms_http_get_endpoint_init (KmsHttpGetEndpoint * self)
+{
+  self->priv = KMS_HTTP_GET_ENDPOINT_GET_PRIVATE (self);
+  KMS_HTTP_ENDPOINT (self)->method = KMS_HTTP_ENDPOINT_METHOD_GET;
+
+  self->priv->profile = DEFAULT_RECORDING_PROFILE;
+  self->priv->drop_slow_clients = DEFAULT_DROP_SLOW_CLIENTS;
+  self->priv->max_client_buffering = DEFAULT_MAX_CLIENT_BUFFERING;
+  self->priv->base_time = GST_CLOCK_TIME_NONE;
+}
+
+gboolean
+kms_http_get_endpoint_plugin_init (GstPlugin * plugin)
+{
+  return gst_element_register (plugin, PLUGIN_NAME, GST_RANK_NONE,
+      KMS_TYPE_HTTP_GET_ENDPOINT);
+}
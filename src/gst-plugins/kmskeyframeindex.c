@@ -0,0 +1,357 @@
+/*
+ * (C) Copyright 2016 Kurento (http://kurento.org/)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <glib/gstdio.h>
+
+#include "kmskeyframeindex.h"
+
+#define GST_DEFAULT_NAME "kmskeyframeindex"
+#define GST_CAT_DEFAULT kms_keyframe_index_debug
+GST_DEBUG_CATEGORY_STATIC (GST_CAT_DEFAULT);
+
+#define SIDECAR_EXTENSION ".kfi"
+#define SIDECAR_HEADER "KFI1"
+
+struct _KmsKeyframeIndex
+{
+  /* Protected by the lock of the table */
+  guint ref;
+
+  gchar *uri;
+
+  GMutex mutex;
+  GArray *times;                /* Sorted GstClockTime */
+  gboolean complete;
+};
+
+/* <uri, KmsKeyframeIndex> */
+G_LOCK_DEFINE_STATIC (indexes);
+static GHashTable *indexes = NULL;
+
+static void
+kms_keyframe_index_init_debug (void)
+{
+  static gsize done = 0;
+
+  if (g_once_init_enter (&done)) {
+    GST_DEBUG_CATEGORY_INIT (GST_CAT_DEFAULT, GST_DEFAULT_NAME, 0,
+        GST_DEFAULT_NAME);
+    g_once_init_leave (&done, 1);
+  }
+}
+
+/* Returns the location of the asset if it is a local file */
+static gchar *
+kms_keyframe_index_get_location (KmsKeyframeIndex * self)
+{
+  if (!g_str_has_prefix (self->uri, "file:")) {
+    return NULL;
+  }
+
+  return g_filename_from_uri (self->uri, NULL, NULL);
+}
+
+static void
+kms_keyframe_index_load (KmsKeyframeIndex * self)
+{
+  gchar *location, *sidecar = NULL, *contents = NULL;
+  gchar **lines = NULL;
+  guint64 size;
+  gint64 mtime;
+  GStatBuf st;
+  guint i;
+
+  location = kms_keyframe_index_get_location (self);
+  if (location == NULL || g_stat (location, &st) != 0) {
+    goto end;
+  }
+
+  sidecar = g_strconcat (location, SIDECAR_EXTENSION, NULL);
+  if (!g_file_get_contents (sidecar, &contents, NULL, NULL)) {
+    goto end;
+  }
+
+  lines = g_strsplit (contents, "\n", -1);
+
+  if (lines[0] == NULL || sscanf (lines[0], SIDECAR_HEADER " %"
+          G_GUINT64_FORMAT " %" G_GINT64_FORMAT, &size, &mtime) != 2 ||
+      size != (guint64) st.st_size || mtime != (gint64) st.st_mtime) {
+    GST_DEBUG ("Ignoring stale index %s", sidecar);
+    goto end;
+  }
+
+  for (i = 1; lines[i] != NULL; i++) {
+    GstClockTime time;
+    gchar *endptr;
+
+    if (lines[i][0] == '\0') {
+      continue;
+    }
+
+    if (!g_ascii_isdigit (lines[i][0])) {
+      goto invalid;
+    }
+
+    time = g_ascii_strtoull (lines[i], &endptr, 10);
+    if (*endptr != '\0' || !GST_CLOCK_TIME_IS_VALID (time)) {
+      goto invalid;
+    }
+
+    /* Lookups rely on the entries being sorted and unique */
+    if (self->times->len > 0 && time <= g_array_index (self->times,
+            GstClockTime, self->times->len - 1)) {
+      goto invalid;
+    }
+
+    g_array_append_val (self->times, time);
+  }
+
+  /* An empty index would prevent the asset from being indexed again */
+  if (self->times->len == 0) {
+    goto invalid;
+  }
+
+  self->complete = TRUE;
+
+  GST_DEBUG ("Loaded %u key frames from %s", self->times->len, sidecar);
+
+  goto end;
+
+invalid:
+  GST_WARNING ("Invalid index %s, it will be rebuilt", sidecar);
+  g_array_set_size (self->times, 0);
+
+end:
+  g_strfreev (lines);
+  g_free (contents);
+  g_free (sidecar);
+  g_free (location);
+}
+
+/* Must be called holding the mutex of the index */
+static void
+kms_keyframe_index_save (KmsKeyframeIndex * self)
+{
+  gchar *location, *sidecar = NULL;
+  GError *err = NULL;
+  GString *str;
+  GStatBuf st;
+  guint i;
+
+  location = kms_keyframe_index_get_location (self);
+  if (location == NULL || g_stat (location, &st) != 0) {
+    g_free (location);
+    return;
+  }
+
+  str = g_string_new (NULL);
+  g_string_append_printf (str, SIDECAR_HEADER " %" G_GUINT64_FORMAT " %"
+      G_GINT64_FORMAT "\n", (guint64) st.st_size, (gint64) st.st_mtime);
+
+  for (i = 0; i < self->times->len; i++) {
+    g_string_append_printf (str, "%" G_GUINT64_FORMAT "\n",
+        g_array_index (self->times, GstClockTime, i));
+  }
+
+  sidecar = g_strconcat (location, SIDECAR_EXTENSION, NULL);
+
+  /* Assets may be in read only locations, the index is kept in memory */
+  if (!g_file_set_contents (sidecar, str->str, str->len, &err)) {
+    GST_DEBUG ("Cannot save index %s: %s", sidecar, err->message);
+    g_error_free (err);
+  } else {
+    GST_DEBUG ("Saved %u key frames to %s", self->times->len, sidecar);
+  }
+
+  g_string_free (str, TRUE);
+  g_free (sidecar);
+  g_free (location);
+}
+
+KmsKeyframeIndex *
+kms_keyframe_index_acquire (const gchar * uri)
+{
+  KmsKeyframeIndex *self;
+
+  g_return_val_if_fail (uri != NULL, NULL);
+
+  kms_keyframe_index_init_debug ();
+
+  G_LOCK (indexes);
+
+  if (indexes == NULL) {
+    indexes = g_hash_table_new (g_str_hash, g_str_equal);
+  }
+
+  self = g_hash_table_lookup (indexes, uri);
+  if (self != NULL) {
+    self->ref++;
+    G_UNLOCK (indexes);
+    return self;
+  }
+
+  self = g_slice_new0 (KmsKeyframeIndex);
+  self->ref = 1;
+  self->uri = g_strdup (uri);
+  g_mutex_init (&self->mutex);
+  self->times = g_array_new (FALSE, FALSE, sizeof (GstClockTime));
+
+  kms_keyframe_index_load (self);
+
+  g_hash_table_insert (indexes, self->uri, self);
+
+  G_UNLOCK (indexes);
+
+  return self;
+}
+
+KmsKeyframeIndex *
+kms_keyframe_index_ref (KmsKeyframeIndex * self)
+{
+  g_return_val_if_fail (self != NULL, NULL);
+
+  G_LOCK (indexes);
+  self->ref++;
+  G_UNLOCK (indexes);
+
+  return self;
+}
+
+void
+kms_keyframe_index_unref (KmsKeyframeIndex * self)
+{
+  g_return_if_fail (self != NULL);
+
+  G_LOCK (indexes);
+
+  if (--self->ref > 0) {
+    G_UNLOCK (indexes);
+    return;
+  }
+
+  g_hash_table_remove (indexes, self->uri);
+
+  G_UNLOCK (indexes);
+
+  g_array_unref (self->times);
+  g_mutex_clear (&self->mutex);
+  g_free (self->uri);
+  g_slice_free (KmsKeyframeIndex, self);
+}
+
+const gchar *
+kms_keyframe_index_get_uri (KmsKeyframeIndex * self)
+{
+  return self->uri;
+}
+
+/* Position of the first entry not lower than @time */
+static guint
+kms_keyframe_index_lower_bound (KmsKeyframeIndex * self, GstClockTime time)
+{
+  guint low = 0, high = self->times->len;
+
+  while (low < high) {
+    guint mid = low + (high - low) / 2;
+
+    if (g_array_index (self->times, GstClockTime, mid) < time) {
+      low = mid + 1;
+    } else {
+      high = mid;
+    }
+  }
+
+  return low;
+}
+
+void
+kms_keyframe_index_add (KmsKeyframeIndex * self, GstClockTime time)
+{
+  guint pos;
+
+  g_return_if_fail (GST_CLOCK_TIME_IS_VALID (time));
+
+  g_mutex_lock (&self->mutex);
+
+  if (self->complete) {
+    goto end;
+  }
+
+  pos = kms_keyframe_index_lower_bound (self, time);
+  if (pos < self->times->len &&
+      g_array_index (self->times, GstClockTime, pos) == time) {
+    goto end;
+  }
+
+  g_array_insert_val (self->times, pos, time);
+
+end:
+  g_mutex_unlock (&self->mutex);
+}
+
+void
+kms_keyframe_index_set_complete (KmsKeyframeIndex * self)
+{
+  g_mutex_lock (&self->mutex);
+
+  if (!self->complete && self->times->len > 0) {
+    GST_DEBUG ("Index of %s complete with %u key frames", self->uri,
+        self->times->len);
+    self->complete = TRUE;
+    kms_keyframe_index_save (self);
+  }
+
+  g_mutex_unlock (&self->mutex);
+}
+
+gboolean
+kms_keyframe_index_lookup_nearest (KmsKeyframeIndex * self, GstClockTime time,
+    GstClockTime * keyframe)
+{
+  GstClockTime before, after;
+  gboolean ret = FALSE;
+  guint pos;
+
+  g_mutex_lock (&self->mutex);
+
+  if (!self->complete || self->times->len == 0) {
+    goto end;
+  }
+
+  pos = kms_keyframe_index_lower_bound (self, time);
+
+  if (pos == self->times->len) {
+    *keyframe = g_array_index (self->times, GstClockTime, pos - 1);
+  } else if (pos == 0) {
+    *keyframe = g_array_index (self->times, GstClockTime, 0);
+  } else {
+    before = g_array_index (self->times, GstClockTime, pos - 1);
+    after = g_array_index (self->times, GstClockTime, pos);
+    *keyframe = (time - before <= after - time) ? before : after;
+  }
+
+  ret = TRUE;
+
+end:
+  g_mutex_unlock (&self->mutex);
+
+  return ret;
+}
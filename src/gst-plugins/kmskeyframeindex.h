@@ -0,0 +1,48 @@
+/*
+ * (C) Copyright 2016 Kurento (http://kurento.org/)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+#ifndef __KMS_KEYFRAME_INDEX_H__
+#define __KMS_KEYFRAME_INDEX_H__
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+/* Stream time of the key frames of the video of an asset, shared by every
+ * player of its uri. Entries are added while the asset is played, and the
+ * index can only be trusted once it has been played from start to end. For
+ * file:// uris complete indexes are saved in a sidecar file next to the
+ * asset (<file>.kfi), which is reused while the asset is not modified. */
+
+typedef struct _KmsKeyframeIndex KmsKeyframeIndex;
+
+KmsKeyframeIndex * kms_keyframe_index_acquire (const gchar * uri);
+KmsKeyframeIndex * kms_keyframe_index_ref (KmsKeyframeIndex * self);
+void kms_keyframe_index_unref (KmsKeyframeIndex * self);
+
+const gchar * kms_keyframe_index_get_uri (KmsKeyframeIndex * self);
+
+void kms_keyframe_index_add (KmsKeyframeIndex * self, GstClockTime time);
+
+/* Marks every key frame of the asset as added and saves the sidecar file */
+void kms_keyframe_index_set_complete (KmsKeyframeIndex * self);
+
+/* Returns FALSE if the index is not complete */
+gboolean kms_keyframe_index_lookup_nearest (KmsKeyframeIndex * self,
+    GstClockTime time, GstClockTime * keyframe);
+
+G_END_DECLS
+#endif /* __KMS_KEYFRAME_INDEX_H__ */
@@ -0,0 +1,717 @@
+/*
+ * (C) Copyright 2016 Kurento (http://kurento.org/)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#define _GNU_SOURCE             /* madvise, F_SETLEASE, F_SETSIG */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <gst/gst.h>
+
+#include "kmsmmapfilesrc.h"
+
+#define PLUGIN_NAME KMS_MMAP_FILE_SRC_NAME
+
+GST_DEBUG_CATEGORY_STATIC (kms_mmap_file_src_debug_category);
+#define GST_CAT_DEFAULT kms_mmap_file_src_debug_category
+
+#define KMS_MMAP_FILE_SRC_GET_PRIVATE(obj) (    \
+  G_TYPE_INSTANCE_GET_PRIVATE (                 \
+    (obj),                                      \
+    KMS_TYPE_MMAP_FILE_SRC,                     \
+    KmsMmapFileSrcPrivate                       \
+  )                                             \
+)
+
+#define DEFAULT_LOCATION NULL
+#define DEFAULT_BLOCK_SIZE (256 * 1024) /* bytes */
+#define DEFAULT_READAHEAD (2 * 1024 * 1024)     /* bytes */
+
+enum
+{
+  PROP_0,
+  PROP_LOCATION,
+  PROP_READAHEAD,
+  PROP_STATS,
+  N_PROPERTIES
+};
+
+static GParamSpec *obj_properties[N_PROPERTIES] = { NULL, };
+
+/* Buffers pushed downstream point to the mapping, which is unmapped once
+ * the source is stopped and all of them are released. Touching a page past
+ * the end of a file that has shrunk raises SIGBUS, so a read lease on the
+ * file is held through @lease_fd for as long as the mapping exists: nobody
+ * can open the file for writing or truncate it without breaking the lease,
+ * and the kernel makes them wait until it is released (or for
+ * /proc/sys/fs/lease-break-time seconds at most) */
+typedef struct _KmsFileMapping
+{
+  gint ref;
+  guint8 *data;
+  gsize size;
+  gint lease_fd;
+} KmsFileMapping;
+
+struct _KmsMmapFileSrcPrivate
+{
+  /* Configuration, only changed while stopped */
+  gchar *location;
+  gchar *uri;
+  guint readahead;
+
+  /* Streaming thread only */
+  gint fd;
+  guint64 size;
+  KmsFileMapping *mapping;      /* NULL when the file is read with pread */
+  gsize page_size;
+  guint64 advised_start;
+  guint64 advised_end;          /* Data requested to the kernel up to here */
+
+  /* Stats, protected by the object lock */
+  guint64 bytes_read;
+  guint64 buffers;
+  guint64 syscalls;
+  guint64 readahead_requests;
+};
+
+static void kms_mmap_file_src_uri_handler_init (gpointer g_iface,
+    gpointer iface_data);
+
+G_DEFINE_TYPE_WITH_CODE (KmsMmapFileSrc, kms_mmap_file_src,
+    GST_TYPE_BASE_SRC,
+    G_IMPLEMENT_INTERFACE (GST_TYPE_URI_HANDLER,
+        kms_mmap_file_src_uri_handler_init);
+    GST_DEBUG_CATEGORY_INIT (kms_mmap_file_src_debug_category, PLUGIN_NAME,
+        0, "debug category for mmap file source element"));
+
+static GstStaticPadTemplate src_template = GST_STATIC_PAD_TEMPLATE ("src",
+    GST_PAD_SRC,
+    GST_PAD_ALWAYS,
+    GST_STATIC_CAPS_ANY);
+
+static KmsFileMapping *
+kms_file_mapping_ref (KmsFileMapping * mapping)
+{
+  g_atomic_int_inc (&mapping->ref);
+
+  return mapping;
+}
+
+static void
+kms_file_mapping_unref (KmsFileMapping * mapping)
+{
+  if (!g_atomic_int_dec_and_test (&mapping->ref)) {
+    return;
+  }
+
+  munmap (mapping->data, mapping->size);
+
+  /* Lets writers waiting for the lease go on */
+  close (mapping->lease_fd);
+
+  g_slice_free (KmsFileMapping, mapping);
+}
+
+static void
+kms_mmap_file_src_count_syscalls (KmsMmapFileSrc * self, guint n)
+{
+  GST_OBJECT_LOCK (self);
+  self->priv->syscalls += n;
+  GST_OBJECT_UNLOCK (self);
+}
+
+/* Maps the file opened as @fd if a read lease on it can be taken, which is
+ * only granted while nobody has it open for writing. Files that can not be
+ * leased (open for writing, owned by other users, on network file systems
+ * not supporting leases...) are not mapped */
+static KmsFileMapping *
+kms_mmap_file_src_map (KmsMmapFileSrc * self, const gchar * location,
+    gint fd, guint * syscalls)
+{
+  KmsFileMapping *mapping;
+  struct stat st, lst;
+  gint lease_fd;
+
+  /* The lease lives in its own descriptor, closed with the mapping */
+  (*syscalls)++;
+  lease_fd = open (location, O_RDONLY | O_CLOEXEC);
+  if (lease_fd < 0) {
+    GST_WARNING_OBJECT (self, "Can not open \"%s\" again: %s", location,
+        g_strerror (errno));
+    return NULL;
+  }
+
+  /* The break of the lease is polled from create. Its signal is SIGIO by
+   * default, which would terminate the process, so an ignored one is set
+   * until no process is set to receive it at all */
+  *syscalls += 3;
+  if (fcntl (lease_fd, F_SETSIG, SIGURG) < 0 ||
+      fcntl (lease_fd, F_SETLEASE, F_RDLCK) < 0 ||
+      fcntl (lease_fd, F_SETOWN, 0) < 0) {
+    GST_WARNING_OBJECT (self, "Can not lease \"%s\" (%s), reading it "
+        "without mapping", location, g_strerror (errno));
+    close (lease_fd);
+    return NULL;
+  }
+
+  /* Under the lease the size can not change anymore */
+  *syscalls += 2;
+  if (fstat (fd, &st) < 0 || fstat (lease_fd, &lst) < 0 ||
+      st.st_dev != lst.st_dev || st.st_ino != lst.st_ino) {
+    GST_WARNING_OBJECT (self, "\"%s\" was replaced, reading it without "
+        "mapping", location);
+    close (lease_fd);
+    return NULL;
+  }
+
+  if (lst.st_size == 0) {
+    /* Empty files can not be mapped */
+    close (lease_fd);
+    return NULL;
+  }
+
+  mapping = g_slice_new0 (KmsFileMapping);
+  mapping->ref = 1;
+  mapping->size = lst.st_size;
+  mapping->lease_fd = lease_fd;
+
+  (*syscalls)++;
+  mapping->data = mmap (NULL, mapping->size, PROT_READ, MAP_SHARED, lease_fd,
+      0);
+  if (mapping->data == MAP_FAILED) {
+    GST_WARNING_OBJECT (self, "Can not map \"%s\" (%s), reading it without "
+        "mapping", location, g_strerror (errno));
+    g_slice_free (KmsFileMapping, mapping);
+    close (lease_fd);
+    return NULL;
+  }
+
+  /* Pages behind the reading position may be reclaimed early */
+  (*syscalls)++;
+  if (madvise (mapping->data, mapping->size, MADV_SEQUENTIAL) < 0) {
+    GST_WARNING_OBJECT (self, "madvise failed: %s", g_strerror (errno));
+  }
+
+  return mapping;
+}
+
+/* A lease being broken is no longer reported as F_RDLCK */
+static gboolean
+kms_mmap_file_src_lease_held (KmsMmapFileSrc * self)
+{
+  kms_mmap_file_src_count_syscalls (self, 1);
+
+  return fcntl (self->priv->mapping->lease_fd, F_GETLEASE) == F_RDLCK;
+}
+
+static gboolean
+kms_mmap_file_src_start (GstBaseSrc * src)
+{
+  KmsMmapFileSrc *self = KMS_MMAP_FILE_SRC (src);
+  KmsFileMapping *mapping;
+  gchar *location;
+  struct stat st;
+  guint syscalls = 0;
+  gint fd;
+
+  GST_OBJECT_LOCK (self);
+  location = g_strdup (self->priv->location);
+  GST_OBJECT_UNLOCK (self);
+
+  if (location == NULL || location[0] == '\0') {
+    GST_ELEMENT_ERROR (self, RESOURCE, NOT_FOUND,
+        ("No file name specified for reading."), (NULL));
+    g_free (location);
+    return FALSE;
+  }
+
+  syscalls++;
+  fd = open (location, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    if (errno == ENOENT) {
+      GST_ELEMENT_ERROR (self, RESOURCE, NOT_FOUND,
+          ("No such file \"%s\".", location), GST_ERROR_SYSTEM);
+    } else {
+      GST_ELEMENT_ERROR (self, RESOURCE, OPEN_READ,
+          ("Could not open file \"%s\" for reading.", location),
+          GST_ERROR_SYSTEM);
+    }
+    goto error;
+  }
+
+  syscalls++;
+  if (fstat (fd, &st) < 0 || !S_ISREG (st.st_mode)) {
+    GST_ELEMENT_ERROR (self, RESOURCE, OPEN_READ,
+        ("\"%s\" is not a regular file.", location), (NULL));
+    close (fd);
+    goto error;
+  }
+
+  mapping = kms_mmap_file_src_map (self, location, fd, &syscalls);
+
+  /* Makes the kernel double its readahead window for this file */
+  syscalls++;
+  posix_fadvise (fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+  /* Files not mapped, or no longer, are read from this descriptor */
+  self->priv->fd = fd;
+  self->priv->size = mapping != NULL ? mapping->size : (guint64) st.st_size;
+  self->priv->mapping = mapping;
+  self->priv->page_size = sysconf (_SC_PAGESIZE);
+  self->priv->advised_start = 0;
+  self->priv->advised_end = 0;
+
+  GST_OBJECT_LOCK (self);
+  self->priv->syscalls += syscalls;
+  GST_OBJECT_UNLOCK (self);
+
+  GST_DEBUG_OBJECT (self, "%s %" G_GUINT64_FORMAT " bytes of %s",
+      mapping != NULL ? "Mapped" : "Reading", self->priv->size, location);
+
+  g_free (location);
+
+  return TRUE;
+
+error:
+  kms_mmap_file_src_count_syscalls (self, syscalls);
+  g_free (location);
+
+  return FALSE;
+}
+
+static gboolean
+kms_mmap_file_src_stop (GstBaseSrc * src)
+{
+  KmsMmapFileSrc *self = KMS_MMAP_FILE_SRC (src);
+
+  if (self->priv->mapping != NULL) {
+    kms_file_mapping_unref (self->priv->mapping);
+    self->priv->mapping = NULL;
+  }
+
+  if (self->priv->fd >= 0) {
+    close (self->priv->fd);
+    self->priv->fd = -1;
+    kms_mmap_file_src_count_syscalls (self, 1);
+  }
+
+  return TRUE;
+}
+
+static gboolean
+kms_mmap_file_src_is_seekable (GstBaseSrc * src)
+{
+  return TRUE;
+}
+
+static gboolean
+kms_mmap_file_src_get_size (GstBaseSrc * src, guint64 * size)
+{
+  KmsMmapFileSrc *self = KMS_MMAP_FILE_SRC (src);
+
+  if (self->priv->fd < 0) {
+    return FALSE;
+  }
+
+  *size = self->priv->size;
+
+  return TRUE;
+}
+
+/* Asks the kernel for the window of data after @offset before it is
+ * touched, so that readers do not stall on page faults */
+static void
+kms_mmap_file_src_read_ahead (KmsMmapFileSrc * self, guint64 offset,
+    guint length)
+{
+  KmsFileMapping *mapping = self->priv->mapping;
+  guint64 window, start, len;
+
+  GST_OBJECT_LOCK (self);
+  window = GST_ROUND_UP_N ((guint64) self->priv->readahead,
+      (guint64) self->priv->page_size);
+  GST_OBJECT_UNLOCK (self);
+
+  if (window == 0) {
+    return;
+  }
+
+  if (offset < self->priv->advised_start || offset > self->priv->advised_end) {
+    /* Seek, start a new window at the reading position */
+    start = offset & ~((guint64) self->priv->page_size - 1);
+    self->priv->advised_start = self->priv->advised_end = start;
+  }
+
+  if (offset + length + window / 2 <= self->priv->advised_end) {
+    return;
+  }
+
+  start = self->priv->advised_end;
+  if (start >= mapping->size) {
+    return;
+  }
+
+  len = MIN (window, mapping->size - start);
+
+  if (madvise (mapping->data + start, len, MADV_WILLNEED) < 0) {
+    GST_WARNING_OBJECT (self, "madvise failed: %s", g_strerror (errno));
+  }
+
+  self->priv->advised_end = start + len;
+
+  GST_OBJECT_LOCK (self);
+  self->priv->syscalls++;
+  self->priv->readahead_requests++;
+  GST_OBJECT_UNLOCK (self);
+}
+
+static GstFlowReturn
+kms_mmap_file_src_create (GstBaseSrc * src, guint64 offset, guint length,
+    GstBuffer ** buf)
+{
+  KmsMmapFileSrc *self = KMS_MMAP_FILE_SRC (src);
+  KmsFileMapping *mapping = self->priv->mapping;
+  GstBuffer *buffer;
+
+  if (mapping != NULL && !kms_mmap_file_src_lease_held (self)) {
+    /* Buffers already pushed keep the lease until they are released, the
+     * rest of the file is read without touching the mapping */
+    GST_WARNING_OBJECT (self, "File about to be written, reading it without "
+        "mapping");
+    kms_file_mapping_unref (mapping);
+    self->priv->mapping = mapping = NULL;
+  }
+
+  if (mapping != NULL) {
+    if (offset >= mapping->size) {
+      GST_DEBUG_OBJECT (self, "EOS at offset %" G_GUINT64_FORMAT, offset);
+      return GST_FLOW_EOS;
+    }
+
+    length = MIN (length, mapping->size - offset);
+    kms_mmap_file_src_read_ahead (self, offset, length);
+
+    /* No copy, buffers keep the mapping alive */
+    buffer = gst_buffer_new ();
+    gst_buffer_append_memory (buffer,
+        gst_memory_new_wrapped (GST_MEMORY_FLAG_READONLY, mapping->data,
+            mapping->size, offset, length, kms_file_mapping_ref (mapping),
+            (GDestroyNotify) kms_file_mapping_unref));
+  } else {
+    GstMapInfo info;
+    gssize ret;
+
+    buffer = gst_buffer_new_allocate (NULL, length, NULL);
+    gst_buffer_map (buffer, &info, GST_MAP_WRITE);
+    ret = pread (self->priv->fd, info.data, length, offset);
+    gst_buffer_unmap (buffer, &info);
+    kms_mmap_file_src_count_syscalls (self, 1);
+
+    if (ret <= 0) {
+      gst_buffer_unref (buffer);
+
+      if (ret == 0) {
+        GST_DEBUG_OBJECT (self, "EOS at offset %" G_GUINT64_FORMAT, offset);
+        return GST_FLOW_EOS;
+      }
+
+      GST_ELEMENT_ERROR (self, RESOURCE, READ, (NULL), GST_ERROR_SYSTEM);
+      return GST_FLOW_ERROR;
+    }
+
+    length = ret;
+    gst_buffer_set_size (buffer, length);
+  }
+
+  GST_BUFFER_OFFSET (buffer) = offset;
+  GST_BUFFER_OFFSET_END (buffer) = offset + length;
+
+  GST_OBJECT_LOCK (self);
+  self->priv->bytes_read += length;
+  self->priv->buffers++;
+  GST_OBJECT_UNLOCK (self);
+
+  *buf = buffer;
+
+  return GST_FLOW_OK;
+}
+
+static GstStructure *
+kms_mmap_file_src_get_stats (KmsMmapFileSrc * self)
+{
+  GstStructure *stats;
+
+  GST_OBJECT_LOCK (self);
+
+  stats = gst_structure_new ("stats",
+      "bytes-read", G_TYPE_UINT64, self->priv->bytes_read,
+      "buffers", G_TYPE_UINT64, self->priv->buffers,
+      "syscalls", G_TYPE_UINT64, self->priv->syscalls,
+      "readahead-requests", G_TYPE_UINT64, self->priv->readahead_requests,
+      NULL);
+
+  GST_OBJECT_UNLOCK (self);
+
+  return stats;
+}
+
+static gboolean
+kms_mmap_file_src_set_location (KmsMmapFileSrc * self, const gchar * location,
+    GError ** error)
+{
+  GstState state;
+
+  GST_OBJECT_LOCK (self);
+
+  state = GST_STATE (self);
+  if (state != GST_STATE_READY && state != GST_STATE_NULL) {
+    GST_OBJECT_UNLOCK (self);
+    g_set_error (error, GST_URI_ERROR, GST_URI_ERROR_BAD_STATE,
+        "Changing the location while running is not supported");
+    return FALSE;
+  }
+
+  g_free (self->priv->location);
+  g_free (self->priv->uri);
+  self->priv->location = NULL;
+  self->priv->uri = NULL;
+
+  if (location != NULL) {
+    gchar *uri = gst_filename_to_uri (location, NULL);
+
+    self->priv->location = g_strdup (location);
+    if (uri != NULL) {
+      self->priv->uri = kms_mmap_file_src_get_uri (uri);
+      g_free (uri);
+    }
+  }
+
+  GST_OBJECT_UNLOCK (self);
+
+  return TRUE;
+}
+
+static void
+kms_mmap_file_src_set_property (GObject * object, guint property_id,
+    const GValue * value, GParamSpec * pspec)
+{
+  KmsMmapFileSrc *self = KMS_MMAP_FILE_SRC (object);
+
+  switch (property_id) {
+    case PROP_LOCATION:
+      kms_mmap_file_src_set_location (self, g_value_get_string (value), NULL);
+      break;
+    case PROP_READAHEAD:
+      GST_OBJECT_LOCK (self);
+      self->priv->readahead = g_value_get_uint (value);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+      break;
+  }
+}
+
+static void
+kms_mmap_file_src_get_property (GObject * object, guint property_id,
+    GValue * value, GParamSpec * pspec)
+{
+  KmsMmapFileSrc *self = KMS_MMAP_FILE_SRC (object);
+
+  if (property_id == PROP_STATS) {
+    g_value_take_boxed (value, kms_mmap_file_src_get_stats (self));
+    return;
+  }
+
+  GST_OBJECT_LOCK (self);
+
+  switch (property_id) {
+    case PROP_LOCATION:
+      g_value_set_string (value, self->priv->location);
+      break;
+    case PROP_READAHEAD:
+      g_value_set_uint (value, self->priv->readahead);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+      break;
+  }
+
+  GST_OBJECT_UNLOCK (self);
+}
+
+static void
+kms_mmap_file_src_finalize (GObject * object)
+{
+  KmsMmapFileSrc *self = KMS_MMAP_FILE_SRC (object);
+
+  g_free (self->priv->location);
+  g_free (self->priv->uri);
+
+  G_OBJECT_CLASS (kms_mmap_file_src_parent_class)->finalize (object);
+}
+
+static void
+kms_mmap_file_src_class_init (KmsMmapFileSrcClass * klass)
+{
+  GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
+  GstElementClass *element_class = GST_ELEMENT_CLASS (klass);
+  GstBaseSrcClass *basesrc_class = GST_BASE_SRC_CLASS (klass);
+
+  gst_element_class_set_static_metadata (element_class,
+      "Memory mapped file source", "Source/File",
+      "Reads from a memory mapped file, hinting the kernel to read ahead",
+      "Kurento <kurento@googlegroups.com>");
+
+  gst_element_class_add_pad_template (element_class,
+      gst_static_pad_template_get (&src_template));
+
+  gobject_class->set_property = kms_mmap_file_src_set_property;
+  gobject_class->get_property = kms_mmap_file_src_get_property;
+  gobject_class->finalize = kms_mmap_file_src_finalize;
+
+  basesrc_class->start = GST_DEBUG_FUNCPTR (kms_mmap_file_src_start);
+  basesrc_class->stop = GST_DEBUG_FUNCPTR (kms_mmap_file_src_stop);
+  basesrc_class->is_seekable = GST_DEBUG_FUNCPTR (kms_mmap_file_src_is_seekable);
+  basesrc_class->get_size = GST_DEBUG_FUNCPTR (kms_mmap_file_src_get_size);
+  basesrc_class->create = GST_DEBUG_FUNCPTR (kms_mmap_file_src_create);
+
+  obj_properties[PROP_LOCATION] = g_param_spec_string ("location",
+      "File location", "Location of the file to read", DEFAULT_LOCATION,
+      G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+
+  obj_properties[PROP_READAHEAD] = g_param_spec_uint ("readahead",
+      "Readahead", "Bytes ahead of the reading position the kernel is asked "
+      "to load (0 = leave it to the kernel)", 0, G_MAXUINT,
+      DEFAULT_READAHEAD, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+
+  obj_properties[PROP_STATS] = g_param_spec_boxed ("stats",
+      "Statistics", "Bytes read and system calls made",
+      GST_TYPE_STRUCTURE, G_PARAM_READABLE | G_PARAM_STATIC_STRINGS);
+
+  g_object_class_install_properties (gobject_class, N_PROPERTIES,
+      obj_properties);
+
+  g_type_class_add_private (klass, sizeof (KmsMmapFileSrcPrivate));
+}
+
+static void
+kms_mmap_file_src_init (KmsMmapFileSrc * self)
+{
+  self->priv = KMS_MMAP_FILE_SRC_GET_PRIVATE (self);
+
+  self->priv->readahead = DEFAULT_READAHEAD;
+  self->priv->fd = -1;
+
+  /* Buffers are not copied, so large ones cost no more than small ones */
+  gst_base_src_set_blocksize (GST_BASE_SRC (self), DEFAULT_BLOCK_SIZE);
+}
+
+static GstURIType
+kms_mmap_file_src_uri_get_type (GType type)
+{
+  return GST_URI_SRC;
+}
+
+static const gchar *const *
+kms_mmap_file_src_uri_get_protocols (GType type)
+{
+  static const gchar *protocols[] = { KMS_MMAP_FILE_SRC_PROTOCOL, NULL };
+
+  return protocols;
+}
+
+static gchar *
+kms_mmap_file_src_uri_get_uri (GstURIHandler * handler)
+{
+  KmsMmapFileSrc *self = KMS_MMAP_FILE_SRC (handler);
+  gchar *uri;
+
+  GST_OBJECT_LOCK (self);
+  uri = g_strdup (self->priv->uri);
+  GST_OBJECT_UNLOCK (self);
+
+  return uri;
+}
+
+static gboolean
+kms_mmap_file_src_uri_set_uri (GstURIHandler * handler, const gchar * uri,
+    GError ** error)
+{
+  KmsMmapFileSrc *self = KMS_MMAP_FILE_SRC (handler);
+  gchar *file_uri, *location;
+  gboolean ret;
+
+  if (!g_str_has_prefix (uri, KMS_MMAP_FILE_SRC_PROTOCOL ":")) {
+    g_set_error (error, GST_URI_ERROR, GST_URI_ERROR_UNSUPPORTED_PROTOCOL,
+        "Unsupported uri '%s'", uri);
+    return FALSE;
+  }
+
+  file_uri = g_strconcat ("file", uri + strlen (KMS_MMAP_FILE_SRC_PROTOCOL),
+      NULL);
+  location = g_filename_from_uri (file_uri, NULL, NULL);
+  g_free (file_uri);
+
+  if (location == NULL) {
+    g_set_error (error, GST_URI_ERROR, GST_URI_ERROR_BAD_URI,
+        "Invalid uri '%s'", uri);
+    return FALSE;
+  }
+
+  ret = kms_mmap_file_src_set_location (self, location, error);
+  g_free (location);
+
+  return ret;
+}
+
+static void
+kms_mmap_file_src_uri_handler_init (gpointer g_iface, gpointer iface_data)
+{
+  GstURIHandlerInterface *iface = (GstURIHandlerInterface *) g_iface;
+
+  iface->get_type = kms_mmap_file_src_uri_get_type;
+  iface->get_protocols = kms_mmap_file_src_uri_get_protocols;
+  iface->get_uri = kms_mmap_file_src_uri_get_uri;
+  iface->set_uri = kms_mmap_file_src_uri_set_uri;
+}
+
+gchar *
+kms_mmap_file_src_get_uri (const gchar * uri)
+{
+  if (uri == NULL || !g_str_has_prefix (uri, "file:")) {
+    return NULL;
+  }
+
+  return g_strconcat (KMS_MMAP_FILE_SRC_PROTOCOL, uri + strlen ("file"), NULL);
+}
+
+gboolean
+kms_mmap_file_src_plugin_init (GstPlugin * plugin)
+{
+  return gst_element_register (plugin, PLUGIN_NAME, GST_RANK_NONE,
+      KMS_TYPE_MMAP_FILE_SRC);
+}
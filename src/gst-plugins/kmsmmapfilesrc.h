@@ -0,0 +1,85 @@
+/*
+ * (C) Copyright 2016 Kurento (http://kurento.org/)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+#ifndef _KMS_MMAP_FILE_SRC_H_
+#define _KMS_MMAP_FILE_SRC_H_
+
+#include <gst/gst.h>
+#include <gst/base/gstbasesrc.h>
+
+G_BEGIN_DECLS
+#define KMS_TYPE_MMAP_FILE_SRC \
+  (kms_mmap_file_src_get_type())
+#define KMS_MMAP_FILE_SRC(obj) (              \
+  G_TYPE_CHECK_INSTANCE_CAST (                \
+    (obj),                                    \
+    KMS_TYPE_MMAP_FILE_SRC,                   \
+    KmsMmapFileSrc                            \
+  )                                           \
+)
+#define KMS_MMAP_FILE_SRC_CLASS(klass) (      \
+  G_TYPE_CHECK_CLASS_CAST (                   \
+    (klass),                                  \
+    KMS_TYPE_MMAP_FILE_SRC,                   \
+    KmsMmapFileSrcClass                       \
+  )                                           \
+)
+#define KMS_IS_MMAP_FILE_SRC(obj) (           \
+  G_TYPE_CHECK_INSTANCE_TYPE (                \
+    (obj),                                    \
+    KMS_TYPE_MMAP_FILE_SRC                    \
+  )                                           \
+)
+#define KMS_IS_MMAP_FILE_SRC_CLASS(klass) (   \
+  G_TYPE_CHECK_CLASS_TYPE (                   \
+    (klass),                                  \
+    KMS_TYPE_MMAP_FILE_SRC                    \
+  )                                           \
+)
+
+#define KMS_MMAP_FILE_SRC_NAME "kmsmmapfilesrc"
+
+/* Scheme handled by the source. It is not registered with a rank, so file://
+ * uris still get the default source unless they are rewritten to this one */
+#define KMS_MMAP_FILE_SRC_PROTOCOL "kmsmmapfile"
+
+typedef struct _KmsMmapFileSrc KmsMmapFileSrc;
+typedef struct _KmsMmapFileSrcClass KmsMmapFileSrcClass;
+typedef struct _KmsMmapFileSrcPrivate KmsMmapFileSrcPrivate;
+
+struct _KmsMmapFileSrc
+{
+  GstBaseSrc parent;
+
+  /*< private > */
+  KmsMmapFileSrcPrivate *priv;
+};
+
+struct _KmsMmapFileSrcClass
+{
+  GstBaseSrcClass parent_class;
+};
+
+GType kms_mmap_file_src_get_type (void);
+
+/* Returns the uri that makes uridecodebin use this source for @uri, or NULL
+ * if @uri is not a file:// uri */
+gchar * kms_mmap_file_src_get_uri (const gchar * uri);
+
+gboolean kms_mmap_file_src_plugin_init (GstPlugin * plugin);
+
+G_END_DECLS
+#endif /* _KMS_MMAP_FILE_SRC_H_ */
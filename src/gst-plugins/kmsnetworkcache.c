@@ -0,0 +1,447 @@
+/*
+ * (C) Copyright 2016 Kurento (http://kurento.org/)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <gst/rtp/gstrtpbuffer.h>
+
+#include "kmsnetworkcache.h"
+
+#define GST_DEFAULT_NAME "kmsnetworkcache"
+#define GST_CAT_DEFAULT kms_network_cache_debug
+GST_DEBUG_CATEGORY_STATIC (GST_CAT_DEFAULT);
+
+#define NETWORK_CACHE_STATS_FIELD "network-cache"
+
+/* Time between latency updates */
+#define UPDATE_INTERVAL G_USEC_PER_SEC
+
+/* Latency kept for each millisecond of jitter */
+#define JITTER_FACTOR 4
+
+/* Growth when an update sees more loss than the threshold or a stall */
+#define LOSS_THRESHOLD 0.01
+#define LOSS_GROWTH 1.25
+#define STALL_GROWTH 1.5
+
+/* Shrinking starts after some steady updates, a step on each update */
+#define STEADY_UPDATES 5
+#define SHRINK_STEP 0.9
+
+/* Output gap taken as a stall */
+#define STALL_THRESHOLD (250 * 1000)
+
+#define RTP_SEQ_MOD (1 << 16)
+#define RTP_JITTER_GAIN 16.0
+
+typedef struct _KmsNetworkCacheStream
+{
+  guint clock_rate;
+
+  /* Inter-arrival jitter of RFC 3550, in clock rate units */
+  gint64 last_arrival;
+  guint32 last_rtptime;
+  gdouble jitter;
+
+  /* Extended sequence numbers */
+  guint16 max_seq;
+  guint32 cycles;
+  guint32 base_seq;
+  guint64 received;
+
+  guint64 expected_prior;
+  guint64 received_prior;
+} KmsNetworkCacheStream;
+
+struct _KmsNetworkCache
+{
+  GMutex mutex;
+
+  guint min_latency;
+  guint max_latency;
+  guint latency;
+
+  /* <GstPad, KmsNetworkCacheStream> */
+  GHashTable *streams;
+  gint64 last_update;
+  guint steady_updates;
+  gdouble jitter;
+  guint64 expected;
+  guint64 lost;
+
+  gboolean started;
+  gint64 start_time;
+  gint64 startup_latency;
+  gint64 last_output;
+  guint stalls;
+  guint pending_stalls;
+};
+
+static void
+kms_network_cache_init_debug (void)
+{
+  static gsize done = 0;
+
+  if (g_once_init_enter (&done)) {
+    GST_DEBUG_CATEGORY_INIT (GST_CAT_DEFAULT, GST_DEFAULT_NAME, 0,
+        GST_DEFAULT_NAME);
+    g_once_init_leave (&done, 1);
+  }
+}
+
+static void
+kms_network_cache_stream_destroy (KmsNetworkCacheStream * stream)
+{
+  g_slice_free (KmsNetworkCacheStream, stream);
+}
+
+KmsNetworkCache *
+kms_network_cache_new (guint min_latency, guint max_latency)
+{
+  KmsNetworkCache *self;
+
+  g_return_val_if_fail (min_latency <= max_latency, NULL);
+
+  kms_network_cache_init_debug ();
+
+  self = g_slice_new0 (KmsNetworkCache);
+  g_mutex_init (&self->mutex);
+  self->min_latency = min_latency;
+  self->max_latency = max_latency;
+  self->latency = min_latency;
+  self->startup_latency = -1;
+  self->streams = g_hash_table_new_full (g_direct_hash, g_direct_equal,
+      g_object_unref, (GDestroyNotify) kms_network_cache_stream_destroy);
+
+  return self;
+}
+
+void
+kms_network_cache_free (KmsNetworkCache * self)
+{
+  g_return_if_fail (self != NULL);
+
+  g_hash_table_unref (self->streams);
+  g_mutex_clear (&self->mutex);
+  g_slice_free (KmsNetworkCache, self);
+}
+
+guint
+kms_network_cache_get_latency (KmsNetworkCache * self)
+{
+  guint latency;
+
+  g_mutex_lock (&self->mutex);
+  latency = self->latency;
+  g_mutex_unlock (&self->mutex);
+
+  return latency;
+}
+
+void
+kms_network_cache_start (KmsNetworkCache * self)
+{
+  g_mutex_lock (&self->mutex);
+
+  if (!self->started) {
+    self->started = TRUE;
+    self->start_time = g_get_monotonic_time ();
+    self->startup_latency = -1;
+    self->stalls = 0;
+    self->pending_stalls = 0;
+    self->last_update = self->start_time;
+  }
+
+  self->last_output = 0;
+
+  g_mutex_unlock (&self->mutex);
+}
+
+void
+kms_network_cache_stop (KmsNetworkCache * self)
+{
+  g_mutex_lock (&self->mutex);
+
+  /* Next source starts low again */
+  self->started = FALSE;
+  self->latency = self->min_latency;
+  self->steady_updates = 0;
+  self->jitter = 0;
+  self->expected = 0;
+  self->lost = 0;
+  g_hash_table_remove_all (self->streams);
+
+  g_mutex_unlock (&self->mutex);
+}
+
+static KmsNetworkCacheStream *
+kms_network_cache_get_stream (KmsNetworkCache * self, GstPad * pad)
+{
+  KmsNetworkCacheStream *stream;
+  const GstStructure *st;
+  GstCaps *caps;
+  gint clock_rate;
+
+  stream = g_hash_table_lookup (self->streams, pad);
+  if (stream != NULL) {
+    return stream;
+  }
+
+  caps = gst_pad_get_current_caps (pad);
+  if (caps == NULL) {
+    return NULL;
+  }
+
+  st = gst_caps_get_structure (caps, 0);
+  if (!gst_structure_get_int (st, "clock-rate", &clock_rate) ||
+      clock_rate <= 0) {
+    gst_caps_unref (caps);
+    return NULL;
+  }
+
+  gst_caps_unref (caps);
+
+  stream = g_slice_new0 (KmsNetworkCacheStream);
+  stream->clock_rate = clock_rate;
+  stream->last_arrival = -1;
+
+  g_hash_table_insert (self->streams, g_object_ref (pad), stream);
+
+  return stream;
+}
+
+static void
+kms_network_cache_stream_add_packet (KmsNetworkCacheStream * stream,
+    guint16 seq, guint32 rtptime, gint64 arrival)
+{
+  if (stream->last_arrival < 0) {
+    stream->max_seq = seq;
+    stream->base_seq = seq;
+  } else {
+    guint16 delta = seq - stream->max_seq;
+
+    /* Older packets are reordered or duplicated, they are not counted */
+    if (delta < RTP_SEQ_MOD / 2) {
+      if (seq < stream->max_seq) {
+        stream->cycles += RTP_SEQ_MOD;
+      }
+      stream->max_seq = seq;
+    }
+  }
+
+  stream->received++;
+
+  /* Arrival is in microseconds */
+  arrival = gst_util_uint64_scale_int (arrival, stream->clock_rate,
+      G_USEC_PER_SEC);
+
+  if (stream->last_arrival >= 0) {
+    gint64 d = (arrival - stream->last_arrival) -
+        (gint32) (rtptime - stream->last_rtptime);
+
+    stream->jitter += (ABS (d) - stream->jitter) / RTP_JITTER_GAIN;
+  }
+
+  stream->last_arrival = arrival;
+  stream->last_rtptime = rtptime;
+}
+
+/* Must be called holding the mutex */
+static gboolean
+kms_network_cache_update (KmsNetworkCache * self)
+{
+  guint64 expected = 0, lost = 0;
+  gdouble jitter = 0, loss = 0, target;
+  KmsNetworkCacheStream *stream;
+  GHashTableIter iter;
+  guint latency;
+
+  g_hash_table_iter_init (&iter, self->streams);
+
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *) & stream)) {
+    guint64 stream_expected, interval_expected, interval_received;
+
+    stream_expected = stream->cycles + stream->max_seq - stream->base_seq + 1;
+    interval_expected = stream_expected - stream->expected_prior;
+    interval_received = stream->received - stream->received_prior;
+    stream->expected_prior = stream_expected;
+    stream->received_prior = stream->received;
+
+    expected += interval_expected;
+    if (interval_expected > interval_received) {
+      lost += interval_expected - interval_received;
+    }
+
+    jitter = MAX (jitter, stream->jitter * 1000 / stream->clock_rate);
+  }
+
+  self->jitter = jitter;
+  self->expected += expected;
+  self->lost += lost;
+
+  if (expected > 0) {
+    loss = (gdouble) lost / expected;
+  }
+
+  target = JITTER_FACTOR * jitter;
+
+  if (loss > LOSS_THRESHOLD) {
+    target = MAX (target, self->latency * LOSS_GROWTH);
+  }
+
+  if (self->pending_stalls > 0) {
+    target = MAX (target, self->latency * STALL_GROWTH);
+    self->pending_stalls = 0;
+  }
+
+  target = CLAMP (target, self->min_latency, self->max_latency);
+
+  if (target > self->latency) {
+    latency = target;
+    self->steady_updates = 0;
+  } else if (target < self->latency * SHRINK_STEP) {
+    if (self->steady_updates < STEADY_UPDATES) {
+      self->steady_updates++;
+      return FALSE;
+    }
+
+    latency = MAX (target, self->latency * SHRINK_STEP);
+  } else {
+    self->steady_updates = 0;
+    return FALSE;
+  }
+
+  GST_DEBUG ("Latency from %u to %u ms (jitter %.1f ms, loss %.3f)",
+      self->latency, latency, jitter, loss);
+
+  self->latency = latency;
+
+  return TRUE;
+}
+
+gboolean
+kms_network_cache_add_packet (KmsNetworkCache * self, GstPad * pad,
+    GstBuffer * buffer, guint * latency)
+{
+  return kms_network_cache_add_packet_at (self, pad, buffer,
+      g_get_monotonic_time (), latency);
+}
+
+gboolean
+kms_network_cache_add_packet_at (KmsNetworkCache * self, GstPad * pad,
+    GstBuffer * buffer, gint64 arrival, guint * latency)
+{
+  GstRTPBuffer rtp = GST_RTP_BUFFER_INIT;
+  KmsNetworkCacheStream *stream;
+  gboolean changed = FALSE;
+  guint32 rtptime;
+  guint16 seq;
+
+  if (!gst_rtp_buffer_map (buffer, GST_MAP_READ, &rtp)) {
+    return FALSE;
+  }
+
+  seq = gst_rtp_buffer_get_seq (&rtp);
+  rtptime = gst_rtp_buffer_get_timestamp (&rtp);
+  gst_rtp_buffer_unmap (&rtp);
+
+  g_mutex_lock (&self->mutex);
+
+  stream = kms_network_cache_get_stream (self, pad);
+  if (stream == NULL) {
+    goto end;
+  }
+
+  kms_network_cache_stream_add_packet (stream, seq, rtptime, arrival);
+
+  if (self->started && arrival - self->last_update >= UPDATE_INTERVAL) {
+    self->last_update = arrival;
+    changed = kms_network_cache_update (self);
+    *latency = self->latency;
+  }
+
+end:
+  g_mutex_unlock (&self->mutex);
+
+  return changed;
+}
+
+void
+kms_network_cache_add_output (KmsNetworkCache * self)
+{
+  gint64 now = g_get_monotonic_time ();
+
+  g_mutex_lock (&self->mutex);
+
+  if (!self->started) {
+    goto end;
+  }
+
+  if (self->startup_latency < 0) {
+    self->startup_latency = now - self->start_time;
+    GST_DEBUG ("First output after %" G_GINT64_FORMAT " ms",
+        self->startup_latency / 1000);
+  } else if (self->last_output > 0 &&
+      now - self->last_output > STALL_THRESHOLD) {
+    GST_DEBUG ("Stalled for %" G_GINT64_FORMAT " ms",
+        (now - self->last_output) / 1000);
+    self->stalls++;
+    self->pending_stalls++;
+  }
+
+  self->last_output = now;
+
+end:
+  g_mutex_unlock (&self->mutex);
+}
+
+void
+kms_network_cache_add_stats (KmsNetworkCache * self, GstStructure * stats)
+{
+  gdouble minutes, stall_frequency = 0, loss = 0;
+  GstStructure *cache_stats;
+
+  g_mutex_lock (&self->mutex);
+
+  if (self->started) {
+    minutes = (gdouble) (g_get_monotonic_time () - self->start_time) /
+        (60 * G_USEC_PER_SEC);
+    if (minutes > 0) {
+      stall_frequency = self->stalls / minutes;
+    }
+  }
+
+  if (self->expected > 0) {
+    loss = (gdouble) self->lost / self->expected;
+  }
+
+  cache_stats = gst_structure_new (NETWORK_CACHE_STATS_FIELD,
+      "latency", G_TYPE_UINT, self->latency,
+      "jitter", G_TYPE_DOUBLE, self->jitter,
+      "packet-loss", G_TYPE_DOUBLE, loss,
+      "startup-latency", G_TYPE_INT64,
+      self->startup_latency < 0 ? -1 : self->startup_latency / 1000,
+      "stalls", G_TYPE_UINT, self->stalls,
+      "stall-frequency", G_TYPE_DOUBLE, stall_frequency, NULL);
+
+  g_mutex_unlock (&self->mutex);
+
+  gst_structure_set (stats, NETWORK_CACHE_STATS_FIELD, GST_TYPE_STRUCTURE,
+      cache_stats, NULL);
+  gst_structure_free (cache_stats);
+}
@@ -0,0 +1,62 @@
+/*
+ * (C) Copyright 2016 Kurento (http://kurento.org/)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+#ifndef __KMS_NETWORK_CACHE_H__
+#define __KMS_NETWORK_CACHE_H__
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+/* Controller of the amount of media buffered from a network source. It starts
+ * with a small cache, so the first frame comes out early, and sizes it from the
+ * inter-arrival jitter and the packet loss of the RTP streams received, growing
+ * it at once when the source stalls and shrinking it slowly while the network
+ * is steady. It also measures the startup latency and the stalls of the
+ * source. Every function is thread safe. */
+
+typedef struct _KmsNetworkCache KmsNetworkCache;
+
+/* Latencies are in milliseconds */
+KmsNetworkCache * kms_network_cache_new (guint min_latency, guint max_latency);
+void kms_network_cache_free (KmsNetworkCache * self);
+
+guint kms_network_cache_get_latency (KmsNetworkCache * self);
+
+/* Marks the start of the playback, from which the startup latency counts.
+ * Called again while started, as when resuming, it only forgets the last
+ * output so the pause is not taken as a stall */
+void kms_network_cache_start (KmsNetworkCache * self);
+void kms_network_cache_stop (KmsNetworkCache * self);
+
+/* RTP packet of the stream of @pad as it comes from the network. Returns TRUE
+ * when the latency has to be changed to @latency */
+gboolean kms_network_cache_add_packet (KmsNetworkCache * self, GstPad * pad,
+    GstBuffer * buffer, guint * latency);
+
+/* As kms_network_cache_add_packet, for a packet that arrived at @arrival, in
+ * monotonic time */
+gboolean kms_network_cache_add_packet_at (KmsNetworkCache * self, GstPad * pad,
+    GstBuffer * buffer, gint64 arrival, guint * latency);
+
+/* Media given out of the cache */
+void kms_network_cache_add_output (KmsNetworkCache * self);
+
+void kms_network_cache_add_stats (KmsNetworkCache * self,
+    GstStructure * stats);
+
+G_END_DECLS
+#endif /* __KMS_NETWORK_CACHE_H__ */
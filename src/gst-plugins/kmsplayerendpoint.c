@@ -19,12 +19,18 @@
 #endif
 
 #include <gst/gst.h>
+#include <string.h>
 #include <commons/kmsstats.h>
 #include <commons/kmsutils.h>
 #include <commons/kmselement.h>
 #include <commons/kmsagnosticcaps.h>
 #include "kmsplayerendpoint.h"
 #include <commons/kmsloop.h>
+#include "kmshousekeeping.h"
+#include "kmsshareddecode.h"
+#include "kmsmmapfilesrc.h"
+#include "kmskeyframeindex.h"
+#include "kmsnetworkcache.h"
 #include <kms-elements-marshal.h>
 
 #include <gst/app/gstappsrc.h>
@@ -35,6 +41,7 @@
 #define VIDEO_APPSRC "video_appsrc"
 #define URIDECODEBIN "uridecodebin"
 #define RTSPSRC "rtspsrc"
+#define FILESRC "filesrc"
 
 #define APPSRC_KEY "appsrc-key"
 G_DEFINE_QUARK (APPSRC_KEY, appsrc);
@@ -45,7 +52,17 @@ G_DEFINE_QUARK (APPSINK_KEY, appsink);
 #define PTS_KEY "pts-key"
 G_DEFINE_QUARK (PTS_KEY, pts);
 
+#define BRIDGE_KEY "bridge-key"
+G_DEFINE_QUARK (BRIDGE_KEY, bridge);
+
 #define NETWORK_CACHE_DEFAULT 2000
+#define PASSTHROUGH_DEFAULT FALSE
+#define SHARED_DECODE_DEFAULT FALSE
+#define MMAP_FILES_DEFAULT FALSE
+#define FILE_BLOCK_SIZE_DEFAULT 0
+#define SEEK_TO_KEYFRAME_DEFAULT FALSE
+#define ADAPTIVE_NETWORK_CACHE_DEFAULT FALSE
+#define ADAPTIVE_NETWORK_CACHE_MIN 50
 #define IS_PREROLL TRUE
 
 GST_DEBUG_CATEGORY_STATIC (kms_player_endpoint_debug_category);
@@ -83,7 +100,24 @@ struct _KmsPlayerEndpointPrivate
   GstElement *uridecodebin;
   KmsLoop *loop;
   gboolean use_encoded_media;
+  gboolean passthrough;
+  gboolean shared_decode;
+  gboolean mmap_files;
+  guint file_block_size;
+  gboolean seek_to_keyframe;
   gint network_cache;
+  gboolean adaptive_network_cache;
+
+  /* Sizes the latency of rtp sources when it is adaptive */
+  KmsNetworkCache *cache;
+  GstElement *rtpbin;
+
+  /* Key frames of the uri, built while it is played from its start */
+  KmsKeyframeIndex *index;
+  gboolean index_recording;
+
+  /* Decode this player is subscribed to while started in shared mode */
+  KmsSharedDecode *shared;
 
   GMutex base_time_mutex;
   gboolean reset;
@@ -101,6 +135,12 @@ enum
   PROP_POSITION,
   PROP_NETWORK_CACHE,
   PROP_PIPELINE,
+  PROP_PASSTHROUGH,
+  PROP_SHARED_DECODE,
+  PROP_MMAP_FILES,
+  PROP_FILE_BLOCK_SIZE,
+  PROP_SEEK_TO_KEYFRAME,
+  PROP_ADAPTIVE_NETWORK_CACHE,
   N_PROPERTIES
 };
 
@@ -171,6 +211,25 @@ kms_player_endpoint_set_caps (KmsPlayerEndpoint * self)
   gst_caps_unref (deco_caps);
 }
 
+/* Pipeline whose position is the one played. Transfer full */
+static GstElement *
+kms_player_endpoint_get_active_pipeline (KmsPlayerEndpoint * self)
+{
+  GstElement *pipeline = NULL;
+
+  KMS_ELEMENT_LOCK (self);
+
+  if (self->priv->shared != NULL) {
+    pipeline = kms_shared_decode_get_pipeline (self->priv->shared);
+  } else if (self->priv->pipeline != NULL) {
+    pipeline = gst_object_ref (self->priv->pipeline);
+  }
+
+  KMS_ELEMENT_UNLOCK (self);
+
+  return pipeline;
+}
+
 void
 kms_player_endpoint_set_property (GObject * object, guint property_id,
     const GValue * value, GParamSpec * pspec)
@@ -188,6 +247,25 @@ kms_player_endpoint_set_property (GObject * object, guint property_id,
     case PROP_NETWORK_CACHE:
       playerendpoint->priv->network_cache = g_value_get_int (value);
       break;
+    case PROP_PASSTHROUGH:
+      playerendpoint->priv->passthrough = g_value_get_boolean (value);
+      break;
+    case PROP_SHARED_DECODE:
+      playerendpoint->priv->shared_decode = g_value_get_boolean (value);
+      break;
+    case PROP_MMAP_FILES:
+      playerendpoint->priv->mmap_files = g_value_get_boolean (value);
+      break;
+    case PROP_FILE_BLOCK_SIZE:
+      playerendpoint->priv->file_block_size = g_value_get_uint (value);
+      break;
+    case PROP_SEEK_TO_KEYFRAME:
+      playerendpoint->priv->seek_to_keyframe = g_value_get_boolean (value);
+      break;
+    case PROP_ADAPTIVE_NETWORK_CACHE:
+      playerendpoint->priv->adaptive_network_cache =
+          g_value_get_boolean (value);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
       break;
@@ -212,8 +290,11 @@ kms_player_endpoint_get_property (GObject * object, guint property_id,
       GstFormat format;
       GstStructure *video_data = NULL;
       GstQuery *query = gst_query_new_seeking (GST_FORMAT_TIME);
+      GstElement *pipeline;
+
+      pipeline = kms_player_endpoint_get_active_pipeline (playerendpoint);
 
-      if (gst_element_query (playerendpoint->priv->pipeline, query)) {
+      if (gst_element_query (pipeline, query)) {
         gst_query_parse_seeking (query,
             &format, &seekable, &segment_start, &segment_end);
       } else {
@@ -223,12 +304,13 @@ kms_player_endpoint_get_property (GObject * object, guint property_id,
 
       gst_query_unref (query);
 
-      if (!gst_element_query_duration (playerendpoint->priv->pipeline,
-              GST_FORMAT_TIME, &duration)) {
+      if (!gst_element_query_duration (pipeline, GST_FORMAT_TIME, &duration)) {
         GST_WARNING_OBJECT (playerendpoint,
             "Impossible to get the file duration");
       }
 
+      gst_object_unref (pipeline);
+
       video_data = gst_structure_new ("video_data",
           "isSeekable", G_TYPE_BOOLEAN, seekable,
           "seekableInit", G_TYPE_INT64, segment_start,
@@ -241,10 +323,14 @@ kms_player_endpoint_get_property (GObject * object, guint property_id,
     case PROP_POSITION:{
       gint64 position = -1;
       gboolean ret = FALSE;
+      GstElement *pipeline;
+
+      pipeline = kms_player_endpoint_get_active_pipeline (playerendpoint);
 
-      if (playerendpoint->priv->pipeline != NULL) {
-        ret = gst_element_query_position (playerendpoint->priv->pipeline,
-            GST_FORMAT_TIME, &position);
+      if (pipeline != NULL) {
+        ret = gst_element_query_position (pipeline, GST_FORMAT_TIME,
+            &position);
+        gst_object_unref (pipeline);
       }
 
       if (!ret) {
@@ -261,6 +347,25 @@ kms_player_endpoint_get_property (GObject * object, guint property_id,
     case PROP_NETWORK_CACHE:
       g_value_set_int (value, playerendpoint->priv->network_cache);
       break;
+    case PROP_PASSTHROUGH:
+      g_value_set_boolean (value, playerendpoint->priv->passthrough);
+      break;
+    case PROP_SHARED_DECODE:
+      g_value_set_boolean (value, playerendpoint->priv->shared_decode);
+      break;
+    case PROP_MMAP_FILES:
+      g_value_set_boolean (value, playerendpoint->priv->mmap_files);
+      break;
+    case PROP_FILE_BLOCK_SIZE:
+      g_value_set_uint (value, playerendpoint->priv->file_block_size);
+      break;
+    case PROP_SEEK_TO_KEYFRAME:
+      g_value_set_boolean (value, playerendpoint->priv->seek_to_keyframe);
+      break;
+    case PROP_ADAPTIVE_NETWORK_CACHE:
+      g_value_set_boolean (value,
+          playerendpoint->priv->adaptive_network_cache);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
       break;
@@ -318,12 +423,16 @@ kms_player_endpoint_enable_latency_probe (KmsPlayerEndpoint * self)
   g_object_unref (pad);
 }
 
+static void kms_player_endpoint_leave_shared_decode (KmsPlayerEndpoint * self);
+
 static void
 kms_player_endpoint_dispose (GObject * object)
 {
   KmsPlayerEndpoint *self = KMS_PLAYER_ENDPOINT (object);
 
-  g_clear_object (&self->priv->loop);
+  KMS_ELEMENT_LOCK (self);
+  kms_player_endpoint_leave_shared_decode (self);
+  KMS_ELEMENT_UNLOCK (self);
 
   if (self->priv->pipeline != NULL) {
     GstBus *bus;
@@ -337,6 +446,12 @@ kms_player_endpoint_dispose (GObject * object)
     self->priv->pipeline = NULL;
   }
 
+  /* No more messages can be scheduled once the bus handler is removed */
+  if (self->priv->loop != NULL) {
+    kms_housekeeping_release_loop (self->priv->loop);
+    self->priv->loop = NULL;
+  }
+
   /* clean up as possible. May be called multiple times */
 
   G_OBJECT_CLASS (kms_player_endpoint_parent_class)->dispose (object);
@@ -351,6 +466,17 @@ kms_player_endpoint_finalize (GObject * object)
 
   g_mutex_clear (&self->priv->base_time_mutex);
   g_clear_object (&self->priv->stats.src);
+
+  if (self->priv->index != NULL) {
+    kms_keyframe_index_unref (self->priv->index);
+  }
+
+  if (self->priv->cache != NULL) {
+    kms_network_cache_free (self->priv->cache);
+  }
+
+  g_clear_object (&self->priv->rtpbin);
+
   kms_list_unref (self->priv->stats.probes);
 
   G_OBJECT_CLASS (kms_player_endpoint_parent_class)->finalize (object);
@@ -424,48 +550,24 @@ kms_player_endpoint_mark_reset_base_time_and_set_state (KmsPlayerEndpoint *
   return gst_element_set_state (self->priv->pipeline, state);
 }
 
-static GstFlowReturn
-process_sample (GstAppSink * appsink, GstAppSrc * appsrc, GstSample * sample,
+/* Re-bases timestamps of a writable @buffer into the main pipeline. Returns
+ * FALSE if it must not be pushed */
+static gboolean
+kms_player_endpoint_adjust_buffer (KmsPlayerEndpoint * self,
+    GstAppSink * appsink, KmsPtsData * pts_data, GstBuffer * buffer,
     gboolean is_preroll)
 {
-  KmsPlayerEndpoint *self = KMS_PLAYER_ENDPOINT (GST_ELEMENT_PARENT (appsrc));
-  KmsPtsData *pts_data;
-  GstBuffer *buffer = NULL;
-  GstPad *src, *sink;
   GstClockTime pts_orig, base_time, offset_time;
-  GstFlowReturn ret = GST_FLOW_OK;
   gint64 diff;
 
-  if (sample == NULL) {
-    GST_ERROR_OBJECT (appsink, "Cannot get sample");
-    return GST_FLOW_OK;
-  }
-
-  if (gst_sample_get_buffer_list (sample) != NULL) {
-    GST_ERROR_OBJECT (appsink, "BufferList not supported");
-    g_warning ("BufferList not supported");
-  }
-
-  buffer = gst_sample_get_buffer (sample);
-  if (buffer == NULL) {
-    goto end;
-  }
-
-  gst_buffer_ref (buffer);
-  buffer = gst_buffer_make_writable (buffer);
-
-  pts_data =
-      (KmsPtsData *) g_object_get_qdata (G_OBJECT (appsink), pts_quark ());
-
   if (!GST_BUFFER_PTS_IS_VALID (buffer) && !GST_BUFFER_DTS_IS_VALID (buffer)) {
     if (pts_data->pts_handled) {
       GST_ERROR_OBJECT (appsink,
           "PTS and DTS are not valid and a previous buffer was handled.");
-      ret = GST_FLOW_OK;
-      goto end;
+      return FALSE;
     }
 
-    goto push;
+    return TRUE;
   } else if (!GST_BUFFER_PTS_IS_VALID (buffer)) {
     GST_BUFFER_PTS (buffer) = GST_BUFFER_DTS (buffer);
   } else if (!GST_BUFFER_DTS_IS_VALID (buffer)) {
@@ -517,13 +619,13 @@ process_sample (GstAppSink * appsink, GstAppSrc * appsrc, GstSample * sample,
           ", is preroll: %d). Not pushing",
           GST_TIME_ARGS (pts_data->last_pts_orig), GST_TIME_ARGS (pts_orig),
           is_preroll);
-      goto end;
+      return FALSE;
     } else if (pts_orig == pts_data->last_pts_orig) {
       GST_DEBUG_OBJECT (appsink,
           "Original PTS equals than last PTS (original PTS: %" GST_TIME_FORMAT
           ", is preroll: %d). It seems to be already pushed.",
           GST_TIME_ARGS (pts_orig), is_preroll);
-      goto end;
+      return FALSE;
     }
   }
 
@@ -548,13 +650,20 @@ process_sample (GstAppSink * appsink, GstAppSrc * appsrc, GstSample * sample,
         GST_TIME_FORMAT ", PTS: %" GST_TIME_FORMAT
         ", is preroll: %d). Not pushing", GST_TIME_ARGS (pts_data->last_pts),
         GST_TIME_ARGS (GST_BUFFER_PTS (buffer)), is_preroll);
-    goto end;
+    return FALSE;
   }
 
   pts_data->last_pts = GST_BUFFER_PTS (buffer);
   pts_data->last_pts_orig = pts_orig;
 
-push:
+  return TRUE;
+}
+
+static void
+kms_player_endpoint_flush_if_eos (GstAppSrc * appsrc)
+{
+  GstPad *src, *sink;
+
   src = gst_element_get_static_pad (GST_ELEMENT (appsrc), "src");
   sink = gst_pad_get_peer (src);
   g_object_unref (src);
@@ -567,6 +676,103 @@ push:
     }
     g_object_unref (sink);
   }
+}
+
+static GstFlowReturn
+kms_player_endpoint_push_buffer_list (KmsPlayerEndpoint * self,
+    GstAppSink * appsink, GstAppSrc * appsrc, KmsPtsData * pts_data,
+    GstBufferList * list, gboolean is_preroll)
+{
+  GstFlowReturn ret = GST_FLOW_OK;
+  GstBufferList *out;
+  guint i, len;
+
+  len = gst_buffer_list_length (list);
+  out = gst_buffer_list_new_sized (len);
+
+  for (i = 0; i < len; i++) {
+    GstBuffer *buffer = gst_buffer_list_get (list, i);
+
+    buffer = gst_buffer_make_writable (gst_buffer_ref (buffer));
+
+    /* Only the head of the list may start a new base time */
+    if (kms_player_endpoint_adjust_buffer (self, appsink, pts_data, buffer,
+            is_preroll && i == 0)) {
+      gst_buffer_list_add (out, buffer);
+    } else {
+      gst_buffer_unref (buffer);
+    }
+  }
+
+  len = gst_buffer_list_length (out);
+
+  if (len == 0) {
+    gst_buffer_list_unref (out);
+    return GST_FLOW_OK;
+  }
+
+  kms_player_endpoint_flush_if_eos (appsrc);
+
+#if GST_CHECK_VERSION (1, 14, 0)
+  ret = gst_app_src_push_buffer_list (appsrc, out);
+#else
+  /* This appsrc takes single buffers only */
+  for (i = 0; i < len && ret == GST_FLOW_OK; i++) {
+    ret = gst_app_src_push_buffer (appsrc,
+        gst_buffer_ref (gst_buffer_list_get (out, i)));
+  }
+
+  gst_buffer_list_unref (out);
+#endif
+
+  if (ret != GST_FLOW_OK) {
+    GST_ERROR_OBJECT (appsink,
+        "Could not send buffer list to appsrc %s. Cause: %s",
+        GST_ELEMENT_NAME (appsrc), gst_flow_get_name (ret));
+  }
+
+  return ret;
+}
+
+static GstFlowReturn
+process_sample (GstAppSink * appsink, GstAppSrc * appsrc, GstSample * sample,
+    gboolean is_preroll)
+{
+  KmsPlayerEndpoint *self = KMS_PLAYER_ENDPOINT (GST_ELEMENT_PARENT (appsrc));
+  KmsPtsData *pts_data;
+  GstBufferList *list;
+  GstBuffer *buffer = NULL;
+  GstFlowReturn ret = GST_FLOW_OK;
+
+  if (sample == NULL) {
+    GST_ERROR_OBJECT (appsink, "Cannot get sample");
+    return GST_FLOW_OK;
+  }
+
+  pts_data =
+      (KmsPtsData *) g_object_get_qdata (G_OBJECT (appsink), pts_quark ());
+
+  list = gst_sample_get_buffer_list (sample);
+  if (list != NULL) {
+    ret = kms_player_endpoint_push_buffer_list (self, appsink, appsrc,
+        pts_data, list, is_preroll);
+    goto end;
+  }
+
+  buffer = gst_sample_get_buffer (sample);
+  if (buffer == NULL) {
+    goto end;
+  }
+
+  gst_buffer_ref (buffer);
+  buffer = gst_buffer_make_writable (buffer);
+
+  if (!kms_player_endpoint_adjust_buffer (self, appsink, pts_data, buffer,
+          is_preroll)) {
+    goto end;
+  }
+
+  kms_player_endpoint_flush_if_eos (appsrc);
 
   ret = gst_app_src_push_buffer (appsrc, buffer);
   buffer = NULL;
@@ -733,9 +939,10 @@ kms_player_end_point_remove_stat_probe (KmsPlayerEndpoint * self, GstPad * pad)
   KMS_ELEMENT_UNLOCK (self);
 }
 
+/* Stats of the media are collected from @stats_pad */
 static GstElement *
 kms_player_end_point_get_agnostic_for_pad (KmsPlayerEndpoint * self,
-    GstPad * pad)
+    GstPad * pad, GstPad * stats_pad)
 {
   GstCaps *caps, *audio_caps = NULL, *video_caps = NULL;
   GstElement *agnosticbin = NULL;
@@ -752,10 +959,12 @@ kms_player_end_point_get_agnostic_for_pad (KmsPlayerEndpoint * self,
   /* TODO: Update latency probe to set valid and media type */
   if (gst_caps_can_intersect (audio_caps, caps)) {
     agnosticbin = kms_element_get_audio_agnosticbin (KMS_ELEMENT (self));
-    kms_player_end_point_add_stat_probe (self, pad, KMS_MEDIA_TYPE_AUDIO);
+    kms_player_end_point_add_stat_probe (self, stats_pad,
+        KMS_MEDIA_TYPE_AUDIO);
   } else if (gst_caps_can_intersect (video_caps, caps)) {
     agnosticbin = kms_element_get_video_agnosticbin (KMS_ELEMENT (self));
-    kms_player_end_point_add_stat_probe (self, pad, KMS_MEDIA_TYPE_VIDEO);
+    kms_player_end_point_add_stat_probe (self, stats_pad,
+        KMS_MEDIA_TYPE_VIDEO);
   }
 
   gst_caps_unref (caps);
@@ -804,133 +1013,674 @@ internal_pipeline_probe (GstPad * pad, GstPadProbeInfo * info, gpointer element)
   }
 }
 
-static void
-pad_added (GstElement * element, GstPad * pad, KmsPlayerEndpoint * self)
+/* Passthrough mode: a fakesink of the private pipeline keeps it in sync
+ * with the clock and the buffers it prerolls or renders are pushed, as they
+ * are, through a bridge pad linked to the agnosticbin. Their running time is
+ * moved to the one of the endpoint with the offset of the bridge, so that
+ * they are neither queued in an appsrc nor made writable. */
+
+static gboolean
+bridge_query (GstPad * pad, GstObject * parent, GstQuery * query)
 {
-  GstElement *appsink, *appsrc;
-  GstElement *agnosticbin;
+  GstElement *sink = GST_ELEMENT (gst_pad_get_element_private (pad));
   GstPad *sinkpad;
+  gboolean ret;
 
-  GST_DEBUG_OBJECT (pad, "Pad added");
+  switch (GST_QUERY_TYPE (query)) {
+    case GST_QUERY_CAPS:
+    case GST_QUERY_ACCEPT_CAPS:
+      break;
+    case GST_QUERY_LATENCY:
+      /* Same latency as the appsrc */
+      gst_query_set_latency (query, TRUE, 0, 0);
+      return TRUE;
+    default:
+      return FALSE;
+  }
 
-  agnosticbin = kms_player_end_point_get_agnostic_for_pad (self, pad);
+  sinkpad = gst_element_get_static_pad (sink, "sink");
+  ret = gst_pad_peer_query (sinkpad, query);
+  g_object_unref (sinkpad);
 
-  if (agnosticbin != NULL) {
-    GstAppSinkCallbacks callbacks;
+  return ret;
+}
 
-    /* Create appsink */
-    appsink = gst_element_factory_make ("appsink", NULL);
-    appsrc = kms_player_end_point_add_appsrc (self, agnosticbin, appsink);
+static gboolean
+bridge_event (GstPad * pad, GstObject * parent, GstEvent * event)
+{
+  /* Like the appsrc, upstream events do not reach the private pipeline */
+  GST_LOG_OBJECT (pad, "Dropping %" GST_PTR_FORMAT, event);
+  gst_event_unref (event);
 
-    g_object_set (appsink, "enable-last-sample", FALSE, "emit-signals", FALSE,
-        "qos", FALSE, "max-buffers", 1, NULL);
+  return FALSE;
+}
 
-    callbacks.eos = eos_cb;
-    callbacks.new_preroll = new_preroll_cb;
-    callbacks.new_sample = new_sample_cb;
-    gst_app_sink_set_callbacks (GST_APP_SINK (appsink), &callbacks, appsrc,
-        NULL);
+/* Lets @bridge push again once a previous EOS has gone through it */
+static void
+kms_player_endpoint_flush_bridge_if_eos (GstPad * bridge, GstEvent * segment)
+{
+  gboolean eos;
+  GstPad *peer;
 
-    g_object_set_qdata_full (G_OBJECT (appsink), pts_quark (),
-        kms_pts_data_new (), kms_pts_data_destroy);
+  eos = GST_OBJECT_FLAG_IS_SET (bridge, GST_PAD_FLAG_EOS);
+  peer = gst_pad_get_peer (bridge);
 
-    g_object_set_qdata (G_OBJECT (pad), appsink_quark (), appsink);
-    g_object_set_qdata (G_OBJECT (pad), appsrc_quark (), appsrc);
-  } else {
-    GST_WARNING_OBJECT (self, "No supported pad: %" GST_PTR_FORMAT
-        ". Connecting it to a fakesink", pad);
-    appsink = gst_element_factory_make ("fakesink", NULL);
+  if (peer != NULL) {
+    eos |= GST_OBJECT_FLAG_IS_SET (peer, GST_PAD_FLAG_EOS);
+    g_object_unref (peer);
   }
 
-  g_object_set (appsink, "sync", TRUE, "async", TRUE, NULL);
-
-  sinkpad = gst_element_get_static_pad (appsink, "sink");
-
-  if (agnosticbin != NULL) {
-    gst_pad_add_probe (sinkpad,
-        (GST_PAD_PROBE_TYPE_QUERY_DOWNSTREAM |
-            GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM), internal_pipeline_probe,
-        appsrc, NULL);
+  if (!eos) {
+    return;
   }
 
-  gst_bin_add (GST_BIN (self->priv->pipeline), appsink);
-  gst_pad_link (pad, sinkpad);
-
-  g_object_unref (sinkpad);
-
-  gst_element_sync_state_with_parent (appsink);
-}
-
-static void
-kms_remove_element_from_bin (GstBin * bin, GstElement * element)
-{
-  GST_DEBUG ("Removing %" GST_PTR_FORMAT " from %" GST_PTR_FORMAT, element,
-      bin);
+  GST_INFO_OBJECT (bridge, "Sending flush events");
+  gst_pad_push_event (bridge, gst_event_new_flush_start ());
+  gst_pad_push_event (bridge, gst_event_new_flush_stop (FALSE));
 
-  if (!gst_element_set_locked_state (element, TRUE)) {
-    GST_ERROR ("Could not block element %" GST_PTR_FORMAT, element);
+  /* Flushing removed it */
+  if (segment != NULL) {
+    gst_pad_push_event (bridge, gst_event_ref (segment));
   }
-
-  gst_element_set_state (element, GST_STATE_NULL);
-  gst_bin_remove (bin, element);
 }
 
-static void
-pad_removed (GstElement * element, GstPad * pad, KmsPlayerEndpoint * self)
+/* Sets the offset of @bridge the first time a buffer is pushed after a
+ * reset. Returns FALSE if the buffer must not be pushed */
+static gboolean
+kms_player_endpoint_update_bridge_offset (KmsPlayerEndpoint * self,
+    GstElement * sink, GstPad * bridge, KmsPtsData * pts_data,
+    const GstSegment * segment, GstBuffer * buffer, gboolean is_preroll)
 {
-  GstElement *appsink, *appsrc;
+  GstClockTime ts, running_time, base_time = GST_CLOCK_TIME_NONE;
+  GstClockTime out_time;
 
-  GST_DEBUG_OBJECT (pad, "Pad removed");
+  ts = GST_BUFFER_PTS_IS_VALID (buffer) ? GST_BUFFER_PTS (buffer) :
+      GST_BUFFER_DTS (buffer);
 
-  if (GST_PAD_IS_SINK (pad))
-    return;
+  if (!GST_CLOCK_TIME_IS_VALID (ts)) {
+    if (pts_data->pts_handled) {
+      GST_ERROR_OBJECT (sink,
+          "PTS and DTS are not valid and a previous buffer was handled.");
+      return FALSE;
+    }
 
-  GST_DEBUG ("pad %" GST_PTR_FORMAT " removed", pad);
+    return TRUE;
+  }
 
-  kms_player_end_point_remove_stat_probe (self, pad);
+  pts_data->pts_handled = TRUE;
+  running_time = gst_segment_to_running_time (segment, GST_FORMAT_TIME, ts);
 
-  appsink = g_object_steal_qdata (G_OBJECT (pad), appsink_quark ());
-  appsrc = g_object_steal_qdata (G_OBJECT (pad), appsrc_quark ());
+  if (!GST_CLOCK_TIME_IS_VALID (running_time)) {
+    GST_DEBUG_OBJECT (sink, "Buffer out of segment: %" GST_PTR_FORMAT, buffer);
+    return FALSE;
+  }
 
-  if (appsink != NULL) {
-    kms_remove_element_from_bin (GST_BIN (self->priv->pipeline), appsink);
+  if (is_preroll) {
+    GST_DEBUG_OBJECT (sink, "Preroll: reset base time");
+
+    kms_player_endpoint_reset_base_time (self);
+    kms_pts_data_reset (pts_data);
+    base_time =
+        kms_player_endpoint_get_or_generate_base_time (self,
+        &self->priv->base_time_preroll, IS_PREROLL);
+  } else if (pts_data->base_time == GST_CLOCK_TIME_NONE) {
+    base_time =
+        kms_player_endpoint_get_or_generate_base_time (self,
+        &self->priv->base_time, !IS_PREROLL);
   }
 
-  if (appsrc != NULL) {
-    kms_remove_element_from_bin (GST_BIN (self), appsrc);
+  if (pts_data->last_pts_orig != GST_CLOCK_TIME_NONE &&
+      running_time <= pts_data->last_pts_orig) {
+    /* Prerolled buffers are rendered again when going to playing */
+    GST_DEBUG_OBJECT (sink, "Buffer already pushed: %" GST_PTR_FORMAT,
+        buffer);
+    return FALSE;
   }
-}
 
-static gboolean
-kms_player_endpoint_stopped (KmsUriEndpoint * obj, GError ** error)
-{
-  KmsPlayerEndpoint *self = KMS_PLAYER_ENDPOINT (obj);
+  if (base_time != GST_CLOCK_TIME_NONE) {
+    if (pts_data->last_pts != GST_CLOCK_TIME_NONE) {
+      /* Ensure that base_time is always greater than the last_pts
+       * to avoid setting the same or less PTS for different buffers */
+      base_time = MAX (base_time, pts_data->last_pts + GST_MSECOND);
+    }
 
-  GST_DEBUG_OBJECT (self, "Pipeline stopped");
+    if (!is_preroll) {
+      pts_data->base_time = base_time;
+    }
 
-  /* Set internal pipeline to NULL */
-  kms_player_endpoint_mark_reset_base_time_and_set_state (self, GST_STATE_NULL);
+    gst_pad_set_offset (bridge, (gint64) base_time - (gint64) running_time);
+  }
 
-  KMS_URI_ENDPOINT_GET_CLASS (self)->change_state (KMS_URI_ENDPOINT (self),
-      KMS_URI_ENDPOINT_STATE_STOP);
+  out_time = running_time + gst_pad_get_offset (bridge);
+
+  if (pts_data->last_pts != GST_CLOCK_TIME_NONE &&
+      out_time <= pts_data->last_pts) {
+    GST_ERROR_OBJECT (sink,
+        "Non incremental running time (last: %" GST_TIME_FORMAT ", current: %"
+        GST_TIME_FORMAT ", is preroll: %d). Not pushing",
+        GST_TIME_ARGS (pts_data->last_pts), GST_TIME_ARGS (out_time),
+        is_preroll);
+    return FALSE;
+  }
+
+  pts_data->last_pts = out_time;
+  pts_data->last_pts_orig = running_time;
 
   return TRUE;
 }
 
-static gboolean
-kms_player_endpoint_started (KmsUriEndpoint * obj, GError ** error)
+static void
+kms_player_endpoint_push_to_bridge (KmsPlayerEndpoint * self,
+    GstElement * sink, GstPad * sinkpad, GstBuffer * buffer,
+    gboolean is_preroll)
 {
-  KmsPlayerEndpoint *self = KMS_PLAYER_ENDPOINT (obj);
+  const GstSegment *segment;
+  KmsPtsData *pts_data;
+  GstEvent *event;
+  GstFlowReturn ret;
+  GstPad *bridge;
 
-  GST_DEBUG_OBJECT (self, "Pipeline started");
+  bridge = g_object_get_qdata (G_OBJECT (sink), bridge_quark ());
+  pts_data = g_object_get_qdata (G_OBJECT (sink), pts_quark ());
+  event = gst_pad_get_sticky_event (sinkpad, GST_EVENT_SEGMENT, 0);
 
-  /* Set uri property in uridecodebin */
-  g_object_set (G_OBJECT (self->priv->uridecodebin), "uri",
-      KMS_URI_ENDPOINT (self)->uri, NULL);
+  if (event == NULL) {
+    GST_WARNING_OBJECT (sink, "Buffer received without segment");
+    return;
+  }
 
-  /* Set internal pipeline to playing */
+  gst_event_parse_segment (event, &segment);
+
+  if (kms_player_endpoint_update_bridge_offset (self, sink, bridge, pts_data,
+          segment, buffer, is_preroll)) {
+    kms_player_endpoint_flush_bridge_if_eos (bridge, event);
+
+    ret = gst_pad_push (bridge, gst_buffer_ref (buffer));
+
+    if (ret != GST_FLOW_OK) {
+      GST_ERROR_OBJECT (sink, "Could not push buffer through %" GST_PTR_FORMAT
+          ". Cause: %s", bridge, gst_flow_get_name (ret));
+    }
+  }
+
+  gst_event_unref (event);
+}
+
+static void
+bridge_handoff (GstElement * sink, GstBuffer * buffer, GstPad * pad,
+    gpointer self)
+{
+  kms_player_endpoint_push_to_bridge (KMS_PLAYER_ENDPOINT (self), sink, pad,
+      buffer, !IS_PREROLL);
+}
+
+static void
+bridge_preroll_handoff (GstElement * sink, GstBuffer * buffer, GstPad * pad,
+    gpointer self)
+{
+  kms_player_endpoint_push_to_bridge (KMS_PLAYER_ENDPOINT (self), sink, pad,
+      buffer, IS_PREROLL);
+}
+
+static GstPadProbeReturn
+bridge_events_probe (GstPad * pad, GstPadProbeInfo * info, gpointer data)
+{
+  GstEvent *event = GST_PAD_PROBE_INFO_EVENT (info);
+  GstPad *bridge = GST_PAD (data);
+
+  switch (GST_EVENT_TYPE (event)) {
+    case GST_EVENT_STREAM_START:
+    case GST_EVENT_CAPS:
+    case GST_EVENT_SEGMENT:
+    case GST_EVENT_TAG:
+      kms_player_endpoint_flush_bridge_if_eos (bridge, NULL);
+      gst_pad_push_event (bridge, gst_event_ref (event));
+      break;
+    case GST_EVENT_EOS:
+      GST_DEBUG_OBJECT (bridge, "Sending eos event to main pipeline");
+      gst_pad_push_event (bridge, gst_event_ref (event));
+      break;
+    default:
+      /* Flushes of the private pipeline stay in it */
+      break;
+  }
+
+  return GST_PAD_PROBE_OK;
+}
+
+static void
+kms_player_end_point_release_bridge (GstPad * bridge)
+{
+  GstPad *peer;
+
+  peer = gst_pad_get_peer (bridge);
+
+  if (peer != NULL) {
+    gst_pad_unlink (bridge, peer);
+    g_object_unref (peer);
+  }
+
+  gst_pad_set_active (bridge, FALSE);
+  gst_object_unref (bridge);
+}
+
+static GstElement *
+kms_player_end_point_add_bridge (KmsPlayerEndpoint * self,
+    GstElement * agnosticbin)
+{
+  GstElement *sink;
+  GstPad *bridge, *sinkpad;
+  gchar *name;
+
+  sink = gst_element_factory_make ("fakesink", NULL);
+  g_object_set (sink, "enable-last-sample", FALSE, "qos", FALSE,
+      "signal-handoffs", TRUE, NULL);
+
+  name = g_strdup_printf ("bridge_%s", GST_ELEMENT_NAME (sink));
+  bridge = gst_object_ref_sink (gst_pad_new (name, GST_PAD_SRC));
+  g_free (name);
+
+  gst_pad_set_element_private (bridge, sink);
+  gst_pad_set_query_function (bridge, bridge_query);
+  gst_pad_set_event_function (bridge, bridge_event);
+  gst_pad_set_active (bridge, TRUE);
+
+  /* Pads in different pipelines */
+  sinkpad = gst_element_get_static_pad (agnosticbin, "sink");
+  if (GST_PAD_LINK_FAILED (gst_pad_link_full (bridge, sinkpad,
+              GST_PAD_LINK_CHECK_NOTHING))) {
+    GST_ERROR_OBJECT (self, "Could not link %" GST_PTR_FORMAT
+        " to element %s", bridge, GST_ELEMENT_NAME (agnosticbin));
+  }
+  g_object_unref (sinkpad);
+
+  /* Bridge is released along with the sink */
+  g_object_set_qdata_full (G_OBJECT (sink), bridge_quark (), bridge,
+      (GDestroyNotify) kms_player_end_point_release_bridge);
+  g_object_set_qdata_full (G_OBJECT (sink), pts_quark (),
+      kms_pts_data_new (), kms_pts_data_destroy);
+
+  g_signal_connect (sink, "handoff", G_CALLBACK (bridge_handoff), self);
+  g_signal_connect (sink, "preroll-handoff",
+      G_CALLBACK (bridge_preroll_handoff), self);
+
+  sinkpad = gst_element_get_static_pad (sink, "sink");
+  gst_pad_add_probe (sinkpad, GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM,
+      bridge_events_probe, bridge, NULL);
+  g_object_unref (sinkpad);
+
+  return sink;
+}
+
+/* Makes @appsink feed a new appsrc linked to @agnosticbin */
+static GstElement *
+kms_player_end_point_connect_appsink (KmsPlayerEndpoint * self,
+    GstElement * agnosticbin, GstElement * appsink)
+{
+  GstAppSinkCallbacks callbacks;
+  GstElement *appsrc;
+  GstPad *sinkpad;
+
+  appsrc = kms_player_end_point_add_appsrc (self, agnosticbin, appsink);
+
+  g_object_set (appsink, "enable-last-sample", FALSE, "emit-signals", FALSE,
+      "qos", FALSE, "max-buffers", 1, NULL);
+#if GST_CHECK_VERSION (1, 12, 0)
+  /* Keep batches from demuxers and depayloaders together */
+  g_object_set (appsink, "buffer-list", TRUE, NULL);
+#endif
+
+  callbacks.eos = eos_cb;
+  callbacks.new_preroll = new_preroll_cb;
+  callbacks.new_sample = new_sample_cb;
+  gst_app_sink_set_callbacks (GST_APP_SINK (appsink), &callbacks, appsrc,
+      NULL);
+
+  g_object_set_qdata_full (G_OBJECT (appsink), pts_quark (),
+      kms_pts_data_new (), kms_pts_data_destroy);
+
+  sinkpad = gst_element_get_static_pad (appsink, "sink");
+  gst_pad_add_probe (sinkpad,
+      (GST_PAD_PROBE_TYPE_QUERY_DOWNSTREAM |
+          GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM), internal_pipeline_probe,
+      appsrc, NULL);
+  g_object_unref (sinkpad);
+
+  return appsrc;
+}
+
+static void
+pad_added (GstElement * element, GstPad * pad, KmsPlayerEndpoint * self)
+{
+  GstElement *appsink, *appsrc = NULL;
+  GstElement *agnosticbin;
+  GstPad *sinkpad;
+
+  GST_DEBUG_OBJECT (pad, "Pad added");
+
+  agnosticbin = kms_player_end_point_get_agnostic_for_pad (self, pad, pad);
+
+  if (agnosticbin != NULL && self->priv->use_encoded_media &&
+      self->priv->passthrough) {
+    appsink = kms_player_end_point_add_bridge (self, agnosticbin);
+    g_object_set_qdata (G_OBJECT (pad), appsink_quark (), appsink);
+  } else if (agnosticbin != NULL) {
+    /* Create appsink */
+    appsink = gst_element_factory_make ("appsink", NULL);
+    appsrc = kms_player_end_point_connect_appsink (self, agnosticbin, appsink);
+
+    g_object_set_qdata (G_OBJECT (pad), appsink_quark (), appsink);
+    g_object_set_qdata (G_OBJECT (pad), appsrc_quark (), appsrc);
+  } else {
+    GST_WARNING_OBJECT (self, "No supported pad: %" GST_PTR_FORMAT
+        ". Connecting it to a fakesink", pad);
+    appsink = gst_element_factory_make ("fakesink", NULL);
+  }
+
+  g_object_set (appsink, "sync", TRUE, "async", TRUE, NULL);
+
+  sinkpad = gst_element_get_static_pad (appsink, "sink");
+
+  gst_bin_add (GST_BIN (self->priv->pipeline), appsink);
+  gst_pad_link (pad, sinkpad);
+
+  g_object_unref (sinkpad);
+
+  gst_element_sync_state_with_parent (appsink);
+}
+
+static void
+kms_remove_element_from_bin (GstBin * bin, GstElement * element)
+{
+  GST_DEBUG ("Removing %" GST_PTR_FORMAT " from %" GST_PTR_FORMAT, element,
+      bin);
+
+  if (!gst_element_set_locked_state (element, TRUE)) {
+    GST_ERROR ("Could not block element %" GST_PTR_FORMAT, element);
+  }
+
+  gst_element_set_state (element, GST_STATE_NULL);
+  gst_bin_remove (bin, element);
+}
+
+static void
+pad_removed (GstElement * element, GstPad * pad, KmsPlayerEndpoint * self)
+{
+  GstElement *appsink, *appsrc;
+
+  GST_DEBUG_OBJECT (pad, "Pad removed");
+
+  if (GST_PAD_IS_SINK (pad))
+    return;
+
+  GST_DEBUG ("pad %" GST_PTR_FORMAT " removed", pad);
+
+  kms_player_end_point_remove_stat_probe (self, pad);
+
+  appsink = g_object_steal_qdata (G_OBJECT (pad), appsink_quark ());
+  appsrc = g_object_steal_qdata (G_OBJECT (pad), appsrc_quark ());
+
+  if (appsink != NULL) {
+    kms_remove_element_from_bin (GST_BIN (self->priv->pipeline), appsink);
+  }
+
+  if (appsrc != NULL) {
+    kms_remove_element_from_bin (GST_BIN (self), appsrc);
+  }
+}
+
+/* Shared mode: the player gets a branch of each stream of a decode shared
+ * with the rest of the players of the same uri, instead of running its own
+ * private pipeline. Each branch keeps its own timestamp offsets, so only the
+ * base time of the player has to be reset when it leaves the decode. */
+
+static void kms_player_endpoint_handle_message (KmsPlayerEndpoint * self,
+    GstMessage * msg);
+
+/* Uri given to uridecodebin. Transfer full */
+static gchar *
+kms_player_endpoint_get_source_uri (KmsPlayerEndpoint * self)
+{
+  gchar *uri = NULL;
+
+  if (self->priv->mmap_files) {
+    uri = kms_mmap_file_src_get_uri (KMS_URI_ENDPOINT (self)->uri);
+  }
+
+  if (uri == NULL) {
+    uri = g_strdup (KMS_URI_ENDPOINT (self)->uri);
+  }
+
+  return uri;
+}
+
+static void
+shared_branch_added (GstPad * stream, GstElement * appsink, gpointer user_data)
+{
+  KmsPlayerEndpoint *self = KMS_PLAYER_ENDPOINT (user_data);
+  GstElement *agnosticbin, *appsrc;
+  GstPad *sinkpad;
+
+  sinkpad = gst_element_get_static_pad (appsink, "sink");
+  agnosticbin = kms_player_end_point_get_agnostic_for_pad (self, stream,
+      sinkpad);
+  g_object_unref (sinkpad);
+
+  if (agnosticbin == NULL) {
+    GST_WARNING_OBJECT (self, "No supported pad: %" GST_PTR_FORMAT
+        ". Discarding its media", stream);
+    g_object_set (appsink, "max-buffers", 1, "drop", TRUE, NULL);
+    return;
+  }
+
+  appsrc = kms_player_end_point_connect_appsink (self, agnosticbin, appsink);
+  g_object_set_qdata (G_OBJECT (appsink), appsrc_quark (), appsrc);
+}
+
+static void
+shared_branch_removed (GstElement * appsink, gpointer user_data)
+{
+  KmsPlayerEndpoint *self = KMS_PLAYER_ENDPOINT (user_data);
+  GstElement *appsrc;
+  GstPad *sinkpad;
+
+  sinkpad = gst_element_get_static_pad (appsink, "sink");
+  kms_player_end_point_remove_stat_probe (self, sinkpad);
+  g_object_unref (sinkpad);
+
+  appsrc = g_object_steal_qdata (G_OBJECT (appsink), appsrc_quark ());
+  if (appsrc != NULL) {
+    kms_remove_element_from_bin (GST_BIN (self), appsrc);
+  }
+}
+
+static void
+shared_message (GstMessage * msg, gpointer user_data)
+{
+  kms_player_endpoint_handle_message (KMS_PLAYER_ENDPOINT (user_data), msg);
+}
+
+static const KmsSharedDecodeCallbacks shared_callbacks = {
+  shared_branch_added,
+  shared_branch_removed,
+  shared_message
+};
+
+/* Must be called with the element lock held. It is released while calling
+ * into the shared decode, whose callbacks take it */
+static void
+kms_player_endpoint_join_shared_decode (KmsPlayerEndpoint * self)
+{
+  KmsSharedDecode *shared;
+  gchar *uri;
+
+  if (self->priv->shared != NULL) {
+    return;
+  }
+
+  uri = kms_player_endpoint_get_source_uri (self);
+
+  KMS_ELEMENT_UNLOCK (self);
+  shared = kms_shared_decode_subscribe (uri, self->priv->use_encoded_media,
+      self->priv->network_cache, &shared_callbacks, self);
+  KMS_ELEMENT_LOCK (self);
+
+  g_free (uri);
+
+  if (self->priv->shared != NULL) {
+    /* Joined meanwhile */
+    KMS_ELEMENT_UNLOCK (self);
+    kms_shared_decode_unsubscribe (shared, self);
+    KMS_ELEMENT_LOCK (self);
+    return;
+  }
+
+  self->priv->shared = shared;
+}
+
+/* Must be called with the element lock held. It is released while calling
+ * into the shared decode, whose callbacks take it */
+static void
+kms_player_endpoint_leave_shared_decode (KmsPlayerEndpoint * self)
+{
+  KmsSharedDecode *shared;
+
+  shared = self->priv->shared;
+  self->priv->shared = NULL;
+
+  if (shared == NULL) {
+    return;
+  }
+
+  KMS_ELEMENT_UNLOCK (self);
+  kms_shared_decode_unsubscribe (shared, self);
+  KMS_ELEMENT_LOCK (self);
+
+  /* Media is taken from the current position when joining again */
+  kms_player_endpoint_mark_reset_base_time (self);
+  kms_player_endpoint_reset_base_time (self);
+}
+
+static gboolean
+kms_player_endpoint_stopped (KmsUriEndpoint * obj, GError ** error)
+{
+  KmsPlayerEndpoint *self = KMS_PLAYER_ENDPOINT (obj);
+
+  GST_DEBUG_OBJECT (self, "Pipeline stopped");
+
+  kms_player_endpoint_leave_shared_decode (self);
+
+  /* Set internal pipeline to NULL */
+  kms_player_endpoint_mark_reset_base_time_and_set_state (self, GST_STATE_NULL);
+
+  /* Playback starts again from the beginning */
+  KMS_ELEMENT_LOCK (self);
+  self->priv->index_recording = TRUE;
+  g_clear_object (&self->priv->rtpbin);
+  KMS_ELEMENT_UNLOCK (self);
+
+  if (self->priv->cache != NULL) {
+    kms_network_cache_stop (self->priv->cache);
+  }
+
+  KMS_URI_ENDPOINT_GET_CLASS (self)->change_state (KMS_URI_ENDPOINT (self),
+      KMS_URI_ENDPOINT_STATE_STOP);
+
+  return TRUE;
+}
+
+/* Index and seeks to key frames are only used by private pipelines */
+static void
+kms_player_endpoint_update_index (KmsPlayerEndpoint * self)
+{
+  const gchar *uri = KMS_URI_ENDPOINT (self)->uri;
+  KmsKeyframeIndex *old = NULL;
+
+  if (!self->priv->seek_to_keyframe || uri == NULL) {
+    return;
+  }
+
+  KMS_ELEMENT_LOCK (self);
+
+  if (self->priv->index == NULL ||
+      g_strcmp0 (kms_keyframe_index_get_uri (self->priv->index), uri) != 0) {
+    old = self->priv->index;
+    self->priv->index = kms_keyframe_index_acquire (uri);
+  }
+
+  KMS_ELEMENT_UNLOCK (self);
+
+  if (old != NULL) {
+    kms_keyframe_index_unref (old);
+  }
+}
+
+static void
+kms_player_endpoint_complete_index (KmsPlayerEndpoint * self)
+{
+  KmsKeyframeIndex *index = NULL;
+
+  KMS_ELEMENT_LOCK (self);
+
+  if (self->priv->index != NULL && self->priv->index_recording &&
+      !self->priv->shared_decode) {
+    index = kms_keyframe_index_ref (self->priv->index);
+  }
+
+  KMS_ELEMENT_UNLOCK (self);
+
+  if (index != NULL) {
+    kms_keyframe_index_set_complete (index);
+    kms_keyframe_index_unref (index);
+  }
+}
+
+static void
+kms_player_endpoint_start_network_cache (KmsPlayerEndpoint * self)
+{
+  if (!self->priv->adaptive_network_cache) {
+    return;
+  }
+
+  KMS_ELEMENT_LOCK (self);
+
+  if (self->priv->cache == NULL) {
+    guint max = self->priv->network_cache;
+
+    self->priv->cache =
+        kms_network_cache_new (MIN (ADAPTIVE_NETWORK_CACHE_MIN, max), max);
+  }
+
+  KMS_ELEMENT_UNLOCK (self);
+
+  kms_network_cache_start (self->priv->cache);
+}
+
+static gboolean
+kms_player_endpoint_started (KmsUriEndpoint * obj, GError ** error)
+{
+  KmsPlayerEndpoint *self = KMS_PLAYER_ENDPOINT (obj);
+  gchar *uri;
+
+  GST_DEBUG_OBJECT (self, "Pipeline started");
+
+  if (self->priv->shared_decode) {
+    kms_player_endpoint_join_shared_decode (self);
+    goto end;
+  }
+
+  kms_player_endpoint_update_index (self);
+  kms_player_endpoint_start_network_cache (self);
+
+  /* Set uri property in uridecodebin */
+  uri = kms_player_endpoint_get_source_uri (self);
+  g_object_set (G_OBJECT (self->priv->uridecodebin), "uri", uri, NULL);
+  g_free (uri);
+
+  /* Set internal pipeline to playing */
   gst_element_set_state (self->priv->pipeline, GST_STATE_PLAYING);
 
+end:
   KMS_URI_ENDPOINT_GET_CLASS (self)->change_state (KMS_URI_ENDPOINT (self),
       KMS_URI_ENDPOINT_STATE_START);
 
@@ -938,7 +1688,8 @@ kms_player_endpoint_started (KmsUriEndpoint * obj, GError ** error)
 }
 
 static gboolean
-kms_player_endpoint_set_position (KmsPlayerEndpoint * self, gint64 position)
+kms_player_endpoint_seek (KmsPlayerEndpoint * self, gint64 position,
+    GstSeekFlags flags)
 {
   GstQuery *query;
   GstEvent *seek;
@@ -959,8 +1710,7 @@ kms_player_endpoint_set_position (KmsPlayerEndpoint * self, gint64 position)
     return FALSE;
   }
 
-  seek = gst_event_new_seek (1.0, GST_FORMAT_TIME,
-      GST_SEEK_FLAG_FLUSH | GST_SEEK_FLAG_TRICKMODE | GST_SEEK_FLAG_ACCURATE,
+  seek = gst_event_new_seek (1.0, GST_FORMAT_TIME, flags,
       /* start */ GST_SEEK_TYPE_SET, position,
       /* stop */ GST_SEEK_TYPE_SET, GST_CLOCK_TIME_NONE);
 
@@ -974,6 +1724,57 @@ kms_player_endpoint_set_position (KmsPlayerEndpoint * self, gint64 position)
   return TRUE;
 }
 
+/* Must be called holding the element mutex */
+static gboolean
+kms_player_endpoint_lookup_keyframe (KmsPlayerEndpoint * self,
+    GstClockTime position, GstClockTime * keyframe)
+{
+  return self->priv->index != NULL &&
+      g_strcmp0 (kms_keyframe_index_get_uri (self->priv->index),
+      KMS_URI_ENDPOINT (self)->uri) == 0 &&
+      kms_keyframe_index_lookup_nearest (self->priv->index, position,
+      keyframe);
+}
+
+static gboolean
+kms_player_endpoint_set_position (KmsPlayerEndpoint * self, gint64 position)
+{
+  GstSeekFlags flags =
+      GST_SEEK_FLAG_FLUSH | GST_SEEK_FLAG_TRICKMODE | GST_SEEK_FLAG_ACCURATE;
+
+  if (self->priv->shared_decode) {
+    GST_WARNING_OBJECT (self, "Players sharing their decode cannot seek");
+    return FALSE;
+  }
+
+  KMS_ELEMENT_LOCK (self);
+
+  /* Part of the media is skipped, its key frames would not be indexed */
+  self->priv->index_recording = FALSE;
+
+  if (self->priv->seek_to_keyframe) {
+    GstClockTime keyframe;
+
+    /* Starting at a key frame, only its group of pictures is decoded and
+     * the demuxer does not have to look for it */
+    if (kms_player_endpoint_lookup_keyframe (self, position, &keyframe)) {
+      GST_DEBUG_OBJECT (self, "Seek to %" GST_TIME_FORMAT
+          " snapped to key frame at %" GST_TIME_FORMAT,
+          GST_TIME_ARGS (position), GST_TIME_ARGS (keyframe));
+      position = keyframe;
+      flags = GST_SEEK_FLAG_FLUSH | GST_SEEK_FLAG_KEY_UNIT;
+    } else {
+      GST_DEBUG_OBJECT (self, "No index, demuxer snaps to the key frame");
+      flags = GST_SEEK_FLAG_FLUSH | GST_SEEK_FLAG_KEY_UNIT |
+          GST_SEEK_FLAG_SNAP_NEAREST;
+    }
+  }
+
+  KMS_ELEMENT_UNLOCK (self);
+
+  return kms_player_endpoint_seek (self, position, flags);
+}
+
 static gboolean
 kms_player_endpoint_paused (KmsUriEndpoint * obj, GError ** error)
 {
@@ -982,6 +1783,12 @@ kms_player_endpoint_paused (KmsUriEndpoint * obj, GError ** error)
 
   GST_DEBUG_OBJECT (self, "Pipeline paused");
 
+  if (self->priv->shared_decode) {
+    /* The shared decode goes on, resuming joins it at its position */
+    kms_player_endpoint_leave_shared_decode (self);
+    goto end;
+  }
+
   /* Set internal pipeline to paused */
   ret =
       kms_player_endpoint_mark_reset_base_time_and_set_state (self,
@@ -996,11 +1803,13 @@ kms_player_endpoint_paused (KmsUriEndpoint * obj, GError ** error)
 
     gst_element_query_position (self->priv->pipeline,
         GST_FORMAT_TIME, &position);
-    kms_player_endpoint_set_position (self, position);
+    kms_player_endpoint_seek (self, position,
+        GST_SEEK_FLAG_FLUSH | GST_SEEK_FLAG_TRICKMODE | GST_SEEK_FLAG_ACCURATE);
     kms_player_endpoint_mark_reset_base_time_and_set_state (self,
         GST_STATE_PAUSED);
   }
 
+end:
   KMS_URI_ENDPOINT_GET_CLASS (self)->change_state (KMS_URI_ENDPOINT (self),
       KMS_URI_ENDPOINT_STATE_PAUSE);
 
@@ -1047,6 +1856,26 @@ kms_player_endpoint_collect_media_stats (KmsElement * obj, gboolean enable)
       (kms_player_endpoint_parent_class)->collect_media_stats (obj, enable);
 }
 
+static GstStructure *
+kms_player_endpoint_stats (KmsElement * obj, gchar * selector)
+{
+  GstStructure *stats;
+
+  /* chain up */
+  stats =
+      KMS_ELEMENT_CLASS (kms_player_endpoint_parent_class)->stats (obj,
+      selector);
+
+  kms_housekeeping_add_stats (stats, selector);
+
+  if (selector == NULL && KMS_PLAYER_ENDPOINT (obj)->priv->cache != NULL) {
+    kms_network_cache_add_stats (KMS_PLAYER_ENDPOINT (obj)->priv->cache,
+        stats);
+  }
+
+  return stats;
+}
+
 static void
 kms_player_endpoint_class_init (KmsPlayerEndpointClass * klass)
 {
@@ -1070,6 +1899,7 @@ kms_player_endpoint_class_init (KmsPlayerEndpointClass * klass)
 
   kms_element_class->collect_media_stats =
       GST_DEBUG_FUNCPTR (kms_player_endpoint_collect_media_stats);
+  kms_element_class->stats = GST_DEBUG_FUNCPTR (kms_player_endpoint_stats);
 
   klass->set_position = kms_player_endpoint_set_position;
 
@@ -1100,6 +1930,47 @@ kms_player_endpoint_class_init (KmsPlayerEndpointClass * klass)
           "Players private pipeline",
           GST_TYPE_ELEMENT, G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
 
+  g_object_class_install_property (gobject_class, PROP_PASSTHROUGH,
+      g_param_spec_boolean ("passthrough", "passthrough",
+          "With encoded media, push the buffers of the private pipeline "
+          "straight into the endpoint, moving their timestamps with pad "
+          "offsets instead of copying them through an appsink and an appsrc",
+          PASSTHROUGH_DEFAULT, G_PARAM_READWRITE | GST_PARAM_MUTABLE_READY));
+
+  g_object_class_install_property (gobject_class, PROP_SHARED_DECODE,
+      g_param_spec_boolean ("shared-decode", "shared decode",
+          "Share the source, demuxer and decoders with the rest of players "
+          "of the same uri and kind of media. Players join the playback at "
+          "its current position, they cannot seek and passthrough is not used",
+          SHARED_DECODE_DEFAULT, G_PARAM_READWRITE | GST_PARAM_MUTABLE_READY));
+
+  g_object_class_install_property (gobject_class, PROP_MMAP_FILES,
+      g_param_spec_boolean ("mmap-files", "mmap files",
+          "Read file:// uris from a memory mapping, asking the kernel to "
+          "read ahead, instead of issuing a read for each block",
+          MMAP_FILES_DEFAULT, G_PARAM_READWRITE | GST_PARAM_MUTABLE_READY));
+
+  g_object_class_install_property (gobject_class, PROP_FILE_BLOCK_SIZE,
+      g_param_spec_uint ("file-block-size", "File block size",
+          "Bytes read at once from local files (0 = source default)",
+          0, G_MAXUINT, FILE_BLOCK_SIZE_DEFAULT,
+          G_PARAM_READWRITE | GST_PARAM_MUTABLE_READY));
+
+  g_object_class_install_property (gobject_class, PROP_SEEK_TO_KEYFRAME,
+      g_param_spec_boolean ("seek-to-keyframe", "seek to keyframe",
+          "Snap set-position to the nearest key frame, found in an index of "
+          "the uri built while playing it, instead of decoding from the "
+          "previous key frame up to the exact position",
+          SEEK_TO_KEYFRAME_DEFAULT,
+          G_PARAM_READWRITE | GST_PARAM_MUTABLE_READY));
+
+  g_object_class_install_property (gobject_class, PROP_ADAPTIVE_NETWORK_CACHE,
+      g_param_spec_boolean ("adaptive-network-cache", "adaptive network cache",
+          "When using rtsp sources, start with a small cache and size it from "
+          "the jitter and packet loss of the stream, up to network-cache",
+          ADAPTIVE_NETWORK_CACHE_DEFAULT,
+          G_PARAM_READWRITE | GST_PARAM_MUTABLE_READY));
+
   kms_player_endpoint_signals[SIGNAL_EOS] =
       g_signal_new ("eos",
       G_TYPE_FROM_CLASS (klass),
@@ -1136,6 +2007,7 @@ static gboolean
 kms_player_endpoint_emit_EOS_signal (gpointer data)
 {
   GST_DEBUG ("Emit EOS Signal");
+  kms_player_endpoint_complete_index (KMS_PLAYER_ENDPOINT (data));
   kms_player_endpoint_stopped (KMS_URI_ENDPOINT (data), NULL);
   g_signal_emit (G_OBJECT (data), kms_player_endpoint_signals[SIGNAL_EOS], 0);
 
@@ -1213,44 +2085,151 @@ kms_player_endpoint_post_media_error (gpointer d)
   return G_SOURCE_REMOVE;
 }
 
-static GstBusSyncReply
-bus_sync_signal_handler (GstBus * bus, GstMessage * msg, gpointer data)
+static void
+kms_player_endpoint_handle_message (KmsPlayerEndpoint * self,
+    GstMessage * msg)
 {
-  KmsPlayerEndpoint *self = KMS_PLAYER_ENDPOINT (data);
-
   if (GST_MESSAGE_TYPE (msg) == GST_MESSAGE_EOS) {
-    kms_loop_idle_add_full (self->priv->loop, G_PRIORITY_HIGH_IDLE,
-        kms_player_endpoint_emit_EOS_signal, g_object_ref (self),
-        g_object_unref);
+    kms_housekeeping_idle_add_full (self->priv->loop, self,
+        G_PRIORITY_HIGH_IDLE, kms_player_endpoint_emit_EOS_signal, self, NULL);
   } else if (GST_MESSAGE_TYPE (msg) == GST_MESSAGE_ERROR) {
 
     if (g_str_has_prefix (GST_OBJECT_NAME (msg->src), "decodebin")) {
-      kms_loop_idle_add_full (self->priv->loop, G_PRIORITY_HIGH_IDLE,
-          kms_player_endpoint_emit_invalid_media_signal, g_object_ref (self),
-          g_object_unref);
+      kms_housekeeping_idle_add_full (self->priv->loop, self,
+          G_PRIORITY_HIGH_IDLE, kms_player_endpoint_emit_invalid_media_signal,
+          self, NULL);
     } else if (g_strcmp0 (GST_OBJECT_NAME (msg->src), "source") == 0) {
-      kms_loop_idle_add_full (self->priv->loop, G_PRIORITY_HIGH_IDLE,
-          kms_player_endpoint_emit_invalid_uri_signal, g_object_ref (self),
-          g_object_unref);
+      kms_housekeeping_idle_add_full (self->priv->loop, self,
+          G_PRIORITY_HIGH_IDLE, kms_player_endpoint_emit_invalid_uri_signal,
+          self, NULL);
     } else {
       ErrorData *data = create_error_data (self, msg);
 
       GST_ERROR_OBJECT (self, "Error: %" GST_PTR_FORMAT, msg);
-      kms_loop_idle_add_full (self->priv->loop, G_PRIORITY_HIGH_IDLE,
-          kms_player_endpoint_post_media_error, data, delete_error_data);
+      kms_housekeeping_idle_add_full (self->priv->loop, self,
+          G_PRIORITY_HIGH_IDLE, kms_player_endpoint_post_media_error, data,
+          delete_error_data);
     }
   }
+}
+
+static GstBusSyncReply
+bus_sync_signal_handler (GstBus * bus, GstMessage * msg, gpointer data)
+{
+  kms_player_endpoint_handle_message (KMS_PLAYER_ENDPOINT (data), msg);
+
   return GST_BUS_PASS;
 }
 
+static gboolean
+apply_network_cache (gpointer data)
+{
+  KmsPlayerEndpoint *self = KMS_PLAYER_ENDPOINT (data);
+  GstElement *rtpbin = NULL;
+  guint latency;
+
+  KMS_ELEMENT_LOCK (self);
+  if (self->priv->rtpbin != NULL) {
+    rtpbin = g_object_ref (self->priv->rtpbin);
+  }
+  KMS_ELEMENT_UNLOCK (self);
+
+  if (rtpbin == NULL) {
+    return G_SOURCE_REMOVE;
+  }
+
+  latency = kms_network_cache_get_latency (self->priv->cache);
+  GST_DEBUG_OBJECT (self, "Setting network cache to %u ms", latency);
+
+  /* Propagated to every jitter buffer */
+  g_object_set (rtpbin, "latency", latency, NULL);
+  g_object_unref (rtpbin);
+
+  return G_SOURCE_REMOVE;
+}
+
+static GstPadProbeReturn
+network_cache_packet_probe (GstPad * pad, GstPadProbeInfo * info,
+    gpointer data)
+{
+  KmsPlayerEndpoint *self = KMS_PLAYER_ENDPOINT (data);
+  guint latency;
+
+  if (kms_network_cache_add_packet (self->priv->cache, pad,
+          GST_PAD_PROBE_INFO_BUFFER (info), &latency)) {
+    kms_housekeeping_idle_add_full (self->priv->loop, self,
+        G_PRIORITY_DEFAULT, apply_network_cache, self, NULL);
+  }
+
+  return GST_PAD_PROBE_OK;
+}
+
+static GstPadProbeReturn
+network_cache_output_probe (GstPad * pad, GstPadProbeInfo * info,
+    gpointer data)
+{
+  KmsPlayerEndpoint *self = KMS_PLAYER_ENDPOINT (data);
+
+  kms_network_cache_add_output (self->priv->cache);
+
+  return GST_PAD_PROBE_OK;
+}
+
+static void
+rtpbin_new_jitterbuffer (GstElement * rtpbin, GstElement * jitterbuffer,
+    guint session, guint ssrc, KmsPlayerEndpoint * self)
+{
+  GstPad *sinkpad = gst_element_get_static_pad (jitterbuffer, "sink");
+
+  /* Packets are measured as they arrive, before they are buffered */
+  gst_pad_add_probe (sinkpad, GST_PAD_PROBE_TYPE_BUFFER,
+      network_cache_packet_probe, self, NULL);
+  g_object_unref (sinkpad);
+}
+
+static void
+rtspsrc_new_manager (GstElement * rtspsrc, GstElement * manager,
+    KmsPlayerEndpoint * self)
+{
+  KMS_ELEMENT_LOCK (self);
+  g_clear_object (&self->priv->rtpbin);
+  self->priv->rtpbin = g_object_ref (manager);
+  KMS_ELEMENT_UNLOCK (self);
+
+  g_signal_connect (manager, "new-jitterbuffer",
+      G_CALLBACK (rtpbin_new_jitterbuffer), self);
+}
+
+static void
+rtspsrc_pad_added (GstElement * rtspsrc, GstPad * pad,
+    KmsPlayerEndpoint * self)
+{
+  gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER,
+      network_cache_output_probe, self, NULL);
+}
+
 static void
 source_setup_cb (GstElement * uridecodebin, GstElement * source,
     KmsPlayerEndpoint * self)
 {
   GstPad *srcpad;
 
+  if (self->priv->file_block_size > 0 && (KMS_IS_MMAP_FILE_SRC (source) ||
+          g_strcmp0 (gst_plugin_feature_get_name (GST_PLUGIN_FEATURE
+                  (gst_element_get_factory (source))), FILESRC) == 0)) {
+    g_object_set (source, "blocksize", self->priv->file_block_size, NULL);
+  }
+
   srcpad = gst_element_get_static_pad (source, "src");
 
+  if (srcpad != NULL && self->priv->adaptive_network_cache &&
+      self->priv->cache != NULL &&
+      g_str_has_prefix (KMS_URI_ENDPOINT (self)->uri, "http")) {
+    /* Data is downloaded, only startup and stalls are reported */
+    gst_pad_add_probe (srcpad, GST_PAD_PROBE_TYPE_BUFFER,
+        network_cache_output_probe, self, NULL);
+  }
+
   if (srcpad == NULL) {
     GST_WARNING_OBJECT (self, "Can not set latency probe to %" GST_PTR_FORMAT,
         source);
@@ -1271,14 +2250,117 @@ source_setup_cb (GstElement * uridecodebin, GstElement * source,
   g_object_unref (srcpad);
 }
 
+static GstPadProbeReturn
+index_keyframes_probe (GstPad * pad, GstPadProbeInfo * info, gpointer index)
+{
+  GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER (info);
+  const GstSegment *segment;
+  GstClockTime time;
+  GstEvent *event;
+
+  if (GST_BUFFER_FLAG_IS_SET (buffer, GST_BUFFER_FLAG_DELTA_UNIT) ||
+      !GST_BUFFER_PTS_IS_VALID (buffer)) {
+    return GST_PAD_PROBE_OK;
+  }
+
+  event = gst_pad_get_sticky_event (pad, GST_EVENT_SEGMENT, 0);
+  if (event == NULL) {
+    return GST_PAD_PROBE_OK;
+  }
+
+  /* Seeks are done in stream time */
+  gst_event_parse_segment (event, &segment);
+  time = gst_segment_to_stream_time (segment, GST_FORMAT_TIME,
+      GST_BUFFER_PTS (buffer));
+  gst_event_unref (event);
+
+  if (GST_CLOCK_TIME_IS_VALID (time)) {
+    kms_keyframe_index_add (index, time);
+  }
+
+  return GST_PAD_PROBE_OK;
+}
+
+static void
+demuxer_pad_added (GstElement * demuxer, GstPad * pad, KmsPlayerEndpoint * self)
+{
+  KmsKeyframeIndex *index = NULL;
+  gboolean is_video = FALSE;
+  GstCaps *caps;
+
+  caps = gst_pad_query_caps (pad, NULL);
+  if (caps != NULL) {
+    is_video = !gst_caps_is_empty (caps) && !gst_caps_is_any (caps) &&
+        g_str_has_prefix (gst_structure_get_name (gst_caps_get_structure (caps,
+                0)), "video/");
+    gst_caps_unref (caps);
+  }
+
+  if (!is_video) {
+    return;
+  }
+
+  KMS_ELEMENT_LOCK (self);
+  if (self->priv->index != NULL) {
+    index = kms_keyframe_index_ref (self->priv->index);
+  }
+  KMS_ELEMENT_UNLOCK (self);
+
+  if (index == NULL) {
+    return;
+  }
+
+  GST_DEBUG_OBJECT (self, "Indexing key frames of %" GST_PTR_FORMAT, pad);
+
+  gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER, index_keyframes_probe,
+      index, (GDestroyNotify) kms_keyframe_index_unref);
+}
+
+static void
+decodebin_element_added (GstBin * bin, GstElement * element,
+    KmsPlayerEndpoint * self)
+{
+  GstElementFactory *factory = gst_element_get_factory (element);
+  const gchar *klass;
+
+  if (factory == NULL) {
+    return;
+  }
+
+  klass = gst_element_factory_get_metadata (factory,
+      GST_ELEMENT_METADATA_KLASS);
+
+  if (klass != NULL && strstr (klass, "Demux") != NULL) {
+    g_signal_connect (element, "pad-added", G_CALLBACK (demuxer_pad_added),
+        self);
+  }
+}
+
 static void
 element_added (GstBin * bin, GstElement * element, gpointer data)
 {
   KmsPlayerEndpoint *self = KMS_PLAYER_ENDPOINT (data);
 
+  /* Key frames are taken from demuxers, before they are decoded */
+  if (self->priv->seek_to_keyframe &&
+      g_str_has_prefix (GST_OBJECT_NAME (element), "decodebin")) {
+    g_signal_connect (element, "element-added",
+        G_CALLBACK (decodebin_element_added), self);
+  }
+
   if (g_strcmp0 (gst_plugin_feature_get_name (GST_PLUGIN_FEATURE
               (gst_element_get_factory (element))), RTSPSRC) == 0) {
-    g_object_set (G_OBJECT (element), "latency", self->priv->network_cache,
+    gint latency = self->priv->network_cache;
+
+    if (self->priv->adaptive_network_cache && self->priv->cache != NULL) {
+      latency = kms_network_cache_get_latency (self->priv->cache);
+      g_signal_connect (element, "new-manager",
+          G_CALLBACK (rtspsrc_new_manager), self);
+      g_signal_connect (element, "pad-added", G_CALLBACK (rtspsrc_pad_added),
+          self);
+    }
+
+    g_object_set (G_OBJECT (element), "latency", latency,
         "drop-on-latency", TRUE, NULL);
   }
 }
@@ -1300,11 +2382,18 @@ kms_player_endpoint_init (KmsPlayerEndpoint * self)
   self->priv->base_time = GST_CLOCK_TIME_NONE;
   self->priv->base_time_preroll = GST_CLOCK_TIME_NONE;
 
-  self->priv->loop = kms_loop_new ();
+  self->priv->loop = kms_housekeeping_acquire_loop ();
   self->priv->pipeline = gst_pipeline_new ("pipeline");
   self->priv->uridecodebin =
       gst_element_factory_make ("uridecodebin", URIDECODEBIN);
   self->priv->network_cache = NETWORK_CACHE_DEFAULT;
+  self->priv->passthrough = PASSTHROUGH_DEFAULT;
+  self->priv->shared_decode = SHARED_DECODE_DEFAULT;
+  self->priv->mmap_files = MMAP_FILES_DEFAULT;
+  self->priv->file_block_size = FILE_BLOCK_SIZE_DEFAULT;
+  self->priv->seek_to_keyframe = SEEK_TO_KEYFRAME_DEFAULT;
+  self->priv->index_recording = TRUE;
+  self->priv->adaptive_network_cache = ADAPTIVE_NETWORK_CACHE_DEFAULT;
 
   self->priv->stats.probes = kms_list_new_full (g_direct_equal, g_object_unref,
       (GDestroyNotify) kms_stats_probe_destroy);
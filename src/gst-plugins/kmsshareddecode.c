@@ -0,0 +1,688 @@
+/*
+ * (C) Copyright 2016 Kurento (http://kurento.org/)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "kmsshareddecode.h"
+#include <commons/kmsagnosticcaps.h>
+
+#define GST_DEFAULT_NAME "kmsshareddecode"
+#define GST_CAT_DEFAULT kms_shared_decode_debug
+GST_DEBUG_CATEGORY_STATIC (GST_CAT_DEFAULT);
+
+#define RTSPSRC "rtspsrc"
+
+/* Buffers queued in each branch. Upstream is paced by the slowest branch,
+ * whose appsink is synchronized to the clock */
+#define BRANCH_MAX_BUFFERS 2
+
+typedef struct _KmsSharedStream
+{
+  gint ref;
+  GstPad *pad;
+  GstElement *tee;
+  gboolean removed;             /* Protected by the mutex of the decode */
+} KmsSharedStream;
+
+typedef struct _KmsSharedBranch
+{
+  KmsSharedStream *stream;
+  GstElement *queue;
+  GstElement *appsink;
+  GstPad *tee_pad;
+
+  GMutex mutex;
+  GCond cond;
+  gboolean unlinked;
+} KmsSharedBranch;
+
+/* Callbacks are invoked with no lock held. While one of them is in progress
+ * the subscriber is busy, and unsubscribing waits for it */
+typedef struct _KmsSharedSubscriber
+{
+  gint ref;
+  KmsSharedDecodeCallbacks callbacks;
+  gpointer user_data;
+
+  /* Protected by the mutex of the decode */
+  GSList *branches;             /* KmsSharedBranch */
+  guint busy;
+} KmsSharedSubscriber;
+
+struct _KmsSharedDecode
+{
+  gchar *key;
+  GstElement *pipeline;
+  GstElement *uridecodebin;
+  gint network_cache;
+
+  /* Protected by the lock of the table */
+  guint n_subscribers;
+
+  /* Only held to update the lists, never while calling a subscriber or
+   * waiting for the pipeline */
+  GMutex mutex;
+  GCond cond;
+  GSList *streams;              /* KmsSharedStream */
+  GSList *subscribers;          /* KmsSharedSubscriber */
+};
+
+/* <key, KmsSharedDecode>. Pipelines that reached EOS or failed are taken out
+ * of it, so that new players do not subscribe to them */
+G_LOCK_DEFINE_STATIC (decodes);
+static GHashTable *decodes = NULL;
+
+static void
+kms_shared_decode_init_debug (void)
+{
+  static gsize done = 0;
+
+  if (g_once_init_enter (&done)) {
+    GST_DEBUG_CATEGORY_INIT (GST_CAT_DEFAULT, GST_DEFAULT_NAME, 0,
+        GST_DEFAULT_NAME);
+    g_once_init_leave (&done, 1);
+  }
+}
+
+static KmsSharedStream *
+kms_shared_stream_ref (KmsSharedStream * stream)
+{
+  g_atomic_int_inc (&stream->ref);
+
+  return stream;
+}
+
+static void
+kms_shared_stream_unref (KmsSharedStream * stream)
+{
+  if (!g_atomic_int_dec_and_test (&stream->ref)) {
+    return;
+  }
+
+  g_object_unref (stream->tee);
+  g_object_unref (stream->pad);
+  g_slice_free (KmsSharedStream, stream);
+}
+
+static KmsSharedSubscriber *
+kms_shared_subscriber_ref (KmsSharedSubscriber * subscriber)
+{
+  g_atomic_int_inc (&subscriber->ref);
+
+  return subscriber;
+}
+
+static void
+kms_shared_subscriber_unref (KmsSharedSubscriber * subscriber)
+{
+  if (g_atomic_int_dec_and_test (&subscriber->ref)) {
+    g_slice_free (KmsSharedSubscriber, subscriber);
+  }
+}
+
+/* Must be called with the mutex held */
+static void
+kms_shared_decode_enter (KmsSharedDecode * self,
+    KmsSharedSubscriber * subscriber)
+{
+  subscriber->busy++;
+}
+
+static void
+kms_shared_decode_leave (KmsSharedDecode * self,
+    KmsSharedSubscriber * subscriber)
+{
+  g_mutex_lock (&self->mutex);
+
+  if (--subscriber->busy == 0) {
+    g_cond_broadcast (&self->cond);
+  }
+
+  g_mutex_unlock (&self->mutex);
+}
+
+/* Subscribers that can be called back, each one marked as busy.
+ * Must be called with the mutex held */
+static GSList *
+kms_shared_decode_enter_subscribers (KmsSharedDecode * self)
+{
+  GSList *subscribers = NULL, *l;
+
+  for (l = self->subscribers; l != NULL; l = l->next) {
+    KmsSharedSubscriber *subscriber = l->data;
+
+    kms_shared_decode_enter (self, subscriber);
+    subscribers = g_slist_prepend (subscribers,
+        kms_shared_subscriber_ref (subscriber));
+  }
+
+  return subscribers;
+}
+
+static void
+kms_shared_decode_remove_element (KmsSharedDecode * self, GstElement * element)
+{
+  if (!gst_element_set_locked_state (element, TRUE)) {
+    GST_ERROR ("Could not block element %" GST_PTR_FORMAT, element);
+  }
+
+  gst_element_set_state (element, GST_STATE_NULL);
+  gst_bin_remove (GST_BIN (self->pipeline), element);
+}
+
+static GstPadProbeReturn
+drop_until_keyframe (GstPad * pad, GstPadProbeInfo * info, gpointer data)
+{
+  GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER (info);
+
+  if (GST_BUFFER_FLAG_IS_SET (buffer, GST_BUFFER_FLAG_DELTA_UNIT)) {
+    GST_TRACE_OBJECT (pad, "Dropping %" GST_PTR_FORMAT, buffer);
+    return GST_PAD_PROBE_DROP;
+  }
+
+  return GST_PAD_PROBE_REMOVE;
+}
+
+static GstPadProbeReturn
+unlink_branch (GstPad * pad, GstPadProbeInfo * info, gpointer data)
+{
+  KmsSharedBranch *branch = data;
+  GstPad *peer;
+
+  peer = gst_pad_get_peer (pad);
+  if (peer != NULL) {
+    gst_pad_unlink (pad, peer);
+    g_object_unref (peer);
+  }
+
+  g_mutex_lock (&branch->mutex);
+  branch->unlinked = TRUE;
+  g_cond_signal (&branch->cond);
+  g_mutex_unlock (&branch->mutex);
+
+  return GST_PAD_PROBE_REMOVE;
+}
+
+/* @subscriber must be busy. Called with no lock held, as it waits for the
+ * tee to stop pushing to the branch */
+static void
+kms_shared_decode_remove_branch (KmsSharedDecode * self,
+    KmsSharedSubscriber * subscriber, KmsSharedBranch * branch)
+{
+  /* Unlinking while the tee pushes to the branch would make it fail, so wait
+   * until the pad is idle. The probe may be run right away */
+  gst_pad_add_probe (branch->tee_pad, GST_PAD_PROBE_TYPE_IDLE, unlink_branch,
+      branch, NULL);
+
+  g_mutex_lock (&branch->mutex);
+  while (!branch->unlinked) {
+    g_cond_wait (&branch->cond, &branch->mutex);
+  }
+  g_mutex_unlock (&branch->mutex);
+
+  gst_element_release_request_pad (branch->stream->tee, branch->tee_pad);
+  g_object_unref (branch->tee_pad);
+
+  subscriber->callbacks.branch_removed (branch->appsink,
+      subscriber->user_data);
+
+  kms_shared_decode_remove_element (self, branch->appsink);
+  kms_shared_decode_remove_element (self, branch->queue);
+
+  kms_shared_stream_unref (branch->stream);
+  g_mutex_clear (&branch->mutex);
+  g_cond_clear (&branch->cond);
+  g_slice_free (KmsSharedBranch, branch);
+}
+
+/* @subscriber must be busy. Called with no lock held */
+static void
+kms_shared_decode_add_branch (KmsSharedDecode * self,
+    KmsSharedSubscriber * subscriber, KmsSharedStream * stream)
+{
+  KmsSharedBranch *branch;
+  gboolean removed;
+  GstPad *sinkpad;
+
+  branch = g_slice_new0 (KmsSharedBranch);
+  g_mutex_init (&branch->mutex);
+  g_cond_init (&branch->cond);
+  branch->stream = kms_shared_stream_ref (stream);
+  branch->queue = gst_element_factory_make ("queue", NULL);
+  branch->appsink = gst_element_factory_make ("appsink", NULL);
+
+  g_object_set (branch->queue, "max-size-buffers", BRANCH_MAX_BUFFERS,
+      "max-size-bytes", 0, "max-size-time", G_GUINT64_CONSTANT (0), NULL);
+  /* Branches are added to a running pipeline, which must not preroll again */
+  g_object_set (branch->appsink, "sync", TRUE, "async", FALSE, NULL);
+
+  gst_bin_add_many (GST_BIN (self->pipeline), branch->queue, branch->appsink,
+      NULL);
+  gst_element_link (branch->queue, branch->appsink);
+
+  subscriber->callbacks.branch_added (stream->pad, branch->appsink,
+      subscriber->user_data);
+
+  gst_element_sync_state_with_parent (branch->appsink);
+  gst_element_sync_state_with_parent (branch->queue);
+
+  /* Late subscribers cannot decode anything until the next key frame */
+  sinkpad = gst_element_get_static_pad (branch->queue, "sink");
+  gst_pad_add_probe (sinkpad, GST_PAD_PROBE_TYPE_BUFFER, drop_until_keyframe,
+      NULL, NULL);
+
+  branch->tee_pad = gst_element_get_request_pad (stream->tee, "src_%u");
+  if (GST_PAD_LINK_FAILED (gst_pad_link (branch->tee_pad, sinkpad))) {
+    GST_ERROR ("Could not link %" GST_PTR_FORMAT " to %" GST_PTR_FORMAT,
+        branch->tee_pad, sinkpad);
+  }
+  g_object_unref (sinkpad);
+
+  g_mutex_lock (&self->mutex);
+
+  /* Branches of a removed stream were already taken to be removed */
+  removed = stream->removed;
+  if (!removed) {
+    subscriber->branches = g_slist_prepend (subscriber->branches, branch);
+  }
+
+  g_mutex_unlock (&self->mutex);
+
+  if (removed) {
+    kms_shared_decode_remove_branch (self, subscriber, branch);
+  }
+}
+
+static void
+pad_added (GstElement * element, GstPad * pad, KmsSharedDecode * self)
+{
+  KmsSharedStream *stream;
+  GSList *subscribers, *l;
+  GstPad *sinkpad;
+
+  GST_DEBUG_OBJECT (pad, "Pad added");
+
+  stream = g_slice_new0 (KmsSharedStream);
+  stream->ref = 1;
+  stream->pad = g_object_ref (pad);
+  stream->tee = gst_object_ref (gst_element_factory_make ("tee", NULL));
+  g_object_set (stream->tee, "allow-not-linked", TRUE, NULL);
+
+  gst_bin_add (GST_BIN (self->pipeline), stream->tee);
+  gst_element_sync_state_with_parent (stream->tee);
+
+  g_mutex_lock (&self->mutex);
+
+  self->streams = g_slist_prepend (self->streams, stream);
+  subscribers = kms_shared_decode_enter_subscribers (self);
+
+  g_mutex_unlock (&self->mutex);
+
+  for (l = subscribers; l != NULL; l = l->next) {
+    kms_shared_decode_add_branch (self, l->data, stream);
+    kms_shared_decode_leave (self, l->data);
+  }
+
+  g_slist_free_full (subscribers, (GDestroyNotify) kms_shared_subscriber_unref);
+
+  sinkpad = gst_element_get_static_pad (stream->tee, "sink");
+  gst_pad_link (pad, sinkpad);
+  g_object_unref (sinkpad);
+}
+
+typedef struct _KmsSharedRemoval
+{
+  KmsSharedSubscriber *subscriber;
+  KmsSharedBranch *branch;
+} KmsSharedRemoval;
+
+/* Takes the branches of @stream out of every subscriber, which is marked as
+ * busy for each one. Must be called with the mutex held */
+static GSList *
+kms_shared_decode_take_stream_branches (KmsSharedDecode * self,
+    KmsSharedStream * stream)
+{
+  GSList *removals = NULL, *s;
+
+  for (s = self->subscribers; s != NULL; s = s->next) {
+    KmsSharedSubscriber *subscriber = s->data;
+    GSList *l = subscriber->branches;
+
+    while (l != NULL) {
+      KmsSharedBranch *branch = l->data;
+      GSList *next = l->next;
+
+      if (branch->stream == stream) {
+        KmsSharedRemoval *removal = g_slice_new (KmsSharedRemoval);
+
+        subscriber->branches = g_slist_delete_link (subscriber->branches, l);
+        kms_shared_decode_enter (self, subscriber);
+        removal->subscriber = kms_shared_subscriber_ref (subscriber);
+        removal->branch = branch;
+        removals = g_slist_prepend (removals, removal);
+      }
+
+      l = next;
+    }
+  }
+
+  return removals;
+}
+
+static void
+pad_removed (GstElement * element, GstPad * pad, KmsSharedDecode * self)
+{
+  KmsSharedStream *stream = NULL;
+  GSList *removals = NULL, *l;
+
+  if (GST_PAD_IS_SINK (pad)) {
+    return;
+  }
+
+  GST_DEBUG_OBJECT (pad, "Pad removed");
+
+  g_mutex_lock (&self->mutex);
+
+  for (l = self->streams; l != NULL; l = l->next) {
+    if (((KmsSharedStream *) l->data)->pad == pad) {
+      stream = l->data;
+      self->streams = g_slist_delete_link (self->streams, l);
+      break;
+    }
+  }
+
+  if (stream != NULL) {
+    stream->removed = TRUE;
+    removals = kms_shared_decode_take_stream_branches (self, stream);
+  }
+
+  g_mutex_unlock (&self->mutex);
+
+  if (stream == NULL) {
+    return;
+  }
+
+  for (l = removals; l != NULL; l = l->next) {
+    KmsSharedRemoval *removal = l->data;
+
+    kms_shared_decode_remove_branch (self, removal->subscriber,
+        removal->branch);
+    kms_shared_decode_leave (self, removal->subscriber);
+    kms_shared_subscriber_unref (removal->subscriber);
+    g_slice_free (KmsSharedRemoval, removal);
+  }
+
+  g_slist_free (removals);
+
+  kms_shared_decode_remove_element (self, stream->tee);
+  kms_shared_stream_unref (stream);
+}
+
+static void
+element_added (GstBin * bin, GstElement * element, KmsSharedDecode * self)
+{
+  if (g_strcmp0 (gst_plugin_feature_get_name (GST_PLUGIN_FEATURE
+              (gst_element_get_factory (element))), RTSPSRC) == 0) {
+    g_object_set (G_OBJECT (element), "latency", self->network_cache,
+        "drop-on-latency", TRUE, NULL);
+  }
+}
+
+/* Takes @self out of the table, new subscribers will get a new pipeline */
+static void
+kms_shared_decode_retire (KmsSharedDecode * self)
+{
+  G_LOCK (decodes);
+
+  if (decodes != NULL && g_hash_table_lookup (decodes, self->key) == self) {
+    GST_DEBUG ("Retiring shared decode of %s", self->key);
+    g_hash_table_remove (decodes, self->key);
+  }
+
+  G_UNLOCK (decodes);
+}
+
+static GstBusSyncReply
+bus_sync_handler (GstBus * bus, GstMessage * msg, gpointer data)
+{
+  KmsSharedDecode *self = data;
+  GSList *subscribers, *l;
+
+  switch (GST_MESSAGE_TYPE (msg)) {
+    case GST_MESSAGE_EOS:
+    case GST_MESSAGE_ERROR:
+      kms_shared_decode_retire (self);
+      break;
+    default:
+      /* Nobody watches this bus, do not let messages pile up in it */
+      return GST_BUS_DROP;
+  }
+
+  g_mutex_lock (&self->mutex);
+  subscribers = kms_shared_decode_enter_subscribers (self);
+  g_mutex_unlock (&self->mutex);
+
+  for (l = subscribers; l != NULL; l = l->next) {
+    KmsSharedSubscriber *subscriber = l->data;
+
+    subscriber->callbacks.message (msg, subscriber->user_data);
+    kms_shared_decode_leave (self, subscriber);
+  }
+
+  g_slist_free_full (subscribers, (GDestroyNotify) kms_shared_subscriber_unref);
+
+  return GST_BUS_DROP;
+}
+
+static KmsSharedDecode *
+kms_shared_decode_new (const gchar * key, const gchar * uri,
+    gboolean use_encoded_media, gint network_cache)
+{
+  KmsSharedDecode *self;
+  GstBus *bus;
+
+  GST_DEBUG ("Creating shared decode of %s", key);
+
+  self = g_slice_new0 (KmsSharedDecode);
+  g_mutex_init (&self->mutex);
+  g_cond_init (&self->cond);
+  self->key = g_strdup (key);
+  self->network_cache = network_cache;
+
+  self->pipeline = gst_pipeline_new (NULL);
+  self->uridecodebin = gst_element_factory_make ("uridecodebin", NULL);
+  g_object_set (self->uridecodebin, "uri", uri, "download", TRUE, NULL);
+
+  if (use_encoded_media) {
+    GstCaps *caps = gst_caps_from_string (KMS_AGNOSTIC_CAPS_CAPS);
+
+    g_object_set (self->uridecodebin, "caps", caps, NULL);
+    gst_caps_unref (caps);
+  }
+
+  g_signal_connect (self->uridecodebin, "pad-added", G_CALLBACK (pad_added),
+      self);
+  g_signal_connect (self->uridecodebin, "pad-removed",
+      G_CALLBACK (pad_removed), self);
+  g_signal_connect (self->uridecodebin, "element-added",
+      G_CALLBACK (element_added), self);
+
+  gst_bin_add (GST_BIN (self->pipeline), self->uridecodebin);
+
+  bus = gst_pipeline_get_bus (GST_PIPELINE (self->pipeline));
+  gst_bus_set_sync_handler (bus, bus_sync_handler, self, NULL);
+  g_object_unref (bus);
+
+  return self;
+}
+
+static void
+kms_shared_decode_destroy (KmsSharedDecode * self)
+{
+  GstBus *bus;
+
+  GST_DEBUG ("Destroying shared decode of %s", self->key);
+
+  /* Streams are removed along with the pads of uridecodebin */
+  gst_element_set_state (self->pipeline, GST_STATE_NULL);
+
+  bus = gst_pipeline_get_bus (GST_PIPELINE (self->pipeline));
+  gst_bus_set_sync_handler (bus, NULL, NULL, NULL);
+  g_object_unref (bus);
+
+  gst_object_unref (self->pipeline);
+
+  g_mutex_clear (&self->mutex);
+  g_cond_clear (&self->cond);
+  g_free (self->key);
+  g_slice_free (KmsSharedDecode, self);
+}
+
+KmsSharedDecode *
+kms_shared_decode_subscribe (const gchar * uri, gboolean use_encoded_media,
+    gint network_cache, const KmsSharedDecodeCallbacks * callbacks,
+    gpointer user_data)
+{
+  KmsSharedSubscriber *subscriber;
+  KmsSharedDecode *self;
+  gboolean created = FALSE;
+  GSList *streams, *l;
+  gchar *key;
+
+  g_return_val_if_fail (uri != NULL, NULL);
+  g_return_val_if_fail (callbacks != NULL, NULL);
+
+  kms_shared_decode_init_debug ();
+
+  key = g_strdup_printf ("%s:%s", use_encoded_media ? "encoded" : "raw", uri);
+
+  G_LOCK (decodes);
+
+  if (decodes == NULL) {
+    decodes = g_hash_table_new (g_str_hash, g_str_equal);
+  }
+
+  self = g_hash_table_lookup (decodes, key);
+  if (self == NULL) {
+    self = kms_shared_decode_new (key, uri, use_encoded_media, network_cache);
+    g_hash_table_insert (decodes, self->key, self);
+    created = TRUE;
+  }
+
+  self->n_subscribers++;
+
+  G_UNLOCK (decodes);
+
+  g_free (key);
+
+  subscriber = g_slice_new0 (KmsSharedSubscriber);
+  subscriber->ref = 1;
+  subscriber->callbacks = *callbacks;
+  subscriber->user_data = user_data;
+
+  g_mutex_lock (&self->mutex);
+
+  self->subscribers = g_slist_prepend (self->subscribers, subscriber);
+  kms_shared_decode_enter (self, subscriber);
+  streams = g_slist_copy_deep (self->streams,
+      (GCopyFunc) kms_shared_stream_ref, NULL);
+
+  g_mutex_unlock (&self->mutex);
+
+  for (l = streams; l != NULL; l = l->next) {
+    kms_shared_decode_add_branch (self, subscriber, l->data);
+  }
+
+  kms_shared_decode_leave (self, subscriber);
+  g_slist_free_full (streams, (GDestroyNotify) kms_shared_stream_unref);
+
+  GST_DEBUG ("%p subscribed to %s", user_data, self->key);
+
+  if (created) {
+    gst_element_set_state (self->pipeline, GST_STATE_PLAYING);
+  }
+
+  return self;
+}
+
+void
+kms_shared_decode_unsubscribe (KmsSharedDecode * self, gpointer user_data)
+{
+  KmsSharedSubscriber *subscriber = NULL;
+  GSList *branches = NULL, *l;
+  gboolean last;
+
+  g_return_if_fail (self != NULL);
+
+  g_mutex_lock (&self->mutex);
+
+  for (l = self->subscribers; l != NULL; l = l->next) {
+    if (((KmsSharedSubscriber *) l->data)->user_data == user_data) {
+      subscriber = l->data;
+      self->subscribers = g_slist_delete_link (self->subscribers, l);
+      break;
+    }
+  }
+
+  if (subscriber != NULL) {
+    /* No new callbacks start once it is out of the list */
+    while (subscriber->busy > 0) {
+      g_cond_wait (&self->cond, &self->mutex);
+    }
+
+    branches = subscriber->branches;
+    subscriber->branches = NULL;
+  }
+
+  g_mutex_unlock (&self->mutex);
+
+  if (subscriber == NULL) {
+    GST_WARNING ("%p is not subscribed to %s", user_data, self->key);
+    return;
+  }
+
+  GST_DEBUG ("%p unsubscribed from %s", user_data, self->key);
+
+  for (l = branches; l != NULL; l = l->next) {
+    kms_shared_decode_remove_branch (self, subscriber, l->data);
+  }
+
+  g_slist_free (branches);
+  kms_shared_subscriber_unref (subscriber);
+
+  G_LOCK (decodes);
+
+  last = --self->n_subscribers == 0;
+  if (last && g_hash_table_lookup (decodes, self->key) == self) {
+    g_hash_table_remove (decodes, self->key);
+  }
+
+  G_UNLOCK (decodes);
+
+  if (last) {
+    kms_shared_decode_destroy (self);
+  }
+}
+
+GstElement *
+kms_shared_decode_get_pipeline (KmsSharedDecode * self)
+{
+  g_return_val_if_fail (self != NULL, NULL);
+
+  return gst_object_ref (self->pipeline);
+}
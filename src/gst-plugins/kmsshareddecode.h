@@ -0,0 +1,61 @@
+/*
+ * (C) Copyright 2016 Kurento (http://kurento.org/)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+#ifndef __KMS_SHARED_DECODE_H__
+#define __KMS_SHARED_DECODE_H__
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+/* A process-wide set of private pipelines, one per uri and kind of media
+ * (encoded or raw), whose source, demuxer and decoders are shared by all
+ * the players subscribed to them. Every stream of the pipeline ends in a tee
+ * and each subscriber gets its own branch of it, ending in an appsink, so
+ * players joining late start receiving the media at the current position
+ * (from the next key frame when media is encoded). The pipeline is released
+ * along with its last subscriber. */
+
+typedef struct _KmsSharedDecode KmsSharedDecode;
+
+typedef struct _KmsSharedDecodeCallbacks
+{
+  /* @appsink gets no data until this returns. @stream can be queried for
+   * the caps of the media */
+  void (*branch_added) (GstPad * stream, GstElement * appsink,
+      gpointer user_data);
+  /* @appsink is removed from the pipeline once this returns */
+  void (*branch_removed) (GstElement * appsink, gpointer user_data);
+  /* EOS and error messages of the shared pipeline */
+  void (*message) (GstMessage * message, gpointer user_data);
+} KmsSharedDecodeCallbacks;
+
+/* Callbacks may be invoked from streaming threads until @user_data is
+ * unsubscribed, never with a lock of the shared decode held. Unsubscribing
+ * waits for the callbacks in progress, so it must not be done from them nor
+ * holding a lock they take. @network_cache is only used when the pipeline is
+ * created */
+KmsSharedDecode * kms_shared_decode_subscribe (const gchar * uri,
+    gboolean use_encoded_media, gint network_cache,
+    const KmsSharedDecodeCallbacks * callbacks, gpointer user_data);
+void kms_shared_decode_unsubscribe (KmsSharedDecode * self,
+    gpointer user_data);
+
+/* Pipeline to query for position, duration... Transfer full */
+GstElement * kms_shared_decode_get_pipeline (KmsSharedDecode * self);
+
+G_END_DECLS
+#endif /* __KMS_SHARED_DECODE_H__ */
@@ -0,0 +1,408 @@
+/*
+ * (C) Copyright 2016 Kurento (http://kurento.org/)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "kmslooppool.h"
+#include <commons/kmsrefstruct.h>
+
+#define GST_DEFAULT_NAME "kmslooppool"
+#define GST_CAT_DEFAULT kms_loop_pool_debug
+GST_DEBUG_CATEGORY_STATIC (GST_CAT_DEFAULT);
+
+/* Interval used to check how late each loop dispatches its sources. Unlike
+ * the pool-* counters, it accounts for every source of the context */
+#define PROBE_INTERVAL 1000     /* ms */
+
+typedef struct _KmsLoopPoolEntry
+{
+  KmsLoopPool *pool;
+  KmsLoop *loop;
+  guint id;
+  guint probe_id;
+  gint64 probe_expected;        /* us */
+
+  guint users;
+  guint pending;
+  guint max_pending;
+  guint64 dispatched;
+
+  GstClockTime latency_last;
+  GstClockTime latency_max;
+  GstClockTime latency_sum;
+  guint64 latency_count;
+} KmsLoopPoolEntry;
+
+struct _KmsLoopPool
+{
+  KmsRefStruct ref;
+  GMutex mutex;
+  gchar *name;
+  guint size;
+  GPtrArray *entries;
+};
+
+typedef struct _KmsLoopPoolTask
+{
+  KmsLoopPool *pool;
+  KmsLoopPoolEntry *entry;
+  GSourceFunc function;
+  gpointer data;
+  GDestroyNotify notify;
+  gint64 queued;                /* us */
+  gboolean dispatched;
+} KmsLoopPoolTask;
+
+static void
+kms_loop_pool_init_debug (void)
+{
+  static gsize done = 0;
+
+  if (g_once_init_enter (&done)) {
+    GST_DEBUG_CATEGORY_INIT (GST_CAT_DEFAULT, GST_DEFAULT_NAME, 0,
+        GST_DEFAULT_NAME);
+    g_once_init_leave (&done, 1);
+  }
+}
+
+static guint
+kms_loop_pool_effective_size (KmsLoopPool * self)
+{
+  if (self->size == 0) {
+    return MAX (g_get_num_processors (), 1);
+  }
+
+  return self->size;
+}
+
+/* Must be called with the pool mutex held */
+static void
+kms_loop_pool_entry_account_latency (KmsLoopPoolEntry * entry,
+    GstClockTime latency)
+{
+  entry->latency_last = latency;
+  entry->latency_max = MAX (entry->latency_max, latency);
+  entry->latency_sum += latency;
+  entry->latency_count++;
+}
+
+static gboolean
+kms_loop_pool_probe_cb (gpointer user_data)
+{
+  KmsLoopPoolEntry *entry = user_data;
+  gint64 now = g_get_monotonic_time ();
+  gint64 lag = MAX (now - entry->probe_expected, 0);
+
+  g_mutex_lock (&entry->pool->mutex);
+  kms_loop_pool_entry_account_latency (entry, lag * GST_USECOND);
+  g_mutex_unlock (&entry->pool->mutex);
+
+  entry->probe_expected = now + PROBE_INTERVAL * G_TIME_SPAN_MILLISECOND;
+
+  return G_SOURCE_CONTINUE;
+}
+
+static KmsLoopPoolEntry *
+kms_loop_pool_entry_new (KmsLoopPool * self)
+{
+  KmsLoopPoolEntry *entry;
+
+  entry = g_slice_new0 (KmsLoopPoolEntry);
+  entry->pool = self;
+  entry->id = self->entries->len;
+  entry->loop = kms_loop_new ();
+  entry->probe_expected = g_get_monotonic_time () +
+      PROBE_INTERVAL * G_TIME_SPAN_MILLISECOND;
+  entry->probe_id = kms_loop_timeout_add_full (entry->loop, G_PRIORITY_DEFAULT,
+      PROBE_INTERVAL, kms_loop_pool_probe_cb, entry, NULL);
+
+  GST_INFO ("Pool '%s': started loop %u", self->name, entry->id);
+
+  return entry;
+}
+
+static void
+kms_loop_pool_entry_destroy (KmsLoopPoolEntry * entry)
+{
+  kms_loop_remove (entry->loop, entry->probe_id);
+  g_object_unref (entry->loop);
+
+  g_slice_free (KmsLoopPoolEntry, entry);
+}
+
+static KmsLoopPoolEntry *
+kms_loop_pool_find_entry (KmsLoopPool * self, KmsLoop * loop)
+{
+  guint i;
+
+  for (i = 0; i < self->entries->len; i++) {
+    KmsLoopPoolEntry *entry = g_ptr_array_index (self->entries, i);
+
+    if (entry->loop == loop) {
+      return entry;
+    }
+  }
+
+  return NULL;
+}
+
+static void
+kms_loop_pool_destroy (KmsLoopPool * self)
+{
+  GST_DEBUG ("Destroying pool '%s'", self->name);
+
+  /* Stops every loop, so no probe can be running after this point */
+  g_ptr_array_unref (self->entries);
+  g_mutex_clear (&self->mutex);
+  g_free (self->name);
+
+  g_slice_free (KmsLoopPool, self);
+}
+
+KmsLoopPool *
+kms_loop_pool_new (const gchar * name, guint size)
+{
+  KmsLoopPool *self;
+
+  kms_loop_pool_init_debug ();
+
+  self = g_slice_new0 (KmsLoopPool);
+  kms_ref_struct_init (KMS_REF_STRUCT_CAST (self),
+      (GDestroyNotify) kms_loop_pool_destroy);
+
+  g_mutex_init (&self->mutex);
+  self->name = g_strdup (name);
+  self->size = size;
+  self->entries =
+      g_ptr_array_new_with_free_func ((GDestroyNotify)
+      kms_loop_pool_entry_destroy);
+
+  return self;
+}
+
+KmsLoopPool *
+kms_loop_pool_ref (KmsLoopPool * pool)
+{
+  return (KmsLoopPool *) kms_ref_struct_ref (KMS_REF_STRUCT_CAST (pool));
+}
+
+void
+kms_loop_pool_unref (KmsLoopPool * pool)
+{
+  kms_ref_struct_unref (KMS_REF_STRUCT_CAST (pool));
+}
+
+void
+kms_loop_pool_set_size (KmsLoopPool * pool, guint size)
+{
+  g_mutex_lock (&pool->mutex);
+  pool->size = size;
+  GST_INFO ("Pool '%s': using up to %u loops", pool->name,
+      kms_loop_pool_effective_size (pool));
+  g_mutex_unlock (&pool->mutex);
+}
+
+guint
+kms_loop_pool_get_size (KmsLoopPool * pool)
+{
+  guint size;
+
+  g_mutex_lock (&pool->mutex);
+  size = kms_loop_pool_effective_size (pool);
+  g_mutex_unlock (&pool->mutex);
+
+  return size;
+}
+
+KmsLoop *
+kms_loop_pool_acquire (KmsLoopPool * pool)
+{
+  KmsLoopPoolEntry *selected = NULL;
+  KmsLoop *loop;
+  guint i;
+
+  g_mutex_lock (&pool->mutex);
+
+  for (i = 0; i < pool->entries->len; i++) {
+    KmsLoopPoolEntry *entry = g_ptr_array_index (pool->entries, i);
+
+    if (selected == NULL || entry->users < selected->users ||
+        (entry->users == selected->users &&
+            entry->pending < selected->pending)) {
+      selected = entry;
+    }
+  }
+
+  /* Loops are started lazily, only when every running one is already busy */
+  if ((selected == NULL || selected->users > 0) &&
+      pool->entries->len < kms_loop_pool_effective_size (pool)) {
+    selected = kms_loop_pool_entry_new (pool);
+    g_ptr_array_add (pool->entries, selected);
+  }
+
+  selected->users++;
+  loop = g_object_ref (selected->loop);
+
+  GST_DEBUG ("Pool '%s': assigned loop %u (%u users)", pool->name,
+      selected->id, selected->users);
+
+  g_mutex_unlock (&pool->mutex);
+
+  return loop;
+}
+
+void
+kms_loop_pool_release (KmsLoopPool * pool, KmsLoop * loop)
+{
+  KmsLoopPoolEntry *entry;
+
+  g_mutex_lock (&pool->mutex);
+
+  entry = kms_loop_pool_find_entry (pool, loop);
+
+  if (entry == NULL) {
+    GST_WARNING ("Pool '%s': released loop %" GST_PTR_FORMAT
+        " does not belong to it", pool->name, loop);
+  } else if (entry->users > 0) {
+    entry->users--;
+  }
+
+  g_mutex_unlock (&pool->mutex);
+
+  g_object_unref (loop);
+}
+
+static gboolean
+kms_loop_pool_task_dispatch (gpointer user_data)
+{
+  KmsLoopPoolTask *task = user_data;
+
+  if (!task->dispatched) {
+    gint64 latency = g_get_monotonic_time () - task->queued;
+
+    g_mutex_lock (&task->pool->mutex);
+    kms_loop_pool_entry_account_latency (task->entry, latency * GST_USECOND);
+    task->entry->pending--;
+    task->entry->dispatched++;
+    g_mutex_unlock (&task->pool->mutex);
+
+    task->dispatched = TRUE;
+  }
+
+  return task->function (task->data);
+}
+
+static void
+kms_loop_pool_task_destroy (KmsLoopPoolTask * task)
+{
+  if (!task->dispatched) {
+    /* Source removed before being dispatched */
+    g_mutex_lock (&task->pool->mutex);
+    task->entry->pending--;
+    g_mutex_unlock (&task->pool->mutex);
+  }
+
+  if (task->notify != NULL) {
+    task->notify (task->data);
+  }
+
+  kms_loop_pool_unref (task->pool);
+
+  g_slice_free (KmsLoopPoolTask, task);
+}
+
+guint
+kms_loop_pool_idle_add_full (KmsLoopPool * pool, KmsLoop * loop,
+    gint priority, GSourceFunc function, gpointer data, GDestroyNotify notify)
+{
+  KmsLoopPoolEntry *entry;
+  KmsLoopPoolTask *task;
+
+  g_mutex_lock (&pool->mutex);
+
+  entry = kms_loop_pool_find_entry (pool, loop);
+
+  if (entry == NULL) {
+    g_mutex_unlock (&pool->mutex);
+    GST_WARNING ("Pool '%s': loop %" GST_PTR_FORMAT " does not belong to it",
+        pool->name, loop);
+
+    return kms_loop_idle_add_full (loop, priority, function, data, notify);
+  }
+
+  entry->pending++;
+  entry->max_pending = MAX (entry->max_pending, entry->pending);
+
+  g_mutex_unlock (&pool->mutex);
+
+  task = g_slice_new0 (KmsLoopPoolTask);
+  task->pool = kms_loop_pool_ref (pool);
+  task->entry = entry;
+  task->function = function;
+  task->data = data;
+  task->notify = notify;
+  task->queued = g_get_monotonic_time ();
+
+  return kms_loop_idle_add_full (loop, priority, kms_loop_pool_task_dispatch,
+      task, (GDestroyNotify) kms_loop_pool_task_destroy);
+}
+
+GstStructure *
+kms_loop_pool_get_stats (KmsLoopPool * pool)
+{
+  GstStructure *stats;
+  guint i;
+
+  stats = gst_structure_new_empty (pool->name);
+
+  g_mutex_lock (&pool->mutex);
+
+  gst_structure_set (stats, "size", G_TYPE_UINT,
+      kms_loop_pool_effective_size (pool), NULL);
+
+  for (i = 0; i < pool->entries->len; i++) {
+    KmsLoopPoolEntry *entry = g_ptr_array_index (pool->entries, i);
+    GstClockTime avg = 0;
+    GstStructure *loop_stats;
+    gchar *name;
+
+    if (entry->latency_count > 0) {
+      avg = entry->latency_sum / entry->latency_count;
+    }
+
+    name = g_strdup_printf ("loop-%u", entry->id);
+    loop_stats = gst_structure_new (name,
+        "users", G_TYPE_UINT, entry->users,
+        "pool-pending", G_TYPE_UINT, entry->pending,
+        "pool-max-pending", G_TYPE_UINT, entry->max_pending,
+        "pool-dispatched", G_TYPE_UINT64, entry->dispatched,
+        "latency-last", G_TYPE_UINT64, entry->latency_last,
+        "latency-avg", G_TYPE_UINT64, avg,
+        "latency-max", G_TYPE_UINT64, entry->latency_max, NULL);
+
+    gst_structure_set (stats, name, GST_TYPE_STRUCTURE, loop_stats, NULL);
+
+    gst_structure_free (loop_stats);
+    g_free (name);
+  }
+
+  g_mutex_unlock (&pool->mutex);
+
+  return stats;
+}
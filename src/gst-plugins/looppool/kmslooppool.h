@@ -0,0 +1,61 @@
+/*
+ * (C) Copyright 2016 Kurento (http://kurento.org/)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef __KMS_LOOP_POOL_H__
+#define __KMS_LOOP_POOL_H__
+
+#include <gst/gst.h>
+#include <commons/kmsloop.h>
+
+G_BEGIN_DECLS
+
+#define KMS_LOOP_POOL_STATISTICS_FIELD "event-loops"
+
+/* 0 means one loop per available processor */
+#define KMS_LOOP_POOL_DEFAULT_SIZE 0
+
+typedef struct _KmsLoopPool KmsLoopPool;
+
+KmsLoopPool * kms_loop_pool_new (const gchar * name, guint size);
+KmsLoopPool * kms_loop_pool_ref (KmsLoopPool * pool);
+void kms_loop_pool_unref (KmsLoopPool * pool);
+
+/* Changing the size only affects how many loops can be created from now on.
+ * Loops already running keep working until the pool is destroyed. */
+void kms_loop_pool_set_size (KmsLoopPool * pool, guint size);
+guint kms_loop_pool_get_size (KmsLoopPool * pool);
+
+/* Returns a new reference to the least loaded loop of the pool. Callers must
+ * hand it back with kms_loop_pool_release () once they stop using it */
+KmsLoop * kms_loop_pool_acquire (KmsLoopPool * pool);
+void kms_loop_pool_release (KmsLoopPool * pool, KmsLoop * loop);
+
+/* Same as kms_loop_idle_add_full () but accounted in the pool-* metrics */
+guint kms_loop_pool_idle_add_full (KmsLoopPool * pool, KmsLoop * loop,
+    gint priority, GSourceFunc function, gpointer data,
+    GDestroyNotify notify);
+
+/* Returns a structure with one field per running loop containing its number
+ * of users, its dispatch latency in nanoseconds and the callbacks added with
+ * kms_loop_pool_idle_add_full () (pool-pending, pool-max-pending and
+ * pool-dispatched). Sources attached straight to the context of the loop, as
+ * the ones of libnice and DTLS, are not counted there, but they delay the
+ * periodic probe behind the latency figures. */
+GstStructure * kms_loop_pool_get_stats (KmsLoopPool * pool);
+
+G_END_DECLS
+#endif /* __KMS_LOOP_POOL_H__ */
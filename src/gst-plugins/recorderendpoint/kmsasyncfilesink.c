@@ -0,0 +1,883 @@
+/*
+ * (C) Copyright 2016 Kurento (http://kurento.org/)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#define _GNU_SOURCE             /* O_DIRECT */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <gst/gst.h>
+
+#include "kmsasyncfilesink.h"
+
+#define PLUGIN_NAME KMS_ASYNC_FILE_SINK_NAME
+
+GST_DEBUG_CATEGORY_STATIC (kms_async_file_sink_debug_category);
+#define GST_CAT_DEFAULT kms_async_file_sink_debug_category
+
+#define KMS_ASYNC_FILE_SINK_GET_PRIVATE(obj) (  \
+  G_TYPE_INSTANCE_GET_PRIVATE (                 \
+    (obj),                                      \
+    KMS_TYPE_ASYNC_FILE_SINK,                   \
+    KmsAsyncFileSinkPrivate                     \
+  )                                             \
+)
+
+#define KMS_ASYNC_FILE_SINK_LOCK(obj) (                         \
+  g_mutex_lock (&KMS_ASYNC_FILE_SINK (obj)->priv->mutex)        \
+)
+
+#define KMS_ASYNC_FILE_SINK_UNLOCK(obj) (                       \
+  g_mutex_unlock (&KMS_ASYNC_FILE_SINK (obj)->priv->mutex)      \
+)
+
+/* Writes of every sink in the process share these threads. Each sink has at
+ * most one job queued, so its blocks are written in order */
+#define IO_THREADS 4
+
+/* O_DIRECT requires offsets, sizes and memory aligned to the device block */
+#define ALIGNMENT 4096
+
+#define DEFAULT_LOCATION NULL
+#define DEFAULT_BLOCK_SIZE (1024 * 1024)        /* bytes */
+#define DEFAULT_BUFFER_SIZE (8 * 1024 * 1024)   /* bytes */
+#define DEFAULT_DIRECT_IO FALSE
+#define DEFAULT_SYNC_ON_CLOSE TRUE
+#define DEFAULT_SYNC_INTERVAL 0 /* ms */
+
+enum
+{
+  PROP_0,
+  PROP_LOCATION,
+  PROP_BLOCK_SIZE,
+  PROP_BUFFER_SIZE,
+  PROP_DIRECT_IO,
+  PROP_SYNC_ON_CLOSE,
+  PROP_SYNC_INTERVAL,
+  PROP_STATS,
+  N_PROPERTIES
+};
+
+static GParamSpec *obj_properties[N_PROPERTIES] = { NULL, };
+
+typedef struct _KmsWriteBlock
+{
+  guint8 *data;
+  gsize size;                   /* Bytes filled */
+  guint64 offset;               /* Position in the file */
+} KmsWriteBlock;
+
+struct _KmsAsyncFileSinkPrivate
+{
+  /* Configuration, only changed while stopped */
+  gchar *location;
+  guint block_size;
+  guint buffer_size;
+  gboolean direct_io;
+  gboolean sync_on_close;
+  guint sync_interval;
+
+  gint fd;
+  gboolean direct;              /* O_DIRECT currently set on fd */
+
+  /* Streaming thread only */
+  KmsWriteBlock *current;
+  guint64 position;
+
+  GMutex mutex;
+  GCond cond;
+  GQueue free_blocks;
+  GQueue pending;
+  guint n_blocks;
+  gboolean scheduled;           /* A write job is queued or running */
+  gboolean flushing;
+  gboolean dirty;               /* Written since last sync */
+  gint64 last_sync;
+  GError *error;
+
+  /* Stats */
+  guint64 queued_bytes;
+  guint64 max_queued_bytes;
+  guint64 bytes_written;
+  guint64 writes;
+  guint64 syncs;
+  guint64 stalls;
+  GstClockTime stall_time;
+};
+
+G_DEFINE_TYPE_WITH_CODE (KmsAsyncFileSink, kms_async_file_sink,
+    GST_TYPE_BASE_SINK,
+    GST_DEBUG_CATEGORY_INIT (kms_async_file_sink_debug_category, PLUGIN_NAME,
+        0, "debug category for async file sink element"));
+
+static GstStaticPadTemplate sink_template = GST_STATIC_PAD_TEMPLATE ("sink",
+    GST_PAD_SINK,
+    GST_PAD_ALWAYS,
+    GST_STATIC_CAPS_ANY);
+
+static gpointer
+kms_async_file_sink_create_pool (gpointer data)
+{
+  GError *err = NULL;
+  GThreadPool *pool;
+
+  pool = g_thread_pool_new ((GFunc) data, NULL, IO_THREADS, FALSE, &err);
+
+  if (err != NULL) {
+    GST_ERROR ("Can not create IO thread pool: %s", err->message);
+    g_error_free (err);
+  }
+
+  return pool;
+}
+
+static KmsWriteBlock *
+kms_write_block_new (guint size)
+{
+  KmsWriteBlock *block = g_slice_new0 (KmsWriteBlock);
+
+  if (posix_memalign ((gpointer *) & block->data, ALIGNMENT, size) != 0) {
+    g_slice_free (KmsWriteBlock, block);
+    return NULL;
+  }
+
+  return block;
+}
+
+static void
+kms_write_block_free (KmsWriteBlock * block)
+{
+  free (block->data);
+  g_slice_free (KmsWriteBlock, block);
+}
+
+static gboolean
+kms_async_file_sink_set_direct (KmsAsyncFileSink * self, gboolean direct)
+{
+#ifdef O_DIRECT
+  gint flags;
+
+  if (self->priv->direct == direct) {
+    return TRUE;
+  }
+
+  flags = fcntl (self->priv->fd, F_GETFL);
+
+  if (flags < 0) {
+    return FALSE;
+  }
+
+  flags = direct ? (flags | O_DIRECT) : (flags & ~O_DIRECT);
+
+  if (fcntl (self->priv->fd, F_SETFL, flags) < 0) {
+    return FALSE;
+  }
+
+  self->priv->direct = direct;
+
+  return TRUE;
+#else
+  return !direct;
+#endif
+}
+
+static gboolean
+kms_async_file_sink_write_block (KmsAsyncFileSink * self,
+    KmsWriteBlock * block, GError ** err)
+{
+  gsize written = 0;
+  gboolean aligned;
+
+  /* Partial blocks (seeks and the tail of the file) bypass O_DIRECT */
+  aligned = block->offset % ALIGNMENT == 0 && block->size % ALIGNMENT == 0;
+  kms_async_file_sink_set_direct (self, self->priv->direct_io && aligned);
+
+  while (written < block->size) {
+    gssize ret;
+
+    ret = pwrite (self->priv->fd, block->data + written, block->size - written,
+        block->offset + written);
+
+    if (ret < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+
+      g_set_error (err, GST_RESOURCE_ERROR, GST_RESOURCE_ERROR_WRITE,
+          "Error writing to file \"%s\": %s", self->priv->location,
+          g_strerror (errno));
+      return FALSE;
+    }
+
+    written += ret;
+  }
+
+  return TRUE;
+}
+
+static gboolean
+kms_async_file_sink_sync (KmsAsyncFileSink * self, GError ** err)
+{
+  if (fsync (self->priv->fd) < 0) {
+    g_set_error (err, GST_RESOURCE_ERROR, GST_RESOURCE_ERROR_WRITE,
+        "Error syncing file \"%s\": %s", self->priv->location,
+        g_strerror (errno));
+    return FALSE;
+  }
+
+  return TRUE;
+}
+
+/* Runs in the IO pool until there are no more pending blocks */
+static void
+kms_async_file_sink_io_job (KmsAsyncFileSink * self, gpointer user_data)
+{
+  KmsWriteBlock *block;
+  GError *err = NULL;
+
+  KMS_ASYNC_FILE_SINK_LOCK (self);
+
+  while ((block = g_queue_pop_head (&self->priv->pending)) != NULL) {
+    gboolean sync = FALSE, sync_due;
+
+    if (self->priv->error == NULL) {
+      sync_due = self->priv->sync_interval > 0 &&
+          g_get_monotonic_time () - self->priv->last_sync >=
+          self->priv->sync_interval * G_TIME_SPAN_MILLISECOND;
+
+      KMS_ASYNC_FILE_SINK_UNLOCK (self);
+
+      if (kms_async_file_sink_write_block (self, block, &err) && sync_due) {
+        sync = kms_async_file_sink_sync (self, &err);
+      }
+
+      KMS_ASYNC_FILE_SINK_LOCK (self);
+
+      if (err != NULL) {
+        GST_ERROR_OBJECT (self, "%s", err->message);
+        self->priv->error = err;
+        err = NULL;
+      } else {
+        self->priv->bytes_written += block->size;
+        self->priv->writes++;
+        self->priv->dirty = !sync;
+
+        if (sync) {
+          self->priv->syncs++;
+          self->priv->last_sync = g_get_monotonic_time ();
+        }
+      }
+    }
+
+    self->priv->queued_bytes -= block->size;
+    g_queue_push_tail (&self->priv->free_blocks, block);
+    g_cond_broadcast (&self->priv->cond);
+  }
+
+  self->priv->scheduled = FALSE;
+  g_cond_broadcast (&self->priv->cond);
+
+  KMS_ASYNC_FILE_SINK_UNLOCK (self);
+
+  g_object_unref (self);
+}
+
+static GThreadPool *
+kms_async_file_sink_get_pool (void)
+{
+  static GOnce once = G_ONCE_INIT;
+
+  g_once (&once, kms_async_file_sink_create_pool, kms_async_file_sink_io_job);
+
+  return once.retval;
+}
+
+/* Must be called with the lock held */
+static void
+kms_async_file_sink_schedule (KmsAsyncFileSink * self)
+{
+  if (self->priv->scheduled || g_queue_is_empty (&self->priv->pending)) {
+    return;
+  }
+
+  self->priv->scheduled = TRUE;
+  g_thread_pool_push (kms_async_file_sink_get_pool (), g_object_ref (self),
+      NULL);
+}
+
+static void
+kms_async_file_sink_queue_current (KmsAsyncFileSink * self)
+{
+  KmsWriteBlock *block = self->priv->current;
+
+  if (block == NULL) {
+    return;
+  }
+
+  self->priv->current = NULL;
+
+  KMS_ASYNC_FILE_SINK_LOCK (self);
+
+  if (block->size == 0) {
+    g_queue_push_tail (&self->priv->free_blocks, block);
+    KMS_ASYNC_FILE_SINK_UNLOCK (self);
+    return;
+  }
+
+  g_queue_push_tail (&self->priv->pending, block);
+  self->priv->queued_bytes += block->size;
+  self->priv->max_queued_bytes =
+      MAX (self->priv->max_queued_bytes, self->priv->queued_bytes);
+  kms_async_file_sink_schedule (self);
+
+  KMS_ASYNC_FILE_SINK_UNLOCK (self);
+}
+
+/* Returns an empty block, waiting for the IO threads if the write-behind
+ * buffer is full. NULL if flushing or after a write error */
+static KmsWriteBlock *
+kms_async_file_sink_get_block (KmsAsyncFileSink * self)
+{
+  KmsWriteBlock *block = NULL;
+  gint64 stall_start = 0;
+
+  KMS_ASYNC_FILE_SINK_LOCK (self);
+
+  while (!self->priv->flushing && self->priv->error == NULL) {
+    block = g_queue_pop_head (&self->priv->free_blocks);
+
+    if (block != NULL) {
+      break;
+    }
+
+    if (self->priv->n_blocks * (guint64) self->priv->block_size <
+        MAX (self->priv->buffer_size, 2 * self->priv->block_size)) {
+      block = kms_write_block_new (self->priv->block_size);
+
+      if (block != NULL) {
+        self->priv->n_blocks++;
+        break;
+      }
+    }
+
+    if (stall_start == 0) {
+      stall_start = g_get_monotonic_time ();
+      self->priv->stalls++;
+      GST_DEBUG_OBJECT (self, "Write-behind buffer full, waiting for disk");
+    }
+
+    g_cond_wait (&self->priv->cond, &self->priv->mutex);
+  }
+
+  if (stall_start != 0) {
+    self->priv->stall_time +=
+        (g_get_monotonic_time () - stall_start) * GST_USECOND;
+  }
+
+  KMS_ASYNC_FILE_SINK_UNLOCK (self);
+
+  if (block != NULL) {
+    block->size = 0;
+    block->offset = self->priv->position;
+  }
+
+  return block;
+}
+
+/* Waits until every queued byte reaches the file */
+static gboolean
+kms_async_file_sink_drain (KmsAsyncFileSink * self, gboolean sync)
+{
+  gboolean ret;
+
+  kms_async_file_sink_queue_current (self);
+
+  KMS_ASYNC_FILE_SINK_LOCK (self);
+
+  while (self->priv->scheduled) {
+    g_cond_wait (&self->priv->cond, &self->priv->mutex);
+  }
+
+  if (sync && self->priv->dirty && self->priv->error == NULL) {
+    GError *err = NULL;
+
+    if (kms_async_file_sink_sync (self, &err)) {
+      self->priv->syncs++;
+      self->priv->dirty = FALSE;
+      self->priv->last_sync = g_get_monotonic_time ();
+    } else {
+      self->priv->error = err;
+    }
+  }
+
+  ret = self->priv->error == NULL;
+
+  KMS_ASYNC_FILE_SINK_UNLOCK (self);
+
+  return ret;
+}
+
+static GstFlowReturn
+kms_async_file_sink_post_error (KmsAsyncFileSink * self)
+{
+  GError *err;
+
+  KMS_ASYNC_FILE_SINK_LOCK (self);
+  err = self->priv->error != NULL ? g_error_copy (self->priv->error) : NULL;
+  KMS_ASYNC_FILE_SINK_UNLOCK (self);
+
+  if (err == NULL) {
+    return GST_FLOW_FLUSHING;
+  }
+
+  GST_ELEMENT_ERROR (self, RESOURCE, WRITE, ("%s", err->message), (NULL));
+  g_error_free (err);
+
+  return GST_FLOW_ERROR;
+}
+
+static GstFlowReturn
+kms_async_file_sink_render (GstBaseSink * sink, GstBuffer * buffer)
+{
+  KmsAsyncFileSink *self = KMS_ASYNC_FILE_SINK (sink);
+  GstMapInfo info;
+  gsize copied = 0;
+
+  if (!gst_buffer_map (buffer, &info, GST_MAP_READ)) {
+    GST_ELEMENT_ERROR (self, RESOURCE, WRITE, (NULL),
+        ("Can not map buffer"));
+    return GST_FLOW_ERROR;
+  }
+
+  while (copied < info.size) {
+    KmsWriteBlock *block = self->priv->current;
+    gsize len;
+
+    if (block == NULL) {
+      block = self->priv->current = kms_async_file_sink_get_block (self);
+
+      if (block == NULL) {
+        gst_buffer_unmap (buffer, &info);
+        return kms_async_file_sink_post_error (self);
+      }
+    }
+
+    len = MIN (self->priv->block_size - block->size, info.size - copied);
+    memcpy (block->data + block->size, info.data + copied, len);
+    block->size += len;
+    copied += len;
+    self->priv->position += len;
+
+    if (block->size == self->priv->block_size) {
+      kms_async_file_sink_queue_current (self);
+    }
+  }
+
+  gst_buffer_unmap (buffer, &info);
+
+  return GST_FLOW_OK;
+}
+
+static gboolean
+kms_async_file_sink_event (GstBaseSink * sink, GstEvent * event)
+{
+  KmsAsyncFileSink *self = KMS_ASYNC_FILE_SINK (sink);
+
+  switch (GST_EVENT_TYPE (event)) {
+    case GST_EVENT_SEGMENT:{
+      const GstSegment *segment;
+
+      gst_event_parse_segment (event, &segment);
+
+      /* Muxers seek back to rewrite headers with byte segments */
+      if (segment->format == GST_FORMAT_BYTES &&
+          segment->start != self->priv->position) {
+        GST_DEBUG_OBJECT (self, "Seeking from %" G_GUINT64_FORMAT " to %"
+            G_GUINT64_FORMAT, self->priv->position, segment->start);
+        kms_async_file_sink_queue_current (self);
+        self->priv->position = segment->start;
+      }
+      break;
+    }
+    case GST_EVENT_EOS:
+      /* EOS is only posted once the file is complete */
+      if (!kms_async_file_sink_drain (self, self->priv->sync_on_close)) {
+        kms_async_file_sink_post_error (self);
+        gst_event_unref (event);
+        return FALSE;
+      }
+      break;
+    default:
+      break;
+  }
+
+  return GST_BASE_SINK_CLASS (kms_async_file_sink_parent_class)->event (sink,
+      event);
+}
+
+static gboolean
+kms_async_file_sink_query (GstBaseSink * sink, GstQuery * query)
+{
+  KmsAsyncFileSink *self = KMS_ASYNC_FILE_SINK (sink);
+
+  switch (GST_QUERY_TYPE (query)) {
+    case GST_QUERY_POSITION:{
+      GstFormat format;
+
+      gst_query_parse_position (query, &format, NULL);
+
+      if (format != GST_FORMAT_BYTES && format != GST_FORMAT_DEFAULT) {
+        break;
+      }
+
+      gst_query_set_position (query, GST_FORMAT_BYTES, self->priv->position);
+      return TRUE;
+    }
+    case GST_QUERY_FORMATS:
+      gst_query_set_formats (query, 2, GST_FORMAT_DEFAULT, GST_FORMAT_BYTES);
+      return TRUE;
+    case GST_QUERY_SEEKING:{
+      GstFormat format;
+
+      gst_query_parse_seeking (query, &format, NULL, NULL, NULL);
+      gst_query_set_seeking (query, format, format == GST_FORMAT_BYTES ||
+          format == GST_FORMAT_DEFAULT, 0, -1);
+      return TRUE;
+    }
+    default:
+      break;
+  }
+
+  return GST_BASE_SINK_CLASS (kms_async_file_sink_parent_class)->query (sink,
+      query);
+}
+
+static gboolean
+kms_async_file_sink_start (GstBaseSink * sink)
+{
+  KmsAsyncFileSink *self = KMS_ASYNC_FILE_SINK (sink);
+  gint flags = O_WRONLY | O_CREAT | O_TRUNC;
+
+  if (self->priv->location == NULL) {
+    GST_ELEMENT_ERROR (self, RESOURCE, NOT_FOUND,
+        ("No file name specified for writing."), (NULL));
+    return FALSE;
+  }
+
+  self->priv->fd = -1;
+
+#ifdef O_DIRECT
+  if (self->priv->direct_io) {
+    self->priv->fd = open (self->priv->location, flags | O_DIRECT, 0644);
+
+    if (self->priv->fd < 0 && errno == EINVAL) {
+      GST_WARNING_OBJECT (self, "O_DIRECT not supported for %s",
+          self->priv->location);
+    }
+  }
+#endif
+
+  self->priv->direct = self->priv->fd >= 0;
+
+  if (self->priv->fd < 0) {
+    self->priv->fd = open (self->priv->location, flags, 0644);
+  }
+
+  if (self->priv->fd < 0) {
+    GST_ELEMENT_ERROR (self, RESOURCE, OPEN_WRITE,
+        ("Could not open file \"%s\" for writing.", self->priv->location),
+        GST_ERROR_SYSTEM);
+    return FALSE;
+  }
+
+  self->priv->position = 0;
+  self->priv->last_sync = g_get_monotonic_time ();
+
+  KMS_ASYNC_FILE_SINK_LOCK (self);
+  g_clear_error (&self->priv->error);
+  self->priv->dirty = FALSE;
+  KMS_ASYNC_FILE_SINK_UNLOCK (self);
+
+  return TRUE;
+}
+
+static gboolean
+kms_async_file_sink_stop (GstBaseSink * sink)
+{
+  KmsAsyncFileSink *self = KMS_ASYNC_FILE_SINK (sink);
+  gboolean ret;
+
+  ret = kms_async_file_sink_drain (self, self->priv->sync_on_close);
+
+  if (close (self->priv->fd) < 0) {
+    GST_ERROR_OBJECT (self, "Error closing %s: %s", self->priv->location,
+        g_strerror (errno));
+    ret = FALSE;
+  }
+
+  self->priv->fd = -1;
+
+  KMS_ASYNC_FILE_SINK_LOCK (self);
+  g_queue_foreach (&self->priv->free_blocks, (GFunc) kms_write_block_free,
+      NULL);
+  g_queue_clear (&self->priv->free_blocks);
+  self->priv->n_blocks = 0;
+  KMS_ASYNC_FILE_SINK_UNLOCK (self);
+
+  if (!ret) {
+    kms_async_file_sink_post_error (self);
+  }
+
+  return ret;
+}
+
+static gboolean
+kms_async_file_sink_unlock (GstBaseSink * sink)
+{
+  KmsAsyncFileSink *self = KMS_ASYNC_FILE_SINK (sink);
+
+  KMS_ASYNC_FILE_SINK_LOCK (self);
+  self->priv->flushing = TRUE;
+  g_cond_broadcast (&self->priv->cond);
+  KMS_ASYNC_FILE_SINK_UNLOCK (self);
+
+  return TRUE;
+}
+
+static gboolean
+kms_async_file_sink_unlock_stop (GstBaseSink * sink)
+{
+  KmsAsyncFileSink *self = KMS_ASYNC_FILE_SINK (sink);
+
+  KMS_ASYNC_FILE_SINK_LOCK (self);
+  self->priv->flushing = FALSE;
+  KMS_ASYNC_FILE_SINK_UNLOCK (self);
+
+  return TRUE;
+}
+
+static GstStructure *
+kms_async_file_sink_get_stats (KmsAsyncFileSink * self)
+{
+  GstStructure *stats;
+
+  KMS_ASYNC_FILE_SINK_LOCK (self);
+
+  stats = gst_structure_new ("stats",
+      "queue-depth", G_TYPE_UINT64, self->priv->queued_bytes,
+      "max-queue-depth", G_TYPE_UINT64, self->priv->max_queued_bytes,
+      "bytes-written", G_TYPE_UINT64, self->priv->bytes_written,
+      "writes", G_TYPE_UINT64, self->priv->writes,
+      "syncs", G_TYPE_UINT64, self->priv->syncs,
+      "stalls", G_TYPE_UINT64, self->priv->stalls,
+      "stall-time", G_TYPE_UINT64, self->priv->stall_time, NULL);
+
+  KMS_ASYNC_FILE_SINK_UNLOCK (self);
+
+  return stats;
+}
+
+static void
+kms_async_file_sink_set_property (GObject * object, guint property_id,
+    const GValue * value, GParamSpec * pspec)
+{
+  KmsAsyncFileSink *self = KMS_ASYNC_FILE_SINK (object);
+
+  GST_OBJECT_LOCK (self);
+
+  switch (property_id) {
+    case PROP_LOCATION:
+      g_free (self->priv->location);
+      self->priv->location = g_value_dup_string (value);
+      break;
+    case PROP_BLOCK_SIZE:
+      /* Keep blocks aligned so that they can be written with O_DIRECT */
+      self->priv->block_size =
+          GST_ROUND_UP_N (g_value_get_uint (value), ALIGNMENT);
+      break;
+    case PROP_BUFFER_SIZE:
+      self->priv->buffer_size = g_value_get_uint (value);
+      break;
+    case PROP_DIRECT_IO:
+      self->priv->direct_io = g_value_get_boolean (value);
+      break;
+    case PROP_SYNC_ON_CLOSE:
+      self->priv->sync_on_close = g_value_get_boolean (value);
+      break;
+    case PROP_SYNC_INTERVAL:
+      self->priv->sync_interval = g_value_get_uint (value);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+      break;
+  }
+
+  GST_OBJECT_UNLOCK (self);
+}
+
+static void
+kms_async_file_sink_get_property (GObject * object, guint property_id,
+    GValue * value, GParamSpec * pspec)
+{
+  KmsAsyncFileSink *self = KMS_ASYNC_FILE_SINK (object);
+
+  if (property_id == PROP_STATS) {
+    g_value_take_boxed (value, kms_async_file_sink_get_stats (self));
+    return;
+  }
+
+  GST_OBJECT_LOCK (self);
+
+  switch (property_id) {
+    case PROP_LOCATION:
+      g_value_set_string (value, self->priv->location);
+      break;
+    case PROP_BLOCK_SIZE:
+      g_value_set_uint (value, self->priv->block_size);
+      break;
+    case PROP_BUFFER_SIZE:
+      g_value_set_uint (value, self->priv->buffer_size);
+      break;
+    case PROP_DIRECT_IO:
+      g_value_set_boolean (value, self->priv->direct_io);
+      break;
+    case PROP_SYNC_ON_CLOSE:
+      g_value_set_boolean (value, self->priv->sync_on_close);
+      break;
+    case PROP_SYNC_INTERVAL:
+      g_value_set_uint (value, self->priv->sync_interval);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+      break;
+  }
+
+  GST_OBJECT_UNLOCK (self);
+}
+
+static void
+kms_async_file_sink_finalize (GObject * object)
+{
+  KmsAsyncFileSink *self = KMS_ASYNC_FILE_SINK (object);
+
+  g_free (self->priv->location);
+  g_clear_error (&self->priv->error);
+  g_mutex_clear (&self->priv->mutex);
+  g_cond_clear (&self->priv->cond);
+
+  G_OBJECT_CLASS (kms_async_file_sink_parent_class)->finalize (object);
+}
+
+static void
+kms_async_file_sink_class_init (KmsAsyncFileSinkClass * klass)
+{
+  GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
+  GstElementClass *element_class = GST_ELEMENT_CLASS (klass);
+  GstBaseSinkClass *basesink_class = GST_BASE_SINK_CLASS (klass);
+
+  gst_element_class_set_static_metadata (element_class,
+      "Asynchronous file sink", "Sink/File",
+      "Writes to a file from a pool of IO threads",
+      "Kurento <kurento@googlegroups.com>");
+
+  gst_element_class_add_pad_template (element_class,
+      gst_static_pad_template_get (&sink_template));
+
+  gobject_class->set_property = kms_async_file_sink_set_property;
+  gobject_class->get_property = kms_async_file_sink_get_property;
+  gobject_class->finalize = kms_async_file_sink_finalize;
+
+  basesink_class->start = GST_DEBUG_FUNCPTR (kms_async_file_sink_start);
+  basesink_class->stop = GST_DEBUG_FUNCPTR (kms_async_file_sink_stop);
+  basesink_class->render = GST_DEBUG_FUNCPTR (kms_async_file_sink_render);
+  basesink_class->event = GST_DEBUG_FUNCPTR (kms_async_file_sink_event);
+  basesink_class->query = GST_DEBUG_FUNCPTR (kms_async_file_sink_query);
+  basesink_class->unlock = GST_DEBUG_FUNCPTR (kms_async_file_sink_unlock);
+  basesink_class->unlock_stop =
+      GST_DEBUG_FUNCPTR (kms_async_file_sink_unlock_stop);
+
+  obj_properties[PROP_LOCATION] = g_param_spec_string ("location",
+      "File location", "Location of the file to write", DEFAULT_LOCATION,
+      G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+
+  obj_properties[PROP_BLOCK_SIZE] = g_param_spec_uint ("block-size",
+      "Block size", "Size in bytes of each write, rounded up to 4 KiB",
+      ALIGNMENT, G_MAXINT, DEFAULT_BLOCK_SIZE,
+      G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+
+  obj_properties[PROP_BUFFER_SIZE] = g_param_spec_uint ("buffer-size",
+      "Buffer size", "Maximum bytes waiting to be written before the "
+      "streaming thread blocks (at least two blocks)", 0, G_MAXUINT,
+      DEFAULT_BUFFER_SIZE, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+
+  obj_properties[PROP_DIRECT_IO] = g_param_spec_boolean ("direct-io",
+      "Direct IO", "Bypass the page cache (O_DIRECT) if supported",
+      DEFAULT_DIRECT_IO, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+
+  obj_properties[PROP_SYNC_ON_CLOSE] = g_param_spec_boolean ("sync-on-close",
+      "Sync on close", "Flush the file to disk before posting EOS",
+      DEFAULT_SYNC_ON_CLOSE, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+
+  obj_properties[PROP_SYNC_INTERVAL] = g_param_spec_uint ("sync-interval",
+      "Sync interval", "Flush the file to disk at most every this many ms "
+      "while writing (0 = disabled)", 0, G_MAXUINT, DEFAULT_SYNC_INTERVAL,
+      G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+
+  obj_properties[PROP_STATS] = g_param_spec_boxed ("stats",
+      "Statistics", "Write-behind queue depth and stall statistics",
+      GST_TYPE_STRUCTURE, G_PARAM_READABLE | G_PARAM_STATIC_STRINGS);
+
+  g_object_class_install_properties (gobject_class, N_PROPERTIES,
+      obj_properties);
+
+  g_type_class_add_private (klass, sizeof (KmsAsyncFileSinkPrivate));
+}
+
+static void
+kms_async_file_sink_init (KmsAsyncFileSink * self)
+{
+  self->priv = KMS_ASYNC_FILE_SINK_GET_PRIVATE (self);
+
+  self->priv->fd = -1;
+  self->priv->block_size = DEFAULT_BLOCK_SIZE;
+  self->priv->buffer_size = DEFAULT_BUFFER_SIZE;
+  self->priv->direct_io = DEFAULT_DIRECT_IO;
+  self->priv->sync_on_close = DEFAULT_SYNC_ON_CLOSE;
+  self->priv->sync_interval = DEFAULT_SYNC_INTERVAL;
+
+  g_mutex_init (&self->priv->mutex);
+  g_cond_init (&self->priv->cond);
+  g_queue_init (&self->priv->free_blocks);
+  g_queue_init (&self->priv->pending);
+
+  /* Timing is given by the muxer */
+  gst_base_sink_set_sync (GST_BASE_SINK (self), FALSE);
+}
+
+gboolean
+kms_async_file_sink_plugin_init (GstPlugin * plugin)
+{
+  return gst_element_register (plugin, PLUGIN_NAME, GST_RANK_NONE,
+      KMS_TYPE_ASYNC_FILE_SINK);
+}
@@ -0,0 +1,77 @@
+/*
+ * (C) Copyright 2016 Kurento (http://kurento.org/)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+#ifndef _KMS_ASYNC_FILE_SINK_H_
+#define _KMS_ASYNC_FILE_SINK_H_
+
+#include <gst/gst.h>
+#include <gst/base/gstbasesink.h>
+
+G_BEGIN_DECLS
+#define KMS_TYPE_ASYNC_FILE_SINK \
+  (kms_async_file_sink_get_type())
+#define KMS_ASYNC_FILE_SINK(obj) (            \
+  G_TYPE_CHECK_INSTANCE_CAST (                \
+    (obj),                                    \
+    KMS_TYPE_ASYNC_FILE_SINK,                 \
+    KmsAsyncFileSink                          \
+  )                                           \
+)
+#define KMS_ASYNC_FILE_SINK_CLASS(klass) (    \
+  G_TYPE_CHECK_CLASS_CAST (                   \
+    (klass),                                  \
+    KMS_TYPE_ASYNC_FILE_SINK,                 \
+    KmsAsyncFileSinkClass                     \
+  )                                           \
+)
+#define KMS_IS_ASYNC_FILE_SINK(obj) (         \
+  G_TYPE_CHECK_INSTANCE_TYPE (                \
+    (obj),                                    \
+    KMS_TYPE_ASYNC_FILE_SINK                  \
+  )                                           \
+)
+#define KMS_IS_ASYNC_FILE_SINK_CLASS(klass) ( \
+  G_TYPE_CHECK_CLASS_TYPE (                   \
+    (klass),                                  \
+    KMS_TYPE_ASYNC_FILE_SINK                  \
+  )                                           \
+)
+
+#define KMS_ASYNC_FILE_SINK_NAME "kmsasyncfilesink"
+
+typedef struct _KmsAsyncFileSink KmsAsyncFileSink;
+typedef struct _KmsAsyncFileSinkClass KmsAsyncFileSinkClass;
+typedef struct _KmsAsyncFileSinkPrivate KmsAsyncFileSinkPrivate;
+
+struct _KmsAsyncFileSink
+{
+  GstBaseSink parent;
+
+  /*< private > */
+  KmsAsyncFileSinkPrivate *priv;
+};
+
+struct _KmsAsyncFileSinkClass
+{
+  GstBaseSinkClass parent_class;
+};
+
+GType kms_async_file_sink_get_type (void);
+
+gboolean kms_async_file_sink_plugin_init (GstPlugin * plugin);
+
+G_END_DECLS
+#endif /* _KMS_ASYNC_FILE_SINK_H_ */
@@ -19,6 +19,7 @@
 #include "config.h"
 #endif
 
+#include <string.h>
 #include <gst/gst.h>
 #include <commons/kms-core-enumtypes.h>
 #include <commons/kmsrecordingprofile.h>
@@ -44,6 +45,34 @@ GST_DEBUG_CATEGORY_STATIC (kms_av_muxer_debug_category);
   )                                      \
 )
 
+#define DEFAULT_SEGMENT_DURATION 0
+#define DEFAULT_SEGMENT_SIZE 0
+#define DEFAULT_SEGMENT_TEMPLATE NULL
+#define DEFAULT_FRAGMENT_DURATION 0
+
+#define SEGMENT_INDEX_TOKEN "{index}"
+#define SEGMENT_TIME_TOKEN "{time}"
+
+enum
+{
+  PROP_0,
+  PROP_SEGMENT_DURATION,
+  PROP_SEGMENT_SIZE,
+  PROP_SEGMENT_TEMPLATE,
+  PROP_FRAGMENT_DURATION,
+  N_PROPERTIES
+};
+
+static GParamSpec *obj_properties[N_PROPERTIES] = { NULL, };
+
+enum
+{
+  SIGNAL_ON_SEGMENT_CLOSED,
+  LAST_SIGNAL
+};
+
+static guint obj_signals[LAST_SIGNAL] = { 0 };
+
 struct _KmsAVMuxerPrivate
 {
   GstElement *videosrc;
@@ -54,6 +83,15 @@ struct _KmsAVMuxerPrivate
   GstClockTime lastAudioPts;
 
   gboolean sink_signaled;
+
+  /* Segmented recording */
+  guint64 segment_duration;
+  guint64 segment_size;
+  gchar *segment_template;
+  GstElement *splitmux;
+  gchar *segment_uri;           /* Segment being written */
+
+  guint fragment_duration;      /* ms */
 };
 
 typedef struct _BufferListItData
@@ -67,17 +105,42 @@ G_DEFINE_TYPE_WITH_CODE (KmsAVMuxer, kms_av_muxer,
     GST_DEBUG_CATEGORY_INIT (kms_av_muxer_debug_category, OBJECT_NAME,
         0, "debug category for muxing pipeline object"));
 
+static void
+kms_av_muxer_close_segment (KmsAVMuxer * self, gchar * next_uri)
+{
+  gchar *closed;
+
+  KMS_BASE_MEDIA_MUXER_LOCK (self);
+  closed = self->priv->segment_uri;
+  self->priv->segment_uri = next_uri;
+  KMS_BASE_MEDIA_MUXER_UNLOCK (self);
+
+  if (closed != NULL) {
+    GST_DEBUG_OBJECT (self, "Segment %s closed", closed);
+    g_signal_emit (self, obj_signals[SIGNAL_ON_SEGMENT_CLOSED], 0, closed);
+    g_free (closed);
+  }
+}
+
 GstStateChangeReturn
 kms_av_muxer_set_state (KmsBaseMediaMuxer * obj, GstState state)
 {
   KmsAVMuxer *self = KMS_AV_MUXER (obj);
+  GstStateChangeReturn ret;
 
   if (state == GST_STATE_NULL || state == GST_STATE_READY) {
     self->priv->lastAudioPts = 0;
     self->priv->lastVideoPts = 0;
   }
 
-  return KMS_BASE_MEDIA_MUXER_CLASS (parent_class)->set_state (obj, state);
+  ret = KMS_BASE_MEDIA_MUXER_CLASS (parent_class)->set_state (obj, state);
+
+  if (state == GST_STATE_NULL || state == GST_STATE_READY) {
+    /* Last segment file is finished once the sink is stopped */
+    kms_av_muxer_close_segment (self, NULL);
+  }
+
+  return ret;
 }
 
 static GstElement *
@@ -123,16 +186,125 @@ kms_av_muxer_remove_src (KmsBaseMediaMuxer * obj, const gchar * id)
   return FALSE;
 }
 
+static void
+kms_av_muxer_set_property (GObject * object, guint property_id,
+    const GValue * value, GParamSpec * pspec)
+{
+  KmsAVMuxer *self = KMS_AV_MUXER (object);
+
+  KMS_BASE_MEDIA_MUXER_LOCK (self);
+
+  switch (property_id) {
+    case PROP_SEGMENT_DURATION:
+      self->priv->segment_duration = g_value_get_uint64 (value);
+      break;
+    case PROP_SEGMENT_SIZE:
+      self->priv->segment_size = g_value_get_uint64 (value);
+      break;
+    case PROP_SEGMENT_TEMPLATE:
+      g_free (self->priv->segment_template);
+      self->priv->segment_template = g_value_dup_string (value);
+      break;
+    case PROP_FRAGMENT_DURATION:
+      self->priv->fragment_duration = g_value_get_uint (value);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+      break;
+  }
+
+  KMS_BASE_MEDIA_MUXER_UNLOCK (self);
+}
+
+static void
+kms_av_muxer_get_property (GObject * object, guint property_id,
+    GValue * value, GParamSpec * pspec)
+{
+  KmsAVMuxer *self = KMS_AV_MUXER (object);
+
+  KMS_BASE_MEDIA_MUXER_LOCK (self);
+
+  switch (property_id) {
+    case PROP_SEGMENT_DURATION:
+      g_value_set_uint64 (value, self->priv->segment_duration);
+      break;
+    case PROP_SEGMENT_SIZE:
+      g_value_set_uint64 (value, self->priv->segment_size);
+      break;
+    case PROP_SEGMENT_TEMPLATE:
+      g_value_set_string (value, self->priv->segment_template);
+      break;
+    case PROP_FRAGMENT_DURATION:
+      g_value_set_uint (value, self->priv->fragment_duration);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+      break;
+  }
+
+  KMS_BASE_MEDIA_MUXER_UNLOCK (self);
+}
+
+static void
+kms_av_muxer_finalize (GObject * object)
+{
+  KmsAVMuxer *self = KMS_AV_MUXER (object);
+
+  g_free (self->priv->segment_template);
+  g_free (self->priv->segment_uri);
+
+  G_OBJECT_CLASS (parent_class)->finalize (object);
+}
+
 static void
 kms_av_muxer_class_init (KmsAVMuxerClass * klass)
 {
   KmsBaseMediaMuxerClass *basemediamuxerclass;
+  GObjectClass *objclass = G_OBJECT_CLASS (klass);
+
+  objclass->set_property = kms_av_muxer_set_property;
+  objclass->get_property = kms_av_muxer_get_property;
+  objclass->finalize = kms_av_muxer_finalize;
 
   basemediamuxerclass = KMS_BASE_MEDIA_MUXER_CLASS (klass);
   basemediamuxerclass->set_state = kms_av_muxer_set_state;
   basemediamuxerclass->add_src = kms_av_muxer_add_src;
   basemediamuxerclass->remove_src = kms_av_muxer_remove_src;
 
+  obj_properties[PROP_SEGMENT_DURATION] =
+      g_param_spec_uint64 (KMS_AV_MUXER_SEGMENT_DURATION, "Segment duration",
+      "Start a new file at the next key frame after this time (0 = disabled)",
+      0, G_MAXUINT64, DEFAULT_SEGMENT_DURATION,
+      G_PARAM_CONSTRUCT_ONLY | G_PARAM_READWRITE);
+
+  obj_properties[PROP_SEGMENT_SIZE] =
+      g_param_spec_uint64 (KMS_AV_MUXER_SEGMENT_SIZE, "Segment size",
+      "Start a new file at the next key frame after this amount of bytes "
+      "(0 = disabled)", 0, G_MAXUINT64, DEFAULT_SEGMENT_SIZE,
+      G_PARAM_CONSTRUCT_ONLY | G_PARAM_READWRITE);
+
+  obj_properties[PROP_SEGMENT_TEMPLATE] =
+      g_param_spec_string (KMS_AV_MUXER_SEGMENT_TEMPLATE, "Segment template",
+      "File uri of segments, " SEGMENT_INDEX_TOKEN " is replaced by the "
+      "segment number and " SEGMENT_TIME_TOKEN " by its UTC start time. "
+      "By default the segment number is appended to the uri name",
+      DEFAULT_SEGMENT_TEMPLATE, G_PARAM_CONSTRUCT_ONLY | G_PARAM_READWRITE);
+
+  obj_properties[PROP_FRAGMENT_DURATION] =
+      g_param_spec_uint (KMS_AV_MUXER_FRAGMENT_DURATION, "Fragment duration",
+      "Write MP4 files as fragments of this duration in ms (0 = disabled)",
+      0, G_MAXUINT, DEFAULT_FRAGMENT_DURATION,
+      G_PARAM_CONSTRUCT_ONLY | G_PARAM_READWRITE);
+
+  g_object_class_install_properties (objclass, N_PROPERTIES, obj_properties);
+
+  obj_signals[SIGNAL_ON_SEGMENT_CLOSED] =
+      g_signal_new ("on-segment-closed",
+      G_TYPE_FROM_CLASS (klass),
+      G_SIGNAL_RUN_LAST,
+      G_STRUCT_OFFSET (KmsAVMuxerClass, on_segment_closed), NULL, NULL,
+      g_cclosure_marshal_VOID__STRING, G_TYPE_NONE, 1, G_TYPE_STRING);
+
   g_type_class_add_private (klass, sizeof (KmsAVMuxerPrivate));
 }
 
@@ -145,6 +317,124 @@ kms_av_muxer_init (KmsAVMuxer * self)
   self->priv->lastAudioPts = G_GUINT64_CONSTANT (0);
 }
 
+static gboolean
+kms_av_muxer_is_segmented (KmsAVMuxer * self)
+{
+  if (self->priv->segment_duration == 0 && self->priv->segment_size == 0) {
+    return FALSE;
+  }
+
+  if (KMS_BASE_MEDIA_MUXER_GET_PROFILE (self) ==
+      KMS_RECORDING_PROFILE_JPEG_VIDEO_ONLY) {
+    GST_WARNING_OBJECT (self, "JPEG profile can not be segmented");
+    return FALSE;
+  }
+
+  if (!gst_uri_has_protocol (KMS_BASE_MEDIA_MUXER_GET_URI (self), "file")) {
+    GST_WARNING_OBJECT (self, "Only file uris can be segmented: %s",
+        KMS_BASE_MEDIA_MUXER_GET_URI (self));
+    return FALSE;
+  }
+
+  return TRUE;
+}
+
+/* rec.webm -> rec-{index}.webm, takes @location */
+static gchar *
+kms_av_muxer_add_index_token (gchar * location)
+{
+  gchar *base, *ext, *tmp = location;
+
+  base = g_path_get_basename (location);
+  ext = strrchr (base, '.');
+
+  if (ext != NULL && ext != base) {
+    location = g_strdup_printf ("%.*s-" SEGMENT_INDEX_TOKEN "%s",
+        (gint) (strlen (location) - strlen (ext)), location, ext);
+  } else {
+    location = g_strconcat (location, "-" SEGMENT_INDEX_TOKEN, NULL);
+  }
+
+  g_free (tmp);
+  g_free (base);
+
+  return location;
+}
+
+/* Returns the location template of segment files */
+static gchar *
+kms_av_muxer_get_segment_location (KmsAVMuxer * self)
+{
+  gchar *location;
+
+  if (self->priv->segment_template == NULL) {
+    location = gst_uri_get_location (KMS_BASE_MEDIA_MUXER_GET_URI (self));
+    return kms_av_muxer_add_index_token (location);
+  }
+
+  if (gst_uri_is_valid (self->priv->segment_template)) {
+    location = gst_uri_get_location (self->priv->segment_template);
+  } else {
+    location = g_strdup (self->priv->segment_template);
+  }
+
+  if (strstr (location, SEGMENT_INDEX_TOKEN) == NULL &&
+      strstr (location, SEGMENT_TIME_TOKEN) == NULL) {
+    /* Every segment would overwrite the previous one */
+    GST_WARNING_OBJECT (self, "Segment template %s has no %s or %s token, "
+        "appending the segment number", self->priv->segment_template,
+        SEGMENT_INDEX_TOKEN, SEGMENT_TIME_TOKEN);
+    location = kms_av_muxer_add_index_token (location);
+  }
+
+  return location;
+}
+
+static gchar *
+kms_av_muxer_expand_segment_location (const gchar * location, guint index)
+{
+  GString *str = g_string_new (NULL);
+  const gchar *p = location;
+
+  while (*p != '\0') {
+    if (g_str_has_prefix (p, SEGMENT_INDEX_TOKEN)) {
+      g_string_append_printf (str, "%05u", index);
+      p += strlen (SEGMENT_INDEX_TOKEN);
+    } else if (g_str_has_prefix (p, SEGMENT_TIME_TOKEN)) {
+      GDateTime *now = g_date_time_new_now_utc ();
+      gchar *time = g_date_time_format (now, "%Y%m%dT%H%M%SZ");
+
+      g_string_append (str, time);
+      g_free (time);
+      g_date_time_unref (now);
+      p += strlen (SEGMENT_TIME_TOKEN);
+    } else {
+      g_string_append_c (str, *p++);
+    }
+  }
+
+  return g_string_free (str, FALSE);
+}
+
+static gchar *
+kms_av_muxer_format_location (GstElement * splitmux, guint fragment_id,
+    gpointer user_data)
+{
+  KmsAVMuxer *self = KMS_AV_MUXER (user_data);
+  gchar *template, *location;
+
+  template = kms_av_muxer_get_segment_location (self);
+  location = kms_av_muxer_expand_segment_location (template, fragment_id);
+  g_free (template);
+
+  GST_DEBUG_OBJECT (self, "Opening segment %s", location);
+
+  /* Previous fragment is finished before the next one is opened */
+  kms_av_muxer_close_segment (self, gst_filename_to_uri (location, NULL));
+
+  return location;
+}
+
 static GstElement *
 kms_av_muxer_create_muxer (KmsAVMuxer * self)
 {
@@ -157,17 +447,21 @@ kms_av_muxer_create_muxer (KmsAVMuxer * self)
     case KMS_RECORDING_PROFILE_MP4_VIDEO_ONLY:
     case KMS_RECORDING_PROFILE_MP4_AUDIO_ONLY:{
       GstElement *mux = gst_element_factory_make ("mp4mux", NULL);
-      GstElementFactory *file_sink_factory =
-          gst_element_factory_find ("filesink");
-      GstElementFactory *sink_factory =
-          gst_element_get_factory (self->priv->sink);
 
-      if ((gst_element_factory_get_element_type (sink_factory) !=
-              gst_element_factory_get_element_type (file_sink_factory))) {
+      if (self->priv->fragment_duration > 0) {
+        /* Each fragment is written as soon as it is complete and the header
+         * is never rewritten, so nothing is held for the whole recording
+         * and non seekable sinks get the file progressively */
+        g_object_set (mux, "streamable", TRUE, "fragment-duration",
+            self->priv->fragment_duration, NULL);
+        return mux;
+      }
+
+      /* Local files can be seeked to rewrite the header at the end */
+      if (!gst_uri_has_protocol (KMS_BASE_MEDIA_MUXER_GET_URI (self), "file")) {
         g_object_set (mux, "faststart", TRUE, NULL);
       }
 
-      g_object_unref (file_sink_factory);
       return mux;
     }
     case KMS_RECORDING_PROFILE_JPEG_VIDEO_ONLY:
@@ -180,11 +474,14 @@ kms_av_muxer_create_muxer (KmsAVMuxer * self)
 
 static const gchar *
 kms_av_muxer_get_sink_pad_name (KmsRecordingProfile profile,
-    KmsElementPadType type)
+    KmsElementPadType type, gboolean segmented)
 {
   if (type == KMS_ELEMENT_PAD_TYPE_VIDEO) {
     if (profile == KMS_RECORDING_PROFILE_JPEG_VIDEO_ONLY) {
       return "sink";
+    } else if (segmented) {
+      /* splitmuxsink cuts files on key frames of its only video pad */
+      return "video";
     } else {
       return "video_%u";
     }
@@ -198,6 +495,9 @@ kms_av_muxer_get_sink_pad_name (KmsRecordingProfile profile,
 static void
 kms_av_muxer_prepare_pipeline (KmsAVMuxer * self)
 {
+  gboolean segmented = kms_av_muxer_is_segmented (self);
+  GstElement *target;
+
   self->priv->videosrc = gst_element_factory_make ("appsrc", "videoSrc");
   self->priv->audiosrc = gst_element_factory_make ("appsrc", "audioSrc");
 
@@ -212,31 +512,48 @@ kms_av_muxer_prepare_pipeline (KmsAVMuxer * self)
 
   self->priv->mux = kms_av_muxer_create_muxer (self);
 
-  gst_bin_add_many (GST_BIN (KMS_BASE_MEDIA_MUXER_GET_PIPELINE (self)),
-      self->priv->videosrc, self->priv->audiosrc, self->priv->mux,
-      self->priv->sink, NULL);
+  if (segmented) {
+    /* Muxer and sink are restarted for every segment by splitmuxsink */
+    self->priv->splitmux = gst_element_factory_make ("splitmuxsink", NULL);
+    g_object_set (self->priv->splitmux, "muxer", self->priv->mux, "sink",
+        self->priv->sink, "max-size-time", self->priv->segment_duration,
+        "max-size-bytes", self->priv->segment_size, NULL);
+    g_signal_connect (self->priv->splitmux, "format-location",
+        G_CALLBACK (kms_av_muxer_format_location), self);
+
+    gst_bin_add_many (GST_BIN (KMS_BASE_MEDIA_MUXER_GET_PIPELINE (self)),
+        self->priv->videosrc, self->priv->audiosrc, self->priv->splitmux, NULL);
+    target = self->priv->splitmux;
+  } else {
+    gst_bin_add_many (GST_BIN (KMS_BASE_MEDIA_MUXER_GET_PIPELINE (self)),
+        self->priv->videosrc, self->priv->audiosrc, self->priv->mux,
+        self->priv->sink, NULL);
+
+    if (!gst_element_link (self->priv->mux, self->priv->sink)) {
+      GST_ERROR_OBJECT (self, "Could not link elements: %"
+          GST_PTR_FORMAT ", %" GST_PTR_FORMAT, self->priv->mux,
+          self->priv->sink);
+    }
 
-  if (!gst_element_link (self->priv->mux, self->priv->sink)) {
-    GST_ERROR_OBJECT (self, "Could not link elements: %"
-        GST_PTR_FORMAT ", %" GST_PTR_FORMAT, self->priv->mux, self->priv->sink);
+    target = self->priv->mux;
   }
 
   if (kms_recording_profile_supports_type (KMS_BASE_MEDIA_MUXER_GET_PROFILE
           (self), KMS_ELEMENT_PAD_TYPE_VIDEO)) {
     const gchar *pad_name =
         kms_av_muxer_get_sink_pad_name (KMS_BASE_MEDIA_MUXER_GET_PROFILE (self),
-        KMS_ELEMENT_PAD_TYPE_VIDEO);
+        KMS_ELEMENT_PAD_TYPE_VIDEO, segmented);
 
     if (pad_name == NULL) {
       GST_ERROR_OBJECT (self, "Unsupported pad for recording");
       return;
     }
 
-    if (!gst_element_link_pads (self->priv->videosrc, "src", self->priv->mux,
+    if (!gst_element_link_pads (self->priv->videosrc, "src", target,
             pad_name)) {
       GST_ERROR_OBJECT (self,
           "Could not link elements: %" GST_PTR_FORMAT ", %" GST_PTR_FORMAT,
-          self->priv->videosrc, self->priv->mux);
+          self->priv->videosrc, target);
     }
   }
 
@@ -244,22 +561,59 @@ kms_av_muxer_prepare_pipeline (KmsAVMuxer * self)
           (self), KMS_ELEMENT_PAD_TYPE_AUDIO)) {
     const gchar *pad_name =
         kms_av_muxer_get_sink_pad_name (KMS_BASE_MEDIA_MUXER_GET_PROFILE (self),
-        KMS_ELEMENT_PAD_TYPE_AUDIO);
+        KMS_ELEMENT_PAD_TYPE_AUDIO, segmented);
 
     if (pad_name == NULL) {
       GST_ERROR_OBJECT (self, "Unsupported pad for recording");
       return;
     }
 
-    if (!gst_element_link_pads (self->priv->audiosrc, "src", self->priv->mux,
+    if (!gst_element_link_pads (self->priv->audiosrc, "src", target,
             pad_name)) {
       GST_ERROR_OBJECT (self,
           "Could not link elements: %" GST_PTR_FORMAT ", %" GST_PTR_FORMAT,
-          self->priv->audiosrc, self->priv->mux);
+          self->priv->audiosrc, target);
     }
   }
 }
 
+gboolean
+kms_av_muxer_bind_uri (KmsAVMuxer * self, const gchar * uri)
+{
+  gboolean ret = FALSE;
+  gchar *location;
+
+  g_return_val_if_fail (KMS_IS_AV_MUXER (self), FALSE);
+
+  KMS_BASE_MEDIA_MUXER_LOCK (self);
+
+  if (self->priv->splitmux != NULL || uri == NULL ||
+      !gst_uri_has_protocol (uri, "file") ||
+      !gst_uri_has_protocol (KMS_BASE_MEDIA_MUXER_GET_URI (self), "file")) {
+    GST_WARNING_OBJECT (self, "Can not bind uri %s", uri);
+    goto end;
+  }
+
+  if (GST_STATE (KMS_BASE_MEDIA_MUXER_GET_PIPELINE (self)) > GST_STATE_READY) {
+    GST_WARNING_OBJECT (self, "Can not bind uri %s after starting", uri);
+    goto end;
+  }
+
+  /* Sink and muxer only depend on the protocol, so the file is the only
+   * thing that changes */
+  location = gst_uri_get_location (uri);
+  g_object_set (self->priv->sink, "location", location, NULL);
+  g_free (location);
+
+  g_object_set (self, KMS_BASE_MEDIA_MUXER_URI, uri, NULL);
+  ret = TRUE;
+
+end:
+  KMS_BASE_MEDIA_MUXER_UNLOCK (self);
+
+  return ret;
+}
+
 KmsAVMuxer *
 kms_av_muxer_new (const char *optname1, ...)
 {
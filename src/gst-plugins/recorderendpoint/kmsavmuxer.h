@@ -40,6 +40,10 @@ G_BEGIN_DECLS
   KMS_TYPE_AV_MUXER))
 
 #define KMS_AV_MUXER_PROFILE "profile"
+#define KMS_AV_MUXER_SEGMENT_DURATION "segment-duration"
+#define KMS_AV_MUXER_SEGMENT_SIZE "segment-size"
+#define KMS_AV_MUXER_SEGMENT_TEMPLATE "segment-template"
+#define KMS_AV_MUXER_FRAGMENT_DURATION "fragment-duration"
 
 typedef struct _KmsAVMuxer KmsAVMuxer;
 typedef struct _KmsAVMuxerClass KmsAVMuxerClass;
@@ -56,11 +60,18 @@ struct _KmsAVMuxer
 struct _KmsAVMuxerClass
 {
   KmsBaseMediaMuxerClass parent_class;
+
+  /* <signals> */
+  void (*on_segment_closed) (KmsAVMuxer *obj, const gchar *uri);
 };
 
 GType kms_av_muxer_get_type ();
 
 KmsAVMuxer * kms_av_muxer_new (const char *optname1, ...);
 
+/* Makes a muxer that has not been started yet record to another file uri.
+ * Only muxers created for a file uri and not segmented can be bound again */
+gboolean kms_av_muxer_bind_uri (KmsAVMuxer * self, const gchar * uri);
+
 G_END_DECLS
 #endif
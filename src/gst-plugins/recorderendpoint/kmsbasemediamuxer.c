@@ -24,6 +24,7 @@
 #include <commons/kms-core-enumtypes.h>
 
 #include "kmsbasemediamuxer.h"
+#include "kmsasyncfilesink.h"
 
 #define OBJECT_NAME "basemediamuxer"
 
@@ -38,6 +39,7 @@ G_DEFINE_TYPE_WITH_CODE (KmsBaseMediaMuxer, kms_base_media_muxer, G_TYPE_OBJECT,
 
 #define HTTP_PROTO "http"
 #define HTTPS_PROTO "https"
+#define FILE_PROTO "file"
 
 #define MEGA_BYTES(n) ((n) * 1000000)
 
@@ -166,7 +168,14 @@ kms_base_media_muxer_get_sink (KmsBaseMediaMuxer * self, const gchar * uri)
     goto invalid_uri;
   }
 
-  sink = gst_element_make_from_uri (GST_URI_SINK, uri, NULL, &err);
+  if (gst_uri_has_protocol (uri, FILE_PROTO)) {
+    /* Disk writes are done out of the muxer streaming thread */
+    sink = gst_element_factory_make (KMS_ASYNC_FILE_SINK_NAME, NULL);
+  }
+
+  if (sink == NULL) {
+    sink = gst_element_make_from_uri (GST_URI_SINK, uri, NULL, &err);
+  }
 
   if (sink == NULL) {
     /* Some elements have no URI handling capabilities though they can */
@@ -183,8 +192,10 @@ kms_base_media_muxer_get_sink (KmsBaseMediaMuxer * self, const gchar * uri)
 
   pspec = g_object_class_find_property (sink_class, "location");
   if (pspec != NULL && G_PARAM_SPEC_VALUE_TYPE (pspec) == G_TYPE_STRING) {
-    if (g_strcmp0 (GST_OBJECT_NAME (gst_element_get_factory (sink)),
-            "filesink") == 0) {
+    const gchar *factory = GST_OBJECT_NAME (gst_element_get_factory (sink));
+
+    if (g_strcmp0 (factory, "filesink") == 0
+        || g_strcmp0 (factory, KMS_ASYNC_FILE_SINK_NAME) == 0) {
       /* Work around for filesink elements */
       gchar *location = gst_uri_get_location (uri);
 
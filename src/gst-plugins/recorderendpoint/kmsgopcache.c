@@ -0,0 +1,191 @@
+/*
+ * (C) Copyright 2016 Kurento (http://kurento.org/)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "kmsgopcache.h"
+
+#define GST_DEFAULT_NAME "kmsgopcache"
+#define GST_CAT_DEFAULT kms_gop_cache_debug
+GST_DEBUG_CATEGORY_STATIC (GST_CAT_DEFAULT);
+
+struct _KmsGopCache
+{
+  GMutex mutex;
+  GQueue buffers;
+  gsize size;
+  gsize max_bytes;
+};
+
+static void
+kms_gop_cache_init_debug (void)
+{
+  static gsize done = 0;
+
+  if (g_once_init_enter (&done)) {
+    GST_DEBUG_CATEGORY_INIT (GST_CAT_DEFAULT, GST_DEFAULT_NAME, 0,
+        GST_DEFAULT_NAME);
+    g_once_init_leave (&done, 1);
+  }
+}
+
+KmsGopCache *
+kms_gop_cache_new (gsize max_bytes)
+{
+  KmsGopCache *self;
+
+  kms_gop_cache_init_debug ();
+
+  self = g_slice_new0 (KmsGopCache);
+  g_mutex_init (&self->mutex);
+  g_queue_init (&self->buffers);
+  self->max_bytes = max_bytes;
+
+  return self;
+}
+
+static void
+kms_gop_cache_clear_unlocked (KmsGopCache * self)
+{
+  g_queue_foreach (&self->buffers, (GFunc) gst_mini_object_unref, NULL);
+  g_queue_clear (&self->buffers);
+  self->size = 0;
+}
+
+void
+kms_gop_cache_destroy (KmsGopCache * self)
+{
+  kms_gop_cache_clear_unlocked (self);
+  g_mutex_clear (&self->mutex);
+
+  g_slice_free (KmsGopCache, self);
+}
+
+static void
+kms_gop_cache_add_unlocked (KmsGopCache * self, const GstSegment * segment,
+    GstBuffer * buffer)
+{
+  gsize size = gst_buffer_get_size (buffer);
+
+  if (!GST_BUFFER_FLAG_IS_SET (buffer, GST_BUFFER_FLAG_DELTA_UNIT)) {
+    /* A new group of pictures begins */
+    kms_gop_cache_clear_unlocked (self);
+  } else if (g_queue_is_empty (&self->buffers)) {
+    /* Nothing can be decoded until the next key frame */
+    return;
+  }
+
+  if (self->size + size > self->max_bytes) {
+    GST_DEBUG ("Group of pictures bigger than %" G_GSIZE_FORMAT " bytes, "
+        "waiting for next key frame", self->max_bytes);
+    kms_gop_cache_clear_unlocked (self);
+    return;
+  }
+
+  /* Only metadata is copied, memory is shared with the original buffer */
+  buffer = gst_buffer_copy (buffer);
+
+  if (GST_BUFFER_PTS_IS_VALID (buffer)) {
+    GST_BUFFER_PTS (buffer) = gst_segment_to_running_time (segment,
+        GST_FORMAT_TIME, GST_BUFFER_PTS (buffer));
+  }
+
+  if (GST_BUFFER_DTS_IS_VALID (buffer)) {
+    GST_BUFFER_DTS (buffer) = gst_segment_to_running_time (segment,
+        GST_FORMAT_TIME, GST_BUFFER_DTS (buffer));
+  }
+
+  g_queue_push_tail (&self->buffers, buffer);
+  self->size += size;
+}
+
+void
+kms_gop_cache_add (KmsGopCache * self, const GstSegment * segment,
+    GstBuffer * buffer)
+{
+  g_mutex_lock (&self->mutex);
+  kms_gop_cache_add_unlocked (self, segment, buffer);
+  g_mutex_unlock (&self->mutex);
+}
+
+void
+kms_gop_cache_add_list (KmsGopCache * self, const GstSegment * segment,
+    GstBufferList * list)
+{
+  guint i, len = gst_buffer_list_length (list);
+
+  g_mutex_lock (&self->mutex);
+
+  for (i = 0; i < len; i++) {
+    kms_gop_cache_add_unlocked (self, segment, gst_buffer_list_get (list, i));
+  }
+
+  g_mutex_unlock (&self->mutex);
+}
+
+gboolean
+kms_gop_cache_get_start (KmsGopCache * self, GstClockTime * pts,
+    GstClockTime * dts)
+{
+  GstBuffer *key;
+
+  g_mutex_lock (&self->mutex);
+
+  key = g_queue_peek_head (&self->buffers);
+
+  if (key != NULL) {
+    *pts = GST_BUFFER_PTS (key);
+    *dts = GST_BUFFER_DTS (key);
+  }
+
+  g_mutex_unlock (&self->mutex);
+
+  return key != NULL;
+}
+
+GstBufferList *
+kms_gop_cache_take (KmsGopCache * self)
+{
+  GstBufferList *list = NULL;
+  GstBuffer *buffer;
+
+  g_mutex_lock (&self->mutex);
+
+  if (!g_queue_is_empty (&self->buffers)) {
+    list = gst_buffer_list_new_sized (g_queue_get_length (&self->buffers));
+
+    while ((buffer = g_queue_pop_head (&self->buffers)) != NULL) {
+      gst_buffer_list_add (list, buffer);
+    }
+
+    self->size = 0;
+  }
+
+  g_mutex_unlock (&self->mutex);
+
+  return list;
+}
+
+void
+kms_gop_cache_clear (KmsGopCache * self)
+{
+  g_mutex_lock (&self->mutex);
+  kms_gop_cache_clear_unlocked (self);
+  g_mutex_unlock (&self->mutex);
+}
@@ -0,0 +1,47 @@
+/*
+ * (C) Copyright 2016 Kurento (http://kurento.org/)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+#ifndef __KMS_GOP_CACHE_H__
+#define __KMS_GOP_CACHE_H__
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+typedef struct _KmsGopCache KmsGopCache;
+
+/* Keeps the compressed video received since the last key frame, so that a
+ * recording can start from it instead of waiting for the next one. The
+ * group of pictures is discarded if it grows over @max_bytes */
+KmsGopCache * kms_gop_cache_new (gsize max_bytes);
+void kms_gop_cache_destroy (KmsGopCache * self);
+
+/* Adds @buffer with its timestamps converted to running time */
+void kms_gop_cache_add (KmsGopCache * self, const GstSegment * segment,
+    GstBuffer * buffer);
+void kms_gop_cache_add_list (KmsGopCache * self, const GstSegment * segment,
+    GstBufferList * list);
+
+/* Running time of the cached key frame. FALSE if there is none */
+gboolean kms_gop_cache_get_start (KmsGopCache * self, GstClockTime * pts,
+    GstClockTime * dts);
+
+/* Returns the cached buffers, key frame first, or NULL if it is empty */
+GstBufferList * kms_gop_cache_take (KmsGopCache * self);
+void kms_gop_cache_clear (KmsGopCache * self);
+
+G_END_DECLS
+#endif /* __KMS_GOP_CACHE_H__ */
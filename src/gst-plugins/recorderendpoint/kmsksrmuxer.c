@@ -78,7 +78,7 @@ kms_ksr_muxer_add_src (KmsBaseMediaMuxer * obj, KmsMediaType type,
     const gchar * id)
 {
   KmsKSRMuxer *self = KMS_KSR_MUXER (obj);
-  GstElement *appsrc = NULL;
+  GstElement *appsrc;
   gchar *padname;
 
   KMS_BASE_MEDIA_MUXER_LOCK (self);
@@ -95,22 +95,33 @@ kms_ksr_muxer_add_src (KmsBaseMediaMuxer * obj, KmsMediaType type,
         break;
       default:
         GST_WARNING_OBJECT (obj, "Unsupported media type %u", type);
-        goto end;
+        KMS_BASE_MEDIA_MUXER_UNLOCK (self);
+        return NULL;
     }
 
     g_hash_table_insert (self->priv->tracks, g_strdup (id), padname);
   }
 
+  padname = g_strdup (padname);
+
+  KMS_BASE_MEDIA_MUXER_UNLOCK (self);
+
+  /* Every track owns a different muxer pad, so the lock only protects the
+   * track table. Tracks joining a big recording do not wait for each other
+   * to be linked and started. Interleaving is still done by ksrmux. */
   appsrc = gst_element_factory_make ("appsrc", NULL);
   g_object_set (appsrc, "block", TRUE, "format", GST_FORMAT_TIME, NULL);
 
   gst_bin_add (GST_BIN (KMS_BASE_MEDIA_MUXER_GET_PIPELINE (self)), appsrc);
 
-  gst_element_link_pads (appsrc, "src", self->priv->mux, padname);
+  if (!gst_element_link_pads (appsrc, "src", self->priv->mux, padname)) {
+    GST_ERROR_OBJECT (self, "Can not link %" GST_PTR_FORMAT " to pad %s",
+        appsrc, padname);
+  }
+
   gst_element_sync_state_with_parent (appsrc);
 
-end:
-  KMS_BASE_MEDIA_MUXER_UNLOCK (self);
+  g_free (padname);
 
   return appsrc;
 }
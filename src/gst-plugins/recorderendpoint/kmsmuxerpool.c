@@ -0,0 +1,234 @@
+/*
+ * (C) Copyright 2016 Kurento (http://kurento.org/)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "kmsmuxerpool.h"
+#include "kmsavmuxer.h"
+
+#define GST_DEFAULT_NAME "kmsmuxerpool"
+#define GST_CAT_DEFAULT kms_muxer_pool_debug
+GST_DEBUG_CATEGORY_STATIC (GST_CAT_DEFAULT);
+
+/* Muxers are bound to the real file when they are taken from the pool */
+#define PLACEHOLDER_URI "file:///dev/null"
+#define BUILDER_THREADS 2
+
+typedef struct _KmsMuxerPoolEntry
+{
+  GQueue ready;
+  guint building;
+} KmsMuxerPoolEntry;
+
+typedef struct _KmsMuxerPool
+{
+  GMutex mutex;
+  guint size;
+  gint hits;
+  GHashTable *entries;          /* profile -> KmsMuxerPoolEntry */
+  GThreadPool *builders;
+} KmsMuxerPool;
+
+static void
+kms_muxer_pool_entry_destroy (KmsMuxerPoolEntry * entry)
+{
+  g_queue_foreach (&entry->ready, (GFunc) g_object_unref, NULL);
+  g_queue_clear (&entry->ready);
+  g_slice_free (KmsMuxerPoolEntry, entry);
+}
+
+static KmsMuxerPoolEntry *
+kms_muxer_pool_get_entry (KmsMuxerPool * pool, KmsRecordingProfile profile)
+{
+  KmsMuxerPoolEntry *entry;
+
+  entry = g_hash_table_lookup (pool->entries, GINT_TO_POINTER (profile));
+
+  if (entry == NULL) {
+    entry = g_slice_new0 (KmsMuxerPoolEntry);
+    g_queue_init (&entry->ready);
+    g_hash_table_insert (pool->entries, GINT_TO_POINTER (profile), entry);
+  }
+
+  return entry;
+}
+
+static void
+kms_muxer_pool_build (gpointer data, gpointer user_data)
+{
+  KmsMuxerPool *pool = user_data;
+  KmsRecordingProfile profile = GPOINTER_TO_INT (data) - 1;
+  KmsMuxerPoolEntry *entry;
+  KmsBaseMediaMuxer *mux;
+
+  mux = KMS_BASE_MEDIA_MUXER (kms_av_muxer_new (KMS_BASE_MEDIA_MUXER_PROFILE,
+          profile, KMS_BASE_MEDIA_MUXER_URI, PLACEHOLDER_URI, NULL));
+
+  /* Elements are checked and allocated, but nothing is opened until the
+   * muxer is bound to its file and started */
+  if (kms_base_media_muxer_set_state (mux,
+          GST_STATE_READY) == GST_STATE_CHANGE_FAILURE) {
+    GST_WARNING ("Can not prepare muxer for profile %d", profile);
+    g_clear_object (&mux);
+  }
+
+  g_mutex_lock (&pool->mutex);
+
+  entry = kms_muxer_pool_get_entry (pool, profile);
+  entry->building--;
+
+  if (mux != NULL && g_queue_get_length (&entry->ready) < pool->size) {
+    g_queue_push_tail (&entry->ready, mux);
+    mux = NULL;
+  }
+
+  g_mutex_unlock (&pool->mutex);
+
+  g_clear_object (&mux);
+}
+
+static KmsMuxerPool *
+kms_muxer_pool_get (void)
+{
+  static gsize pool = 0;
+
+  if (g_once_init_enter (&pool)) {
+    KmsMuxerPool *self = g_slice_new0 (KmsMuxerPool);
+
+    GST_DEBUG_CATEGORY_INIT (GST_CAT_DEFAULT, GST_DEFAULT_NAME, 0,
+        GST_DEFAULT_NAME);
+
+    g_mutex_init (&self->mutex);
+    self->size = KMS_MUXER_POOL_DEFAULT_SIZE;
+    self->entries = g_hash_table_new_full (NULL, NULL, NULL,
+        (GDestroyNotify) kms_muxer_pool_entry_destroy);
+    self->builders = g_thread_pool_new (kms_muxer_pool_build, self,
+        BUILDER_THREADS, FALSE, NULL);
+
+    g_once_init_leave (&pool, (gsize) self);
+  }
+
+  return (KmsMuxerPool *) pool;
+}
+
+/* Must be called with the pool mutex held */
+static void
+kms_muxer_pool_refill (KmsMuxerPool * pool, KmsRecordingProfile profile,
+    KmsMuxerPoolEntry * entry)
+{
+  while (g_queue_get_length (&entry->ready) + entry->building < pool->size) {
+    entry->building++;
+    g_thread_pool_push (pool->builders, GINT_TO_POINTER (profile + 1), NULL);
+  }
+}
+
+void
+kms_muxer_pool_set_size (guint size)
+{
+  KmsMuxerPool *pool = kms_muxer_pool_get ();
+  GSList *unused = NULL;
+  GHashTableIter iter;
+  gpointer entry;
+
+  g_mutex_lock (&pool->mutex);
+
+  GST_DEBUG ("Keeping %u muxers per profile", size);
+  pool->size = size;
+
+  g_hash_table_iter_init (&iter, pool->entries);
+
+  while (g_hash_table_iter_next (&iter, NULL, &entry)) {
+    KmsMuxerPoolEntry *e = entry;
+
+    while (g_queue_get_length (&e->ready) > size) {
+      unused = g_slist_prepend (unused, g_queue_pop_tail (&e->ready));
+    }
+  }
+
+  g_mutex_unlock (&pool->mutex);
+
+  g_slist_free_full (unused, g_object_unref);
+}
+
+guint
+kms_muxer_pool_get_size (void)
+{
+  KmsMuxerPool *pool = kms_muxer_pool_get ();
+  guint size;
+
+  g_mutex_lock (&pool->mutex);
+  size = pool->size;
+  g_mutex_unlock (&pool->mutex);
+
+  return size;
+}
+
+guint
+kms_muxer_pool_get_hits (void)
+{
+  KmsMuxerPool *pool = kms_muxer_pool_get ();
+
+  return g_atomic_int_get (&pool->hits);
+}
+
+KmsBaseMediaMuxer *
+kms_muxer_pool_acquire (KmsRecordingProfile profile, const gchar * uri)
+{
+  KmsMuxerPool *pool = kms_muxer_pool_get ();
+  KmsMuxerPoolEntry *entry;
+  KmsBaseMediaMuxer *mux;
+  GstBus *bus;
+
+  g_return_val_if_fail (profile != KMS_RECORDING_PROFILE_KSR, NULL);
+
+  g_mutex_lock (&pool->mutex);
+
+  if (pool->size == 0) {
+    g_mutex_unlock (&pool->mutex);
+    return NULL;
+  }
+
+  /* Profiles are prepared once they have been requested */
+  entry = kms_muxer_pool_get_entry (pool, profile);
+  mux = g_queue_pop_head (&entry->ready);
+  kms_muxer_pool_refill (pool, profile, entry);
+
+  g_mutex_unlock (&pool->mutex);
+
+  if (mux == NULL) {
+    GST_DEBUG ("No muxer ready for profile %d", profile);
+    return NULL;
+  }
+
+  if (!kms_av_muxer_bind_uri (KMS_AV_MUXER (mux), uri)) {
+    g_object_unref (mux);
+    return NULL;
+  }
+
+  /* Drop the messages posted while it was waiting in the pool */
+  bus = kms_base_media_muxer_get_bus (mux);
+  gst_bus_set_flushing (bus, TRUE);
+  gst_bus_set_flushing (bus, FALSE);
+  g_object_unref (bus);
+
+  GST_DEBUG_OBJECT (mux, "Bound to %s", uri);
+  g_atomic_int_inc (&pool->hits);
+
+  return mux;
+}
@@ -0,0 +1,44 @@
+/*
+ * (C) Copyright 2016 Kurento (http://kurento.org/)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+#ifndef __KMS_MUXER_POOL_H__
+#define __KMS_MUXER_POOL_H__
+
+#include <gst/gst.h>
+#include <commons/kmsrecordingprofile.h>
+
+#include "kmsbasemediamuxer.h"
+
+G_BEGIN_DECLS
+
+/* 0 disables the pool */
+#define KMS_MUXER_POOL_DEFAULT_SIZE 0
+
+/* Number of muxers kept built and ready for every audio and video profile
+ * that has been recorded. It is shared by all the recorders of the process */
+void kms_muxer_pool_set_size (guint size);
+guint kms_muxer_pool_get_size (void);
+
+/* Muxers taken from the pool since the process started */
+guint kms_muxer_pool_get_hits (void);
+
+/* Returns a muxer for @profile that records to the file @uri, or NULL if
+ * none is ready. Muxers taken are replaced in the background */
+KmsBaseMediaMuxer * kms_muxer_pool_acquire (KmsRecordingProfile profile,
+    const gchar * uri);
+
+G_END_DECLS
+#endif /* __KMS_MUXER_POOL_H__ */
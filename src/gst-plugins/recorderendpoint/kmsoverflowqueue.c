@@ -0,0 +1,573 @@
+/*
+ * (C) Copyright 2016 Kurento (http://kurento.org/)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#define _GNU_SOURCE             /* pread, pwrite, ftruncate */
+
+#include <errno.h>
+#include <unistd.h>
+#include <glib/gstdio.h>
+
+#include "kmsoverflowqueue.h"
+
+#define GST_DEFAULT_NAME "kmsoverflowqueue"
+#define GST_CAT_DEFAULT kms_overflow_queue_debug
+GST_DEBUG_CATEGORY_STATIC (GST_CAT_DEFAULT);
+
+#define KMS_OVERFLOW_QUEUE_KEY "kms-overflow-queue"
+G_DEFINE_QUARK (KMS_OVERFLOW_QUEUE_KEY, kms_overflow_queue_key);
+
+#define SPILL_TEMPLATE "kms-recorder-spill-XXXXXX"
+
+/* Header stored in the spill file before the data of each buffer */
+typedef struct _KmsSpillHeader
+{
+  GstClockTime pts;
+  GstClockTime dts;
+  GstClockTime duration;
+  guint32 flags;
+  guint32 size;
+} KmsSpillHeader;
+
+struct _KmsOverflowQueue
+{
+  KmsOverflowPolicy policy;
+  guint64 max_bytes;
+  GstClockTime max_time;
+  gchar *spill_dir;
+  guint64 spill_max_bytes;
+
+  GMutex mutex;
+
+  /* Running time of the last buffer that entered and left the appsrc */
+  GstClockTime last_in;
+  GstClockTime last_out;
+
+  gboolean dropping;
+  gboolean discont;
+
+  gint spill_fd;
+  guint64 spill_read;
+  guint64 spill_write;
+  gboolean spill_discont;
+  gboolean eos_pending;
+
+  guint64 dropped_buffers;
+  guint64 dropped_bytes;
+  guint64 spilled_buffers;
+  guint64 spilled_bytes;
+};
+
+GType
+kms_overflow_policy_get_type (void)
+{
+  static gsize type = 0;
+
+  if (g_once_init_enter (&type)) {
+    static const GEnumValue values[] = {
+      {KMS_OVERFLOW_POLICY_BLOCK, "Block the upstream thread", "block"},
+      {KMS_OVERFLOW_POLICY_DROP_UNTIL_KEYFRAME,
+          "Drop media until the next key frame", "drop-until-keyframe"},
+      {KMS_OVERFLOW_POLICY_SPILL, "Spill media to a temporary file", "spill"},
+      {0, NULL, NULL}
+    };
+    GType t = g_enum_register_static ("KmsOverflowPolicy", values);
+
+    g_once_init_leave (&type, t);
+  }
+
+  return type;
+}
+
+static void
+kms_overflow_queue_init_debug (void)
+{
+  static gsize done = 0;
+
+  if (g_once_init_enter (&done)) {
+    GST_DEBUG_CATEGORY_INIT (GST_CAT_DEFAULT, GST_DEFAULT_NAME, 0,
+        GST_DEFAULT_NAME);
+    g_once_init_leave (&done, 1);
+  }
+}
+
+static GstClockTime
+buffer_time (GstBuffer * buffer)
+{
+  return GST_BUFFER_DTS_IS_VALID (buffer) ? GST_BUFFER_DTS (buffer) :
+      GST_BUFFER_PTS (buffer);
+}
+
+static void
+kms_overflow_queue_destroy (KmsOverflowQueue * self)
+{
+  if (self->spill_fd >= 0) {
+    close (self->spill_fd);
+  }
+
+  g_free (self->spill_dir);
+  g_mutex_clear (&self->mutex);
+
+  g_slice_free (KmsOverflowQueue, self);
+}
+
+/* Must be called with the mutex held */
+static gboolean
+kms_overflow_queue_is_spilling (KmsOverflowQueue * self)
+{
+  return self->spill_read < self->spill_write;
+}
+
+/* Must be called with the mutex held */
+static gboolean
+kms_overflow_queue_over_budget (KmsOverflowQueue * self, GstAppSrc * appsrc)
+{
+  if (self->max_bytes > 0 &&
+      gst_app_src_get_current_level_bytes (appsrc) >= self->max_bytes) {
+    return TRUE;
+  }
+
+  return self->max_time > 0 && GST_CLOCK_TIME_IS_VALID (self->last_in) &&
+      GST_CLOCK_TIME_IS_VALID (self->last_out) &&
+      self->last_in > self->last_out &&
+      self->last_in - self->last_out >= self->max_time;
+}
+
+/* Must be called with the mutex held */
+static GstFlowReturn
+kms_overflow_queue_push_to_appsrc (KmsOverflowQueue * self,
+    GstAppSrc * appsrc, GstBuffer * buffer)
+{
+  if (self->discont) {
+    buffer = gst_buffer_make_writable (buffer);
+    GST_BUFFER_FLAG_SET (buffer, GST_BUFFER_FLAG_DISCONT);
+    self->discont = FALSE;
+  }
+
+  if (GST_CLOCK_TIME_IS_VALID (buffer_time (buffer))) {
+    self->last_in = buffer_time (buffer);
+  }
+
+  return gst_app_src_push_buffer (appsrc, buffer);
+}
+
+/* Must be called with the mutex held */
+static gboolean
+kms_overflow_queue_spill (KmsOverflowQueue * self, GstBuffer * buffer)
+{
+  KmsSpillHeader header;
+  GstMapInfo info;
+  gboolean ret = FALSE;
+
+  if (self->spill_max_bytes > 0 && self->spill_write + sizeof (header) +
+      gst_buffer_get_size (buffer) > self->spill_max_bytes) {
+    return FALSE;
+  }
+
+  if (self->spill_fd < 0) {
+    gchar *path = g_build_filename (self->spill_dir, SPILL_TEMPLATE, NULL);
+
+    self->spill_fd = g_mkstemp (path);
+
+    if (self->spill_fd < 0) {
+      GST_ERROR ("Can not create spill file %s: %s", path,
+          g_strerror (errno));
+      g_free (path);
+      return FALSE;
+    }
+
+    /* Nothing is left on disk when the file is closed */
+    g_unlink (path);
+    g_free (path);
+  }
+
+  if (!gst_buffer_map (buffer, &info, GST_MAP_READ)) {
+    return FALSE;
+  }
+
+  header.pts = GST_BUFFER_PTS (buffer);
+  header.dts = GST_BUFFER_DTS (buffer);
+  header.duration = GST_BUFFER_DURATION (buffer);
+  header.flags = GST_BUFFER_FLAGS (buffer);
+  header.size = info.size;
+
+  if (self->spill_discont) {
+    header.flags |= GST_BUFFER_FLAG_DISCONT;
+  }
+
+  if (pwrite (self->spill_fd, &header, sizeof (header),
+          self->spill_write) == sizeof (header) &&
+      pwrite (self->spill_fd, info.data, info.size,
+          self->spill_write + sizeof (header)) == (gssize) info.size) {
+    self->spill_write += sizeof (header) + info.size;
+    self->spill_discont = FALSE;
+    self->spilled_buffers++;
+    self->spilled_bytes += info.size;
+    ret = TRUE;
+  } else {
+    GST_ERROR ("Can not write to spill file: %s", g_strerror (errno));
+  }
+
+  gst_buffer_unmap (buffer, &info);
+
+  return ret;
+}
+
+/* Must be called with the mutex held */
+static GstBuffer *
+kms_overflow_queue_unspill (KmsOverflowQueue * self)
+{
+  KmsSpillHeader header;
+  GstBuffer *buffer;
+  GstMapInfo info;
+
+  if (pread (self->spill_fd, &header, sizeof (header),
+          self->spill_read) != sizeof (header)) {
+    return NULL;
+  }
+
+  buffer = gst_buffer_new_allocate (NULL, header.size, NULL);
+  gst_buffer_map (buffer, &info, GST_MAP_WRITE);
+
+  if (pread (self->spill_fd, info.data, header.size,
+          self->spill_read + sizeof (header)) != header.size) {
+    gst_buffer_unmap (buffer, &info);
+    gst_buffer_unref (buffer);
+    return NULL;
+  }
+
+  gst_buffer_unmap (buffer, &info);
+
+  GST_BUFFER_PTS (buffer) = header.pts;
+  GST_BUFFER_DTS (buffer) = header.dts;
+  GST_BUFFER_DURATION (buffer) = header.duration;
+  GST_BUFFER_FLAGS (buffer) = header.flags;
+
+  self->spill_read += sizeof (header) + header.size;
+
+  return buffer;
+}
+
+/* Called from the appsrc streaming thread when its queue runs empty */
+static void
+kms_overflow_queue_need_data (GstAppSrc * appsrc, guint length,
+    KmsOverflowQueue * self)
+{
+  g_mutex_lock (&self->mutex);
+
+  while (kms_overflow_queue_is_spilling (self) &&
+      !kms_overflow_queue_over_budget (self, appsrc)) {
+    GstBuffer *buffer = kms_overflow_queue_unspill (self);
+
+    if (buffer == NULL) {
+      GST_ERROR_OBJECT (appsrc, "Can not read spill file, %" G_GUINT64_FORMAT
+          " bytes lost", self->spill_write - self->spill_read);
+      self->spill_read = self->spill_write;
+      self->discont = TRUE;
+      break;
+    }
+
+    if (kms_overflow_queue_push_to_appsrc (self, appsrc, buffer) !=
+        GST_FLOW_OK) {
+      break;
+    }
+  }
+
+  if (!kms_overflow_queue_is_spilling (self) && self->spill_write > 0) {
+    GST_DEBUG_OBJECT (appsrc, "Spill file drained");
+    self->spill_read = self->spill_write = 0;
+
+    if (ftruncate (self->spill_fd, 0) < 0) {
+      GST_WARNING_OBJECT (appsrc, "Can not truncate spill file");
+    }
+
+    if (self->eos_pending) {
+      self->eos_pending = FALSE;
+      gst_app_src_end_of_stream (appsrc);
+    }
+  }
+
+  g_mutex_unlock (&self->mutex);
+}
+
+static GstPadProbeReturn
+kms_overflow_queue_buffer_out (GstPad * pad, GstPadProbeInfo * info,
+    KmsOverflowQueue * self)
+{
+  GstBuffer *buffer = gst_pad_probe_info_get_buffer (info);
+
+  if (GST_CLOCK_TIME_IS_VALID (buffer_time (buffer))) {
+    g_mutex_lock (&self->mutex);
+    self->last_out = buffer_time (buffer);
+    g_mutex_unlock (&self->mutex);
+  }
+
+  return GST_PAD_PROBE_OK;
+}
+
+KmsOverflowQueue *
+kms_overflow_queue_attach (GstAppSrc * appsrc, KmsOverflowPolicy policy,
+    guint64 max_bytes, GstClockTime max_time, const gchar * spill_dir,
+    guint64 spill_max_bytes)
+{
+  KmsOverflowQueue *self;
+  GstPad *srcpad;
+
+  kms_overflow_queue_init_debug ();
+
+  if (policy != KMS_OVERFLOW_POLICY_BLOCK && max_bytes == 0 && max_time == 0) {
+    GST_WARNING_OBJECT (appsrc, "No overflow budget, queueing up to %u bytes",
+        KMS_OVERFLOW_QUEUE_DEFAULT_MAX_BYTES);
+    max_bytes = KMS_OVERFLOW_QUEUE_DEFAULT_MAX_BYTES;
+  }
+
+  self = g_slice_new0 (KmsOverflowQueue);
+  g_mutex_init (&self->mutex);
+  self->policy = policy;
+  self->max_bytes = max_bytes;
+  self->max_time = max_time;
+  self->spill_dir = g_strdup (spill_dir != NULL ? spill_dir :
+      g_get_tmp_dir ());
+  self->spill_max_bytes = spill_max_bytes;
+  self->spill_fd = -1;
+  self->last_in = GST_CLOCK_TIME_NONE;
+  self->last_out = GST_CLOCK_TIME_NONE;
+
+  g_object_set_qdata_full (G_OBJECT (appsrc), kms_overflow_queue_key_quark (),
+      self, (GDestroyNotify) kms_overflow_queue_destroy);
+
+  if (policy == KMS_OVERFLOW_POLICY_BLOCK) {
+    if (max_bytes > 0) {
+      g_object_set (appsrc, "max-bytes", max_bytes, NULL);
+    }
+#if GST_CHECK_VERSION (1, 10, 0)
+    if (max_time > 0) {
+      g_object_set (appsrc, "max-time", max_time, NULL);
+    }
+#endif
+    g_object_set (appsrc, "block", TRUE, NULL);
+
+    return self;
+  }
+
+  /* The budget is enforced before pushing, the appsrc itself never blocks */
+  g_object_set (appsrc, "block", FALSE, "max-bytes", G_GUINT64_CONSTANT (0),
+      NULL);
+
+  if (max_time > 0) {
+    srcpad = gst_element_get_static_pad (GST_ELEMENT (appsrc), "src");
+    gst_pad_add_probe (srcpad, GST_PAD_PROBE_TYPE_BUFFER,
+        (GstPadProbeCallback) kms_overflow_queue_buffer_out, self, NULL);
+    g_object_unref (srcpad);
+  }
+
+  if (policy == KMS_OVERFLOW_POLICY_SPILL) {
+    g_signal_connect (appsrc, "need-data",
+        G_CALLBACK (kms_overflow_queue_need_data), self);
+  }
+
+  return self;
+}
+
+KmsOverflowQueue *
+kms_overflow_queue_get (GstAppSrc * appsrc)
+{
+  return g_object_get_qdata (G_OBJECT (appsrc),
+      kms_overflow_queue_key_quark ());
+}
+
+GstFlowReturn
+kms_overflow_queue_push_buffer (KmsOverflowQueue * self, GstAppSrc * appsrc,
+    GstBuffer * buffer)
+{
+  GstFlowReturn ret = GST_FLOW_OK;
+
+  if (self->policy == KMS_OVERFLOW_POLICY_BLOCK) {
+    return gst_app_src_push_buffer (appsrc, buffer);
+  }
+
+  g_mutex_lock (&self->mutex);
+
+  if (self->policy == KMS_OVERFLOW_POLICY_SPILL &&
+      (kms_overflow_queue_is_spilling (self) ||
+          kms_overflow_queue_over_budget (self, appsrc))) {
+    /* Once spilling, everything goes through the file to keep the order */
+    if (self->dropping &&
+        GST_BUFFER_FLAG_IS_SET (buffer, GST_BUFFER_FLAG_DELTA_UNIT)) {
+      goto drop;
+    }
+
+    if (kms_overflow_queue_spill (self, buffer)) {
+      if (self->dropping) {
+        GST_DEBUG_OBJECT (appsrc, "Key frame, spilling again after %"
+            G_GUINT64_FORMAT " dropped buffers", self->dropped_buffers);
+        self->dropping = FALSE;
+      }
+
+      gst_buffer_unref (buffer);
+      goto end;
+    }
+
+    if (kms_overflow_queue_is_spilling (self)) {
+      /* Can not push ahead of spilled data */
+      if (!self->dropping) {
+        GST_WARNING_OBJECT (appsrc, "Spill file is full, dropping media "
+            "until next key frame");
+        self->dropping = TRUE;
+      }
+
+      goto drop;
+    }
+  }
+
+  if (self->dropping) {
+    if (GST_BUFFER_FLAG_IS_SET (buffer, GST_BUFFER_FLAG_DELTA_UNIT) ||
+        kms_overflow_queue_over_budget (self, appsrc)) {
+      goto drop;
+    }
+
+    GST_DEBUG_OBJECT (appsrc, "Key frame, resuming after %" G_GUINT64_FORMAT
+        " dropped buffers", self->dropped_buffers);
+    self->dropping = FALSE;
+  } else if (kms_overflow_queue_over_budget (self, appsrc)) {
+    GST_WARNING_OBJECT (appsrc, "Muxer is not keeping up, dropping media "
+        "until next key frame");
+    self->dropping = TRUE;
+    goto drop;
+  }
+
+  ret = kms_overflow_queue_push_to_appsrc (self, appsrc, buffer);
+
+end:
+  g_mutex_unlock (&self->mutex);
+
+  return ret;
+
+drop:
+  self->dropped_buffers++;
+  self->dropped_bytes += gst_buffer_get_size (buffer);
+
+  /* The gap is after the spilled data, not before it */
+  if (kms_overflow_queue_is_spilling (self)) {
+    self->spill_discont = TRUE;
+  } else {
+    self->discont = TRUE;
+  }
+  gst_buffer_unref (buffer);
+
+  goto end;
+}
+
+GstFlowReturn
+kms_overflow_queue_push_buffer_list (KmsOverflowQueue * self,
+    GstAppSrc * appsrc, GstBufferList * list)
+{
+  GstFlowReturn ret = GST_FLOW_OK;
+  guint i, len;
+
+#if GST_CHECK_VERSION (1, 14, 0)
+  if (self->policy == KMS_OVERFLOW_POLICY_BLOCK) {
+    return gst_app_src_push_buffer_list (appsrc, list);
+  }
+#endif
+
+  /* Budget is checked for every buffer */
+  len = gst_buffer_list_length (list);
+
+  for (i = 0; i < len && ret == GST_FLOW_OK; i++) {
+    ret = kms_overflow_queue_push_buffer (self, appsrc,
+        gst_buffer_ref (gst_buffer_list_get (list, i)));
+  }
+
+  gst_buffer_list_unref (list);
+
+  return ret;
+}
+
+GstFlowReturn
+kms_overflow_queue_end_of_stream (KmsOverflowQueue * self, GstAppSrc * appsrc)
+{
+  g_mutex_lock (&self->mutex);
+
+  if (kms_overflow_queue_is_spilling (self)) {
+    GST_DEBUG_OBJECT (appsrc, "EOS after %" G_GUINT64_FORMAT " spilled bytes",
+        self->spill_write - self->spill_read);
+    self->eos_pending = TRUE;
+    g_mutex_unlock (&self->mutex);
+
+    return GST_FLOW_OK;
+  }
+
+  g_mutex_unlock (&self->mutex);
+
+  return gst_app_src_end_of_stream (appsrc);
+}
+
+GstFlowReturn
+kms_overflow_queue_force_end_of_stream (KmsOverflowQueue * self,
+    GstAppSrc * appsrc)
+{
+  gboolean eos_pending;
+
+  g_mutex_lock (&self->mutex);
+
+  if (kms_overflow_queue_is_spilling (self)) {
+    GST_WARNING_OBJECT (appsrc, "Dropping %" G_GUINT64_FORMAT
+        " spilled bytes to finish the stream", self->spill_write -
+        self->spill_read);
+    self->spill_read = self->spill_write;
+  }
+
+  eos_pending = self->eos_pending;
+  self->eos_pending = FALSE;
+
+  g_mutex_unlock (&self->mutex);
+
+  if (!eos_pending) {
+    /* Already in the appsrc */
+    return GST_FLOW_OK;
+  }
+
+  return gst_app_src_end_of_stream (appsrc);
+}
+
+static void
+accumulate (GstStructure * stats, const gchar * field, guint64 value)
+{
+  guint64 total = 0;
+
+  gst_structure_get_uint64 (stats, field, &total);
+  gst_structure_set (stats, field, G_TYPE_UINT64, total + value, NULL);
+}
+
+void
+kms_overflow_queue_accumulate_stats (KmsOverflowQueue * self,
+    GstStructure * stats)
+{
+  g_mutex_lock (&self->mutex);
+
+  accumulate (stats, "dropped-buffers", self->dropped_buffers);
+  accumulate (stats, "dropped-bytes", self->dropped_bytes);
+  accumulate (stats, "spilled-buffers", self->spilled_buffers);
+  accumulate (stats, "spilled-bytes", self->spilled_bytes);
+  accumulate (stats, "spill-level", self->spill_write - self->spill_read);
+
+  g_mutex_unlock (&self->mutex);
+}
@@ -0,0 +1,75 @@
+/*
+ * (C) Copyright 2016 Kurento (http://kurento.org/)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+#ifndef __KMS_OVERFLOW_QUEUE_H__
+#define __KMS_OVERFLOW_QUEUE_H__
+
+#include <gst/gst.h>
+#include <gst/app/gstappsrc.h>
+
+G_BEGIN_DECLS
+
+typedef enum
+{
+  KMS_OVERFLOW_POLICY_BLOCK,
+  KMS_OVERFLOW_POLICY_DROP_UNTIL_KEYFRAME,
+  KMS_OVERFLOW_POLICY_SPILL
+} KmsOverflowPolicy;
+
+GType kms_overflow_policy_get_type (void);
+#define KMS_TYPE_OVERFLOW_POLICY (kms_overflow_policy_get_type ())
+
+typedef struct _KmsOverflowQueue KmsOverflowQueue;
+
+/* Budget of drop-until-keyframe and spill when none is given, as their
+ * appsrc does not block and would queue media without limit otherwise */
+#define KMS_OVERFLOW_QUEUE_DEFAULT_MAX_BYTES (16 * 1024 * 1024)
+
+/* Controls what happens when the muxer does not consume the media pushed to
+ * @appsrc fast enough. Once the data queued in it exceeds @max_bytes or
+ * @max_time (0 means no limit, but drop-until-keyframe and spill without any
+ * budget use KMS_OVERFLOW_QUEUE_DEFAULT_MAX_BYTES):
+ *  - block: pushing waits for the muxer, stalling the upstream thread.
+ *  - drop-until-keyframe: media is discarded until a key frame arrives and
+ *    the queue is below the budget again.
+ *  - spill: media is written to a temporary file in @spill_dir and fed
+ *    back to @appsrc, in order, as the muxer catches up. Once the file holds
+ *    @spill_max_bytes (0 means no limit), media is dropped until a key frame
+ *    fits in it again.
+ * The queue configures @appsrc and is owned by it. */
+KmsOverflowQueue * kms_overflow_queue_attach (GstAppSrc * appsrc,
+    KmsOverflowPolicy policy, guint64 max_bytes, GstClockTime max_time,
+    const gchar * spill_dir, guint64 spill_max_bytes);
+KmsOverflowQueue * kms_overflow_queue_get (GstAppSrc * appsrc);
+
+GstFlowReturn kms_overflow_queue_push_buffer (KmsOverflowQueue * self,
+    GstAppSrc * appsrc, GstBuffer * buffer);
+GstFlowReturn kms_overflow_queue_push_buffer_list (KmsOverflowQueue * self,
+    GstAppSrc * appsrc, GstBufferList * list);
+/* EOS is sent once every spilled buffer has been pushed */
+GstFlowReturn kms_overflow_queue_end_of_stream (KmsOverflowQueue * self,
+    GstAppSrc * appsrc);
+/* Drops the spilled media not pushed yet and sends EOS without waiting for
+ * it, so that the muxer can still finish a stop that takes too long */
+GstFlowReturn kms_overflow_queue_force_end_of_stream (KmsOverflowQueue * self,
+    GstAppSrc * appsrc);
+
+/* Adds the counters of @self to the ones already in @stats */
+void kms_overflow_queue_accumulate_stats (KmsOverflowQueue * self,
+    GstStructure * stats);
+
+G_END_DECLS
+#endif /* __KMS_OVERFLOW_QUEUE_H__ */
@@ -23,6 +23,7 @@
 
 #include <string.h>
 #include <gst/gst.h>
+#include <glib/gstdio.h>
 #include <gst/pbutils/encoding-profile.h>
 
 #include <gst/app/gstappsrc.h>
@@ -41,15 +42,30 @@
 #include "kmsbasemediamuxer.h"
 #include "kmsavmuxer.h"
 #include "kmsksrmuxer.h"
+#include "kmsasyncfilesink.h"
+#include "kmsoverflowqueue.h"
+#include "kmsmuxerpool.h"
+#include "kmsgopcache.h"
 
 #define PLUGIN_NAME "recorderendpoint"
 
 #define RECORDER_DEFAULT_SUFFIX "_default"
 
 #define DEFAULT_RECORDING_PROFILE KMS_RECORDING_PROFILE_NONE
-
-#define KMS_BASE_TIME_KEY "base-time-key"
-G_DEFINE_QUARK (KMS_BASE_TIME_KEY, base_time_key);
+#define DEFAULT_SEGMENT_DURATION 0
+#define DEFAULT_SEGMENT_SIZE 0
+#define DEFAULT_SEGMENT_TEMPLATE NULL
+#define DEFAULT_FRAGMENT_DURATION 0
+#define DEFAULT_OVERFLOW_POLICY KMS_OVERFLOW_POLICY_BLOCK
+#define DEFAULT_OVERFLOW_MAX_BYTES 0
+#define DEFAULT_OVERFLOW_MAX_TIME 0
+#define DEFAULT_SPILL_DIRECTORY NULL
+#define DEFAULT_SPILL_MAX_BYTES (G_GUINT64_CONSTANT (1) << 30)
+#define DEFAULT_GOP_CACHE FALSE
+#define DEFAULT_STOP_TIMEOUT 0
+
+/* Longer groups of pictures are not cached */
+#define GOP_CACHE_MAX_BYTES (8 * 1024 * 1024)
 
 #define KMS_PAD_ID_KEY "kms-pad-id-key"
 G_DEFINE_QUARK (KMS_PAD_ID_KEY, kms_pad_id_key);
@@ -57,6 +73,9 @@ G_DEFINE_QUARK (KMS_PAD_ID_KEY, kms_pad_id_key);
 #define KMS_APPSRC_ID_KEY "kms-appsrc-id-key"
 G_DEFINE_QUARK (KMS_APPSRC_ID_KEY, kms_appsrc_id_key);
 
+#define KMS_GOP_CACHE_KEY "kms-gop-cache-key"
+G_DEFINE_QUARK (KMS_GOP_CACHE_KEY, kms_gop_cache_key);
+
 GST_DEBUG_CATEGORY_STATIC (kms_recorder_endpoint_debug_category);
 #define GST_CAT_DEFAULT kms_recorder_endpoint_debug_category
 
@@ -87,17 +106,43 @@ GST_DEBUG_CATEGORY_STATIC (kms_recorder_endpoint_debug_category);
 static GstPadLinkReturn link_sinkpad_cb (GstPad * pad, GstObject * appsink,
     GstPad * peer);
 static void unlink_sinkpad_cb (GstPad * pad, GstObject * parent);
+static void kms_recorder_endpoint_on_eos (KmsBaseMediaMuxer * obj,
+    gpointer user_data);
+static void kms_recorder_endpoint_schedule_stop_deadline (KmsRecorderEndpoint *
+    self);
 
 enum
 {
   PROP_0,
   PROP_DVR,
   PROP_PROFILE,
+  PROP_SEGMENT_DURATION,
+  PROP_SEGMENT_SIZE,
+  PROP_SEGMENT_TEMPLATE,
+  PROP_FRAGMENT_DURATION,
+  PROP_OVERFLOW_POLICY,
+  PROP_OVERFLOW_MAX_BYTES,
+  PROP_OVERFLOW_MAX_TIME,
+  PROP_SPILL_DIRECTORY,
+  PROP_SPILL_MAX_BYTES,
+  PROP_MUXER_POOL_SIZE,
+  PROP_MUXER_POOL_HITS,
+  PROP_GOP_CACHE,
+  PROP_STOP_TIMEOUT,
   N_PROPERTIES
 };
 
 static GParamSpec *obj_properties[N_PROPERTIES] = { NULL, };
 
+enum
+{
+  SIGNAL_SEGMENT_CLOSED,
+  SIGNAL_RECORDING_FINISHED,
+  LAST_SIGNAL
+};
+
+static guint obj_signals[LAST_SIGNAL] = { 0 };
+
 typedef enum
 {
   KMS_RECORDER_ENDPOINT_COMPLETED = 0,
@@ -121,8 +166,25 @@ typedef struct _KmsSinkPadData
   GstPad *sink_target;
   gulong sink_probe;
   gboolean requested;
+  KmsGopCache *gop_cache;       /* Owned by the appsink */
 } KmsSinkPadData;
 
+/* Everything the streaming threads need to timestamp a buffer. It is
+ * published with a sequence counter so that they never take a lock: the
+ * counter is odd while it is being written and readers retry whenever it
+ * changed during their copy. Writers are serialized by base_time_lock. */
+typedef struct _KmsRecordingState
+{
+  gboolean recording;
+  gboolean has_base_time;
+  GstClockTime base_pts;
+  GstClockTime base_dts;
+  GstClockTime paused_time;
+  /* Bumped when a recording stops, so that a base time taken from one of its
+   * buffers is never set for the next one */
+  guint generation;
+} KmsRecordingState;
+
 typedef struct _KmsRecorderStats
 {
   gchar *id;
@@ -134,14 +196,35 @@ typedef struct _KmsRecorderStats
 struct _KmsRecorderEndpointPrivate
 {
   KmsRecordingProfile profile;
-  GstClockTime paused_time;
   GstClockTime paused_start;
   gboolean use_dvr;
   GstTaskPool *pool;
   KmsBaseMediaMuxer *mux;
   GMutex base_time_lock;
 
-  GSList *sink_probes;
+  guint64 segment_duration;
+  guint64 segment_size;
+  gchar *segment_template;
+  guint fragment_duration;
+
+  KmsOverflowPolicy overflow_policy;
+  guint64 overflow_max_bytes;
+  GstClockTime overflow_max_time;
+  gchar *spill_directory;
+  guint64 spill_max_bytes;
+  gboolean gop_cache;
+
+  guint stop_timeout;           /* ms, 0 waits for every stream */
+  GstClockID stop_deadline;
+  gboolean stop_timed_out;
+  gboolean stop_forced_eos;     /* Spilled media dropped to finish the stop */
+  GstClockTime recorded_duration;
+
+  gint rec_state_seq;
+  KmsRecordingState rec_state;
+
+  GSList *sink_probes;          /* Same order as sinks */
+  GSList *sinks;                /* Elements writing the recording */
   GHashTable *srcs;
   GMutex srcs_mutex;
 
@@ -243,7 +326,8 @@ send_eos (GstElement * appsrc)
 
   GST_DEBUG ("Send EOS to %s", GST_ELEMENT_NAME (appsrc));
 
-  ret = gst_app_src_end_of_stream (GST_APP_SRC (appsrc));
+  ret = kms_overflow_queue_end_of_stream (kms_overflow_queue_get (GST_APP_SRC
+          (appsrc)), GST_APP_SRC (appsrc));
   if (ret != GST_FLOW_OK) {
     /* something wrong */
     GST_ERROR ("Could not send EOS to appsrc  %s. Ret code %d",
@@ -251,73 +335,107 @@ send_eos (GstElement * appsrc)
   }
 }
 
-typedef struct _BaseTimeType
+static void
+kms_recorder_endpoint_read_rec_state (KmsRecorderEndpoint * self,
+    KmsRecordingState * state)
+{
+  gint seq;
+
+  do {
+    while ((seq = g_atomic_int_get (&self->priv->rec_state_seq)) & 1) {
+      /* Writer in progress */
+      g_thread_yield ();
+    }
+
+    *state = self->priv->rec_state;
+  } while (g_atomic_int_get (&self->priv->rec_state_seq) != seq);
+}
+
+/* Must be called with BASE_TIME_LOCK held */
+static void
+kms_recorder_endpoint_write_rec_state_begin (KmsRecorderEndpoint * self)
 {
-  GstClockTime pts;
-  GstClockTime dts;
-} BaseTimeType;
+  g_atomic_int_inc (&self->priv->rec_state_seq);
+}
 
 static void
-release_base_time_type (gpointer data)
+kms_recorder_endpoint_write_rec_state_end (KmsRecorderEndpoint * self)
 {
-  g_slice_free (BaseTimeType, data);
+  g_atomic_int_inc (&self->priv->rec_state_seq);
 }
 
-static GstFlowReturn
-recv_sample (GstAppSink * appsink, gpointer user_data)
+/*
+ * It should be always called with the element lock hold.
+ */
+static void
+kms_recorder_endpoint_publish_recording (KmsRecorderEndpoint * self)
 {
-  KmsRecorderEndpoint *self =
-      KMS_RECORDER_ENDPOINT (GST_OBJECT_PARENT (appsink));
   KmsUriEndpointState state;
-  GstAppSrc *appsrc;
-  GstFlowReturn ret;
-  GstSample *sample;
-  GstSegment *segment;
-  GstBuffer *buffer;
-  BaseTimeType *base_time;
-  GstClockTime offset;
-  GstCaps *caps;
-  gboolean unlock_element = TRUE;
+  gboolean recording;
 
-  appsrc = g_object_get_qdata (G_OBJECT (appsink), kms_appsrc_id_key_quark ());
+  state = kms_uri_endpoint_get_state (KMS_URI_ENDPOINT (self));
+  recording = (state == KMS_URI_ENDPOINT_STATE_START &&
+      self->priv->transition == KMS_RECORDER_ENDPOINT_COMPLETED) ||
+      self->priv->transition == KMS_RECORDER_ENDPOINT_STARTING;
 
-  if (appsrc == NULL) {
-    GST_ERROR_OBJECT (appsink, "No appsrc attached");
-    return GST_FLOW_NOT_LINKED;
+  if (recording == self->priv->rec_state.recording) {
+    return;
   }
 
-  sample = gst_app_sink_pull_sample (appsink);
-  if (sample == NULL) {
-    return GST_FLOW_OK;
+  BASE_TIME_LOCK (self);
+  kms_recorder_endpoint_write_rec_state_begin (self);
+  self->priv->rec_state.recording = recording;
+  kms_recorder_endpoint_write_rec_state_end (self);
+  BASE_TIME_UNLOCK (self);
+}
+
+/* Returns FALSE if the recording @rec_state was read from has been stopped,
+ * so @buffer does not belong to any recording */
+static gboolean
+kms_recorder_endpoint_set_base_time (KmsRecorderEndpoint * self,
+    GstElement * appsrc, GstBuffer * buffer, KmsRecordingState * rec_state)
+{
+  BASE_TIME_LOCK (self);
+
+  /* Recording may have been stopped since @rec_state was read */
+  if (self->priv->rec_state.generation != rec_state->generation) {
+    GST_DEBUG_OBJECT (appsrc, "Recording stopped, not setting base time");
+    BASE_TIME_UNLOCK (self);
+    return FALSE;
   }
 
-  buffer = gst_sample_get_buffer (sample);
-  if (buffer == NULL) {
-    if (gst_sample_get_buffer_list (sample) != NULL) {
-      GST_ERROR_OBJECT (appsink,
-          "Discarding buffer list at the recorder endpoint");
-      g_warning ("Discarding buffer list at the recorder endpoint");
-    }
-    ret = GST_FLOW_OK;
+  /* Other stream may have set it while we were waiting */
+  if (self->priv->rec_state.has_base_time &&
+      (GST_CLOCK_TIME_IS_VALID (self->priv->rec_state.base_pts) ||
+          !GST_BUFFER_PTS_IS_VALID (buffer))) {
     goto end;
   }
 
-  segment = gst_sample_get_segment (sample);
+  kms_recorder_endpoint_write_rec_state_begin (self);
+  self->priv->rec_state.has_base_time = TRUE;
+  self->priv->rec_state.base_pts = GST_BUFFER_PTS (buffer);
+  self->priv->rec_state.base_dts = GST_BUFFER_DTS (buffer);
+  kms_recorder_endpoint_write_rec_state_end (self);
 
-  KMS_ELEMENT_LOCK (self);
-  state = kms_uri_endpoint_get_state (KMS_URI_ENDPOINT (self));
+  GST_DEBUG_OBJECT (appsrc, "Setting pts base time to: %" G_GUINT64_FORMAT,
+      self->priv->rec_state.base_pts);
 
-  if (!((state == KMS_URI_ENDPOINT_STATE_START &&
-              self->priv->transition == KMS_RECORDER_ENDPOINT_COMPLETED) ||
-          self->priv->transition == KMS_RECORDER_ENDPOINT_STARTING)) {
-    GST_LOG_OBJECT (appsink,
-        "Not recording, dropping buffer %" GST_PTR_FORMAT, buffer);
-    ret = GST_FLOW_OK;
-    goto end;
-  }
+end:
+  *rec_state = self->priv->rec_state;
 
-  gst_buffer_ref (buffer);
-  buffer = gst_buffer_make_writable (buffer);
+  BASE_TIME_UNLOCK (self);
+
+  return TRUE;
+}
+
+/* Moves timestamps of a writable @buffer to the recording time line. Returns
+ * FALSE if the buffer has to be dropped because its recording was stopped */
+static gboolean
+kms_recorder_endpoint_rebase_buffer (KmsRecorderEndpoint * self,
+    GstAppSrc * appsrc, GstSegment * segment, GstBuffer * buffer,
+    KmsRecordingState * rec_state)
+{
+  GstClockTime offset;
 
   if (GST_BUFFER_PTS_IS_VALID (buffer))
     GST_BUFFER_PTS (buffer) =
@@ -328,31 +446,19 @@ recv_sample (GstAppSink * appsink, gpointer user_data)
         gst_segment_to_running_time (segment, GST_FORMAT_TIME,
         GST_BUFFER_DTS (buffer));
 
-  BASE_TIME_LOCK (self);
-
-  base_time = g_object_get_qdata (G_OBJECT (self), base_time_key_quark ());
-
-  if (base_time == NULL) {
-    base_time = g_slice_new0 (BaseTimeType);
-    base_time->pts = GST_BUFFER_PTS (buffer);
-    base_time->dts = GST_BUFFER_DTS (buffer);
-    GST_DEBUG_OBJECT (appsrc, "Setting pts base time to: %" G_GUINT64_FORMAT,
-        base_time->pts);
-    g_object_set_qdata_full (G_OBJECT (self), base_time_key_quark (), base_time,
-        release_base_time_type);
-  }
-
-  if (!GST_CLOCK_TIME_IS_VALID (base_time->pts)
-      && GST_BUFFER_PTS_IS_VALID (buffer)) {
-    base_time->pts = GST_BUFFER_PTS (buffer);
-    GST_DEBUG_OBJECT (appsrc, "Setting pts base time to: %" G_GUINT64_FORMAT,
-        base_time->pts);
-    base_time->dts = GST_BUFFER_DTS (buffer);
+  if (!rec_state->has_base_time ||
+      (!GST_CLOCK_TIME_IS_VALID (rec_state->base_pts) &&
+          GST_BUFFER_PTS_IS_VALID (buffer))) {
+    /* Only first buffers of each recording get here */
+    if (!kms_recorder_endpoint_set_base_time (self, GST_ELEMENT (appsrc),
+            buffer, rec_state)) {
+      return FALSE;
+    }
   }
 
-  if (GST_CLOCK_TIME_IS_VALID (base_time->pts)) {
+  if (GST_CLOCK_TIME_IS_VALID (rec_state->base_pts)) {
     if (GST_BUFFER_PTS_IS_VALID (buffer)) {
-      offset = base_time->pts + self->priv->paused_time;
+      offset = rec_state->base_pts + rec_state->paused_time;
       if (GST_BUFFER_PTS (buffer) > offset) {
         GST_BUFFER_PTS (buffer) -= offset;
       } else {
@@ -361,9 +467,9 @@ recv_sample (GstAppSink * appsink, gpointer user_data)
     }
   }
 
-  if (GST_CLOCK_TIME_IS_VALID (base_time->dts)) {
+  if (GST_CLOCK_TIME_IS_VALID (rec_state->base_dts)) {
     if (GST_BUFFER_DTS_IS_VALID (buffer)) {
-      offset = base_time->dts + self->priv->paused_time;
+      offset = rec_state->base_dts + rec_state->paused_time;
       if (GST_BUFFER_DTS (buffer) > offset) {
         GST_BUFFER_DTS (buffer) -= offset;
       } else {
@@ -372,13 +478,163 @@ recv_sample (GstAppSink * appsink, gpointer user_data)
     }
   }
 
-  BASE_TIME_UNLOCK (GST_OBJECT_PARENT (appsink));
-
   GST_BUFFER_FLAG_SET (buffer, GST_BUFFER_FLAG_LIVE);
 
   if (GST_BUFFER_FLAG_IS_SET (buffer, GST_BUFFER_FLAG_HEADER))
     GST_BUFFER_FLAG_SET (buffer, GST_BUFFER_FLAG_DISCONT);
 
+  return TRUE;
+}
+
+typedef struct _RebaseListData
+{
+  KmsRecorderEndpoint *self;
+  GstAppSrc *appsrc;
+  GstSegment *segment;
+  KmsRecordingState *rec_state;
+  gboolean stopped;
+} RebaseListData;
+
+static gboolean
+rebase_list_buffer (GstBuffer ** buffer, guint idx, gpointer user_data)
+{
+  RebaseListData *data = user_data;
+
+  *buffer = gst_buffer_make_writable (*buffer);
+  data->stopped = !kms_recorder_endpoint_rebase_buffer (data->self,
+      data->appsrc, data->segment, *buffer, data->rec_state);
+
+  return !data->stopped;
+}
+
+static GstFlowReturn
+kms_recorder_endpoint_push_buffer_list (KmsRecorderEndpoint * self,
+    GstAppSrc * appsrc, GstSegment * segment, GstBufferList * list,
+    KmsRecordingState * rec_state)
+{
+  RebaseListData data;
+
+  data.self = self;
+  data.appsrc = appsrc;
+  data.segment = segment;
+  data.rec_state = rec_state;
+  data.stopped = FALSE;
+
+  /* Whole list is re-based with the same recording state */
+  list = gst_buffer_list_make_writable (gst_buffer_list_ref (list));
+  gst_buffer_list_foreach (list, rebase_list_buffer, &data);
+
+  if (data.stopped) {
+    GST_DEBUG_OBJECT (appsrc, "Recording stopped, dropping list");
+    gst_buffer_list_unref (list);
+    return GST_FLOW_OK;
+  }
+
+  return kms_overflow_queue_push_buffer_list (kms_overflow_queue_get (appsrc),
+      appsrc, list);
+}
+
+/* Pushes the group of pictures cached before recording started */
+static GstFlowReturn
+kms_recorder_endpoint_flush_gop_cache (KmsRecorderEndpoint * self,
+    GstAppSrc * appsrc, KmsGopCache * gop_cache, KmsRecordingState * rec_state)
+{
+  GstBufferList *cached;
+  GstSegment segment;
+  GstFlowReturn ret;
+
+  cached = kms_gop_cache_take (gop_cache);
+
+  if (cached == NULL) {
+    return GST_FLOW_OK;
+  }
+
+  GST_DEBUG_OBJECT (appsrc, "Starting with %u cached buffers",
+      gst_buffer_list_length (cached));
+
+  /* Cached timestamps are already in running time */
+  gst_segment_init (&segment, GST_FORMAT_TIME);
+  ret = kms_recorder_endpoint_push_buffer_list (self, appsrc, &segment, cached,
+      rec_state);
+  gst_buffer_list_unref (cached);
+
+  return ret;
+}
+
+static gpointer
+ref_object (gpointer data, gpointer user_data)
+{
+  return (data != NULL) ? g_object_ref (data) : NULL;
+}
+
+/* Samples are pushed without the element lock, the appsrc is kept alive
+ * while the muxer could be replaced */
+static GstElement *
+kms_recorder_endpoint_dup_appsrc (GstElement * appsink)
+{
+  return g_object_dup_qdata (G_OBJECT (appsink), kms_appsrc_id_key_quark (),
+      ref_object, NULL);
+}
+
+static GstFlowReturn
+recv_sample (GstAppSink * appsink, gpointer user_data)
+{
+  KmsRecorderEndpoint *self =
+      KMS_RECORDER_ENDPOINT (GST_OBJECT_PARENT (appsink));
+  KmsRecordingState rec_state;
+  KmsGopCache *gop_cache;
+  GstAppSrc *appsrc;
+  GstFlowReturn ret;
+  GstSample *sample;
+  GstSegment *segment;
+  GstBufferList *list;
+  GstBuffer *buffer;
+  GstCaps *caps;
+
+  appsrc = GST_APP_SRC (kms_recorder_endpoint_dup_appsrc (GST_ELEMENT
+          (appsink)));
+
+  if (appsrc == NULL) {
+    GST_ERROR_OBJECT (appsink, "No appsrc attached");
+    return GST_FLOW_NOT_LINKED;
+  }
+
+  sample = gst_app_sink_pull_sample (appsink);
+  if (sample == NULL) {
+    gst_object_unref (appsrc);
+    return GST_FLOW_OK;
+  }
+
+  buffer = gst_sample_get_buffer (sample);
+  list = gst_sample_get_buffer_list (sample);
+
+  if (buffer == NULL && list == NULL) {
+    ret = GST_FLOW_OK;
+    goto end;
+  }
+
+  segment = gst_sample_get_segment (sample);
+  gop_cache = g_object_get_qdata (G_OBJECT (appsink),
+      kms_gop_cache_key_quark ());
+
+  kms_recorder_endpoint_read_rec_state (self, &rec_state);
+
+  if (!rec_state.recording) {
+    GST_LOG_OBJECT (appsink, "Not recording, dropping sample %" GST_PTR_FORMAT,
+        sample);
+
+    if (gop_cache == NULL) {
+      /* Nothing to keep */
+    } else if (list != NULL) {
+      kms_gop_cache_add_list (gop_cache, segment, list);
+    } else {
+      kms_gop_cache_add (gop_cache, segment, buffer);
+    }
+
+    ret = GST_FLOW_OK;
+    goto end;
+  }
+
   caps = gst_app_src_get_caps (appsrc);
 
   if (caps == NULL) {
@@ -387,11 +643,32 @@ recv_sample (GstAppSink * appsink, gpointer user_data)
     gst_caps_unref (caps);
   }
 
-  KMS_ELEMENT_UNLOCK (self);
+  if (gop_cache != NULL) {
+    ret = kms_recorder_endpoint_flush_gop_cache (self, appsrc, gop_cache,
+        &rec_state);
 
-  unlock_element = FALSE;
+    if (ret != GST_FLOW_OK) {
+      GST_ERROR_OBJECT (self, "Could not send cached buffers to appsrc %s. "
+          "Cause: %s", GST_ELEMENT_NAME (appsrc), gst_flow_get_name (ret));
+    }
+  }
+
+  if (list != NULL) {
+    ret = kms_recorder_endpoint_push_buffer_list (self, appsrc, segment, list,
+        &rec_state);
+  } else {
+    buffer = gst_buffer_make_writable (gst_buffer_ref (buffer));
 
-  ret = gst_app_src_push_buffer (appsrc, buffer);
+    if (kms_recorder_endpoint_rebase_buffer (self, appsrc, segment, buffer,
+            &rec_state)) {
+      ret = kms_overflow_queue_push_buffer (kms_overflow_queue_get (appsrc),
+          appsrc, buffer);
+    } else {
+      GST_DEBUG_OBJECT (appsrc, "Recording stopped, dropping buffer");
+      gst_buffer_unref (buffer);
+      ret = GST_FLOW_OK;
+    }
+  }
 
   if (ret != GST_FLOW_OK) {
     /* something wrong */
@@ -401,14 +678,12 @@ recv_sample (GstAppSink * appsink, gpointer user_data)
   }
 
 end:
-  if (unlock_element) {
-    KMS_ELEMENT_UNLOCK (self);
-  }
-
   if (sample != NULL) {
     gst_sample_unref (sample);
   }
 
+  gst_object_unref (appsrc);
+
   return ret;
 }
 
@@ -417,12 +692,13 @@ recv_eos (GstAppSink * appsink, gpointer user_data)
 {
   GstElement *appsrc;
 
-  appsrc = g_object_get_qdata (G_OBJECT (appsink), kms_appsrc_id_key_quark ());
+  appsrc = kms_recorder_endpoint_dup_appsrc (GST_ELEMENT (appsink));
 
   if (appsrc == NULL) {
     GST_ERROR_OBJECT (appsink, "No appsrc attached");
   } else {
     send_eos (appsrc);
+    gst_object_unref (appsrc);
   }
 }
 
@@ -436,6 +712,132 @@ kms_recorder_endpoint_change_state (KmsRecorderEndpoint * self,
   }
 
   self->priv->transition = transition;
+  kms_recorder_endpoint_publish_recording (self);
+}
+
+/*
+ * It should be always called with the element lock hold.
+ */
+static void
+kms_recorder_endpoint_cancel_stop_deadline (KmsRecorderEndpoint * self)
+{
+  if (self->priv->stop_deadline == NULL) {
+    return;
+  }
+
+  gst_clock_id_unschedule (self->priv->stop_deadline);
+  gst_clock_id_unref (self->priv->stop_deadline);
+  self->priv->stop_deadline = NULL;
+}
+
+/* Size of the recording, taken from the file when it is a single local one
+ * and from what the sinks wrote otherwise */
+static guint64
+kms_recorder_endpoint_get_recorded_size (KmsRecorderEndpoint * self)
+{
+  const gchar *uri = KMS_URI_ENDPOINT (self)->uri;
+  guint64 size = 0, written;
+  GSList *l;
+
+  if (uri != NULL && gst_uri_has_protocol (uri, "file") &&
+      self->priv->segment_duration == 0 && self->priv->segment_size == 0) {
+    gchar *file = gst_uri_get_location (uri);
+    GStatBuf st;
+    gboolean found;
+
+    found = file != NULL && g_stat (file, &st) == 0;
+    g_free (file);
+
+    if (found) {
+      return st.st_size;
+    }
+  }
+
+  for (l = self->priv->sinks; l != NULL; l = l->next) {
+    GstStructure *stats = NULL;
+
+    if (g_object_class_find_property (G_OBJECT_GET_CLASS (l->data),
+            "stats") == NULL) {
+      continue;
+    }
+
+    g_object_get (l->data, "stats", &stats, NULL);
+
+    if (stats == NULL) {
+      continue;
+    }
+
+    if (gst_structure_get_uint64 (stats, "bytes-written", &written)) {
+      size += written;
+    }
+
+    gst_structure_free (stats);
+  }
+
+  return size;
+}
+
+/* The muxer is being torn down */
+static void
+kms_recorder_endpoint_clear_sinks (KmsRecorderEndpoint * self)
+{
+  g_slist_free_full (self->priv->sink_probes,
+      (GDestroyNotify) kms_stats_probe_destroy);
+  self->priv->sink_probes = NULL;
+  g_slist_free_full (self->priv->sinks, g_object_unref);
+  self->priv->sinks = NULL;
+}
+
+/*
+ * Forgets the sinks the muxer has already removed from its pipeline, so they
+ * are not accounted in the next recordings.
+ * It should be always called with the element lock hold.
+ */
+static void
+kms_recorder_endpoint_prune_sinks (KmsRecorderEndpoint * self)
+{
+  GSList *s = self->priv->sinks, *p = self->priv->sink_probes;
+
+  while (s != NULL && p != NULL) {
+    GSList *next_s = s->next, *next_p = p->next;
+    GstObject *parent;
+
+    parent = gst_object_get_parent (GST_OBJECT (s->data));
+
+    if (parent != NULL) {
+      gst_object_unref (parent);
+    } else {
+      GST_DEBUG_OBJECT (self, "Forgetting removed sink %" GST_PTR_FORMAT,
+          s->data);
+      kms_stats_probe_destroy (p->data);
+      g_object_unref (s->data);
+      self->priv->sink_probes =
+          g_slist_delete_link (self->priv->sink_probes, p);
+      self->priv->sinks = g_slist_delete_link (self->priv->sinks, s);
+    }
+
+    s = next_s;
+    p = next_p;
+  }
+}
+
+/*
+ * It should be always called with the element lock hold.
+ */
+static void
+kms_recorder_endpoint_emit_recording_finished (KmsRecorderEndpoint * self)
+{
+  guint64 size;
+
+  size = kms_recorder_endpoint_get_recorded_size (self);
+
+  GST_INFO_OBJECT (self, "Recording finished: %" G_GUINT64_FORMAT " bytes, %"
+      GST_TIME_FORMAT "%s", size,
+      GST_TIME_ARGS (self->priv->recorded_duration),
+      self->priv->stop_timed_out ? " (stop timed out)" : "");
+
+  g_signal_emit (self, obj_signals[SIGNAL_RECORDING_FINISHED], 0, size,
+      self->priv->recorded_duration, self->priv->stop_timed_out);
 }
 
 static void
@@ -445,6 +847,7 @@ kms_recorder_endpoint_update_internal_state (KmsRecorderEndpoint * self,
   if (state == KMS_URI_ENDPOINT_STATE_START) {
     self->priv->playing = TRUE;
   } else if (state == KMS_URI_ENDPOINT_STATE_STOP) {
+    kms_recorder_endpoint_cancel_stop_deadline (self);
     self->priv->playing = FALSE;
     self->priv->sent_eos = FALSE;
     self->priv->stopped = TRUE;
@@ -461,6 +864,12 @@ kms_recorder_endpoint_sync_state_changed (KmsRecorderEndpoint * self,
 
   KMS_URI_ENDPOINT_GET_CLASS (self)->change_state (KMS_URI_ENDPOINT (self),
       state);
+  kms_recorder_endpoint_publish_recording (self);
+
+  if (state == KMS_URI_ENDPOINT_STATE_STOP) {
+    kms_recorder_endpoint_emit_recording_finished (self);
+    kms_recorder_endpoint_prune_sinks (self);
+  }
 
   KMS_ELEMENT_UNLOCK (KMS_ELEMENT (self));
 }
@@ -488,6 +897,12 @@ kms_recorder_endpoint_async_state_changed (KmsRecorderEndpoint * self,
 
     KMS_URI_ENDPOINT_GET_CLASS (self)->change_state (KMS_URI_ENDPOINT (self),
         state);
+    kms_recorder_endpoint_publish_recording (self);
+
+    if (state == KMS_URI_ENDPOINT_STATE_STOP) {
+      kms_recorder_endpoint_emit_recording_finished (self);
+      kms_recorder_endpoint_prune_sinks (self);
+    }
   } else {
     KmsUriEndpointState current;
 
@@ -546,6 +961,8 @@ kms_recorder_endpoint_dispose (GObject * object)
 
   KMS_ELEMENT_LOCK (KMS_ELEMENT (self));
 
+  kms_recorder_endpoint_cancel_stop_deadline (self);
+
   if (self->priv->mux != NULL) {
     GstBus *bus;
 
@@ -568,6 +985,7 @@ kms_recorder_endpoint_dispose (GObject * object)
 
     if (self->priv->sent_eos) {
       GST_WARNING_OBJECT (self, "Forcing pending stop operation to finish");
+      self->priv->stop_timed_out = TRUE;
       kms_recorder_endpoint_sync_state_changed (self,
           KMS_URI_ENDPOINT_STATE_STOP);
     }
@@ -585,6 +1003,7 @@ kms_recorder_endpoint_release_pending_requests (KmsRecorderEndpoint * self)
 {
   gst_task_pool_cleanup (self->priv->pool);
 
+  kms_recorder_endpoint_clear_sinks (self);
   g_clear_object (&self->priv->mux);
   gst_object_unref (self->priv->pool);
 }
@@ -597,14 +1016,14 @@ kms_recorder_endpoint_finalize (GObject * object)
   GST_DEBUG_OBJECT (self, "releasing resources...");
 
   kms_recorder_endpoint_release_pending_requests (self);
-  g_slist_free_full (self->priv->sink_probes,
-      (GDestroyNotify) kms_stats_probe_destroy);
   g_hash_table_unref (self->priv->srcs);
   g_mutex_clear (&self->priv->srcs_mutex);
 
   g_hash_table_unref (self->priv->sink_pad_data);
   g_slist_free_full (self->priv->pending_srcs, g_free);
   g_hash_table_unref (self->priv->stats.avg_e2e);
+  g_free (self->priv->segment_template);
+  g_free (self->priv->spill_directory);
 
   g_mutex_clear (&self->priv->base_time_lock);
 
@@ -745,6 +1164,156 @@ kms_recorder_endpoint_create_parent_directories (KmsRecorderEndpoint * self)
   g_free (protocol);
 }
 
+static GstClockTime
+kms_recorder_endpoint_get_running_time (KmsRecorderEndpoint * self)
+{
+  GstClockTime now = GST_CLOCK_TIME_NONE;
+  GstClock *clock;
+
+  clock = gst_element_get_clock (GST_ELEMENT (self));
+
+  if (clock != NULL) {
+    now = gst_clock_get_time (clock) -
+        gst_element_get_base_time (GST_ELEMENT (self));
+    gst_object_unref (clock);
+  }
+
+  return now;
+}
+
+/* Time recorded until now, without pauses. It should be always called with
+ * BASE_TIME_LOCK held. */
+static GstClockTime
+kms_recorder_endpoint_get_recorded_duration (KmsRecorderEndpoint * self)
+{
+  GstClockTime now, paused;
+  GstClock *clk = NULL;
+
+  if (!self->priv->rec_state.has_base_time ||
+      !GST_CLOCK_TIME_IS_VALID (self->priv->rec_state.base_pts)) {
+    return 0;
+  }
+
+  now = kms_recorder_endpoint_get_running_time (self);
+
+  if (!GST_CLOCK_TIME_IS_VALID (now) ||
+      now < self->priv->rec_state.base_pts) {
+    return 0;
+  }
+
+  now -= self->priv->rec_state.base_pts;
+  paused = self->priv->rec_state.paused_time;
+
+  if (self->priv->mux != NULL) {
+    clk = kms_base_media_muxer_get_clock (self->priv->mux);
+  }
+
+  if (clk != NULL && GST_CLOCK_TIME_IS_VALID (self->priv->paused_start)) {
+    /* Stopped while paused */
+    paused += gst_clock_get_time (clk) - self->priv->paused_start;
+  }
+
+  return now > paused ? now - paused : 0;
+}
+
+static void
+force_eos_cb (gchar * id, GstElement * appsrc, gpointer user_data)
+{
+  GstFlowReturn ret;
+
+  ret = kms_overflow_queue_force_end_of_stream (kms_overflow_queue_get
+      (GST_APP_SRC (appsrc)), GST_APP_SRC (appsrc));
+  if (ret != GST_FLOW_OK) {
+    GST_ERROR ("Could not force EOS in appsrc %s. Ret code %d",
+        GST_ELEMENT_NAME (appsrc), ret);
+  }
+}
+
+/*
+ * The first deadline drops the spilled media still waiting to be pushed, so
+ * that EOS reaches the muxer and it can write its index (the moov of MP4
+ * files). The recording is only closed without EOS if a second deadline
+ * expires too.
+ */
+static void
+kms_recorder_endpoint_on_stop_timeout (gpointer data)
+{
+  KmsRecorderEndpoint *self = KMS_RECORDER_ENDPOINT (data);
+  gboolean draining, force_eos = FALSE;
+
+  KMS_ELEMENT_LOCK (KMS_ELEMENT (self));
+
+  draining = self->priv->transition == KMS_RECORDER_ENDPOINT_STOPPING &&
+      self->priv->sent_eos;
+
+  if (draining) {
+    self->priv->stop_timed_out = TRUE;
+    force_eos = !self->priv->stop_forced_eos;
+  }
+
+  if (force_eos) {
+    self->priv->stop_forced_eos = TRUE;
+    kms_recorder_endpoint_cancel_stop_deadline (self);
+    kms_recorder_endpoint_schedule_stop_deadline (self);
+  }
+
+  KMS_ELEMENT_UNLOCK (KMS_ELEMENT (self));
+
+  if (!draining) {
+    return;
+  }
+
+  if (force_eos) {
+    GST_WARNING_OBJECT (self, "Recording not drained after %u ms, forcing EOS",
+        self->priv->stop_timeout);
+
+    SRCS_LOCK (self);
+    g_hash_table_foreach (self->priv->srcs, (GHFunc) force_eos_cb, NULL);
+    SRCS_UNLOCK (self);
+
+    return;
+  }
+
+  GST_WARNING_OBJECT (self, "EOS not written after %u ms more, closing the"
+      " recording", self->priv->stop_timeout);
+
+  /* Finish as if every stream had reached the muxer */
+  kms_recorder_endpoint_on_eos (self->priv->mux, self);
+}
+
+static gboolean
+kms_recorder_endpoint_stop_deadline_cb (GstClock * clock, GstClockTime time,
+    GstClockID id, gpointer user_data)
+{
+  KmsRecorderEndpoint *self = KMS_RECORDER_ENDPOINT (user_data);
+
+  /* Do not change states from the clock thread */
+  gst_task_pool_push (self->priv->pool, kms_recorder_endpoint_on_stop_timeout,
+      self, NULL);
+
+  return TRUE;
+}
+
+/*
+ * It should be always called with the element lock hold.
+ */
+static void
+kms_recorder_endpoint_schedule_stop_deadline (KmsRecorderEndpoint * self)
+{
+  GstClock *clock;
+
+  if (self->priv->stop_timeout == 0) {
+    return;
+  }
+
+  clock = gst_system_clock_obtain ();
+  self->priv->stop_deadline = gst_clock_new_single_shot_id (clock,
+      gst_clock_get_time (clock) + self->priv->stop_timeout * GST_MSECOND);
+  gst_clock_id_wait_async (self->priv->stop_deadline,
+      kms_recorder_endpoint_stop_deadline_cb, self, NULL);
+  gst_object_unref (clock);
+}
+
 static gboolean
 kms_recorder_endpoint_stopped (KmsUriEndpoint * obj, GError ** error)
 {
@@ -782,9 +1351,17 @@ kms_recorder_endpoint_stopped (KmsUriEndpoint * obj, GError ** error)
   // Reset base time data
   BASE_TIME_LOCK (self);
 
-  g_object_set_qdata_full (G_OBJECT (self), base_time_key_quark (), NULL, NULL);
+  self->priv->recorded_duration =
+      kms_recorder_endpoint_get_recorded_duration (self);
+
+  kms_recorder_endpoint_write_rec_state_begin (self);
+  self->priv->rec_state.has_base_time = FALSE;
+  self->priv->rec_state.base_pts = GST_CLOCK_TIME_NONE;
+  self->priv->rec_state.base_dts = GST_CLOCK_TIME_NONE;
+  self->priv->rec_state.paused_time = G_GUINT64_CONSTANT (0);
+  self->priv->rec_state.generation++;
+  kms_recorder_endpoint_write_rec_state_end (self);
 
-  self->priv->paused_time = G_GUINT64_CONSTANT (0);
   self->priv->paused_start = GST_CLOCK_TIME_NONE;
 
   BASE_TIME_UNLOCK (self);
@@ -796,6 +1373,7 @@ kms_recorder_endpoint_stopped (KmsUriEndpoint * obj, GError ** error)
       KMS_ELEMENT_LOCK (self);
     } else {
       GST_DEBUG_OBJECT (self, "Pipeline will stop when all eos are processed");
+      kms_recorder_endpoint_schedule_stop_deadline (self);
     }
   } else {
     /* Internal pipeline never went to playing, we go to stop from pause */
@@ -813,6 +1391,117 @@ drop_until_key_frame_cb (GstPad * pad, gpointer data)
   kms_utils_drop_until_keyframe (pad, TRUE);
 }
 
+/* Makes the recording begin at the earliest cached key frame. Returns FALSE
+ * if the caches can not be used */
+static gboolean
+kms_recorder_endpoint_start_from_gop_caches (KmsRecorderEndpoint * self,
+    gboolean was_paused)
+{
+  GstClockTime start = GST_CLOCK_TIME_NONE, start_dts = GST_CLOCK_TIME_NONE;
+  GstClockTime now, paused, preroll;
+  GHashTableIter iter;
+  gpointer value;
+  GstClock *clk;
+
+  g_hash_table_iter_init (&iter, self->priv->sink_pad_data);
+
+  while (g_hash_table_iter_next (&iter, NULL, &value)) {
+    KmsSinkPadData *data = value;
+    GstClockTime pts, dts;
+
+    if (data->gop_cache != NULL &&
+        kms_gop_cache_get_start (data->gop_cache, &pts, &dts) &&
+        GST_CLOCK_TIME_IS_VALID (pts) &&
+        (!GST_CLOCK_TIME_IS_VALID (start) || pts < start)) {
+      start = pts;
+      start_dts = GST_CLOCK_TIME_IS_VALID (dts) ? dts : pts;
+    }
+  }
+
+  if (!GST_CLOCK_TIME_IS_VALID (start)) {
+    return FALSE;
+  }
+
+  if (!was_paused) {
+    BASE_TIME_LOCK (self);
+
+    if (!self->priv->rec_state.has_base_time) {
+      kms_recorder_endpoint_write_rec_state_begin (self);
+      self->priv->rec_state.has_base_time = TRUE;
+      self->priv->rec_state.base_pts = start;
+      self->priv->rec_state.base_dts = start_dts;
+      kms_recorder_endpoint_write_rec_state_end (self);
+    }
+
+    BASE_TIME_UNLOCK (self);
+
+    GST_DEBUG_OBJECT (self, "Recording from cached key frame at %"
+        GST_TIME_FORMAT, GST_TIME_ARGS (start));
+
+    return TRUE;
+  }
+
+  clk = kms_base_media_muxer_get_clock (self->priv->mux);
+  now = kms_recorder_endpoint_get_running_time (self);
+
+  if (clk == NULL || !GST_CLOCK_TIME_IS_VALID (self->priv->paused_start) ||
+      !GST_CLOCK_TIME_IS_VALID (now)) {
+    return FALSE;
+  }
+
+  paused = gst_clock_get_time (clk) - self->priv->paused_start;
+  preroll = now > start ? now - start : 0;
+
+  if (preroll > paused) {
+    /* Part of that group of pictures was recorded before pausing */
+    GST_DEBUG_OBJECT (self, "Cached key frame is older than the pause");
+    return FALSE;
+  }
+
+  /* Pause is considered finished when the cached key frame was received */
+  self->priv->paused_start += preroll;
+
+  GST_DEBUG_OBJECT (self, "Resuming %" GST_TIME_FORMAT " before now from "
+      "cached key frame", GST_TIME_ARGS (preroll));
+
+  return TRUE;
+}
+
+static void
+kms_recorder_endpoint_preroll_gop_caches (KmsRecorderEndpoint * self,
+    gboolean was_paused)
+{
+  gboolean use_caches;
+  GHashTableIter iter;
+  gpointer value;
+
+  use_caches = kms_recorder_endpoint_start_from_gop_caches (self, was_paused);
+
+  g_hash_table_iter_init (&iter, self->priv->sink_pad_data);
+
+  while (g_hash_table_iter_next (&iter, NULL, &value)) {
+    KmsSinkPadData *data = value;
+    GstClockTime pts, dts;
+
+    if (data->gop_cache == NULL) {
+      if (was_paused) {
+        kms_utils_drop_until_keyframe (data->sink_target, TRUE);
+      }
+
+      continue;
+    }
+
+    if (!use_caches) {
+      kms_gop_cache_clear (data->gop_cache);
+    }
+
+    /* Only tracks without a cached key frame need to ask for one */
+    if (!kms_gop_cache_get_start (data->gop_cache, &pts, &dts)) {
+      kms_utils_drop_until_keyframe (data->sink_target, TRUE);
+    }
+  }
+}
+
 static gboolean
 kms_recorder_endpoint_started (KmsUriEndpoint * obj, GError ** error)
 {
@@ -844,7 +1533,9 @@ kms_recorder_endpoint_started (KmsUriEndpoint * obj, GError ** error)
 
   kms_recorder_endpoint_create_parent_directories (self);
 
-  if (was_paused) {
+  if (self->priv->gop_cache) {
+    kms_recorder_endpoint_preroll_gop_caches (self, was_paused);
+  } else if (was_paused) {
     kms_element_for_each_sink_pad (GST_ELEMENT (self),
         drop_until_key_frame_cb, NULL);
   }
@@ -859,9 +1550,11 @@ kms_recorder_endpoint_started (KmsUriEndpoint * obj, GError ** error)
   BASE_TIME_LOCK (self);
 
   if (GST_CLOCK_TIME_IS_VALID (self->priv->paused_start)) {
-    self->priv->paused_time +=
+    kms_recorder_endpoint_write_rec_state_begin (self);
+    self->priv->rec_state.paused_time +=
         gst_clock_get_time (kms_base_media_muxer_get_clock (self->priv->mux)) -
         self->priv->paused_start;
+    kms_recorder_endpoint_write_rec_state_end (self);
     self->priv->paused_start = GST_CLOCK_TIME_NONE;
   }
 
@@ -1019,10 +1712,11 @@ configure_pipeline_capabilities (GstPad * pad, GstPadProbeInfo * info,
 
   set_appsink_caps (appsink, caps, self->priv->profile);
 
-  appsrc = g_object_get_qdata (G_OBJECT (appsink), kms_appsrc_id_key_quark ());
+  appsrc = kms_recorder_endpoint_dup_appsrc (appsink);
 
   if (appsrc != NULL) {
     set_appsrc_caps (appsrc, caps);
+    gst_object_unref (appsrc);
   } else {
     GST_ERROR_OBJECT (pad, "No appsrc attached");
   }
@@ -1091,6 +1785,14 @@ link_sinkpad_cb (GstPad * pad, GstObject * parent, GstPad * peer)
     goto end;
   }
 
+  if (kms_overflow_queue_get (GST_APP_SRC (appsrc)) == NULL) {
+    /* Audio and video muxer reuse their appsrcs when pads are relinked */
+    kms_overflow_queue_attach (GST_APP_SRC (appsrc),
+        self->priv->overflow_policy, self->priv->overflow_max_bytes,
+        self->priv->overflow_max_time, self->priv->spill_directory,
+        self->priv->spill_max_bytes);
+  }
+
   gst_pad_set_element_private (pad, g_object_ref (appsrc));
 
   SRCS_LOCK (self);
@@ -1103,7 +1805,7 @@ link_sinkpad_cb (GstPad * pad, GstObject * parent, GstPad * peer)
 
   appsink = gst_pad_get_parent_element (target);
   g_object_set_qdata_full (G_OBJECT (appsink), kms_appsrc_id_key_quark (),
-      appsrc, NULL);
+      g_object_ref (appsrc), gst_object_unref);
   g_object_unref (appsink);
 
   ret = GST_PAD_LINK_OK;
@@ -1180,6 +1882,10 @@ kms_recorder_endpoint_add_appsink (KmsRecorderEndpoint * self,
 
   g_object_set (appsink, "emit-signals", FALSE, "async", FALSE,
       "sync", FALSE, "qos", FALSE, NULL);
+#if GST_CHECK_VERSION (1, 12, 0)
+  /* Keep batches from depayloaders and agnosticbin together */
+  g_object_set (appsink, "buffer-list", TRUE, NULL);
+#endif
 
   gst_bin_add (GST_BIN (self), appsink);
 
@@ -1187,6 +1893,13 @@ kms_recorder_endpoint_add_appsink (KmsRecorderEndpoint * self,
 
   data = sink_pad_data_new (type, description, name, requested);
   data->sink_target = sinkpad;
+
+  if (self->priv->gop_cache && type == KMS_ELEMENT_PAD_TYPE_VIDEO) {
+    data->gop_cache = kms_gop_cache_new (GOP_CACHE_MAX_BYTES);
+    g_object_set_qdata_full (G_OBJECT (appsink), kms_gop_cache_key_quark (),
+        data->gop_cache, (GDestroyNotify) kms_gop_cache_destroy);
+  }
+
   g_hash_table_insert (self->priv->sink_pad_data, g_strdup (name), data);
   g_object_set_qdata_full (G_OBJECT (sinkpad), kms_pad_id_key_quark (),
       g_strdup (name), g_free);
@@ -1301,7 +2014,9 @@ kms_recorder_endpoint_on_sink_added (KmsBaseMediaMuxer * obj,
 
   KMS_ELEMENT_LOCK (KMS_ELEMENT (self));
 
-  self->priv->sink_probes = g_slist_append (self->priv->sink_probes, sprobe);
+  kms_recorder_endpoint_prune_sinks (self);
+  self->priv->sink_probes = g_slist_prepend (self->priv->sink_probes, sprobe);
+  self->priv->sinks = g_slist_prepend (self->priv->sinks, g_object_ref (sink));
 
   if (self->priv->stats.enabled) {
     kms_stats_probe_add_latency (sprobe, kms_recorder_endpoint_latency_cb,
@@ -1311,24 +2026,59 @@ kms_recorder_endpoint_on_sink_added (KmsBaseMediaMuxer * obj,
   KMS_ELEMENT_UNLOCK (KMS_ELEMENT (self));
 }
 
+/* Pooled muxers record to local files with the default options */
+static gboolean
+kms_recorder_endpoint_can_use_muxer_pool (KmsRecorderEndpoint * self)
+{
+  const gchar *uri = KMS_URI_ENDPOINT (self)->uri;
+
+  return self->priv->profile != KMS_RECORDING_PROFILE_KSR &&
+      self->priv->segment_duration == 0 && self->priv->segment_size == 0 &&
+      self->priv->fragment_duration == 0 && uri != NULL &&
+      gst_uri_is_valid (uri) && gst_uri_has_protocol (uri, "file");
+}
+
 static void
 kms_recorder_endpoint_create_base_media_muxer (KmsRecorderEndpoint * self)
 {
-  KmsBaseMediaMuxer *mux;
+  KmsBaseMediaMuxer *mux = NULL;
+
+  if (kms_recorder_endpoint_can_use_muxer_pool (self)) {
+    mux = kms_muxer_pool_acquire (self->priv->profile,
+        KMS_URI_ENDPOINT (self)->uri);
+  }
 
-  if (self->priv->profile == KMS_RECORDING_PROFILE_KSR) {
+  if (mux != NULL) {
+    GST_DEBUG_OBJECT (self, "Using muxer from pool");
+  } else if (self->priv->profile == KMS_RECORDING_PROFILE_KSR) {
     mux = KMS_BASE_MEDIA_MUXER (kms_ksr_muxer_new
         (KMS_BASE_MEDIA_MUXER_PROFILE, self->priv->profile,
             KMS_BASE_MEDIA_MUXER_URI, KMS_URI_ENDPOINT (self)->uri, NULL));
   } else {
     mux = KMS_BASE_MEDIA_MUXER (kms_av_muxer_new
         (KMS_BASE_MEDIA_MUXER_PROFILE, self->priv->profile,
-            KMS_BASE_MEDIA_MUXER_URI, KMS_URI_ENDPOINT (self)->uri, NULL));
+            KMS_BASE_MEDIA_MUXER_URI, KMS_URI_ENDPOINT (self)->uri,
+            KMS_AV_MUXER_SEGMENT_DURATION, self->priv->segment_duration,
+            KMS_AV_MUXER_SEGMENT_SIZE, self->priv->segment_size,
+            KMS_AV_MUXER_SEGMENT_TEMPLATE, self->priv->segment_template,
+            KMS_AV_MUXER_FRAGMENT_DURATION, self->priv->fragment_duration,
+            NULL));
   }
 
   self->priv->mux = mux;
 }
 
+static void
+kms_recorder_endpoint_on_segment_closed (KmsAVMuxer * obj, const gchar * uri,
+    gpointer user_data)
+{
+  KmsRecorderEndpoint *self = KMS_RECORDER_ENDPOINT (user_data);
+
+  GST_INFO_OBJECT (self, "Segment closed: %s", uri);
+
+  g_signal_emit (self, obj_signals[SIGNAL_SEGMENT_CLOSED], 0, uri);
+}
+
 static void
 kms_recorder_endpoint_new_media_muxer (KmsRecorderEndpoint * self)
 {
@@ -1339,6 +2089,11 @@ kms_recorder_endpoint_new_media_muxer (KmsRecorderEndpoint * self)
   g_signal_connect (self->priv->mux, "on-sink-added",
       G_CALLBACK (kms_recorder_endpoint_on_sink_added), self);
 
+  if (KMS_IS_AV_MUXER (self->priv->mux)) {
+    g_signal_connect (self->priv->mux, "on-segment-closed",
+        G_CALLBACK (kms_recorder_endpoint_on_segment_closed), self);
+  }
+
   kms_recorder_endpoint_update_media_stats (self);
   bus = kms_base_media_muxer_get_bus (self->priv->mux);
   gst_bus_set_sync_handler (bus, bus_sync_signal_handler, self, NULL);
@@ -1355,6 +2110,11 @@ kms_recorder_endpoint_new_media_muxer (KmsRecorderEndpoint * self)
     kms_recorder_endpoint_add_appsink (self, KMS_ELEMENT_PAD_TYPE_VIDEO, NULL,
         VIDEO_STREAM_NAME RECORDER_DEFAULT_SUFFIX, FALSE);
   }
+
+  if (self->priv->gop_cache) {
+    /* Media is accepted before recording so that there is something cached */
+    kms_recorder_generate_pads (self);
+  }
 }
 
 static void
@@ -1381,6 +2141,61 @@ kms_recorder_endpoint_set_property (GObject * object, guint property_id,
 
       break;
     }
+    case PROP_SEGMENT_DURATION:
+    case PROP_SEGMENT_SIZE:
+    case PROP_SEGMENT_TEMPLATE:
+      if (self->priv->mux != NULL) {
+        GST_WARNING_OBJECT (self, "Segments must be configured before the "
+            "profile, %s will not take effect", pspec->name);
+      }
+
+      if (property_id == PROP_SEGMENT_DURATION) {
+        self->priv->segment_duration = g_value_get_uint64 (value);
+      } else if (property_id == PROP_SEGMENT_SIZE) {
+        self->priv->segment_size = g_value_get_uint64 (value);
+      } else {
+        g_free (self->priv->segment_template);
+        self->priv->segment_template = g_value_dup_string (value);
+      }
+      break;
+    case PROP_OVERFLOW_POLICY:
+      self->priv->overflow_policy = g_value_get_enum (value);
+      break;
+    case PROP_OVERFLOW_MAX_BYTES:
+      self->priv->overflow_max_bytes = g_value_get_uint64 (value);
+      break;
+    case PROP_OVERFLOW_MAX_TIME:
+      self->priv->overflow_max_time = g_value_get_uint64 (value);
+      break;
+    case PROP_SPILL_DIRECTORY:
+      g_free (self->priv->spill_directory);
+      self->priv->spill_directory = g_value_dup_string (value);
+      break;
+    case PROP_SPILL_MAX_BYTES:
+      self->priv->spill_max_bytes = g_value_get_uint64 (value);
+      break;
+    case PROP_MUXER_POOL_SIZE:
+      kms_muxer_pool_set_size (g_value_get_uint (value));
+      break;
+    case PROP_GOP_CACHE:
+      if (self->priv->mux != NULL) {
+        GST_WARNING_OBJECT (self, "GOP cache must be configured before the "
+            "profile, %s will not take effect", pspec->name);
+      }
+
+      self->priv->gop_cache = g_value_get_boolean (value);
+      break;
+    case PROP_STOP_TIMEOUT:
+      self->priv->stop_timeout = g_value_get_uint (value);
+      break;
+    case PROP_FRAGMENT_DURATION:
+      if (self->priv->mux != NULL) {
+        GST_WARNING_OBJECT (self, "Fragments must be configured before the "
+            "profile, %s will not take effect", pspec->name);
+      }
+
+      self->priv->fragment_duration = g_value_get_uint (value);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
       break;
@@ -1403,6 +2218,45 @@ kms_recorder_endpoint_get_property (GObject * object, guint property_id,
       g_value_set_enum (value, self->priv->profile);
       break;
     }
+    case PROP_SEGMENT_DURATION:
+      g_value_set_uint64 (value, self->priv->segment_duration);
+      break;
+    case PROP_SEGMENT_SIZE:
+      g_value_set_uint64 (value, self->priv->segment_size);
+      break;
+    case PROP_SEGMENT_TEMPLATE:
+      g_value_set_string (value, self->priv->segment_template);
+      break;
+    case PROP_FRAGMENT_DURATION:
+      g_value_set_uint (value, self->priv->fragment_duration);
+      break;
+    case PROP_OVERFLOW_POLICY:
+      g_value_set_enum (value, self->priv->overflow_policy);
+      break;
+    case PROP_OVERFLOW_MAX_BYTES:
+      g_value_set_uint64 (value, self->priv->overflow_max_bytes);
+      break;
+    case PROP_OVERFLOW_MAX_TIME:
+      g_value_set_uint64 (value, self->priv->overflow_max_time);
+      break;
+    case PROP_SPILL_DIRECTORY:
+      g_value_set_string (value, self->priv->spill_directory);
+      break;
+    case PROP_SPILL_MAX_BYTES:
+      g_value_set_uint64 (value, self->priv->spill_max_bytes);
+      break;
+    case PROP_MUXER_POOL_SIZE:
+      g_value_set_uint (value, kms_muxer_pool_get_size ());
+      break;
+    case PROP_MUXER_POOL_HITS:
+      g_value_set_uint (value, kms_muxer_pool_get_hits ());
+      break;
+    case PROP_GOP_CACHE:
+      g_value_set_boolean (value, self->priv->gop_cache);
+      break;
+    case PROP_STOP_TIMEOUT:
+      g_value_set_uint (value, self->priv->stop_timeout);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
       break;
@@ -1738,6 +2592,110 @@ kms_element_get_e2e_latency_stats (KmsRecorderEndpoint * self, gchar * selector)
   return stats;
 }
 
+static void
+kms_recorder_endpoint_accumulate_sink_stats (GstStructure * acc,
+    const GstStructure * stats)
+{
+  static const gchar *fields[] = {
+    "queue-depth", "bytes-written", "writes", "syncs", "stalls", "stall-time"
+  };
+  guint64 value, total, max = 0;
+  guint i;
+
+  for (i = 0; i < G_N_ELEMENTS (fields); i++) {
+    total = 0;
+
+    if (gst_structure_get_uint64 (stats, fields[i], &value)) {
+      gst_structure_get_uint64 (acc, fields[i], &total);
+      gst_structure_set (acc, fields[i], G_TYPE_UINT64, total + value, NULL);
+    }
+  }
+
+  if (gst_structure_get_uint64 (stats, "max-queue-depth", &value)) {
+    gst_structure_get_uint64 (acc, "max-queue-depth", &max);
+    gst_structure_set (acc, "max-queue-depth", G_TYPE_UINT64, MAX (max,
+            value), NULL);
+  }
+}
+
+/* Adds the write queue and stall statistics of the sinks that provide them */
+static void
+kms_recorder_endpoint_add_sink_stats (KmsRecorderEndpoint * self,
+    GstStructure * e_stats)
+{
+  GstStructure *sink_stats = NULL;
+  GSList *sinks, *l;
+
+  KMS_ELEMENT_LOCK (KMS_ELEMENT (self));
+  sinks = g_slist_copy_deep (self->priv->sinks, (GCopyFunc) g_object_ref,
+      NULL);
+  KMS_ELEMENT_UNLOCK (KMS_ELEMENT (self));
+
+  for (l = sinks; l != NULL; l = l->next) {
+    GstStructure *stats = NULL;
+
+    if (g_object_class_find_property (G_OBJECT_GET_CLASS (l->data),
+            "stats") == NULL) {
+      continue;
+    }
+
+    g_object_get (l->data, "stats", &stats, NULL);
+
+    if (stats == NULL) {
+      continue;
+    }
+
+    if (sink_stats == NULL) {
+      sink_stats = gst_structure_new_empty ("sink-stats");
+    }
+
+    kms_recorder_endpoint_accumulate_sink_stats (sink_stats, stats);
+    gst_structure_free (stats);
+  }
+
+  g_slist_free_full (sinks, g_object_unref);
+
+  if (sink_stats != NULL) {
+    gst_structure_set (e_stats, "sink-stats", GST_TYPE_STRUCTURE, sink_stats,
+        NULL);
+    gst_structure_free (sink_stats);
+  }
+}
+
+/* Adds media dropped or spilled by the overflow policy of every track */
+static void
+kms_recorder_endpoint_add_overflow_stats (KmsRecorderEndpoint * self,
+    GstStructure * e_stats)
+{
+  GstStructure *overflow_stats;
+  GHashTable *seen;
+  GHashTableIter iter;
+  gpointer appsrc;
+
+  overflow_stats = gst_structure_new_empty ("overflow-stats");
+  seen = g_hash_table_new (NULL, NULL);
+
+  SRCS_LOCK (self);
+
+  g_hash_table_iter_init (&iter, self->priv->srcs);
+
+  while (g_hash_table_iter_next (&iter, NULL, &appsrc)) {
+    KmsOverflowQueue *queue = kms_overflow_queue_get (GST_APP_SRC (appsrc));
+
+    if (queue != NULL && g_hash_table_add (seen, appsrc)) {
+      kms_overflow_queue_accumulate_stats (queue, overflow_stats);
+    }
+  }
+
+  SRCS_UNLOCK (self);
+
+  g_hash_table_unref (seen);
+
+  gst_structure_set (e_stats, "overflow-stats", GST_TYPE_STRUCTURE,
+      overflow_stats, NULL);
+  gst_structure_free (overflow_stats);
+}
+
 static GstStructure *
 kms_recorder_endpoint_stats (KmsElement * obj, gchar * selector)
 {
@@ -1749,13 +2707,16 @@ kms_recorder_endpoint_stats (KmsElement * obj, gchar * selector)
       KMS_ELEMENT_CLASS (kms_recorder_endpoint_parent_class)->stats (obj,
       selector);
 
-  if (!self->priv->stats.enabled) {
+  e_stats = kms_stats_get_element_stats (stats);
+
+  if (e_stats == NULL) {
     return stats;
   }
 
-  e_stats = kms_stats_get_element_stats (stats);
+  kms_recorder_endpoint_add_sink_stats (self, e_stats);
+  kms_recorder_endpoint_add_overflow_stats (self, e_stats);
 
-  if (e_stats == NULL) {
+  if (!self->priv->stats.enabled) {
     return stats;
   }
 
@@ -1896,9 +2857,99 @@ kms_recorder_endpoint_class_init (KmsRecorderEndpointClass * klass)
       "The profile used for encapsulating the media",
       KMS_TYPE_RECORDING_PROFILE, DEFAULT_RECORDING_PROFILE, G_PARAM_READWRITE);
 
+  obj_properties[PROP_SEGMENT_DURATION] =
+      g_param_spec_uint64 ("segment-duration", "Segment duration",
+      "Split the recording in files of at least this duration (0 = disabled). "
+      "Must be set before the profile", 0, G_MAXUINT64,
+      DEFAULT_SEGMENT_DURATION, G_PARAM_READWRITE);
+
+  obj_properties[PROP_SEGMENT_SIZE] =
+      g_param_spec_uint64 ("segment-size", "Segment size",
+      "Split the recording in files of at least this size in bytes "
+      "(0 = disabled). Must be set before the profile", 0, G_MAXUINT64,
+      DEFAULT_SEGMENT_SIZE, G_PARAM_READWRITE);
+
+  obj_properties[PROP_SEGMENT_TEMPLATE] =
+      g_param_spec_string ("segment-template", "Segment template",
+      "File uri of segments, {index} and {time} are replaced by the segment "
+      "number and its UTC start time. Must be set before the profile",
+      DEFAULT_SEGMENT_TEMPLATE, G_PARAM_READWRITE);
+
+  obj_properties[PROP_FRAGMENT_DURATION] =
+      g_param_spec_uint ("fragment-duration", "Fragment duration",
+      "Record MP4 profiles as fragmented MP4 with fragments of this duration "
+      "in ms (0 = disabled). Must be set before the profile", 0, G_MAXUINT,
+      DEFAULT_FRAGMENT_DURATION, G_PARAM_READWRITE);
+
+  obj_properties[PROP_OVERFLOW_POLICY] = g_param_spec_enum ("overflow-policy",
+      "Overflow policy",
+      "What to do with media when the muxer does not keep up. Applies to "
+      "tracks linked after it is set", KMS_TYPE_OVERFLOW_POLICY,
+      DEFAULT_OVERFLOW_POLICY, G_PARAM_READWRITE);
+
+  obj_properties[PROP_OVERFLOW_MAX_BYTES] =
+      g_param_spec_uint64 ("overflow-max-bytes", "Overflow max bytes",
+      "Bytes that can be queued per track before the overflow policy "
+      "applies (0 = no limit)", 0, G_MAXUINT64, DEFAULT_OVERFLOW_MAX_BYTES,
+      G_PARAM_READWRITE);
+
+  obj_properties[PROP_OVERFLOW_MAX_TIME] =
+      g_param_spec_uint64 ("overflow-max-time", "Overflow max time",
+      "Time in ns that can be queued per track before the overflow policy "
+      "applies (0 = no limit)", 0, G_MAXUINT64, DEFAULT_OVERFLOW_MAX_TIME,
+      G_PARAM_READWRITE);
+
+  obj_properties[PROP_SPILL_DIRECTORY] =
+      g_param_spec_string ("spill-directory", "Spill directory",
+      "Directory for the temporary files of the spill policy (NULL = system "
+      "temporary directory)", DEFAULT_SPILL_DIRECTORY, G_PARAM_READWRITE);
+
+  obj_properties[PROP_SPILL_MAX_BYTES] =
+      g_param_spec_uint64 ("spill-max-bytes", "Spill max bytes",
+      "Bytes the spill file of a track can hold before media is dropped "
+      "until the next key frame (0 = no limit)", 0, G_MAXUINT64,
+      DEFAULT_SPILL_MAX_BYTES, G_PARAM_READWRITE);
+
+  obj_properties[PROP_MUXER_POOL_SIZE] =
+      g_param_spec_uint ("muxer-pool-size", "Muxer pool size",
+      "Muxers kept ready per recording profile, shared by every recorder in "
+      "the process (0 = disabled)", 0, G_MAXUINT,
+      KMS_MUXER_POOL_DEFAULT_SIZE, G_PARAM_READWRITE);
+
+  obj_properties[PROP_MUXER_POOL_HITS] =
+      g_param_spec_uint ("muxer-pool-hits", "Muxer pool hits",
+      "Recordings of the process that started with a muxer from the pool",
+      0, G_MAXUINT, 0, G_PARAM_READABLE);
+
+  obj_properties[PROP_GOP_CACHE] = g_param_spec_boolean ("gop-cache",
+      "GOP cache",
+      "Keep video received since the last key frame while not recording, so "
+      "that recordings start from it instead of requesting a new key frame",
+      DEFAULT_GOP_CACHE, G_PARAM_READWRITE);
+
+  obj_properties[PROP_STOP_TIMEOUT] = g_param_spec_uint ("stop-timeout",
+      "Stop timeout",
+      "Milliseconds that a stop waits for the streams to reach the muxer "
+      "before dropping the spilled media, and then before closing the "
+      "recording without finishing it (0 = no limit)",
+      0, G_MAXUINT, DEFAULT_STOP_TIMEOUT, G_PARAM_READWRITE);
+
   g_object_class_install_properties (gobject_class,
       N_PROPERTIES, obj_properties);
 
+  obj_signals[SIGNAL_SEGMENT_CLOSED] =
+      g_signal_new ("segment-closed",
+      G_TYPE_FROM_CLASS (klass),
+      G_SIGNAL_RUN_LAST, 0, NULL, NULL,
+      g_cclosure_marshal_VOID__STRING, G_TYPE_NONE, 1, G_TYPE_STRING);
+
+  /* Size in bytes, recorded duration and whether the stop timed out */
+  obj_signals[SIGNAL_RECORDING_FINISHED] =
+      g_signal_new ("recording-finished",
+      G_TYPE_FROM_CLASS (klass),
+      G_SIGNAL_RUN_LAST, 0, NULL, NULL, NULL, G_TYPE_NONE, 3, G_TYPE_UINT64,
+      G_TYPE_UINT64, G_TYPE_BOOLEAN);
+
   /* Registers a private structure for the instantiatable type */
   g_type_class_add_private (klass, sizeof (KmsRecorderEndpointPrivate));
 }
@@ -2021,8 +3072,22 @@ kms_recorder_endpoint_init (KmsRecorderEndpoint * self)
       g_object_unref);
 
   self->priv->profile = DEFAULT_RECORDING_PROFILE;
-
-  self->priv->paused_time = G_GUINT64_CONSTANT (0);
+  self->priv->segment_duration = DEFAULT_SEGMENT_DURATION;
+  self->priv->segment_size = DEFAULT_SEGMENT_SIZE;
+  self->priv->fragment_duration = DEFAULT_FRAGMENT_DURATION;
+  self->priv->overflow_policy = DEFAULT_OVERFLOW_POLICY;
+  self->priv->overflow_max_bytes = DEFAULT_OVERFLOW_MAX_BYTES;
+  self->priv->overflow_max_time = DEFAULT_OVERFLOW_MAX_TIME;
+  self->priv->spill_max_bytes = DEFAULT_SPILL_MAX_BYTES;
+  self->priv->gop_cache = DEFAULT_GOP_CACHE;
+  self->priv->stop_timeout = DEFAULT_STOP_TIMEOUT;
+
+  self->priv->rec_state.recording = FALSE;
+  self->priv->rec_state.has_base_time = FALSE;
+  self->priv->rec_state.base_pts = GST_CLOCK_TIME_NONE;
+  self->priv->rec_state.base_dts = GST_CLOCK_TIME_NONE;
+  self->priv->rec_state.paused_time = G_GUINT64_CONSTANT (0);
+  self->priv->rec_state.generation = 0;
   self->priv->paused_start = GST_CLOCK_TIME_NONE;
 
   self->priv->sink_pad_data = g_hash_table_new_full (g_str_hash, g_str_equal,
@@ -2047,9 +3112,16 @@ kms_recorder_endpoint_plugin_init (GstPlugin * plugin)
       KMS_TYPE_RECORDER_ENDPOINT);
 }
 
+static gboolean
+kms_recorder_plugin_init (GstPlugin * plugin)
+{
+  return kms_recorder_endpoint_plugin_init (plugin) &&
+      kms_async_file_sink_plugin_init (plugin);
+}
+
 GST_PLUGIN_DEFINE (GST_VERSION_MAJOR,
     GST_VERSION_MINOR,
     kmsrecorderendpoint,
     "Kurento recorder endpoint",
-    kms_recorder_endpoint_plugin_init, VERSION, GST_LICENSE_UNKNOWN,
+    kms_recorder_plugin_init, VERSION, GST_LICENSE_UNKNOWN,
     "Kurento Elements", "http://kurento.com/")
@@ -0,0 +1,63 @@
+/*
+ * (C) Copyright 2016 Kurento (http://kurento.org/)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef _KMS_RTCP_CLASSIFIER_H_
+#define _KMS_RTCP_CLASSIFIER_H_
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+/* Internal to rtcpdemux, kept in a header so that tests time the same code
+ * the element runs */
+
+/* RFC 5761 section 4: RTCP packet types 192-223 collide with RTP payload
+ * types 64-95 when the marker bit is set, so those values identify RTCP. */
+#define KMS_RTCP_PT_MIN 192
+#define KMS_RTCP_PT_MAX 223
+
+static inline gboolean
+kms_rtcp_demux_buffer_is_rtcp (GstBuffer * buffer)
+{
+  GstMemory *mem;
+  GstMapInfo info;
+  gboolean is_rtcp = TRUE;
+
+  if (gst_buffer_n_memory (buffer) == 0) {
+    return TRUE;
+  }
+
+  /* Only the first memory block is peeked, no RTP validation is done here */
+  mem = gst_buffer_peek_memory (buffer, 0);
+
+  if (!gst_memory_map (mem, &info, GST_MAP_READ)) {
+    return TRUE;
+  }
+
+  if (info.size >= 2) {
+    is_rtcp = (info.data[1] >= KMS_RTCP_PT_MIN &&
+        info.data[1] <= KMS_RTCP_PT_MAX);
+  }
+
+  gst_memory_unmap (mem, &info);
+
+  return is_rtcp;
+}
+
+G_END_DECLS
+
+#endif /* _KMS_RTCP_CLASSIFIER_H_ */
@@ -27,6 +27,8 @@
 #include <gst/rtp/gstrtcpbuffer.h>
 #include <gst/rtp/gstrtpbuffer.h>
 #include "kms-marshal.h"
+#include "kmsssrcmap.h"
+#include "kmsrtcpclassifier.h"
 
 #define PLUGIN_NAME "rtcpdemux"
 
@@ -48,7 +50,18 @@ struct _KmsRtcpDemuxPrivate
   GstPad *rtp_src;
   GstPad *rtcp_src;
 
-  GHashTable *rr_ssrcs;         /* remote_ssrc - local_ssrc mapping */
+  KmsSsrcMap *rr_ssrcs;         /* remote_ssrc - local_ssrc mapping */
+};
+
+/* Remote ssrcs come and go with simulcast layers and renegotiations, so the
+ * mapping only keeps the ones that reported recently */
+#define RR_SSRCS_CAPACITY 64
+#define RR_SSRCS_IDLE_TIMEOUT 30        /* s */
+
+enum
+{
+  PROP_0,
+  PROP_SSRC_MAP_STATS
 };
 
 /* Signals and args */
@@ -100,81 +113,72 @@ G_DEFINE_TYPE_WITH_CODE (KmsRtcpDemux, kms_rtcp_demux,
 static guint32
 kms_rtcp_demux_get_local_rr_ssrc_pair (KmsRtcpDemux * self, guint32 remote_ssrc)
 {
-  gpointer val;
+  guint32 local_ssrc;
 
-  val =
-      g_hash_table_lookup (self->priv->rr_ssrcs,
-      GUINT_TO_POINTER (remote_ssrc));
-  if (val == NULL) {
+  if (!kms_ssrc_map_lookup (self->priv->rr_ssrcs, remote_ssrc, &local_ssrc)) {
     return 0;
   }
 
-  return GPOINTER_TO_UINT (val);
+  return local_ssrc;
 }
 
+/* The first local ssrc reported by a remote ssrc is kept. A buffer is dropped
+ * when it starts with an empty RR from a remote ssrc that is not known yet */
 static gboolean
 refresh_rtcp_rr_ssrcs_map (KmsRtcpDemux * rtcpdemux, GstBuffer * buffer)
 {
   GstRTCPBuffer rtcp = { NULL, };
   GstRTCPPacket packet;
-  GstRTCPType type;
-  gboolean ret = TRUE;
+  gboolean more, first, ret = TRUE;
   guint32 remote_ssrc, local_ssrc;
 
-  gst_rtcp_buffer_map (buffer, GST_MAP_READ, &rtcp);
+  if (!gst_rtcp_buffer_map (buffer, GST_MAP_READ, &rtcp)) {
+    return FALSE;
+  }
 
   if (!gst_rtcp_buffer_get_first_packet (&rtcp, &packet)) {
-    ret = FALSE;
-    goto end;
+    gst_rtcp_buffer_unmap (&rtcp);
+    return FALSE;
   }
 
-  type = gst_rtcp_packet_get_type (&packet);
+  /* Compound packets usually start with a SR, any RR can come after it */
+  for (more = TRUE, first = TRUE; more;
+      more = gst_rtcp_packet_move_to_next (&packet), first = FALSE) {
+    if (gst_rtcp_packet_get_type (&packet) != GST_RTCP_TYPE_RR) {
+      continue;
+    }
 
-  if (type != GST_RTCP_TYPE_RR) {
-    ret = TRUE;
-    goto end;
-  }
+    remote_ssrc = gst_rtcp_packet_rr_get_ssrc (&packet);
+
+    if (kms_ssrc_map_refresh (rtcpdemux->priv->rr_ssrcs, remote_ssrc)) {
+      continue;
+    }
 
-  remote_ssrc = gst_rtcp_packet_rr_get_ssrc (&packet);
-  ret =
-      g_hash_table_contains (rtcpdemux->priv->rr_ssrcs,
-      GUINT_TO_POINTER (remote_ssrc));
+    if (gst_rtcp_packet_get_rb_count (&packet) == 0) {
+      if (first) {
+        ret = FALSE;
+      }
+      continue;
+    }
 
-  if (!ret && (gst_rtcp_packet_get_rb_count (&packet) > 0)) {
     gst_rtcp_packet_get_rb (&packet, 0, &local_ssrc, NULL, NULL, NULL, NULL,
         NULL, NULL);
     GST_DEBUG_OBJECT (rtcpdemux, "remote_ssrc (%u) - local_ssrc(%u)",
         remote_ssrc, local_ssrc);
-    g_hash_table_insert (rtcpdemux->priv->rr_ssrcs,
-        GUINT_TO_POINTER (remote_ssrc), GUINT_TO_POINTER (local_ssrc));
-    ret = TRUE;
+    kms_ssrc_map_update (rtcpdemux->priv->rr_ssrcs, remote_ssrc, local_ssrc);
   }
 
-end:
   gst_rtcp_buffer_unmap (&rtcp);
 
   return ret;
 }
 
-static gboolean
-buffer_is_rtcp (GstBuffer * buffer)
-{
-  GstRTPBuffer rtp_buffer = { NULL };
-
-  if (!gst_rtp_buffer_map (buffer, GST_MAP_READ, &rtp_buffer)) {
-    return TRUE;
-  }
-
-  gst_rtp_buffer_unmap (&rtp_buffer);
-  return FALSE;
-}
-
 static GstFlowReturn
 kms_rtcp_demux_chain (GstPad * chain, GstObject * parent, GstBuffer * buffer)
 {
   KmsRtcpDemux *self = KMS_RTCP_DEMUX (parent);
 
-  if (!buffer_is_rtcp (buffer)) {
+  if (!kms_rtcp_demux_buffer_is_rtcp (buffer)) {
     GST_TRACE_OBJECT (self, "Push RTP buffer");
     gst_pad_push (self->priv->rtp_src, buffer);
     return GST_FLOW_OK;
@@ -190,6 +194,49 @@ kms_rtcp_demux_chain (GstPad * chain, GstObject * parent, GstBuffer * buffer)
   return GST_FLOW_OK;
 }
 
+static GstFlowReturn
+kms_rtcp_demux_chain_list (GstPad * chain, GstObject * parent,
+    GstBufferList * list)
+{
+  KmsRtcpDemux *self = KMS_RTCP_DEMUX (parent);
+  GstBufferList *rtp_list, *rtcp_list;
+  guint i, len;
+
+  len = gst_buffer_list_length (list);
+  rtp_list = gst_buffer_list_new_sized (len);
+  rtcp_list = gst_buffer_list_new ();
+
+  for (i = 0; i < len; i++) {
+    GstBuffer *buffer = gst_buffer_list_get (list, i);
+
+    if (!kms_rtcp_demux_buffer_is_rtcp (buffer)) {
+      gst_buffer_list_add (rtp_list, gst_buffer_ref (buffer));
+    } else if (refresh_rtcp_rr_ssrcs_map (self, buffer)) {
+      gst_buffer_list_add (rtcp_list, gst_buffer_ref (buffer));
+    }
+  }
+
+  gst_buffer_list_unref (list);
+
+  if (gst_buffer_list_length (rtp_list) > 0) {
+    GST_TRACE_OBJECT (self, "Push RTP list (%u buffers)",
+        gst_buffer_list_length (rtp_list));
+    gst_pad_push_list (self->priv->rtp_src, rtp_list);
+  } else {
+    gst_buffer_list_unref (rtp_list);
+  }
+
+  if (gst_buffer_list_length (rtcp_list) > 0) {
+    GST_TRACE_OBJECT (self, "Push RTCP list (%u buffers)",
+        gst_buffer_list_length (rtcp_list));
+    gst_pad_push_list (self->priv->rtcp_src, rtcp_list);
+  } else {
+    gst_buffer_list_unref (rtcp_list);
+  }
+
+  return GST_FLOW_OK;
+}
+
 static void
 kms_rtcp_demux_init (KmsRtcpDemux * rtcpdemux)
 {
@@ -215,9 +262,12 @@ kms_rtcp_demux_init (KmsRtcpDemux * rtcpdemux)
   g_object_unref (tmpl);
   gst_element_add_pad (GST_ELEMENT (rtcpdemux), sink);
 
-  rtcpdemux->priv->rr_ssrcs = g_hash_table_new (g_direct_hash, g_direct_equal);
+  rtcpdemux->priv->rr_ssrcs =
+      kms_ssrc_map_new (RR_SSRCS_CAPACITY, RR_SSRCS_IDLE_TIMEOUT);
 
   gst_pad_set_chain_function (sink, GST_DEBUG_FUNCPTR (kms_rtcp_demux_chain));
+  gst_pad_set_chain_list_function (sink,
+      GST_DEBUG_FUNCPTR (kms_rtcp_demux_chain_list));
 }
 
 static void
@@ -225,12 +275,29 @@ kms_rtcp_demux_finalize (GObject * object)
 {
   KmsRtcpDemux *self = KMS_RTCP_DEMUX (object);
 
-  g_hash_table_unref (self->priv->rr_ssrcs);
+  kms_ssrc_map_free (self->priv->rr_ssrcs);
 
   /* chain up */
   G_OBJECT_CLASS (kms_rtcp_demux_parent_class)->finalize (object);
 }
 
+static void
+kms_rtcp_demux_get_property (GObject * object, guint property_id,
+    GValue * value, GParamSpec * pspec)
+{
+  KmsRtcpDemux *self = KMS_RTCP_DEMUX (object);
+
+  switch (property_id) {
+    case PROP_SSRC_MAP_STATS:
+      g_value_take_boxed (value,
+          kms_ssrc_map_get_stats (self->priv->rr_ssrcs));
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+      break;
+  }
+}
+
 static void
 kms_rtcp_demux_class_init (KmsRtcpDemuxClass * klass)
 {
@@ -238,6 +305,13 @@ kms_rtcp_demux_class_init (KmsRtcpDemuxClass * klass)
   GstElementClass *gst_element_class = GST_ELEMENT_CLASS (klass);
 
   gobject_class->finalize = kms_rtcp_demux_finalize;
+  gobject_class->get_property = kms_rtcp_demux_get_property;
+
+  g_object_class_install_property (gobject_class, PROP_SSRC_MAP_STATS,
+      g_param_spec_boxed ("ssrc-map-stats", "SSRC map stats",
+          "Usage of the remote-local ssrc map: capacity, entries, hits, "
+          "misses and evictions",
+          GST_TYPE_STRUCTURE, G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
 
   /* Setting up pads and setting metadata should be moved to
      base_class_init if you intend to subclass this class. */
@@ -0,0 +1,243 @@
+/*
+ * (C) Copyright 2016 Kurento (http://kurento.org/)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "kmsssrcmap.h"
+
+/* Slots probed after the home one before giving up and evicting */
+#define PROBE_LIMIT 8
+
+/* Each slot packs remote_ssrc (high half) and local_ssrc (low half) so both
+ * are read and written at once. A zero slot is empty: a pair mapping to a
+ * local ssrc 0 is useless as lookups report 0 for unknown ssrcs anyway. */
+#define SLOT_PACK(remote, local) (((guint64) (remote) << 32) | (guint32) (local))
+#define SLOT_REMOTE(slot) ((guint32) ((slot) >> 32))
+#define SLOT_LOCAL(slot) ((guint32) ((slot) & G_MAXUINT32))
+
+#define SLOT_LOAD(map, i) __atomic_load_n (&(map)->slots[i], __ATOMIC_ACQUIRE)
+#define SLOT_STORE(map, i, v) \
+  __atomic_store_n (&(map)->slots[i], (v), __ATOMIC_RELEASE)
+
+struct _KmsSsrcMap
+{
+  guint mask;
+  guint idle_timeout;           /* s */
+  gint64 base_time;             /* us */
+
+  guint64 *slots;
+  gint *last_seen;              /* s since base_time + 1, 0 if never used */
+
+  gint hits;
+  gint misses;
+  gint evictions;
+};
+
+static gint
+kms_ssrc_map_now (KmsSsrcMap * map)
+{
+  return (g_get_monotonic_time () - map->base_time) / G_USEC_PER_SEC + 1;
+}
+
+static guint
+kms_ssrc_map_home (KmsSsrcMap * map, guint32 remote_ssrc)
+{
+  /* Fibonacci hashing, ssrcs are random but keep consecutive ones apart */
+  return (remote_ssrc * 2654435761u) & map->mask;
+}
+
+static gboolean
+kms_ssrc_map_is_expired (KmsSsrcMap * map, guint i, gint now)
+{
+  gint seen = g_atomic_int_get (&map->last_seen[i]);
+
+  return seen == 0 || (guint) (now - seen) > map->idle_timeout;
+}
+
+KmsSsrcMap *
+kms_ssrc_map_new (guint capacity, guint idle_timeout)
+{
+  KmsSsrcMap *map;
+  guint size = 1;
+
+  while (size < MAX (capacity, PROBE_LIMIT)) {
+    size <<= 1;
+  }
+
+  map = g_slice_new0 (KmsSsrcMap);
+  map->mask = size - 1;
+  map->idle_timeout = idle_timeout;
+  map->base_time = g_get_monotonic_time ();
+  map->slots = g_new0 (guint64, size);
+  map->last_seen = g_new0 (gint, size);
+
+  return map;
+}
+
+void
+kms_ssrc_map_free (KmsSsrcMap * map)
+{
+  g_free (map->slots);
+  g_free (map->last_seen);
+
+  g_slice_free (KmsSsrcMap, map);
+}
+
+gboolean
+kms_ssrc_map_lookup (KmsSsrcMap * map, guint32 remote_ssrc,
+    guint32 * local_ssrc)
+{
+  guint home = kms_ssrc_map_home (map, remote_ssrc);
+  gint now = kms_ssrc_map_now (map);
+  guint n;
+
+  for (n = 0; n < PROBE_LIMIT; n++) {
+    guint i = (home + n) & map->mask;
+    guint64 slot = SLOT_LOAD (map, i);
+
+    if (slot == 0) {
+      /* Slots are never emptied, so the ssrc cannot be further away */
+      break;
+    }
+
+    if (SLOT_REMOTE (slot) != remote_ssrc) {
+      continue;
+    }
+
+    if (kms_ssrc_map_is_expired (map, i, now)) {
+      break;
+    }
+
+    if (local_ssrc != NULL) {
+      *local_ssrc = SLOT_LOCAL (slot);
+    }
+
+    g_atomic_int_inc (&map->hits);
+    return TRUE;
+  }
+
+  g_atomic_int_inc (&map->misses);
+  return FALSE;
+}
+
+void
+kms_ssrc_map_update (KmsSsrcMap * map, guint32 remote_ssrc,
+    guint32 local_ssrc)
+{
+  guint64 packed = SLOT_PACK (remote_ssrc, local_ssrc);
+  guint home = kms_ssrc_map_home (map, remote_ssrc);
+  gint now = kms_ssrc_map_now (map);
+  gint target = -1, oldest = -1;
+  gboolean expired = FALSE;
+  guint n;
+
+  if (packed == 0) {
+    return;
+  }
+
+  for (n = 0; n < PROBE_LIMIT; n++) {
+    guint i = (home + n) & map->mask;
+    guint64 slot = SLOT_LOAD (map, i);
+
+    if (slot != 0 && SLOT_REMOTE (slot) == remote_ssrc) {
+      target = i;
+      expired = kms_ssrc_map_is_expired (map, i, now);
+      break;
+    }
+
+    if (target < 0 && (slot == 0 || kms_ssrc_map_is_expired (map, i, now))) {
+      /* Keep looking, the ssrc could still be stored later in the chain */
+      target = i;
+    }
+
+    if (slot == 0) {
+      break;
+    }
+
+    if (oldest < 0 || map->last_seen[i] < map->last_seen[oldest]) {
+      oldest = i;
+    }
+  }
+
+  if (target < 0) {
+    target = oldest;
+    g_atomic_int_inc (&map->evictions);
+  }
+
+  /* Refresh first so readers never see the new pair with a stale time */
+  g_atomic_int_set (&map->last_seen[target], now);
+
+  /* A live pair of the same remote ssrc keeps its local one */
+  if (map->slots[target] != 0 &&
+      SLOT_REMOTE (map->slots[target]) == remote_ssrc && !expired) {
+    return;
+  }
+
+  SLOT_STORE (map, target, packed);
+}
+
+gboolean
+kms_ssrc_map_refresh (KmsSsrcMap * map, guint32 remote_ssrc)
+{
+  guint home = kms_ssrc_map_home (map, remote_ssrc);
+  gint now = kms_ssrc_map_now (map);
+  guint n;
+
+  for (n = 0; n < PROBE_LIMIT; n++) {
+    guint i = (home + n) & map->mask;
+    guint64 slot = map->slots[i];
+
+    if (slot == 0) {
+      break;
+    }
+
+    if (SLOT_REMOTE (slot) != remote_ssrc) {
+      continue;
+    }
+
+    if (kms_ssrc_map_is_expired (map, i, now)) {
+      break;
+    }
+
+    g_atomic_int_set (&map->last_seen[i], now);
+    return TRUE;
+  }
+
+  return FALSE;
+}
+
+GstStructure *
+kms_ssrc_map_get_stats (KmsSsrcMap * map)
+{
+  gint now = kms_ssrc_map_now (map);
+  guint i, entries = 0;
+
+  for (i = 0; i <= map->mask; i++) {
+    if (SLOT_LOAD (map, i) != 0 && !kms_ssrc_map_is_expired (map, i, now)) {
+      entries++;
+    }
+  }
+
+  return gst_structure_new ("ssrc-map",
+      "capacity", G_TYPE_UINT, map->mask + 1,
+      "entries", G_TYPE_UINT, entries,
+      "hits", G_TYPE_UINT, (guint) g_atomic_int_get (&map->hits),
+      "misses", G_TYPE_UINT, (guint) g_atomic_int_get (&map->misses),
+      "evictions", G_TYPE_UINT, (guint) g_atomic_int_get (&map->evictions),
+      NULL);
+}
@@ -0,0 +1,54 @@
+/*
+ * (C) Copyright 2016 Kurento (http://kurento.org/)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef __KMS_SSRC_MAP_H__
+#define __KMS_SSRC_MAP_H__
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+/* Fixed-capacity remote_ssrc -> local_ssrc map.
+ *
+ * There must be a single writer (the streaming thread) but lookups can be done
+ * concurrently from any thread without locking. Entries not refreshed for
+ * @idle_timeout seconds are considered gone and their slots are reused. When
+ * there is no room left, the least recently refreshed entry is evicted. */
+
+typedef struct _KmsSsrcMap KmsSsrcMap;
+
+/* @capacity is rounded up to the next power of two */
+KmsSsrcMap * kms_ssrc_map_new (guint capacity, guint idle_timeout);
+void kms_ssrc_map_free (KmsSsrcMap * map);
+
+gboolean kms_ssrc_map_lookup (KmsSsrcMap * map, guint32 remote_ssrc,
+    guint32 * local_ssrc);
+
+/* Writer side: inserts the pair. If @remote_ssrc is already mapped the first
+ * pair wins, it is only refreshed and keeps its local ssrc */
+void kms_ssrc_map_update (KmsSsrcMap * map, guint32 remote_ssrc,
+    guint32 local_ssrc);
+
+/* Writer side: refreshes the pair of @remote_ssrc, returns FALSE if there is
+ * none. Not accounted in the hits and misses of lookups */
+gboolean kms_ssrc_map_refresh (KmsSsrcMap * map, guint32 remote_ssrc);
+
+/* Returns capacity, entries, hits, misses and evictions */
+GstStructure * kms_ssrc_map_get_stats (KmsSsrcMap * map);
+
+G_END_DECLS
+#endif /* __KMS_SSRC_MAP_H__ */
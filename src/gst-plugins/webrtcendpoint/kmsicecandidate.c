@@ -18,6 +18,7 @@
 #include "kmsicecandidate.h"
 #include <gst/gst.h>
 #include <stdlib.h>
+#include <string.h>
 
 #define GST_CAT_DEFAULT kmsicecandidate
 GST_DEBUG_CATEGORY_STATIC (GST_CAT_DEFAULT);
@@ -38,29 +39,21 @@ G_DEFINE_TYPE (KmsIceCandidate, kms_ice_candidate, G_TYPE_OBJECT);
 #define DEFAULT_SDP_MID    NULL
 #define DEFAULT_SDP_M_LINE_INDEX    0
 
-#define BYTE_STRING_ATTR_EXPR "([\\x01-\\x09]|[\\x0B-\\x0C]|[\\x0E-\\xFF])+"    /* any byte except NUL, CR, or LF (rfc4566) */
-
-#define ALPHA_ATTR_EXPR "[\\x41-\\x5A]|[\\x61-\\x7A]"   /* "[A-Z] | [a-z]" (rfc5234 appendix-B.1) */
-#define DIGIT_ATTR_EXPR "[\\x30-\\x39]"                 /* "[0-9]"         (rfc5234 appendix-B.1) */
-//J TODO - FIXME - libnice bug: Invalid candidate foundation string
-// Remove "x2D" as an option ('-'); this is a ñapa done to avoid a bug in libnice:
-// https://lists.freedesktop.org/archives/nice/2017-June/001381.html
-#define ICE_CHAR_ATTR_EXPR ALPHA_ATTR_EXPR "|" DIGIT_ATTR_EXPR "|\\x2B|\\x2F|\\x2D"   /* "ALPHA | DIGIT | + | /" (rfc5245 section-15.1) */
-
-#define EXTENSION_ATTR_EXP "( tcptype (?<tcptype>(active|passive|so)))?" \
-  "( " BYTE_STRING_ATTR_EXPR " " BYTE_STRING_ATTR_EXPR ")*$"
-
-#define CANDIDATE_EXPR "^candidate:" \
-  "(?<foundation>(" ICE_CHAR_ATTR_EXPR "){1,32})" \
-  " (?<cid>(" DIGIT_ATTR_EXPR "){1,5})" \
-  " (?<transport>(udp|UDP|tcp|TCP))" \
-  " (?<priority>(" DIGIT_ATTR_EXPR "){1,10})" \
-  " (?<addr>[0-9.:a-zA-Z]+)" \
-  " (?<port>[0-9]+)" \
-  " typ (?<type>(host|srflx|prflx|relay))" \
-  "( raddr (?<raddr>[0-9.:a-zA-Z]+))?" \
-  "( rport (?<rport>[0-9]+))?" \
-  EXTENSION_ATTR_EXP
+/* Candidate lines are tokenized in a single pass following the grammar of
+ * section 15.1 of ICE (rfc5245):
+ *
+ *   candidate:<foundation> <component-id> <transport> <priority> <addr> <port>
+ *       typ <type> [raddr <addr>] [rport <port>] [tcptype <tcptype>]
+ *       *(<extension-att-name> <extension-att-value>)
+ *
+ * String fields are not copied, only their position in the candidate line is
+ * kept until a getter asks for them. A line is parsed into a local
+ * KmsIceCandidateFields that is only kept when the whole line is valid, so a
+ * wrong line leaves the values of the previous one untouched. */
+
+#define FOUNDATION_MAX_LEN 32
+#define COMPONENT_ID_MAX_LEN 5
+#define PRIORITY_MAX_LEN 10
 
 enum
 {
@@ -71,122 +64,342 @@ enum
   N_PROPERTIES
 };
 
-/* Based on http://www.w3.org/TR/webrtc/#rtcicecandidate-type */
-struct _KmsIceCandidatePrivate
+/* Substring of the candidate line */
+typedef struct _KmsIceCandidateToken
 {
-  gchar *candidate;
-  gchar *sdp_mid;
-  guint8 sdp_m_line_index;
-  gchar *foundation;
+  guint offset;
+  guint len;                    /* 0 if not provided */
+} KmsIceCandidateToken;
+
+typedef struct _KmsIceCandidateFields
+{
+  KmsIceCandidateToken foundation;
   guint priority;
-  gchar *ip;
+  KmsIceCandidateToken ip;
   KmsIceProtocol protocol;
   guint port;
   KmsIceCandidateType type;
   KmsIceTcpCandidateType tcp_type;
-  gchar *related_addr;          /* optional NULL if not provided */
+  KmsIceCandidateToken related_addr;    /* optional */
   gint related_port;            /* optional, -1 if not provided */
+} KmsIceCandidateFields;
+
+/* Based on http://www.w3.org/TR/webrtc/#rtcicecandidate-type */
+struct _KmsIceCandidatePrivate
+{
+  gchar *candidate;
+  gchar *sdp_mid;
+  guint8 sdp_m_line_index;
+
+  /* Last valid line, tokens of @fields point into it */
+  gchar *line;
+  KmsIceCandidateFields fields;
 
   gchar *stream_id;
   gboolean is_valid;
 };
 
 static gboolean
-kms_ice_candidate_update_values (KmsIceCandidate * self)
+is_ice_char (gchar c)
 {
-  GRegex *regex;
-  GMatchInfo *match_info;
-  gchar *tmp = NULL;
-  gboolean ret = FALSE;
+  //J TODO - FIXME - libnice bug: Invalid candidate foundation string
+  // Remove '-' as an option; this is a ñapa done to avoid a bug in libnice:
+  // https://lists.freedesktop.org/archives/nice/2017-June/001381.html
+  return g_ascii_isalnum (c) || c == '+' || c == '/' || c == '-';
+}
 
-  regex = g_regex_new (CANDIDATE_EXPR, 0, 0, NULL);
-  g_regex_match (regex, self->priv->candidate, 0, &match_info);
+static gboolean
+is_digit_char (gchar c)
+{
+  return g_ascii_isdigit (c);
+}
 
-  if (!g_match_info_matches (match_info)) {
-    GST_WARNING_OBJECT (self, "Cannot parse from '%s'", self->priv->candidate);
-    goto end;
+static gboolean
+is_addr_char (gchar c)
+{
+  return g_ascii_isalnum (c) || c == '.' || c == ':';
+}
+
+static guint
+span (const gchar * str, guint pos, gboolean (*accept) (gchar))
+{
+  guint len = 0;
+
+  while (str[pos + len] != '\0' && accept (str[pos + len])) {
+    len++;
   }
 
-  g_free (self->priv->foundation);
-  g_free (self->priv->ip);
-  g_free (self->priv->related_addr);
+  return len;
+}
 
-  self->priv->ip = g_match_info_fetch_named (match_info, "addr");
+static gboolean
+skip_word (const gchar * str, guint * pos, const gchar * word)
+{
+  gsize len = strlen (word);
 
-  tmp = g_match_info_fetch_named (match_info, "port");
-  self->priv->port = atoi (tmp);
-  g_free (tmp);
+  if (strncmp (str + *pos, word, len) != 0) {
+    return FALSE;
+  }
 
-  self->priv->foundation = g_match_info_fetch_named (match_info, "foundation");
+  *pos += len;
 
-  tmp = g_match_info_fetch_named (match_info, "priority");
-  self->priv->priority = atoi (tmp);
-  g_free (tmp);
+  return TRUE;
+}
 
-  tmp = g_match_info_fetch_named (match_info, "transport");
-  if (g_strcmp0 (tmp, "TCP") == 0 || g_strcmp0 (tmp, "tcp") == 0) {
-    self->priv->protocol = KMS_ICE_PROTOCOL_TCP;
-  } else if (g_strcmp0 (tmp, "UDP") == 0 || g_strcmp0 (tmp, "udp") == 0) {
-    self->priv->protocol = KMS_ICE_PROTOCOL_UDP;
-  } else {
-    GST_ERROR_OBJECT (self, "Unsupported protocol %s", tmp);
-    goto end;
+/* Reads a non empty run of @accept characters followed by a space */
+static gboolean
+read_field (const gchar * str, guint * pos, gboolean (*accept) (gchar),
+    guint max_len, KmsIceCandidateToken * token)
+{
+  guint len = span (str, *pos, accept);
+
+  if (len == 0 || (max_len > 0 && len > max_len) || str[*pos + len] != ' ') {
+    return FALSE;
   }
 
-  g_free (tmp);
-
-  tmp = g_match_info_fetch_named (match_info, "type");
-  if (g_strcmp0 (tmp, "host") == 0) {
-    self->priv->type = KMS_ICE_CANDIDATE_TYPE_HOST;
-  } else if (g_strcmp0 (tmp, "srflx") == 0) {
-    self->priv->type = KMS_ICE_CANDIDATE_TYPE_SRFLX;
-  } else if (g_strcmp0 (tmp, "prflx") == 0) {
-    self->priv->type = KMS_ICE_CANDIDATE_TYPE_PRFLX;
-  } else if (g_strcmp0 (tmp, "relay") == 0) {
-    self->priv->type = KMS_ICE_CANDIDATE_TYPE_RELAY;
-  } else {
-    GST_ERROR_OBJECT (self, "Unsupported ice candidate type %s", tmp);
-    goto end;
+  token->offset = *pos;
+  token->len = len;
+  *pos += len + 1;
+
+  return TRUE;
+}
+
+static gboolean
+read_optional_field (const gchar * str, guint * pos, guint end,
+    const gchar * name, gboolean (*accept) (gchar),
+    KmsIceCandidateToken * token)
+{
+  guint p = *pos;
+  guint len;
+
+  if (!skip_word (str, &p, name)) {
+    return FALSE;
   }
 
-  g_free (tmp);
+  len = span (str, p, accept);
 
-  tmp = g_match_info_fetch_named (match_info, "tcptype");
-  if (g_strcmp0 (tmp, "active") == 0) {
-    self->priv->tcp_type = KMS_ICE_TCP_CANDIDATE_TYPE_ACTIVE;
-  } else if (g_strcmp0 (tmp, "passive") == 0) {
-    self->priv->tcp_type = KMS_ICE_TCP_CANDIDATE_TYPE_PASSIVE;
-  } else if (g_strcmp0 (tmp, "so") == 0) {
-    self->priv->tcp_type = KMS_ICE_TCP_CANDIDATE_TYPE_SO;
-  } else {
-    self->priv->tcp_type = KMS_ICE_TCP_CANDIDATE_TYPE_NONE;
+  if (len == 0 || p + len > end) {
+    return FALSE;
+  }
+
+  token->offset = p;
+  token->len = len;
+  *pos = p + len;
+
+  return TRUE;
+}
+
+/* Extension attributes are name-value pairs of byte-strings: any character
+ * but NUL, CR or LF, where the previous GRegex implementation only accepted
+ * valid UTF-8 up to U+00FF, so that is kept as is */
+static gboolean
+match_extensions (const gchar * str, guint pos, guint end)
+{
+  const gchar *p;
+  gboolean sep = FALSE;
+  guint i;
+
+  if (pos == end) {
+    return TRUE;
+  }
+
+  if (str[pos] != ' ') {
+    return FALSE;
+  }
+
+  for (i = pos; i < end; i++) {
+    if (str[i] == '\r' || str[i] == '\n') {
+      return FALSE;
+    }
+
+    if (i >= pos + 2 && i + 2 <= end && str[i] == ' ') {
+      /* A space with at least one character on each side */
+      sep = TRUE;
+    }
+
+    if ((guchar) str[i] >= 0x80) {
+      break;
+    }
+  }
+
+  /* Non ASCII tail */
+  for (p = str + i; p < str + end; p = g_utf8_next_char (p)) {
+    gunichar c = g_utf8_get_char_validated (p, str + end - p);
+
+    if (c == (gunichar) - 1 || c == (gunichar) - 2 || c > 0xFF || c == '\r'
+        || c == '\n') {
+      return FALSE;
+    }
+
+    if ((guint) (p - str) >= pos + 2 && (guint) (p - str) + 2 <= end
+        && c == ' ') {
+      sep = TRUE;
+    }
   }
-  g_free (tmp);
 
-  tmp = g_match_info_fetch_named (match_info, "raddr");
-  if (tmp != NULL && g_strcmp0 (tmp, "") != 0) {
-    self->priv->related_addr = tmp;
+  return sep;
+}
+
+static gboolean
+kms_ice_candidate_parse_tail (const gchar * str, guint pos, guint end,
+    KmsIceCandidateFields * fields)
+{
+  gint options;
+
+  /* raddr, rport and tcptype are optional and whatever does not fit in them
+   * must be extension attributes. Combinations are tried from all present to
+   * none, so the first one that matches is the one with more known fields */
+  for (options = 7; options >= 0; options--) {
+    KmsIceCandidateToken raddr = { 0, 0 }, rport = { 0, 0 }, tcptype = { 0, 0 };
+    guint p = pos;
+
+    if ((options & 4)
+        && !read_optional_field (str, &p, end, " raddr ", is_addr_char,
+            &raddr)) {
+      continue;
+    }
+
+    if ((options & 2)
+        && !read_optional_field (str, &p, end, " rport ", is_digit_char,
+            &rport)) {
+      continue;
+    }
+
+    if (options & 1) {
+      guint t = p;
+
+      if (skip_word (str, &t, " tcptype active")) {
+        fields->tcp_type = KMS_ICE_TCP_CANDIDATE_TYPE_ACTIVE;
+      } else if (skip_word (str, &t, " tcptype passive")) {
+        fields->tcp_type = KMS_ICE_TCP_CANDIDATE_TYPE_PASSIVE;
+      } else if (skip_word (str, &t, " tcptype so")) {
+        fields->tcp_type = KMS_ICE_TCP_CANDIDATE_TYPE_SO;
+      } else {
+        continue;
+      }
+
+      if (t > end) {
+        continue;
+      }
+
+      tcptype.offset = p;
+      tcptype.len = t - p;
+      p = t;
+    }
+
+    if (!match_extensions (str, p, end)) {
+      continue;
+    }
+
+    if (tcptype.len == 0) {
+      fields->tcp_type = KMS_ICE_TCP_CANDIDATE_TYPE_NONE;
+    }
+
+    fields->related_addr = raddr;
+    fields->related_port = rport.len > 0 ? atoi (str + rport.offset) : -1;
+
+    return TRUE;
+  }
+
+  return FALSE;
+}
+
+static gboolean
+kms_ice_candidate_parse (const gchar * str, KmsIceCandidateFields * fields)
+{
+  KmsIceCandidateToken token;
+  guint pos = 0, end;
+
+  if (str == NULL || !skip_word (str, &pos, "candidate:")) {
+    return FALSE;
+  }
+
+  if (!read_field (str, &pos, is_ice_char, FOUNDATION_MAX_LEN,
+          &fields->foundation)) {
+    return FALSE;
+  }
+
+  /* component-id */
+  if (!read_field (str, &pos, is_digit_char, COMPONENT_ID_MAX_LEN, &token)) {
+    return FALSE;
+  }
+
+  if (skip_word (str, &pos, "udp ") || skip_word (str, &pos, "UDP ")) {
+    fields->protocol = KMS_ICE_PROTOCOL_UDP;
+  } else if (skip_word (str, &pos, "tcp ") || skip_word (str, &pos, "TCP ")) {
+    fields->protocol = KMS_ICE_PROTOCOL_TCP;
   } else {
-    self->priv->related_addr = NULL;
-    g_free (tmp);
+    return FALSE;
+  }
+
+  if (!read_field (str, &pos, is_digit_char, PRIORITY_MAX_LEN, &token)) {
+    return FALSE;
+  }
+
+  fields->priority = atoi (str + token.offset);
+
+  if (!read_field (str, &pos, is_addr_char, 0, &fields->ip)) {
+    return FALSE;
+  }
+
+  if (!read_field (str, &pos, is_digit_char, 0, &token)) {
+    return FALSE;
+  }
+
+  fields->port = atoi (str + token.offset);
+
+  if (!skip_word (str, &pos, "typ ")) {
+    return FALSE;
   }
 
-  tmp = g_match_info_fetch_named (match_info, "rport");
-  if (tmp != NULL && g_strcmp0 (tmp, "") != 0) {
-    self->priv->related_port = atoi (tmp);
+  if (skip_word (str, &pos, "host")) {
+    fields->type = KMS_ICE_CANDIDATE_TYPE_HOST;
+  } else if (skip_word (str, &pos, "srflx")) {
+    fields->type = KMS_ICE_CANDIDATE_TYPE_SRFLX;
+  } else if (skip_word (str, &pos, "prflx")) {
+    fields->type = KMS_ICE_CANDIDATE_TYPE_PRFLX;
+  } else if (skip_word (str, &pos, "relay")) {
+    fields->type = KMS_ICE_CANDIDATE_TYPE_RELAY;
   } else {
-    self->priv->related_port = -1;
+    return FALSE;
+  }
+
+  /* A single trailing line break is tolerated */
+  end = pos + strlen (str + pos);
+  if (end > pos && str[end - 1] == '\n') {
+    end--;
   }
 
-  ret = TRUE;
+  return kms_ice_candidate_parse_tail (str, pos, end, fields);
+}
 
-end:
-  g_free (tmp);
+static gboolean
+kms_ice_candidate_update_values (KmsIceCandidate * self)
+{
+  KmsIceCandidateFields fields = self->priv->fields;
 
-  g_match_info_free (match_info);
-  g_regex_unref (regex);
+  if (!kms_ice_candidate_parse (self->priv->candidate, &fields)) {
+    GST_WARNING_OBJECT (self, "Cannot parse from '%s'",
+        self->priv->candidate);
+    return FALSE;
+  }
+
+  g_free (self->priv->line);
+  self->priv->line = g_strdup (self->priv->candidate);
+  self->priv->fields = fields;
+
+  return TRUE;
+}
+
+static gchar *
+kms_ice_candidate_dup_token (KmsIceCandidate * self,
+    KmsIceCandidateToken * token)
+{
+  if (token->len == 0) {
+    return NULL;
+  }
 
-  return ret;
+  return g_strndup (self->priv->line + token->offset, token->len);
 }
 
 static void
@@ -244,11 +457,9 @@ kms_ice_candidate_finalize (GObject * gobject)
   GST_DEBUG_OBJECT (self, "finalize");
 
   g_free (self->priv->candidate);
+  g_free (self->priv->line);
   g_free (self->priv->sdp_mid);
   g_free (self->priv->stream_id);
-  g_free (self->priv->foundation);
-  g_free (self->priv->ip);
-  g_free (self->priv->related_addr);
 
   G_OBJECT_CLASS (kms_ice_candidate_parent_class)->finalize (gobject);
 }
@@ -291,6 +502,7 @@ kms_ice_candidate_init (KmsIceCandidate * self)
   self->priv->candidate = DEFAULT_CANDIDATE;
   self->priv->sdp_mid = DEFAULT_SDP_MID;
   self->priv->sdp_m_line_index = DEFAULT_SDP_M_LINE_INDEX;
+  self->priv->fields.related_port = -1;
   self->priv->is_valid = FALSE;
 }
 
@@ -341,13 +553,13 @@ kms_ice_candidate_get_stream_id (KmsIceCandidate * self)
 gchar *
 kms_ice_candidate_get_address (KmsIceCandidate * self)
 {
-  return g_strdup (self->priv->ip);
+  return kms_ice_candidate_dup_token (self, &self->priv->fields.ip);
 }
 
 const guint
 kms_ice_candidate_get_port (KmsIceCandidate * self)
 {
-  return self->priv->port;
+  return self->priv->fields.port;
 }
 
 int
@@ -370,43 +582,43 @@ kms_ice_candidate_get_sdp_line (KmsIceCandidate * self)
 gchar *
 kms_ice_candidate_get_foundation (KmsIceCandidate * self)
 {
-  return g_strdup (self->priv->foundation);
+  return kms_ice_candidate_dup_token (self, &self->priv->fields.foundation);
 }
 
 guint
 kms_ice_candidate_get_priority (KmsIceCandidate * self)
 {
-  return self->priv->priority;
+  return self->priv->fields.priority;
 }
 
 KmsIceProtocol
 kms_ice_candidate_get_protocol (KmsIceCandidate * self)
 {
-  return self->priv->protocol;
+  return self->priv->fields.protocol;
 }
 
 KmsIceCandidateType
 kms_ice_candidate_get_candidate_type (KmsIceCandidate * self)
 {
-  return self->priv->type;
+  return self->priv->fields.type;
 }
 
 KmsIceTcpCandidateType
 kms_ice_candidate_get_candidate_tcp_type (KmsIceCandidate * self)
 {
-  return self->priv->tcp_type;
+  return self->priv->fields.tcp_type;
 }
 
 gchar *
 kms_ice_candidate_get_related_address (KmsIceCandidate * self)
 {
-  return g_strdup (self->priv->related_addr);
+  return kms_ice_candidate_dup_token (self, &self->priv->fields.related_addr);
 }
 
 gint
 kms_ice_candidate_get_related_port (KmsIceCandidate * self)
 {
-  return self->priv->related_port;
+  return self->priv->fields.related_port;
 }
 
 gboolean
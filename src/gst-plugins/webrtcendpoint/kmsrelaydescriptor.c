@@ -0,0 +1,250 @@
+/*
+ * (C) Copyright 2016 Kurento (http://kurento.org/)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "kmsrelaydescriptor.h"
+#include <gst/gst.h>
+#include <commons/kmsrefstruct.h>
+
+#define GST_DEFAULT_NAME "kmsrelaydescriptor"
+#define GST_CAT_DEFAULT kms_relay_descriptor_debug
+GST_DEBUG_CATEGORY_STATIC (GST_CAT_DEFAULT);
+
+#define TURN_URL_EXPR "^(?<user>.+):(?<password>.+)@(?<address>[0-9.]+):(?<port>[0-9]+)(\\?transport=(?<transport>(udp|tcp|tls)))?$"
+
+struct _KmsRelayDescriptor
+{
+  KmsRefStruct ref;
+  gchar *url;
+  GArray *servers;
+};
+
+/* Descriptors alive, by URL. Every ref and unref is done with the lock held
+ * so a descriptor cannot be found while it is being destroyed */
+static GMutex cache_mutex;
+static GHashTable *cache = NULL;
+
+static GRegex *
+kms_relay_descriptor_get_regex (void)
+{
+  static gsize regex = 0;
+
+  if (g_once_init_enter (&regex)) {
+    GST_DEBUG_CATEGORY_INIT (GST_CAT_DEFAULT, GST_DEFAULT_NAME, 0,
+        GST_DEFAULT_NAME);
+    g_once_init_leave (&regex, (gsize) g_regex_new (TURN_URL_EXPR,
+            G_REGEX_OPTIMIZE, 0, NULL));
+  }
+
+  return (GRegex *) regex;
+}
+
+static void
+kms_relay_server_clear (KmsRelayServer * server)
+{
+  g_free (server->user);
+  g_free (server->password);
+  g_free (server->address);
+}
+
+static gboolean
+kms_relay_server_parse (const gchar * url, KmsRelayServer * server)
+{
+  GMatchInfo *match_info = NULL;
+  gchar *port_str, *transport;
+  gboolean ret = FALSE;
+
+  g_regex_match (kms_relay_descriptor_get_regex (), url, 0, &match_info);
+
+  if (!g_match_info_matches (match_info)) {
+    goto end;
+  }
+
+  server->user = g_match_info_fetch_named (match_info, "user");
+  server->password = g_match_info_fetch_named (match_info, "password");
+  server->address = g_match_info_fetch_named (match_info, "address");
+
+  port_str = g_match_info_fetch_named (match_info, "port");
+  server->port = g_ascii_strtoll (port_str, NULL, 10);
+  g_free (port_str);
+
+  server->transport = TURN_PROTOCOL_UDP;        /* default */
+  transport = g_match_info_fetch_named (match_info, "transport");
+  if (g_strcmp0 ("tcp", transport) == 0) {
+    server->transport = TURN_PROTOCOL_TCP;
+  } else if (g_strcmp0 ("tls", transport) == 0) {
+    server->transport = TURN_PROTOCOL_TLS;
+  }
+  g_free (transport);
+
+  ret = TRUE;
+
+end:
+  g_match_info_free (match_info);
+
+  return ret;
+}
+
+static void
+kms_relay_descriptor_destroy (KmsRelayDescriptor * self)
+{
+  /* Cache lock is held by kms_relay_descriptor_unref () */
+  g_hash_table_remove (cache, self->url);
+
+  GST_DEBUG ("Relay descriptor for '%s' destroyed", self->url);
+
+  g_array_unref (self->servers);
+  g_free (self->url);
+
+  g_slice_free (KmsRelayDescriptor, self);
+}
+
+static KmsRelayDescriptor *
+kms_relay_descriptor_new (const gchar * url)
+{
+  KmsRelayDescriptor *self;
+  GString *pending;
+  gchar **urls;
+  guint i;
+
+  self = g_slice_new0 (KmsRelayDescriptor);
+  kms_ref_struct_init (KMS_REF_STRUCT_CAST (self),
+      (GDestroyNotify) kms_relay_descriptor_destroy);
+
+  self->url = g_strdup (url);
+  self->servers = g_array_new (FALSE, TRUE, sizeof (KmsRelayServer));
+  g_array_set_clear_func (self->servers,
+      (GDestroyNotify) kms_relay_server_clear);
+
+  urls = g_strsplit (url, KMS_RELAY_DESCRIPTOR_SEPARATOR, -1);
+  pending = g_string_new (NULL);
+
+  /* Pieces are joined back until they make a whole server URL, as the
+   * separator can also be part of the credentials */
+  for (i = 0; urls[i] != NULL; i++) {
+    KmsRelayServer server = { NULL, };
+    gchar *server_url;
+
+    if (pending->len > 0) {
+      g_string_append (pending, KMS_RELAY_DESCRIPTOR_SEPARATOR);
+    }
+    g_string_append (pending, urls[i]);
+
+    server_url = g_strstrip (g_strdup (pending->str));
+
+    if (*server_url == '\0') {
+      g_string_truncate (pending, 0);
+    } else if (kms_relay_server_parse (server_url, &server)) {
+      g_array_append_val (self->servers, server);
+      g_string_truncate (pending, 0);
+    }
+
+    g_free (server_url);
+  }
+
+  g_strfreev (urls);
+
+  if (pending->len > 0) {
+    GST_WARNING ("Invalid TURN URL '%s'", pending->str);
+    g_string_free (pending, TRUE);
+    g_array_unref (self->servers);
+    g_free (self->url);
+    g_slice_free (KmsRelayDescriptor, self);
+
+    return NULL;
+  }
+
+  g_string_free (pending, TRUE);
+
+  GST_DEBUG ("Relay descriptor for '%s' created (%u servers)", self->url,
+      self->servers->len);
+
+  return self;
+}
+
+KmsRelayDescriptor *
+kms_relay_descriptor_get (const gchar * url)
+{
+  KmsRelayDescriptor *self;
+
+  g_return_val_if_fail (url != NULL, NULL);
+
+  kms_relay_descriptor_get_regex ();
+
+  g_mutex_lock (&cache_mutex);
+
+  if (cache == NULL) {
+    cache = g_hash_table_new (g_str_hash, g_str_equal);
+  }
+
+  self = g_hash_table_lookup (cache, url);
+
+  if (self != NULL) {
+    kms_ref_struct_ref (KMS_REF_STRUCT_CAST (self));
+  } else {
+    self = kms_relay_descriptor_new (url);
+
+    if (self != NULL) {
+      g_hash_table_insert (cache, self->url, self);
+    }
+  }
+
+  g_mutex_unlock (&cache_mutex);
+
+  return self;
+}
+
+KmsRelayDescriptor *
+kms_relay_descriptor_ref (KmsRelayDescriptor * self)
+{
+  g_mutex_lock (&cache_mutex);
+  kms_ref_struct_ref (KMS_REF_STRUCT_CAST (self));
+  g_mutex_unlock (&cache_mutex);
+
+  return self;
+}
+
+void
+kms_relay_descriptor_unref (KmsRelayDescriptor * self)
+{
+  g_mutex_lock (&cache_mutex);
+  kms_ref_struct_unref (KMS_REF_STRUCT_CAST (self));
+  g_mutex_unlock (&cache_mutex);
+}
+
+const gchar *
+kms_relay_descriptor_get_url (KmsRelayDescriptor * self)
+{
+  return self->url;
+}
+
+guint
+kms_relay_descriptor_get_n_servers (KmsRelayDescriptor * self)
+{
+  return self->servers->len;
+}
+
+const KmsRelayServer *
+kms_relay_descriptor_get_server (KmsRelayDescriptor * self, guint index)
+{
+  g_return_val_if_fail (index < self->servers->len, NULL);
+
+  return &g_array_index (self->servers, KmsRelayServer, index);
+}
@@ -0,0 +1,58 @@
+/*
+ * (C) Copyright 2016 Kurento (http://kurento.org/)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef __KMS_RELAY_DESCRIPTOR_H__
+#define __KMS_RELAY_DESCRIPTOR_H__
+
+#include "kmsicebaseagent.h"
+
+G_BEGIN_DECLS
+
+/* TURN URLs: 'user:password@address:port(?transport=[udp|tcp|tls])'.
+ * Several relays can be given separated by commas, in priority order. A comma
+ * only separates relays after a complete URL, so credentials can contain it */
+#define KMS_RELAY_DESCRIPTOR_SEPARATOR ","
+
+typedef struct _KmsRelayServer KmsRelayServer;
+typedef struct _KmsRelayDescriptor KmsRelayDescriptor;
+
+struct _KmsRelayServer
+{
+  gchar *user;
+  gchar *password;
+  gchar *address;
+  guint port;
+  TurnProtocol transport;
+};
+
+/* Returns the immutable descriptor of @url, parsing it only if no other
+ * descriptor of the same URL is alive. NULL if the URL is not valid */
+KmsRelayDescriptor * kms_relay_descriptor_get (const gchar * url);
+
+KmsRelayDescriptor * kms_relay_descriptor_ref (KmsRelayDescriptor * self);
+void kms_relay_descriptor_unref (KmsRelayDescriptor * self);
+
+const gchar * kms_relay_descriptor_get_url (KmsRelayDescriptor * self);
+
+/* Servers are kept in the order of the URL, so the first one is the relay
+ * of highest priority */
+guint kms_relay_descriptor_get_n_servers (KmsRelayDescriptor * self);
+const KmsRelayServer * kms_relay_descriptor_get_server (
+    KmsRelayDescriptor * self, guint index);
+
+G_END_DECLS
+#endif /* __KMS_RELAY_DESCRIPTOR_H__ */
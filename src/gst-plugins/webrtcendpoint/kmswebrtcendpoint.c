@@ -21,6 +21,7 @@
 
 #include "kmswebrtcendpoint.h"
 #include "kmswebrtcsession.h"
+#include <looppool/kmslooppool.h>
 #include <commons/constants.h>
 #include <commons/kmsloop.h>
 #include <commons/kmsutils.h>
@@ -84,6 +85,26 @@ enum
 
 static guint kms_webrtc_endpoint_signals[LAST_SIGNAL] = { 0 };
 
+/* ICE agents and DTLS callbacks of every endpoint share this pool */
+static KmsLoopPool *
+kms_webrtc_endpoint_get_loop_pool (void)
+{
+  static gsize pool = 0;
+
+  if (g_once_init_enter (&pool)) {
+    g_once_init_leave (&pool, (gsize) kms_loop_pool_new (PLUGIN_NAME,
+            KMS_LOOP_POOL_DEFAULT_SIZE));
+  }
+
+  return (KmsLoopPool *) pool;
+}
+
+void
+kms_webrtc_endpoint_set_event_loops (guint n_loops)
+{
+  kms_loop_pool_set_size (kms_webrtc_endpoint_get_loop_pool (), n_loops);
+}
+
 struct _KmsWebrtcEndpointPrivate
 {
   KmsLoop *loop;
@@ -521,7 +542,11 @@ kms_webrtc_endpoint_dispose (GObject * object)
 
   KMS_ELEMENT_LOCK (self);
 
-  g_clear_object (&self->priv->loop);
+  if (self->priv->loop != NULL) {
+    kms_loop_pool_release (kms_webrtc_endpoint_get_loop_pool (),
+        self->priv->loop);
+    self->priv->loop = NULL;
+  }
 
   KMS_ELEMENT_UNLOCK (self);
 
@@ -627,7 +652,7 @@ static GstStructure *
 kms_webrtc_endpoint_stats (KmsElement * obj, gchar * selector)
 {
   KmsWebrtcEndpoint *self = KMS_WEBRTC_ENDPOINT (obj);
-  GstStructure *stats;
+  GstStructure *stats, *loop_stats;
   KmsSessStats ss;
   GHashTable *sessions;
 
@@ -642,6 +667,13 @@ kms_webrtc_endpoint_stats (KmsElement * obj, gchar * selector)
   g_hash_table_foreach (sessions,
       (GHFunc) kms_base_rtp_endpoint_add_session_stats, &ss);
 
+  if (selector == NULL) {
+    loop_stats = kms_loop_pool_get_stats (kms_webrtc_endpoint_get_loop_pool ());
+    gst_structure_set (stats, KMS_LOOP_POOL_STATISTICS_FIELD,
+        GST_TYPE_STRUCTURE, loop_stats, NULL);
+    gst_structure_free (loop_stats);
+  }
+
   return stats;
 }
 
@@ -706,7 +738,8 @@ kms_webrtc_endpoint_class_init (KmsWebrtcEndpointClass * klass)
           "TurnUrl",
           "TURN server URL with this format: 'user:password@address:port(?transport=[udp|tcp|tls])'."
           "'address' must be an IP (not a domain)."
-          "'transport' is optional (UDP by default).",
+          "'transport' is optional (UDP by default)."
+          "Several URLs can be given separated by commas, in priority order.",
           DEFAULT_STUN_TURN_URL, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
 
   g_object_class_install_property (gobject_class, PROP_PEM_CERTIFICATE,
@@ -847,7 +880,8 @@ kms_webrtc_endpoint_init (KmsWebrtcEndpoint * self)
   self->priv->stun_server_port = DEFAULT_STUN_SERVER_PORT;
   self->priv->turn_url = DEFAULT_STUN_TURN_URL;
 
-  self->priv->loop = kms_loop_new ();
+  self->priv->loop =
+      kms_loop_pool_acquire (kms_webrtc_endpoint_get_loop_pool ());
   g_object_get (self->priv->loop, "context", &self->priv->context, NULL);
 }
 
@@ -71,5 +71,9 @@ GType kms_webrtc_endpoint_get_type (void);
 
 gboolean kms_webrtc_endpoint_plugin_init (GstPlugin * plugin);
 
+/* Sets how many event loops are shared by all the endpoints of the process.
+ * 0 means one loop per available processor */
+void kms_webrtc_endpoint_set_event_loops (guint n_loops);
+
 G_END_DECLS
 #endif /* __KMS_WEBRTC_ENDPOINT_H__ */
@@ -714,13 +714,20 @@ static void
 kms_webrtc_session_set_relay_info (KmsWebrtcSession * self,
     KmsWebRtcBaseConnection * conn)
 {
-  if (self->turn_address == NULL) {
+  guint i;
+
+  if (self->relays == NULL) {
     return;
   }
 
-  kms_webrtc_base_connection_set_relay_info (conn, self->turn_address,
-      self->turn_port, self->turn_user, self->turn_password,
-      self->turn_transport);
+  /* Installed in priority order */
+  for (i = 0; i < kms_relay_descriptor_get_n_servers (self->relays); i++) {
+    const KmsRelayServer *server =
+        kms_relay_descriptor_get_server (self->relays, i);
+
+    kms_webrtc_base_connection_set_relay_info (conn, server->address,
+        server->port, server->user, server->password, server->transport);
+  }
 }
 
 static gboolean
@@ -1499,15 +1506,7 @@ kms_webrtc_session_add_data_channels_stats (KmsWebrtcSession * self,
 static void
 kms_webrtc_session_parse_turn_url (KmsWebrtcSession * self)
 {
-  GRegex *regex;
-  GMatchInfo *match_info = NULL;
-
-  g_free (self->turn_user);
-  self->turn_user = NULL;
-  g_free (self->turn_password);
-  self->turn_password = NULL;
-  g_free (self->turn_address);
-  self->turn_address = NULL;
+  g_clear_pointer (&self->relays, kms_relay_descriptor_unref);
 
   if ((self->turn_url == NULL)
       || (g_strcmp0 ("", self->turn_url) == 0)) {
@@ -1515,36 +1514,10 @@ kms_webrtc_session_parse_turn_url (KmsWebrtcSession * self)
     return;
   }
 
-  regex =
-      g_regex_new
-      ("^(?<user>.+):(?<password>.+)@(?<address>[0-9.]+):(?<port>[0-9]+)(\\?transport=(?<transport>(udp|tcp|tls)))?$",
-      0, 0, NULL);
-  g_regex_match (regex, self->turn_url, 0, &match_info);
-  g_regex_unref (regex);
-
-  if (g_match_info_matches (match_info)) {
-    gchar *port_str;
-    gchar *turn_transport;
-
-    self->turn_user = g_match_info_fetch_named (match_info, "user");
-    self->turn_password = g_match_info_fetch_named (match_info, "password");
-    self->turn_address = g_match_info_fetch_named (match_info, "address");
-
-    port_str = g_match_info_fetch_named (match_info, "port");
-    self->turn_port = g_ascii_strtoll (port_str, NULL, 10);
-    g_free (port_str);
-
-    self->turn_transport = TURN_PROTOCOL_UDP;   /* default */
-    turn_transport = g_match_info_fetch_named (match_info, "transport");
-    if (turn_transport != NULL) {
-      if (g_strcmp0 ("tcp", turn_transport) == 0) {
-        self->turn_transport = TURN_PROTOCOL_TCP;
-      } else if (g_strcmp0 ("tls", turn_transport) == 0) {
-        self->turn_transport = TURN_PROTOCOL_TLS;
-      }
-      g_free (turn_transport);
-    }
+  /* Endpoints usually share the same URL, so it is only parsed once */
+  self->relays = kms_relay_descriptor_get (self->turn_url);
 
+  if (self->relays != NULL) {
     GST_INFO_OBJECT (self, "TURN server info set (%s)", self->turn_url);
   } else {
     GST_ELEMENT_ERROR (self, RESOURCE, SETTINGS,
@@ -1553,8 +1526,6 @@ kms_webrtc_session_parse_turn_url (KmsWebrtcSession * self)
         ("URL '%s' not allowed. It must have this format: 'user:password@address:port(?transport=[udp|tcp|tls])'",
             self->turn_url));
   }
-
-  g_match_info_free (match_info);
 }
 
 static void
@@ -1635,9 +1606,7 @@ kms_webrtc_session_finalize (GObject * object)
 
   g_free (self->stun_server_ip);
   g_free (self->turn_url);
-  g_free (self->turn_user);
-  g_free (self->turn_password);
-  g_free (self->turn_address);
+  g_clear_pointer (&self->relays, kms_relay_descriptor_unref);
   g_free (self->pem_certificate);
 
   if (self->destroy_data != NULL && self->cb_data != NULL) {
@@ -1828,7 +1797,8 @@ kms_webrtc_session_class_init (KmsWebrtcSessionClass * klass)
           "TurnUrl",
           "TURN server URL with this format: 'user:password@address:port(?transport=[udp|tcp|tls])'."
           "'address' must be an IP (not a domain)."
-          "'transport' is optional (UDP by default).",
+          "'transport' is optional (UDP by default)."
+          "Several URLs can be given separated by commas, in priority order.",
           DEFAULT_STUN_TURN_URL, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
 
   g_object_class_install_property (gobject_class, PROP_PEM_CERTIFICATE,
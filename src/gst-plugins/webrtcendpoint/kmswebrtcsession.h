@@ -22,6 +22,7 @@
 #include <commons/kmsbasertpsession.h>
 #include "kmsicecandidate.h"
 #include "kmsicebaseagent.h"
+#include "kmsrelaydescriptor.h"
 #include "kmswebrtcconnection.h"
 
 G_BEGIN_DECLS
@@ -64,11 +65,7 @@ struct _KmsWebrtcSession
   gchar *stun_server_ip;
   guint stun_server_port;
   gchar *turn_url;
-  gchar *turn_user;
-  gchar *turn_password;
-  gchar *turn_address;
-  guint turn_port;
-  TurnProtocol turn_transport;
+  KmsRelayDescriptor *relays;
   gchar *pem_certificate;
 
   guint16 min_port;
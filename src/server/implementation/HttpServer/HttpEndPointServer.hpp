@@ -33,7 +33,8 @@ class HttpEndPointServer
 {
 public:
   static std::shared_ptr<HttpEndPointServer> getHttpEndPointServer (
-    const uint port, const std::string &iface, const std::string &addr);
+    const uint port, const std::string &iface, const std::string &addr,
+    const uint loops = 1);
   void start ();
   void stop ();
   void registerEndPoint (GstElement *endpoint, guint timeout,
@@ -57,6 +58,7 @@ private:
   static uint port;
   static std::string interface;
   static std::string announcedAddr;
+  static uint loops;
 
   HttpEndPointServer ();
   KmsHttpEPServer *server;
@@ -19,12 +19,14 @@
 #include <libsoup/soup.h>
 #include <uuid/uuid.h>
 #include <string.h>
+#include <sys/socket.h>
 #include <gio/gio.h>
 #include <nice/interfaces.h>
 #include <commons/kmsloop.h>
 
 #include "KmsHttpEPServer.h"
 #include "KmsHttpPost.h"
+#include "KmsHttpGet.h"
 #include "http-enumtypes.h"
 #include "http-marshal.h"
 
@@ -59,6 +61,12 @@ G_DEFINE_QUARK (KEY_COOKIE, key_cookie)
 #define KEY_PARAM_POST_CONTROLLER "kms-post-controller"
 G_DEFINE_QUARK (KEY_PARAM_POST_CONTROLLER, key_param_post_controller)
 
+#define KEY_PARAM_GET_CONTROLLER "kms-get-controller"
+G_DEFINE_QUARK (KEY_PARAM_GET_CONTROLLER, key_param_get_controller)
+
+#define KEY_NEW_BUFFER_HANDLER_ID "kms-new-buffer-handler-id"
+G_DEFINE_QUARK (KEY_NEW_BUFFER_HANDLER_ID, key_new_buffer_handler_id)
+
 #define KEY_PARAM_TIMEOUT "kms-param-timeout"
 G_DEFINE_QUARK (KEY_PARAM_TIMEOUT, key_param_timeout)
 
@@ -68,14 +76,43 @@ GST_DEBUG_CATEGORY_STATIC (GST_CAT_DEFAULT);
 #define RESOLV_TIMEOUT 5000 /* 5 seconds */
 
 #define KMS_HTTP_EP_SERVER_GET_PRIVATE(obj) (G_TYPE_INSTANCE_GET_PRIVATE ((obj), KMS_TYPE_HTTP_EP_SERVER, KmsHttpEPServerPrivate))
+
+/* Each worker accepts and serves connections from its own loop. When there
+ * are several, all of them listen on the same port and the kernel balances
+ * connections among them */
+typedef struct _KmsHttpEPServerWorker {
+  KmsHttpEPServer *self;
+  KmsLoop *loop;
+  SoupServer *server;
+  GSocket *socket;
+
+  /* Pushed as thread default while listening, only used from the loop */
+  GMainContext *context;
+
+  /* Signaled once the server is disconnected from its loop */
+  GMutex mutex;
+  GCond cond;
+  gboolean disconnected;
+
+  GMutex stats_lock;
+  guint64 requests;
+  guint64 bytes_received;
+  guint64 bytes_sent;
+} KmsHttpEPServerWorker;
+
 struct _KmsHttpEPServerPrivate {
+  /* Looked up from every worker, modified from the control loop */
   GHashTable *handlers;
-  SoupServer *server;
+  GRWLock handlers_lock;
+
+  GPtrArray *workers;
   gchar *announced_addr;
   gchar *got_addr;
   gchar *iface;
   gint port;
-  GRand *rand;
+  guint loops;
+
+  /* Control loop, registration and expiration timeouts are run here */
   KmsLoop *loop;
 };
 
@@ -98,6 +135,8 @@ enum {
   PROP_KMS_HTTP_EP_SERVER_PORT,
   PROP_KMS_HTTP_EP_SERVER_INTERFACE,
   PROP_KMS_HTTP_EP_SERVER_ANNOUNCED_ADDRESS,
+  PROP_KMS_HTTP_EP_SERVER_LOOPS,
+  PROP_KMS_HTTP_EP_SERVER_STATS,
 
   N_PROPERTIES
 };
@@ -106,6 +145,7 @@ enum {
 #define KMS_HTTP_EP_SERVER_DEFAULT_INTERFACE NULL
 #define KMS_HTTP_EP_SERVER_DEFAULT_ANNOUNCED_ADDRESS \
   KMS_HTTP_EP_SERVER_DEFAULT_INTERFACE
+#define KMS_HTTP_EP_SERVER_DEFAULT_LOOPS 1
 
 static GParamSpec *obj_properties[N_PROPERTIES] = { NULL, };
 
@@ -149,6 +189,15 @@ struct sample_data {
   GstSample *sample;
 };
 
+static gboolean
+equal_str_key (gconstpointer a, gconstpointer b)
+{
+  const char *str1 = (const char *) a;
+  const char *str2 = (const char *) b;
+
+  return (g_strcmp0 (str1, str2) == 0);
+}
+
 static gchar *
 get_address ()
 {
@@ -200,8 +249,28 @@ get_address ()
   return addressStr;
 }
 
+struct tmp_timeout_data {
+  KmsHttpEPServer *server;
+  GstElement *httpep;
+  SoupMessage *msg;
+};
+
 static void
-kms_http_ep_server_remove_timeout (KmsHttpEPServer *self, GstElement *httpep)
+destroy_tmp_timeout_data (struct tmp_timeout_data *tdata)
+{
+  g_object_unref (tdata->server);
+  gst_object_unref (tdata->httpep);
+
+  if (tdata->msg != NULL) {
+    g_object_unref (tdata->msg);
+  }
+
+  g_slice_free (struct tmp_timeout_data, tdata);
+}
+
+/* Runs from the control loop, the only one accessing timeouts */
+static void
+kms_http_ep_server_clear_timeout (KmsHttpEPServer *self, GstElement *httpep)
 {
   guint *timeout_id;
 
@@ -219,17 +288,64 @@ kms_http_ep_server_remove_timeout (KmsHttpEPServer *self, GstElement *httpep)
                            NULL);
 }
 
+static gboolean
+remove_timeout_cb (struct tmp_timeout_data *tdata)
+{
+  kms_http_ep_server_clear_timeout (tdata->server, tdata->httpep);
+
+  return G_SOURCE_REMOVE;
+}
+
+static void
+kms_http_ep_server_remove_timeout (KmsHttpEPServer *self, GstElement *httpep)
+{
+  struct tmp_timeout_data *tdata;
+
+  if (KMS_LOOP_IS_CURRENT_THREAD (self->priv->loop) ) {
+    kms_http_ep_server_clear_timeout (self, httpep);
+    return;
+  }
+
+  tdata = g_slice_new0 (struct tmp_timeout_data);
+  tdata->server = KMS_HTTP_EP_SERVER (g_object_ref (self) );
+  tdata->httpep = GST_ELEMENT (gst_object_ref (httpep) );
+
+  kms_loop_idle_add_full (self->priv->loop, G_PRIORITY_HIGH_IDLE,
+                          (GSourceFunc) remove_timeout_cb, tdata,
+                          (GDestroyNotify) destroy_tmp_timeout_data);
+}
+
+/* Returns a new reference to the end point registered for @uri */
 static GstElement *
-kms_http_ep_server_get_ep_from_msg (KmsHttpEPServer *self, SoupMessage *msg)
+kms_http_ep_server_lookup (KmsHttpEPServer *self, const char *uri)
 {
-  SoupURI *suri = soup_message_get_uri (msg);
-  const char *uri = soup_uri_get_path (suri);
+  GstElement *httpep = NULL;
 
-  if (uri == NULL || self->priv->handlers == NULL) {
+  if (uri == NULL) {
     return NULL;
   }
 
-  return (GstElement *) g_hash_table_lookup (self->priv->handlers, uri);
+  g_rw_lock_reader_lock (&self->priv->handlers_lock);
+
+  if (self->priv->handlers != NULL) {
+    httpep = (GstElement *) g_hash_table_lookup (self->priv->handlers, uri);
+
+    if (httpep != NULL) {
+      gst_object_ref (httpep);
+    }
+  }
+
+  g_rw_lock_reader_unlock (&self->priv->handlers_lock);
+
+  return httpep;
+}
+
+static GstElement *
+kms_http_ep_server_get_ep_from_msg (KmsHttpEPServer *self, SoupMessage *msg)
+{
+  SoupURI *suri = soup_message_get_uri (msg);
+
+  return kms_http_ep_server_lookup (self, soup_uri_get_path (suri) );
 }
 
 static gboolean
@@ -245,10 +361,11 @@ emit_expiration_signal_cb (gpointer user_data)
   GST_DEBUG ("Cookie expired for %s", path);
   g_signal_emit (G_OBJECT (serv), obj_signals[URL_EXPIRED], 0, path);
 
-  httpep = (GstElement *) g_hash_table_lookup (serv->priv->handlers, path);
+  httpep = kms_http_ep_server_lookup (serv, path);
 
   if (httpep != NULL) {
-    kms_http_ep_server_remove_timeout (serv, httpep);
+    kms_http_ep_server_clear_timeout (serv, httpep);
+    gst_object_unref (httpep);
   }
 
   return G_SOURCE_REMOVE;
@@ -260,10 +377,11 @@ destroy_guint (guint *id)
   g_slice_free (guint, id);
 }
 
+/* Runs from the control loop, the only one accessing timeouts */
 static void
-emit_expiration_signal (SoupMessage *msg, GstElement *httpep)
+kms_http_ep_server_add_timeout (KmsHttpEPServer *serv, SoupMessage *msg,
+                                GstElement *httpep)
 {
-  KmsHttpEPServer *serv;
   double t_timeout;
   SoupDate *now;
   guint *timeout, *id;
@@ -277,8 +395,6 @@ emit_expiration_signal (SoupMessage *msg, GstElement *httpep)
   t_timeout = difftime (soup_date_to_time_t (now) + *timeout,
                         soup_date_to_time_t (now) );
 
-  serv = (KmsHttpEPServer *) g_object_get_qdata (G_OBJECT (msg),
-         key_http_ep_server_quark () );
   id = g_slice_new (guint);
   *id = kms_loop_timeout_add_full (serv->priv->loop,
                                    G_PRIORITY_DEFAULT, t_timeout * 1000,
@@ -290,6 +406,39 @@ emit_expiration_signal (SoupMessage *msg, GstElement *httpep)
   soup_date_free (now);
 }
 
+static gboolean
+add_timeout_cb (struct tmp_timeout_data *tdata)
+{
+  kms_http_ep_server_add_timeout (tdata->server, tdata->msg, tdata->httpep);
+
+  return G_SOURCE_REMOVE;
+}
+
+static void
+emit_expiration_signal (SoupMessage *msg, GstElement *httpep)
+{
+  struct tmp_timeout_data *tdata;
+  KmsHttpEPServer *serv;
+
+  serv = (KmsHttpEPServer *) g_object_get_qdata (G_OBJECT (msg),
+         key_http_ep_server_quark () );
+
+  if (KMS_LOOP_IS_CURRENT_THREAD (serv->priv->loop) ) {
+    kms_http_ep_server_add_timeout (serv, msg, httpep);
+    return;
+  }
+
+  /* Messages are finished from the loop of the worker serving them */
+  tdata = g_slice_new0 (struct tmp_timeout_data);
+  tdata->server = KMS_HTTP_EP_SERVER (g_object_ref (serv) );
+  tdata->httpep = GST_ELEMENT (gst_object_ref (httpep) );
+  tdata->msg = SOUP_MESSAGE (g_object_ref (msg) );
+
+  kms_loop_idle_add_full (serv->priv->loop, G_PRIORITY_HIGH_IDLE,
+                          (GSourceFunc) add_timeout_cb, tdata,
+                          (GDestroyNotify) destroy_tmp_timeout_data);
+}
+
 static void
 destroy_ulong (gulong *handlerid)
 {
@@ -303,16 +452,17 @@ got_post_data_cb (KmsHttpPost *post_obj, SoupBuffer *buffer, gpointer data)
   GstFlowReturn ret;
   GstBuffer *new_buffer;
   GstMemory *memory;
-  GstMapInfo info;
+  SoupBuffer *copy;
 
+  /* Temporary chunks are duplicated by soup_buffer_copy (), so the data of
+   * the copy is wrapped, which stays alive until the memory is freed */
+  copy = soup_buffer_copy (buffer);
   new_buffer = gst_buffer_new ();
-  memory = gst_allocator_alloc (NULL, buffer->length, NULL);
+  memory = gst_memory_new_wrapped (GST_MEMORY_FLAG_READONLY,
+                                   (gpointer) copy->data, copy->length, 0, copy->length,
+                                   copy, (GDestroyNotify) soup_buffer_free);
   gst_buffer_append_memory (new_buffer, memory);
 
-  gst_buffer_map (new_buffer, &info, GST_MAP_WRITE);
-  memcpy (info.data, buffer->data, info.size);
-  gst_buffer_unmap (new_buffer, &info);
-
   g_signal_emit_by_name (httpep, "push-buffer", new_buffer, &ret);
 
   if (ret != GST_FLOW_OK) {
@@ -425,6 +575,60 @@ uninstall_http_post_signals (GstElement *httpep)
   }
 }
 
+static void
+new_buffer_cb (GstElement *httpep, GstBuffer *buffer, gpointer data)
+{
+  kms_http_get_push_buffer (KMS_HTTP_GET (data), buffer);
+}
+
+/* Called serialized with the clients added and removed on every worker, so
+ * a client can not join a muxer being stopped */
+static void
+get_start_cb (KmsHttpGet *get_obj, gboolean start, SoupMessage *msg,
+              gpointer data)
+{
+  GstElement *httpep = GST_ELEMENT (data);
+
+  GST_DEBUG ("%s muxing for GET clients", start ? "Start" : "Stop");
+
+  g_object_set (G_OBJECT (httpep), "start", start, NULL);
+
+  if (!start) {
+    /* No clients left, media is not muxed until a new one arrives */
+    emit_expiration_signal (msg, httpep);
+  }
+}
+
+static void
+uninstall_http_get_signals (GstElement *httpep)
+{
+  KmsHttpGet *get_obj;
+  gulong *handlerid;
+
+  handlerid = (gulong *) g_object_get_qdata (G_OBJECT (httpep),
+              key_new_buffer_handler_id_quark () );
+
+  if (handlerid != NULL) {
+    GST_DEBUG ("Disconnecting new-buffer signal with id %lu from %p ",
+               *handlerid, (gpointer) httpep);
+    g_signal_handler_disconnect (httpep, *handlerid);
+    g_object_set_qdata_full (G_OBJECT (httpep), key_new_buffer_handler_id_quark (),
+                             NULL, NULL);
+  }
+
+  get_obj = (KmsHttpGet *) g_object_get_qdata (G_OBJECT (httpep),
+            key_param_get_controller_quark () );
+
+  if (get_obj != NULL) {
+    /* Workers still using the controller must not start the endpoint */
+    kms_http_get_set_start_func (get_obj, NULL, NULL, NULL);
+  }
+
+  /* Finishes the responses of all clients */
+  g_object_set_qdata_full (G_OBJECT (httpep), key_param_get_controller_quark (),
+                           NULL, NULL);
+}
+
 static void
 add_access_control_headers (SoupMessage *msg)
 {
@@ -451,14 +655,95 @@ kms_http_ep_server_post_handler (KmsHttpEPServer *self, SoupMessage *msg,
 
   if (post_obj == NULL) {
     post_obj = kms_http_post_new ();
-    g_object_set_qdata_full (G_OBJECT (httpep), key_param_post_controller_quark (),
-                             post_obj, g_object_unref);
+
+    /* First request may arrive at the same time from other worker */
+    if (!g_object_replace_qdata (G_OBJECT (httpep),
+                                 key_param_post_controller_quark (), NULL, post_obj,
+                                 g_object_unref, NULL) ) {
+      g_object_unref (post_obj);
+      post_obj = (KmsHttpPost *) g_object_get_qdata (G_OBJECT (httpep),
+                 key_param_post_controller_quark () );
+    }
   }
 
   install_http_post_signals (httpep);
   g_object_set (G_OBJECT (post_obj), "soup-message", msg, NULL);
 }
 
+static gpointer
+ref_object (gpointer data, gpointer user_data)
+{
+  return (data != NULL) ? g_object_ref (data) : NULL;
+}
+
+static gboolean
+kms_http_ep_server_get_handler (KmsHttpEPServerWorker *worker,
+                                SoupMessage *msg, GstElement *httpep)
+{
+  KmsHttpGet *get_obj;
+
+  /* Controller may be removed from the control loop while in use */
+  get_obj = (KmsHttpGet *) g_object_dup_qdata (G_OBJECT (httpep),
+            key_param_get_controller_quark (), ref_object, NULL);
+
+  if (get_obj == NULL) {
+    gboolean drop_slow_clients;
+    guint max_buffering;
+    gchar *mime_type;
+    gulong *handlerid;
+
+    g_object_get (G_OBJECT (httpep), "mime-type", &mime_type,
+                  "drop-slow-clients", &drop_slow_clients, "max-client-buffering",
+                  &max_buffering, NULL);
+
+    /* One muxed stream per endpoint, shared by all its clients */
+    get_obj = kms_http_get_new ();
+    g_object_set (G_OBJECT (get_obj), "mime-type", mime_type,
+                  "drop-slow-clients", drop_slow_clients, "max-buffering",
+                  max_buffering, NULL);
+    g_free (mime_type);
+
+    /* Set before other workers can add clients to it */
+    kms_http_get_set_start_func (get_obj, get_start_cb, httpep, NULL);
+
+    /* First client may arrive at the same time from other worker */
+    if (!g_object_replace_qdata (G_OBJECT (httpep),
+                                 key_param_get_controller_quark (), NULL, get_obj,
+                                 g_object_unref, NULL) ) {
+      g_object_unref (get_obj);
+      get_obj = (KmsHttpGet *) g_object_dup_qdata (G_OBJECT (httpep),
+                key_param_get_controller_quark (), ref_object, NULL);
+
+      if (get_obj == NULL) {
+        /* End point has just been unregistered */
+        soup_message_set_status_full (msg, SOUP_STATUS_NOT_FOUND,
+                                      "Http end point not found");
+        return FALSE;
+      }
+
+      goto add_client;
+    }
+
+    /* End point owns the controller set above */
+    g_object_ref (get_obj);
+
+    handlerid = g_slice_new (gulong);
+    *handlerid = g_signal_connect_data (httpep, "new-buffer",
+                                        G_CALLBACK (new_buffer_cb), g_object_ref (get_obj),
+                                        (GClosureNotify) g_object_unref, (GConnectFlags) 0);
+    GST_DEBUG ("Installing new-buffer signal with id %lu from %p ",
+               *handlerid, (gpointer) httpep);
+    g_object_set_qdata_full (G_OBJECT (httpep), key_new_buffer_handler_id_quark (),
+                             handlerid, (GDestroyNotify) destroy_ulong);
+  }
+
+add_client:
+  kms_http_get_add_client (get_obj, worker->loop, worker->server, msg);
+  g_object_unref (get_obj);
+
+  return TRUE;
+}
+
 static void
 emit_removed_url_signal (KmsHttpEPServer *self, gchar *uri)
 {
@@ -471,8 +756,9 @@ kms_http_ep_server_clean_http_end_point (KmsHttpEPServer *self,
     GstElement *httpep)
 {
   uninstall_http_post_signals (httpep);
+  uninstall_http_get_signals (httpep);
 
-  kms_http_ep_server_remove_timeout (self, httpep);
+  kms_http_ep_server_clear_timeout (self, httpep);
 
   /* Cancel current transtacion */
   g_object_set_qdata_full (G_OBJECT (httpep), key_message_quark (), NULL, NULL);
@@ -493,10 +779,17 @@ remove_http_end_point_cb (gpointer key, gpointer value, gpointer user_data)
 static void
 kms_http_ep_server_remove_handlers (KmsHttpEPServer *self)
 {
-  g_hash_table_foreach (self->priv->handlers, remove_http_end_point_cb, self);
+  GHashTable *handlers;
 
-  /* Remove handlers */
-  g_hash_table_remove_all (self->priv->handlers);
+  g_rw_lock_writer_lock (&self->priv->handlers_lock);
+  handlers = self->priv->handlers;
+  self->priv->handlers = g_hash_table_new_full (g_str_hash, equal_str_key,
+                         g_free, g_object_unref);
+  g_rw_lock_writer_unlock (&self->priv->handlers_lock);
+
+  /* Handlers of removed signals may unregister end points */
+  g_hash_table_foreach (handlers, remove_http_end_point_cb, self);
+  g_hash_table_unref (handlers);
 }
 
 static void
@@ -552,12 +845,27 @@ destroy_tmp_data (struct tmp_data *tdata)
   g_slice_free (struct tmp_data, tdata);
 }
 
+/* Runs from the loop of the worker */
+static gboolean
+kms_http_ep_server_worker_disconnect (KmsHttpEPServerWorker *worker)
+{
+  if (worker->context != NULL) {
+    soup_server_disconnect (worker->server);
+    g_main_context_pop_thread_default (worker->context);
+    g_main_context_unref (worker->context);
+    worker->context = NULL;
+  }
+
+  return G_SOURCE_REMOVE;
+}
+
 static gboolean
 stop_http_ep_server_cb (struct tmp_data *tdata)
 {
   GError *gerr = NULL;
+  guint i;
 
-  if (tdata->server->priv->server == NULL) {
+  if (tdata->server->priv->workers->len == 0) {
     g_set_error (&gerr, KMS_HTTP_EP_SERVER_ERROR,
                  HTTPEPSERVER_UNEXPECTED_ERROR,
                  "Server is not started");
@@ -566,8 +874,14 @@ stop_http_ep_server_cb (struct tmp_data *tdata)
 
   kms_http_ep_server_remove_handlers (tdata->server);
 
-  /* Stops processing for server */
-  soup_server_quit (tdata->server->priv->server);
+  /* Stops processing for server, connections are closed from their loops */
+  for (i = 0; i < tdata->server->priv->workers->len; i++) {
+    KmsHttpEPServerWorker *worker = (KmsHttpEPServerWorker *)
+                                    g_ptr_array_index (tdata->server->priv->workers, i);
+
+    kms_loop_idle_add_full (worker->loop, G_PRIORITY_HIGH_IDLE,
+                            (GSourceFunc) kms_http_ep_server_worker_disconnect, worker, NULL);
+  }
 
 end:
 
@@ -609,23 +923,9 @@ destroy_pending_message (SoupMessage *msg)
 
   GST_DEBUG ("Destroy pending message %" GST_PTR_FORMAT, (gpointer) msg);
 
-  if (msg->method == SOUP_METHOD_GET) {
-    gulong *handlerid;
-
-    if (httpep != NULL) {
-      /* Drop internal media flowing in the piepline */
-      g_object_set (G_OBJECT (httpep), "start", FALSE, NULL);
-    }
-
-    /* Do not call to finished callback */
-    handlerid = (gulong *) g_object_get_qdata (G_OBJECT (msg),
-                key_finished_handler_id_quark () );
-    g_signal_handler_disconnect (G_OBJECT (msg), *handlerid);
-
-    soup_server_unpause_message (serv->priv->server, msg);
-    soup_message_body_complete (msg->response_body);
-
-  } else if (msg->method == SOUP_METHOD_POST) {
+  /* GET requests are not bound to the end point, they are finished by the
+   * KmsHttpGet serving them */
+  if (msg->method == SOUP_METHOD_POST) {
     KmsHttpPost *post_obj = NULL;
 
     if (httpep != NULL)
@@ -637,6 +937,10 @@ destroy_pending_message (SoupMessage *msg)
     }
   }
 
+  if (httpep != NULL) {
+    gst_object_unref (httpep);
+  }
+
   /* Force to remove http server reference */
   g_object_set_qdata_full (G_OBJECT (msg), key_http_ep_server_quark (), NULL,
                            NULL);
@@ -651,16 +955,21 @@ kms_http_ep_server_register_handler (KmsHttpEPServer *self, gchar *uri,
 {
   GstElement *element;
 
+  g_rw_lock_writer_lock (&self->priv->handlers_lock);
+
   element = (GstElement *) g_hash_table_lookup (self->priv->handlers, uri);
 
   if (element != NULL) {
     GST_ERROR ("URI %s is already registered for element %s.", uri,
                GST_ELEMENT_NAME (element) );
+    g_rw_lock_writer_unlock (&self->priv->handlers_lock);
     return FALSE;
   }
 
   g_hash_table_insert (self->priv->handlers, uri, g_object_ref (endpoint) );
 
+  g_rw_lock_writer_unlock (&self->priv->handlers_lock);
+
   return TRUE;
 }
 
@@ -689,7 +998,8 @@ kms_http_ep_server_set_cookie (KmsHttpEPServer *self, GstElement *httpep,
   gint64 id;
 
   /* No cookie has been set for this httpep */
-  id = g_rand_double_range (self->priv->rand, G_MININT64, G_MAXINT64);
+  /* Global generator is thread safe, cookies are set from every worker */
+  id = g_random_double_range (G_MININT64, G_MAXINT64);
   id_str = g_strdup_printf ("%" G_GINT64_FORMAT, id);
   cookie = soup_cookie_new (COOKIE_NAME, id_str,
                             kms_http_ep_server_get_announced_addr (self), path,
@@ -746,7 +1056,9 @@ kms_http_ep_server_manage_cookie_session (KmsHttpEPServer *self,
 
   g_object_get (G_OBJECT (msg), "method", &method, NULL);
 
-  if (g_strcmp0 (method, SOUP_METHOD_OPTIONS) == 0) {
+  /* Any number of clients can play a GET endpoint */
+  if (g_strcmp0 (method, SOUP_METHOD_OPTIONS) == 0 ||
+      g_strcmp0 (method, SOUP_METHOD_GET) == 0) {
     g_free (method);
     return TRUE;
   }
@@ -778,12 +1090,13 @@ static void
 got_headers_handler (SoupMessage *msg, gpointer data)
 {
   KmsHttpEndPointAction action = KMS_HTTP_END_POINT_ACTION_UNDEFINED;
-  KmsHttpEPServer *self = KMS_HTTP_EP_SERVER (data);
+  KmsHttpEPServerWorker *worker = (KmsHttpEPServerWorker *) data;
+  KmsHttpEPServer *self = worker->self;
   SoupURI *uri = soup_message_get_uri (msg);
   const char *path = soup_uri_get_path (uri);
   GstElement *httpep;
 
-  httpep = (GstElement *) g_hash_table_lookup (self->priv->handlers, path);
+  httpep = kms_http_ep_server_lookup (self, path);
 
   if (httpep == NULL) {
     /* URI is not registered */
@@ -796,85 +1109,344 @@ got_headers_handler (SoupMessage *msg, gpointer data)
     GST_WARNING ("Request declined because of a cookie error");
     soup_message_set_status_full (msg, SOUP_STATUS_BAD_REQUEST,
                                   "Invalid cookie");
-    return;
+    goto end;
   }
 
   kms_http_ep_server_remove_timeout (self, httpep);
 
-  /* Bind message life cicle to this httpendpoint */
-  g_object_set_qdata_full (G_OBJECT (httpep), key_message_quark (),
-                           g_object_ref (G_OBJECT (msg) ),
-                           (GDestroyNotify) destroy_pending_message);
+  if (msg->method != SOUP_METHOD_GET) {
+    /* Bind message life cicle to this httpendpoint */
+    g_object_set_qdata_full (G_OBJECT (httpep), key_message_quark (),
+                             g_object_ref (G_OBJECT (msg) ),
+                             (GDestroyNotify) destroy_pending_message);
+  }
 
   /* Common parameters used for both, get and post operations */
   g_object_set_qdata_full (G_OBJECT (msg), key_http_ep_server_quark (),
                            g_object_ref (self), g_object_unref);
 
-  if (msg->method == SOUP_METHOD_POST) {
+  if (msg->method == SOUP_METHOD_GET) {
+    if (!g_object_class_find_property (G_OBJECT_GET_CLASS (httpep),
+                                       "mime-type") ) {
+      GST_WARNING ("Http end point %s does not serve GET requests",
+                   GST_ELEMENT_NAME (httpep) );
+      soup_message_set_status_full (msg, SOUP_STATUS_METHOD_NOT_ALLOWED,
+                                    "Not allowed");
+      goto end;
+    }
+
+    if (!kms_http_ep_server_get_handler (worker, msg, httpep) ) {
+      goto end;
+    }
+
+    action = KMS_HTTP_END_POINT_ACTION_GET;
+  } else if (msg->method == SOUP_METHOD_POST) {
     kms_http_ep_server_post_handler (self, msg, httpep);
     action = KMS_HTTP_END_POINT_ACTION_POST;
   } else if (msg->method == SOUP_METHOD_OPTIONS) {
     kms_http_ep_server_options_handler (self, msg, httpep);
-    return;
+    goto end;
   } else {
     GST_WARNING ("HTTP operation %s is not allowed", msg->method);
     soup_message_set_status_full (msg, SOUP_STATUS_METHOD_NOT_ALLOWED,
                                   "Not allowed");
-    return;
+    goto end;
   }
 
   g_signal_emit (G_OBJECT (self), obj_signals[ACTION_REQUESTED], 0, path,
                  action);
+
+end:
+  gst_object_unref (httpep);
+}
+
+static void
+got_chunk_stats_cb (SoupMessage *msg, SoupBuffer *chunk, gpointer data)
+{
+  KmsHttpEPServerWorker *worker = (KmsHttpEPServerWorker *) data;
+
+  g_mutex_lock (&worker->stats_lock);
+  worker->bytes_received += chunk->length;
+  g_mutex_unlock (&worker->stats_lock);
+}
+
+static void
+wrote_body_data_stats_cb (SoupMessage *msg, SoupBuffer *chunk, gpointer data)
+{
+  KmsHttpEPServerWorker *worker = (KmsHttpEPServerWorker *) data;
+
+  g_mutex_lock (&worker->stats_lock);
+  worker->bytes_sent += chunk->length;
+  g_mutex_unlock (&worker->stats_lock);
 }
 
 static void
 request_started_handler (SoupServer *server, SoupMessage *msg,
                          SoupClientContext *client, gpointer data)
 {
+  KmsHttpEPServerWorker *worker = (KmsHttpEPServerWorker *) data;
+
+  g_mutex_lock (&worker->stats_lock);
+  worker->requests++;
+  g_mutex_unlock (&worker->stats_lock);
+
   g_signal_connect (msg, "got-headers", G_CALLBACK (got_headers_handler), data);
+  g_signal_connect (msg, "got-chunk", G_CALLBACK (got_chunk_stats_cb), data);
+  g_signal_connect (msg, "wrote-body-data",
+                    G_CALLBACK (wrote_body_data_stats_cb), data);
+}
+
+static KmsHttpEPServerWorker *
+kms_http_ep_server_add_worker (KmsHttpEPServer *self)
+{
+  KmsHttpEPServerWorker *worker;
+
+  worker = g_slice_new0 (KmsHttpEPServerWorker);
+  worker->self = self;
+  g_mutex_init (&worker->stats_lock);
+  g_mutex_init (&worker->mutex);
+  g_cond_init (&worker->cond);
+
+  if (self->priv->workers->len == 0) {
+    /* First worker shares the control loop */
+    worker->loop = (KmsLoop *) g_object_ref (self->priv->loop);
+  } else {
+    worker->loop = kms_loop_new ();
+  }
+
+  g_ptr_array_add (self->priv->workers, worker);
+
+  return worker;
+}
+
+static gboolean
+worker_free_disconnect_cb (KmsHttpEPServerWorker *worker)
+{
+  kms_http_ep_server_worker_disconnect (worker);
+
+  g_mutex_lock (&worker->mutex);
+  worker->disconnected = TRUE;
+  g_cond_signal (&worker->cond);
+  g_mutex_unlock (&worker->mutex);
+
+  return G_SOURCE_REMOVE;
 }
 
 static void
-kms_http_ep_server_create_server (KmsHttpEPServer *self, SoupAddress *addr)
+kms_http_ep_server_worker_free (KmsHttpEPServerWorker *worker)
 {
-  SoupSocket *listener;
-  GMainContext *ctx;
+  if (worker->server == NULL) {
+    goto end;
+  }
+
+  /* Server is only accessed from the loop of the worker */
+  if (KMS_LOOP_IS_CURRENT_THREAD (worker->loop) ) {
+    kms_http_ep_server_worker_disconnect (worker);
+  } else {
+    /* Sources are dispatched in order, so this runs after a pending stop */
+    g_mutex_lock (&worker->mutex);
+    kms_loop_idle_add_full (worker->loop, G_PRIORITY_HIGH_IDLE,
+                            (GSourceFunc) worker_free_disconnect_cb, worker, NULL);
 
-  g_object_get (self->priv->loop, "context", &ctx, NULL);
-  self->priv->server = soup_server_new (SOUP_SERVER_PORT, self->priv->port,
-                                        SOUP_SERVER_INTERFACE, addr,
-                                        SOUP_SERVER_ASYNC_CONTEXT, ctx, NULL);
-  g_main_context_unref (ctx);
+    while (!worker->disconnected) {
+      g_cond_wait (&worker->cond, &worker->mutex);
+    }
 
-  /* Connect server signals handlers */
-  g_signal_connect (self->priv->server, "request-started",
-                    G_CALLBACK (request_started_handler), self);
+    g_mutex_unlock (&worker->mutex);
+  }
 
-  soup_server_run_async (self->priv->server);
+  g_object_unref (worker->server);
 
-  listener = soup_server_get_listener (self->priv->server);
+end:
+  g_clear_object (&worker->socket);
+  g_object_unref (worker->loop);
+  g_mutex_clear (&worker->stats_lock);
+  g_mutex_clear (&worker->mutex);
+  g_cond_clear (&worker->cond);
 
-  if (!soup_socket_is_connected (listener) ) {
-    GST_ERROR ("Server socket is not connected");
-    return;
+  g_slice_free (KmsHttpEPServerWorker, worker);
+}
+
+static gboolean
+kms_http_ep_server_worker_listen (KmsHttpEPServerWorker *worker)
+{
+  GError *err = NULL;
+
+  /* Accepted connections are attached to the thread default context, it is
+   * kept pushed until the server is disconnected */
+  g_object_get (worker->loop, "context", &worker->context, NULL);
+  g_main_context_push_thread_default (worker->context);
+
+  if (!soup_server_listen_socket (worker->server, worker->socket,
+                                  (SoupServerListenOptions) 0, &err) ) {
+    GST_ERROR ("Can not listen: %s", err->message);
+    g_error_free (err);
   }
 
-  addr = soup_socket_get_local_address (listener);
+  return G_SOURCE_REMOVE;
+}
 
-  if (self->priv->iface == NULL) {
-    /* Update the recently id adrress */
-    self->priv->iface = g_strdup (soup_address_get_physical (addr) );
-    /* TODO: Emit property change signal */
+static GSocket *
+kms_http_ep_server_create_socket (GSocketAddress *saddr, gboolean reuse_port,
+                                  GError **err)
+{
+  GSocket *socket;
+
+  socket = g_socket_new (g_socket_address_get_family (saddr),
+                         G_SOCKET_TYPE_STREAM, G_SOCKET_PROTOCOL_DEFAULT, err);
+
+  if (socket == NULL) {
+    return NULL;
+  }
+
+#ifdef SO_REUSEPORT
+
+  /* Let the kernel balance connections among the workers */
+  if (reuse_port &&
+      !g_socket_set_option (socket, SOL_SOCKET, SO_REUSEPORT, 1, err) ) {
+    g_object_unref (socket);
+    return NULL;
+  }
+
+#endif
+
+  if (!g_socket_bind (socket, saddr, TRUE, err) ||
+      !g_socket_listen (socket, err) ) {
+    g_object_unref (socket);
+    return NULL;
+  }
+
+  return socket;
+}
+
+static guint
+kms_http_ep_server_get_n_loops (KmsHttpEPServer *self)
+{
+#ifdef SO_REUSEPORT
+
+  if (self->priv->loops == 0) {
+    return g_get_num_processors ();
+  }
+
+  return self->priv->loops;
+#else
+
+  if (self->priv->loops != 1) {
+    GST_WARNING ("SO_REUSEPORT is not available, using a single loop");
+  }
+
+  /* Listeners can not share the port */
+  return 1;
+#endif
+}
+
+static void
+kms_http_ep_server_create_server (KmsHttpEPServer *self, SoupAddress *addr)
+{
+  GSocketAddress *saddr;
+  guint i, n_loops;
+
+  if (addr != NULL) {
+    saddr = soup_address_get_gsockaddr (addr);
+  } else {
+    GInetAddress *any = g_inet_address_new_any (G_SOCKET_FAMILY_IPV4);
+
+    saddr = g_inet_socket_address_new (any, self->priv->port);
+    g_object_unref (any);
+  }
+
+  n_loops = kms_http_ep_server_get_n_loops (self);
+
+  for (i = 0; i < n_loops; i++) {
+    KmsHttpEPServerWorker *worker;
+    GError *err = NULL;
+    GSocket *socket;
+
+    /* Port is only shared when several loops are requested */
+    socket = kms_http_ep_server_create_socket (saddr, n_loops > 1, &err);
+
+    if (socket == NULL) {
+      GST_ERROR ("Can not create server socket: %s", err->message);
+      g_error_free (err);
+      break;
+    }
+
+    if (i == 0) {
+      GSocketAddress *local;
+      GInetAddress *inet;
+
+      local = g_socket_get_local_address (socket, NULL);
+      inet = g_inet_socket_address_get_address (G_INET_SOCKET_ADDRESS (local) );
+
+      if (self->priv->iface == NULL) {
+        /* Update the recently id adrress */
+        self->priv->iface = g_inet_address_to_string (inet);
+        /* TODO: Emit property change signal */
+      }
+
+      if (self->priv->port == 0) {
+        /* Update the recently id adrress */
+        self->priv->port =
+          g_inet_socket_address_get_port (G_INET_SOCKET_ADDRESS (local) );
+        /* TODO: Emit property change signal */
+      }
+
+      /* Rest of listeners must bind to the port got by the first one */
+      g_object_unref (saddr);
+      saddr = g_inet_socket_address_new (inet, self->priv->port);
+      g_object_unref (local);
+    }
+
+    worker = kms_http_ep_server_add_worker (self);
+    worker->socket = socket;
+    worker->server = soup_server_new (NULL, NULL);
+
+    /* Connect server signals handlers */
+    g_signal_connect (worker->server, "request-started",
+                      G_CALLBACK (request_started_handler), worker);
+
+    if (KMS_LOOP_IS_CURRENT_THREAD (worker->loop) ) {
+      kms_http_ep_server_worker_listen (worker);
+    } else {
+      kms_loop_idle_add_full (worker->loop, G_PRIORITY_HIGH_IDLE,
+                              (GSourceFunc) kms_http_ep_server_worker_listen, worker, NULL);
+    }
   }
 
-  if (self->priv->port == 0) {
-    /* Update the recently id adrress */
-    self->priv->port = soup_address_get_port (addr);
-    /* TODO: Emit property change signal */
+  g_object_unref (saddr);
+
+  GST_DEBUG ("Http end point server running in %s:%d with %u loops",
+             self->priv->iface, self->priv->port, self->priv->workers->len);
+}
+
+static GstStructure *
+kms_http_ep_server_get_stats (KmsHttpEPServer *self)
+{
+  GstStructure *stats;
+  guint i;
+
+  stats = gst_structure_new_empty ("http-ep-server-stats");
+
+  for (i = 0; i < self->priv->workers->len; i++) {
+    KmsHttpEPServerWorker *worker = (KmsHttpEPServerWorker *)
+                                    g_ptr_array_index (self->priv->workers, i);
+    GstStructure *loop_stats;
+    gchar *name;
+
+    g_mutex_lock (&worker->stats_lock);
+    loop_stats = gst_structure_new ("loop-stats",
+                                    "requests", G_TYPE_UINT64, worker->requests,
+                                    "bytes-received", G_TYPE_UINT64, worker->bytes_received,
+                                    "bytes-sent", G_TYPE_UINT64, worker->bytes_sent, NULL);
+    g_mutex_unlock (&worker->stats_lock);
+
+    name = g_strdup_printf ("loop-%u", i);
+    gst_structure_set (stats, name, GST_TYPE_STRUCTURE, loop_stats, NULL);
+    gst_structure_free (loop_stats);
+    g_free (name);
   }
 
-  GST_DEBUG ("Http end point server running in %s:%d", self->priv->iface,
-             self->priv->port );
+  return stats;
 }
 
 static void
@@ -936,7 +1508,7 @@ kms_http_ep_server_start_impl (KmsHttpEPServer *self,
   SoupAddress *addr = NULL;
   GCancellable *cancel;
 
-  if (self->priv->server != NULL) {
+  if (self->priv->workers->len > 0) {
     GST_WARNING ("Server is already running");
     return;
   }
@@ -1083,7 +1655,10 @@ unregister_end_point_cb (struct tmp_unregister_data *tdata)
 
   GST_DEBUG ("Unregister uri: %s", tdata->uri);
 
+  g_rw_lock_writer_lock (&tdata->server->priv->handlers_lock);
+
   if (tdata->server->priv->handlers == NULL) {
+    g_rw_lock_writer_unlock (&tdata->server->priv->handlers_lock);
     g_set_error (&gerr, KMS_HTTP_EP_SERVER_ERROR,
                  HTTPEPSERVER_UNEXPECTED_ERROR,
                  "handlers list is NULL");
@@ -1091,6 +1666,7 @@ unregister_end_point_cb (struct tmp_unregister_data *tdata)
   }
 
   if (!g_hash_table_contains (tdata->server->priv->handlers, tdata->uri) ) {
+    g_rw_lock_writer_unlock (&tdata->server->priv->handlers_lock);
     g_set_error (&gerr, KMS_HTTP_EP_SERVER_ERROR,
                  HTTPEPSERVER_UNEXPECTED_ERROR,
                  "uri not registered");
@@ -1101,11 +1677,19 @@ unregister_end_point_cb (struct tmp_unregister_data *tdata)
            tdata->uri);
 
   if (httpep != NULL) {
-    kms_http_ep_server_clean_http_end_point (tdata->server, httpep);
+    gst_object_ref (httpep);
   }
 
+  /* Workers will not find it any more */
   g_hash_table_remove (tdata->server->priv->handlers, tdata->uri);
 
+  g_rw_lock_writer_unlock (&tdata->server->priv->handlers_lock);
+
+  if (httpep != NULL) {
+    kms_http_ep_server_clean_http_end_point (tdata->server, httpep);
+    gst_object_unref (httpep);
+  }
+
   if (tdata->cb != NULL) {
     tdata->cb (tdata->server, gerr, tdata->data);
   }
@@ -1174,6 +1758,8 @@ kms_http_ep_server_finalize (GObject *obj)
   g_free (self->priv->announced_addr);
   g_free (self->priv->got_addr);
 
+  g_ptr_array_unref (self->priv->workers);
+
   if (self->priv->loop) {
     g_clear_object (&self->priv->loop);
   }
@@ -1183,15 +1769,7 @@ kms_http_ep_server_finalize (GObject *obj)
     self->priv->handlers = NULL;
   }
 
-  if (self->priv->server != NULL) {
-    soup_server_disconnect (self->priv->server);
-    g_clear_object (&self->priv->server);
-  }
-
-  if (self->priv->rand != NULL) {
-    g_rand_free (self->priv->rand);
-    self->priv->rand = NULL;
-  }
+  g_rw_lock_clear (&self->priv->handlers_lock);
 
   /* Chain up to the parent class */
   G_OBJECT_CLASS (kms_http_ep_server_parent_class)->finalize (obj);
@@ -1229,6 +1807,10 @@ kms_http_ep_server_set_property (GObject *obj, guint prop_id,
     break;
   }
 
+  case PROP_KMS_HTTP_EP_SERVER_LOOPS:
+    self->priv->loops = g_value_get_uint (value);
+    break;
+
   default:
     /* We don't have any other property... */
     G_OBJECT_WARN_INVALID_PROPERTY_ID (obj, prop_id, pspec);
@@ -1255,6 +1837,14 @@ kms_http_ep_server_get_property (GObject *obj, guint prop_id, GValue *value,
     g_value_set_string (value, kms_http_ep_server_get_announced_addr (self) );
     break;
 
+  case PROP_KMS_HTTP_EP_SERVER_LOOPS:
+    g_value_set_uint (value, self->priv->loops);
+    break;
+
+  case PROP_KMS_HTTP_EP_SERVER_STATS:
+    g_value_take_boxed (value, kms_http_ep_server_get_stats (self) );
+    break;
+
   default:
     /* We don't have any other property... */
     G_OBJECT_WARN_INVALID_PROPERTY_ID (obj, prop_id, pspec);
@@ -1301,6 +1891,23 @@ kms_http_ep_server_class_init (KmsHttpEPServerClass *klass)
                          KMS_HTTP_EP_SERVER_DEFAULT_INTERFACE,
                          (GParamFlags) (G_PARAM_CONSTRUCT_ONLY | G_PARAM_READWRITE) );
 
+  obj_properties[PROP_KMS_HTTP_EP_SERVER_LOOPS] =
+    g_param_spec_uint (KMS_HTTP_EP_SERVER_LOOPS,
+                       "Number of loops",
+                       "Loops accepting and serving connections, sharing the port "
+                       "with SO_REUSEPORT when more than one. 0 for one per processor",
+                       0,
+                       G_MAXUINT,
+                       KMS_HTTP_EP_SERVER_DEFAULT_LOOPS,
+                       (GParamFlags) (G_PARAM_CONSTRUCT_ONLY | G_PARAM_READWRITE) );
+
+  obj_properties[PROP_KMS_HTTP_EP_SERVER_STATS] =
+    g_param_spec_boxed (KMS_HTTP_EP_SERVER_STATS,
+                        "Statistics",
+                        "Requests and bytes served by each loop",
+                        GST_TYPE_STRUCTURE,
+                        (GParamFlags) (G_PARAM_READABLE) );
+
   g_object_class_install_properties (gobject_class,
                                      N_PROPERTIES,
                                      obj_properties);
@@ -1333,30 +1940,23 @@ kms_http_ep_server_class_init (KmsHttpEPServerClass *klass)
   g_type_class_add_private (klass, sizeof (KmsHttpEPServerPrivate) );
 }
 
-static gboolean
-equal_str_key (gconstpointer a, gconstpointer b)
-{
-  const char *str1 = (const char *) a;
-  const char *str2 = (const char *) b;
-
-  return (g_strcmp0 (str1, str2) == 0);
-}
-
 static void
 kms_http_ep_server_init (KmsHttpEPServer *self)
 {
   self->priv = KMS_HTTP_EP_SERVER_GET_PRIVATE (self);
 
   /* Set default values */
-  self->priv->server = NULL;
+  self->priv->workers = g_ptr_array_new_with_free_func ((GDestroyNotify)
+                        kms_http_ep_server_worker_free);
+  self->priv->loops = KMS_HTTP_EP_SERVER_DEFAULT_LOOPS;
   self->priv->port = KMS_HTTP_EP_SERVER_DEFAULT_PORT;
   self->priv->iface = KMS_HTTP_EP_SERVER_DEFAULT_INTERFACE;
   self->priv->announced_addr = KMS_HTTP_EP_SERVER_DEFAULT_ANNOUNCED_ADDRESS;
   self->priv->got_addr = NULL;
   self->priv->handlers = g_hash_table_new_full (g_str_hash, equal_str_key,
                          g_free, g_object_unref);
+  g_rw_lock_init (&self->priv->handlers_lock);
 
-  self->priv->rand = g_rand_new();
   self->priv->loop = kms_loop_new ();
 }
 
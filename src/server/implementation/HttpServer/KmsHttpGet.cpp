@@ -0,0 +1,689 @@
+/*
+ * (C) Copyright 2016 Kurento (http://kurento.org/)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+#include <libsoup/soup.h>
+#include "KmsHttpGet.h"
+
+#define OBJECT_NAME "HttpGet"
+
+#define GST_CAT_DEFAULT kms_http_get_debug_category
+GST_DEBUG_CATEGORY_STATIC (GST_CAT_DEFAULT);
+
+#define KMS_HTTP_GET_GET_PRIVATE(obj) \
+  (G_TYPE_INSTANCE_GET_PRIVATE ((obj), KMS_TYPE_HTTP_GET, KmsHttpGetPrivate))
+
+typedef struct _KmsHttpGetGroup KmsHttpGetGroup;
+
+typedef struct _KmsHttpGetClient {
+  KmsHttpGetGroup *group;
+  SoupMessage *msg;
+  gulong wrote_id;
+  gulong finished_id;
+
+  /* Last buffer pushed before joining, it got the ones it needs as headers */
+  guint64 join_seq;
+
+  /* Bytes appended to the response not written to the socket yet */
+  guint64 pending;
+
+  /* Media is only sent from the start of a cluster or fragment on */
+  gboolean synced;
+} KmsHttpGetClient;
+
+/* Clients served from the same loop. Clients are only accessed from that
+ * loop, the rest of fields are protected by the object mutex */
+struct _KmsHttpGetGroup {
+  KmsHttpGet *self;
+  KmsLoop *loop;
+  SoupServer *server;
+
+  GSList *clients;
+  guint n_clients;
+
+  GQueue *queue;
+  gboolean dispatching;
+};
+
+typedef struct _KmsHttpGetItem {
+  GstBuffer *buffer;
+  guint64 seq;
+} KmsHttpGetItem;
+
+/* Keeps a GstBuffer mapped while a SoupBuffer wrapping it is alive */
+typedef struct _KmsHttpGetMapping {
+  GstBuffer *buffer;
+  GstMapInfo info;
+} KmsHttpGetMapping;
+
+struct _KmsHttpGetPrivate {
+  gchar *mime_type;
+  gboolean drop_slow_clients;
+  guint max_buffering;
+
+  /* Held while a client is added or removed and the stream is started or
+   * stopped accordingly, taken before the mutex */
+  GMutex start_mutex;
+  KmsHttpGetStartFunc start_func;
+  gpointer start_data;
+  GDestroyNotify start_notify;
+  gboolean started;
+
+  GMutex mutex;
+  GPtrArray *groups;
+  guint n_clients;
+
+  /* Sequence number of the last buffer pushed */
+  guint64 seq;
+
+  /* Stream headers, sent first to clients joining a running stream */
+  GPtrArray *headers;
+  gboolean headers_done;
+};
+
+/* class initialization */
+
+G_DEFINE_TYPE_WITH_CODE (KmsHttpGet, kms_http_get,
+                         G_TYPE_OBJECT,
+                         GST_DEBUG_CATEGORY_INIT (GST_CAT_DEFAULT, OBJECT_NAME,
+                             0, "debug category for " OBJECT_NAME " element") )
+/* properties */
+enum {
+  PROP_0,
+
+  PROP_MIME_TYPE,
+  PROP_DROP_SLOW_CLIENTS,
+  PROP_MAX_BUFFERING,
+  PROP_N_CLIENTS,
+  N_PROPERTIES
+};
+
+#define KMS_HTTP_GET_DEFAULT_MIME_TYPE "video/webm"
+#define KMS_HTTP_GET_DEFAULT_DROP_SLOW_CLIENTS FALSE
+#define KMS_HTTP_GET_DEFAULT_MAX_BUFFERING (4 * 1024 * 1024)
+
+static GParamSpec *obj_properties[N_PROPERTIES] = { NULL, };
+
+/* signals */
+enum {
+  CLIENT_REMOVED,
+  LAST_SIGNAL
+};
+
+static guint obj_signals[LAST_SIGNAL] = { 0 };
+
+static void
+kms_http_get_mapping_free (KmsHttpGetMapping *mapping)
+{
+  gst_buffer_unmap (mapping->buffer, &mapping->info);
+  gst_buffer_unref (mapping->buffer);
+  g_slice_free (KmsHttpGetMapping, mapping);
+}
+
+/* The returned SoupBuffer is shared by the clients of a group, its data is
+ * not copied. SoupBuffers are not thread safe, so each group wraps its own */
+static SoupBuffer *
+kms_http_get_wrap_buffer (GstBuffer *buffer)
+{
+  KmsHttpGetMapping *mapping = g_slice_new (KmsHttpGetMapping);
+
+  if (!gst_buffer_map (buffer, &mapping->info, GST_MAP_READ) ) {
+    g_slice_free (KmsHttpGetMapping, mapping);
+    return NULL;
+  }
+
+  mapping->buffer = gst_buffer_ref (buffer);
+
+  return soup_buffer_new_with_owner (mapping->info.data, mapping->info.size,
+                                     mapping, (GDestroyNotify) kms_http_get_mapping_free);
+}
+
+static void
+kms_http_get_item_free (KmsHttpGetItem *item)
+{
+  gst_buffer_unref (item->buffer);
+  g_slice_free (KmsHttpGetItem, item);
+}
+
+static void
+kms_http_get_client_send (KmsHttpGetClient *client, SoupBuffer *chunk)
+{
+  client->pending += chunk->length;
+  /* Not a temporary buffer, so it is referenced instead of copied */
+  soup_message_body_append_buffer (client->msg->response_body, chunk);
+  soup_server_unpause_message (client->group->server, client->msg);
+}
+
+static void
+kms_http_get_client_free (KmsHttpGetClient *client)
+{
+  g_object_unref (client->msg);
+  g_slice_free (KmsHttpGetClient, client);
+}
+
+static void
+kms_http_get_remove_client (KmsHttpGet *self, KmsHttpGetClient *client,
+                            gboolean complete)
+{
+  KmsHttpGetGroup *group = client->group;
+  gboolean last;
+
+  g_mutex_lock (&self->priv->start_mutex);
+  g_mutex_lock (&self->priv->mutex);
+
+  group->clients = g_slist_remove (group->clients, client);
+  group->n_clients--;
+
+  last = (--self->priv->n_clients == 0);
+
+  if (last && self->priv->started && self->priv->start_func != NULL) {
+    /* The stream is restarted with new headers for the next client, which
+     * can not join before it is stopped as the start mutex is held. Headers
+     * are kept when nothing stops it */
+    g_ptr_array_set_size (self->priv->headers, 0);
+    self->priv->headers_done = FALSE;
+  }
+
+  g_mutex_unlock (&self->priv->mutex);
+
+  if (last && self->priv->started) {
+    self->priv->started = FALSE;
+
+    if (self->priv->start_func != NULL) {
+      self->priv->start_func (self, FALSE, client->msg, self->priv->start_data);
+    }
+  }
+
+  g_mutex_unlock (&self->priv->start_mutex);
+
+  g_signal_handler_disconnect (client->msg, client->wrote_id);
+  g_signal_handler_disconnect (client->msg, client->finished_id);
+
+  if (complete) {
+    soup_message_body_complete (client->msg->response_body);
+    soup_server_unpause_message (group->server, client->msg);
+  }
+}
+
+static void
+wrote_body_data_cb (SoupMessage *msg, SoupBuffer *chunk, gpointer data)
+{
+  KmsHttpGetClient *client = (KmsHttpGetClient *) data;
+
+  client->pending -= MIN (client->pending, chunk->length);
+}
+
+static void
+msg_finished_cb (SoupMessage *msg, gpointer data)
+{
+  KmsHttpGetClient *client = (KmsHttpGetClient *) data;
+  KmsHttpGet *self = client->group->self;
+
+  GST_DEBUG ("Client %p finished", (gpointer) msg);
+
+  kms_http_get_remove_client (self, client, FALSE);
+  g_signal_emit (G_OBJECT (self), obj_signals[CLIENT_REMOVED], 0, msg);
+  kms_http_get_client_free (client);
+}
+
+static void
+kms_http_get_dispatch_item (KmsHttpGetGroup *group, KmsHttpGetItem *item)
+{
+  KmsHttpGet *self = group->self;
+  gboolean header = GST_BUFFER_FLAG_IS_SET (item->buffer,
+                    GST_BUFFER_FLAG_HEADER);
+  /* Endpoint only leaves buffers starting a cluster or a fragment as non
+   * delta units, so clients never join in the middle of one */
+  gboolean sync = !header && !GST_BUFFER_FLAG_IS_SET (item->buffer,
+                  GST_BUFFER_FLAG_DELTA_UNIT);
+  SoupBuffer *chunk;
+  GSList *l, *next;
+
+  chunk = kms_http_get_wrap_buffer (item->buffer);
+
+  if (chunk == NULL) {
+    GST_WARNING ("Can not map buffer %" GST_PTR_FORMAT, item->buffer);
+    return;
+  }
+
+  for (l = group->clients; l != NULL; l = next) {
+    KmsHttpGetClient *client = (KmsHttpGetClient *) l->data;
+
+    next = l->next;
+
+    if (item->seq <= client->join_seq) {
+      continue;
+    }
+
+    if (header) {
+      kms_http_get_client_send (client, chunk);
+      continue;
+    }
+
+    if (!client->synced && !sync) {
+      continue;
+    }
+
+    if (client->pending + chunk->length > self->priv->max_buffering) {
+      if (self->priv->drop_slow_clients) {
+        GST_DEBUG ("Dropping slow client %p", (gpointer) client->msg);
+        kms_http_get_remove_client (self, client, TRUE);
+        g_signal_emit (G_OBJECT (self), obj_signals[CLIENT_REMOVED], 0,
+                       client->msg);
+        kms_http_get_client_free (client);
+      } else if (client->synced) {
+        GST_DEBUG ("Client %p is too slow, skipping to next fragment",
+                   (gpointer) client->msg);
+        client->synced = FALSE;
+      }
+
+      continue;
+    }
+
+    client->synced = TRUE;
+    kms_http_get_client_send (client, chunk);
+  }
+
+  soup_buffer_free (chunk);
+}
+
+static gboolean
+kms_http_get_dispatch_cb (gpointer data)
+{
+  KmsHttpGetGroup *group = (KmsHttpGetGroup *) data;
+  KmsHttpGet *self = group->self;
+  KmsHttpGetItem *item;
+  GQueue *queue;
+
+  g_mutex_lock (&self->priv->mutex);
+  queue = group->queue;
+  group->queue = g_queue_new ();
+  group->dispatching = FALSE;
+  g_mutex_unlock (&self->priv->mutex);
+
+  while ( (item = (KmsHttpGetItem *) g_queue_pop_head (queue) ) != NULL) {
+    kms_http_get_dispatch_item (group, item);
+    kms_http_get_item_free (item);
+  }
+
+  g_queue_free (queue);
+
+  return G_SOURCE_REMOVE;
+}
+
+static void
+kms_http_get_dispatch_done (gpointer data)
+{
+  KmsHttpGetGroup *group = (KmsHttpGetGroup *) data;
+
+  g_object_unref (group->self);
+}
+
+static KmsHttpGetGroup *
+kms_http_get_group_new (KmsHttpGet *self, KmsLoop *loop, SoupServer *server)
+{
+  KmsHttpGetGroup *group = g_slice_new0 (KmsHttpGetGroup);
+
+  group->self = self;
+  group->loop = (KmsLoop *) g_object_ref (loop);
+  group->server = SOUP_SERVER (g_object_ref (server) );
+  group->queue = g_queue_new ();
+
+  return group;
+}
+
+static void
+kms_http_get_group_free (KmsHttpGetGroup *group)
+{
+  g_queue_free_full (group->queue, (GDestroyNotify) kms_http_get_item_free);
+  g_object_unref (group->server);
+  g_object_unref (group->loop);
+  g_slice_free (KmsHttpGetGroup, group);
+}
+
+/* Object mutex must be held */
+static KmsHttpGetGroup *
+kms_http_get_get_group (KmsHttpGet *self, KmsLoop *loop, SoupServer *server)
+{
+  KmsHttpGetGroup *group;
+  guint i;
+
+  for (i = 0; i < self->priv->groups->len; i++) {
+    group = (KmsHttpGetGroup *) g_ptr_array_index (self->priv->groups, i);
+
+    if (group->loop == loop) {
+      return group;
+    }
+  }
+
+  group = kms_http_get_group_new (self, loop, server);
+  g_ptr_array_add (self->priv->groups, group);
+
+  return group;
+}
+
+static void
+kms_http_get_set_property (GObject *obj, guint prop_id,
+                           const GValue *value, GParamSpec *pspec)
+{
+  KmsHttpGet *self = KMS_HTTP_GET (obj);
+
+  switch (prop_id) {
+  case PROP_MIME_TYPE:
+    g_free (self->priv->mime_type);
+    self->priv->mime_type = g_value_dup_string (value);
+    break;
+
+  case PROP_DROP_SLOW_CLIENTS:
+    self->priv->drop_slow_clients = g_value_get_boolean (value);
+    break;
+
+  case PROP_MAX_BUFFERING:
+    self->priv->max_buffering = g_value_get_uint (value);
+    break;
+
+  default:
+    /* We don't have any other property... */
+    G_OBJECT_WARN_INVALID_PROPERTY_ID (obj, prop_id, pspec);
+    break;
+  }
+}
+
+static void
+kms_http_get_get_property (GObject *obj, guint prop_id, GValue *value,
+                           GParamSpec *pspec)
+{
+  KmsHttpGet *self = KMS_HTTP_GET (obj);
+
+  switch (prop_id) {
+  case PROP_MIME_TYPE:
+    g_value_set_string (value, self->priv->mime_type);
+    break;
+
+  case PROP_DROP_SLOW_CLIENTS:
+    g_value_set_boolean (value, self->priv->drop_slow_clients);
+    break;
+
+  case PROP_MAX_BUFFERING:
+    g_value_set_uint (value, self->priv->max_buffering);
+    break;
+
+  case PROP_N_CLIENTS:
+    g_mutex_lock (&self->priv->mutex);
+    g_value_set_uint (value, self->priv->n_clients);
+    g_mutex_unlock (&self->priv->mutex);
+    break;
+
+  default:
+    /* We don't have any other property... */
+    G_OBJECT_WARN_INVALID_PROPERTY_ID (obj, prop_id, pspec);
+    break;
+  }
+}
+
+static void
+kms_http_get_dispose (GObject *obj)
+{
+  KmsHttpGet *self = KMS_HTTP_GET (obj);
+  guint i;
+
+  /* The owner is going away, clients are finished without stopping it */
+  kms_http_get_set_start_func (self, NULL, NULL, NULL);
+
+  for (i = 0; i < self->priv->groups->len; i++) {
+    KmsHttpGetGroup *group =
+      (KmsHttpGetGroup *) g_ptr_array_index (self->priv->groups, i);
+
+    while (group->clients != NULL) {
+      KmsHttpGetClient *client = (KmsHttpGetClient *) group->clients->data;
+
+      kms_http_get_remove_client (self, client, TRUE);
+      kms_http_get_client_free (client);
+    }
+  }
+
+  g_ptr_array_set_size (self->priv->groups, 0);
+
+  /* Chain up to the parent class */
+  G_OBJECT_CLASS (kms_http_get_parent_class)->dispose (obj);
+}
+
+static void
+kms_http_get_finalize (GObject *obj)
+{
+  KmsHttpGet *self = KMS_HTTP_GET (obj);
+
+  g_ptr_array_unref (self->priv->groups);
+  g_ptr_array_unref (self->priv->headers);
+  g_mutex_clear (&self->priv->mutex);
+  g_mutex_clear (&self->priv->start_mutex);
+  g_free (self->priv->mime_type);
+
+  /* Chain up to the parent class */
+  G_OBJECT_CLASS (kms_http_get_parent_class)->finalize (obj);
+}
+
+static void
+kms_http_get_class_init (KmsHttpGetClass *klass)
+{
+  GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
+
+  gobject_class->set_property = kms_http_get_set_property;
+  gobject_class->get_property = kms_http_get_get_property;
+  gobject_class->dispose = kms_http_get_dispose;
+  gobject_class->finalize = kms_http_get_finalize;
+
+  obj_properties[PROP_MIME_TYPE] =
+    g_param_spec_string ("mime-type",
+                         "Mime type",
+                         "Content type of the stream",
+                         KMS_HTTP_GET_DEFAULT_MIME_TYPE,
+                         (GParamFlags) (G_PARAM_READWRITE) );
+
+  obj_properties[PROP_DROP_SLOW_CLIENTS] =
+    g_param_spec_boolean ("drop-slow-clients",
+                          "Drop slow clients",
+                          "Disconnect slow clients instead of making them "
+                          "skip media up to the next key frame",
+                          KMS_HTTP_GET_DEFAULT_DROP_SLOW_CLIENTS,
+                          (GParamFlags) (G_PARAM_READWRITE) );
+
+  obj_properties[PROP_MAX_BUFFERING] =
+    g_param_spec_uint ("max-buffering",
+                       "Max buffering",
+                       "Bytes pending to be sent to a client before it is "
+                       "considered slow",
+                       0, G_MAXUINT, KMS_HTTP_GET_DEFAULT_MAX_BUFFERING,
+                       (GParamFlags) (G_PARAM_READWRITE) );
+
+  obj_properties[PROP_N_CLIENTS] =
+    g_param_spec_uint ("n-clients",
+                       "Number of clients",
+                       "Number of clients receiving the stream",
+                       0, G_MAXUINT, 0,
+                       (GParamFlags) (G_PARAM_READABLE) );
+
+  g_object_class_install_properties (gobject_class,
+                                     N_PROPERTIES,
+                                     obj_properties);
+
+  obj_signals[CLIENT_REMOVED] =
+    g_signal_new ("client-removed",
+                  G_TYPE_FROM_CLASS (klass),
+                  G_SIGNAL_RUN_LAST,
+                  G_STRUCT_OFFSET (KmsHttpGetClass, client_removed), NULL, NULL,
+                  g_cclosure_marshal_VOID__OBJECT, G_TYPE_NONE, 1,
+                  SOUP_TYPE_MESSAGE);
+
+  /* Registers a private structure for an instantiatable type */
+  g_type_class_add_private (klass, sizeof (KmsHttpGetPrivate) );
+}
+
+static void
+kms_http_get_init (KmsHttpGet *self)
+{
+  self->priv = KMS_HTTP_GET_GET_PRIVATE (self);
+
+  self->priv->mime_type = g_strdup (KMS_HTTP_GET_DEFAULT_MIME_TYPE);
+  self->priv->drop_slow_clients = KMS_HTTP_GET_DEFAULT_DROP_SLOW_CLIENTS;
+  self->priv->max_buffering = KMS_HTTP_GET_DEFAULT_MAX_BUFFERING;
+  self->priv->groups =
+    g_ptr_array_new_with_free_func ( (GDestroyNotify) kms_http_get_group_free);
+  self->priv->headers =
+    g_ptr_array_new_with_free_func ( (GDestroyNotify) gst_buffer_unref);
+  g_mutex_init (&self->priv->mutex);
+  g_mutex_init (&self->priv->start_mutex);
+}
+
+KmsHttpGet *
+kms_http_get_new ()
+{
+  KmsHttpGet *obj;
+
+  obj = KMS_HTTP_GET (g_object_new (KMS_TYPE_HTTP_GET, NULL) );
+
+  return obj;
+}
+
+void
+kms_http_get_set_start_func (KmsHttpGet *self, KmsHttpGetStartFunc func,
+                             gpointer user_data, GDestroyNotify notify)
+{
+  GDestroyNotify old_notify;
+  gpointer old_data;
+
+  g_mutex_lock (&self->priv->start_mutex);
+  old_notify = self->priv->start_notify;
+  old_data = self->priv->start_data;
+  self->priv->start_func = func;
+  self->priv->start_data = user_data;
+  self->priv->start_notify = notify;
+  g_mutex_unlock (&self->priv->start_mutex);
+
+  if (old_notify != NULL) {
+    old_notify (old_data);
+  }
+}
+
+void
+kms_http_get_add_client (KmsHttpGet *self, KmsLoop *loop, SoupServer *server,
+                         SoupMessage *msg)
+{
+  KmsHttpGetClient *client;
+  guint i;
+
+  client = g_slice_new0 (KmsHttpGetClient);
+  client->msg = SOUP_MESSAGE (g_object_ref (msg) );
+
+  soup_message_set_status (msg, SOUP_STATUS_OK);
+  soup_message_headers_set_encoding (msg->response_headers,
+                                     SOUP_ENCODING_CHUNKED);
+  soup_message_headers_set_content_type (msg->response_headers,
+                                         self->priv->mime_type, NULL);
+
+  /* Chunks are shared with other clients, release them once written */
+  soup_message_body_set_accumulate (msg->response_body, FALSE);
+
+  client->wrote_id = g_signal_connect (msg, "wrote-body-data",
+                                       G_CALLBACK (wrote_body_data_cb), client);
+  client->finished_id = g_signal_connect (msg, "finished",
+                                          G_CALLBACK (msg_finished_cb), client);
+
+  /* Response is sent as media arrives */
+  soup_server_pause_message (server, msg);
+
+  g_mutex_lock (&self->priv->start_mutex);
+  g_mutex_lock (&self->priv->mutex);
+
+  client->group = kms_http_get_get_group (self, loop, server);
+  client->join_seq = self->priv->seq;
+
+  for (i = 0; i < self->priv->headers->len; i++) {
+    SoupBuffer *chunk;
+
+    chunk = kms_http_get_wrap_buffer ( (GstBuffer *)
+                                       g_ptr_array_index (self->priv->headers, i) );
+
+    if (chunk != NULL) {
+      kms_http_get_client_send (client, chunk);
+      soup_buffer_free (chunk);
+    }
+  }
+
+  client->group->clients = g_slist_prepend (client->group->clients, client);
+  client->group->n_clients++;
+  self->priv->n_clients++;
+
+  g_mutex_unlock (&self->priv->mutex);
+
+  if (!self->priv->started) {
+    self->priv->started = TRUE;
+
+    if (self->priv->start_func != NULL) {
+      self->priv->start_func (self, TRUE, msg, self->priv->start_data);
+    }
+  }
+
+  g_mutex_unlock (&self->priv->start_mutex);
+
+  GST_DEBUG ("Client %p added", (gpointer) msg);
+}
+
+void
+kms_http_get_push_buffer (KmsHttpGet *self, GstBuffer *buffer)
+{
+  guint i;
+
+  g_mutex_lock (&self->priv->mutex);
+
+  self->priv->seq++;
+
+  if (GST_BUFFER_FLAG_IS_SET (buffer, GST_BUFFER_FLAG_HEADER) ) {
+    if (self->priv->headers_done) {
+      /* Muxer restarted, previous headers are not valid anymore */
+      g_ptr_array_set_size (self->priv->headers, 0);
+      self->priv->headers_done = FALSE;
+    }
+
+    g_ptr_array_add (self->priv->headers, gst_buffer_ref (buffer) );
+  } else {
+    self->priv->headers_done = TRUE;
+  }
+
+  for (i = 0; i < self->priv->groups->len; i++) {
+    KmsHttpGetGroup *group =
+      (KmsHttpGetGroup *) g_ptr_array_index (self->priv->groups, i);
+    KmsHttpGetItem *item;
+
+    if (group->n_clients == 0) {
+      continue;
+    }
+
+    item = g_slice_new (KmsHttpGetItem);
+    item->buffer = gst_buffer_ref (buffer);
+    item->seq = self->priv->seq;
+    g_queue_push_tail (group->queue, item);
+
+    /* Buffers are dispatched in batches, one idle at most is pending */
+    if (!group->dispatching) {
+      group->dispatching = TRUE;
+      g_object_ref (self);
+      kms_loop_idle_add_full (group->loop, G_PRIORITY_DEFAULT,
+                              kms_http_get_dispatch_cb, group, kms_http_get_dispatch_done);
+    }
+  }
+
+  g_mutex_unlock (&self->priv->mutex);
+}
@@ -0,0 +1,117 @@
+/*
+ * (C) Copyright 2016 Kurento (http://kurento.org/)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+/* inclusion guard */
+#ifndef __KMS_HTTP_GET_H__
+#define __KMS_HTTP_GET_H__
+
+#include <gst/gst.h>
+#include <glib-object.h>
+#include <libsoup/soup.h>
+#include <commons/kmsloop.h>
+
+/*
+ * Type macros.
+ */
+#define KMS_TYPE_HTTP_GET (             \
+  kms_http_get_get_type ()              \
+)
+
+#define KMS_HTTP_GET(obj) (             \
+  G_TYPE_CHECK_INSTANCE_CAST (          \
+    (obj),                              \
+    KMS_TYPE_HTTP_GET,                  \
+    KmsHttpGet                          \
+  )                                     \
+)
+
+#define KMS_IS_HTTP_GET(obj) (          \
+  G_TYPE_CHECK_INSTANCE_TYPE (          \
+    (obj),                              \
+    KMS_TYPE_HTTP_GET                   \
+  )                                     \
+)
+
+#define KMS_HTTP_GET_CLASS(klass) (     \
+  G_TYPE_CHECK_CLASS_CAST (             \
+    (klass),                            \
+    KMS_TYPE_HTTP_GET,                  \
+    KmsHttpGetClass                     \
+  )                                     \
+)
+
+#define KMS_IS_HTTP_GET_CLASS(klass) (  \
+  G_TYPE_CHECK_CLASS_TYPE (             \
+    (klass),                            \
+    KMS_TYPE_HTTP_GET                   \
+  )                                     \
+)
+
+#define KMS_HTTP_GET_GET_CLASS(obj) (   \
+  G_TYPE_INSTANCE_GET_CLASS (           \
+    (obj),                              \
+    KMS_TYPE_HTTP_GET,                  \
+    KmsHttpGetClass)                    \
+)
+
+typedef struct _KmsHttpGet KmsHttpGet;
+typedef struct _KmsHttpGetClass KmsHttpGetClass;
+typedef struct _KmsHttpGetPrivate KmsHttpGetPrivate;
+
+struct _KmsHttpGet
+{
+  GObject parent_instance;
+
+  /*< private > */
+  KmsHttpGetPrivate *priv;
+};
+
+struct _KmsHttpGetClass
+{
+  GObjectClass parent_class;
+
+  /* signal callbacks */
+  void (*client_removed) (KmsHttpGet * self, SoupMessage *msg);
+};
+
+/* used by KMS_TYPE_HTTP_GET */
+GType kms_http_get_get_type (void);
+
+/* Starts the stream with @start TRUE when its first client is added and
+ * stops it with FALSE when the last one is removed, @msg being the request of
+ * that client. Calls are serialized with the additions and removals of
+ * clients, so a client added while the stream is being stopped waits for it
+ * and starts it again */
+typedef void (*KmsHttpGetStartFunc) (KmsHttpGet *self, gboolean start,
+                                     SoupMessage *msg, gpointer user_data);
+
+/* Serves one muxed stream to many GET requests */
+KmsHttpGet * kms_http_get_new ();
+
+/* Must be set before the first client is added */
+void kms_http_get_set_start_func (KmsHttpGet *self, KmsHttpGetStartFunc func,
+    gpointer user_data, GDestroyNotify notify);
+
+/* Must be called from @loop, the one running the @server that got @msg.
+ * Clients are served from the loop they were added from */
+void kms_http_get_add_client (KmsHttpGet *self, KmsLoop *loop,
+    SoupServer *server, SoupMessage *msg);
+
+/* Can be called from any thread */
+void kms_http_get_push_buffer (KmsHttpGet *self, GstBuffer *buffer);
+
+#endif /* __KMS_HTTP_GET_H__ */
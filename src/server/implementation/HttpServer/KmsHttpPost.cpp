@@ -21,6 +21,9 @@
 #define OBJECT_NAME "HttpPost"
 #define MIME_MULTIPART_FORM_DATA "multipart/form-data"
 
+/* Bytes following the delimiter: "--" in the last one or "\r\n" */
+#define BOUNDARY_TRAILER_LEN 2
+
 #define GST_CAT_DEFAULT kms_http_post_debug_category
 GST_DEBUG_CATEGORY_STATIC (GST_CAT_DEFAULT);
 
@@ -43,13 +46,35 @@ typedef struct _KmsHttpPostMultipart {
   ParseState state;
   gchar *tmp_buff;
   guint len;
+
+  /* "\r\n--boundary" and its Boyer-Moore-Horspool skip table */
+  gchar *delimiter;
+  guint delimiter_len;
+  guint skip[256];
+
+  /* Possible delimiter carried over from the previous chunk. Sized for
+   * twice the delimiter so the next chunk's head can be appended to it */
+  gchar *window;
+  guint window_len;
 } KmsHttpPostMultipart;
 
+typedef enum {
+  BOUNDARY_NOT_FOUND,
+  BOUNDARY_PARTIAL,
+  BOUNDARY_FOUND
+} BoundaryMatch;
+
 struct _KmsHttpPostPrivate {
   KmsHttpPostMultipart *multipart;
   SoupMessage *msg;
   gulong chunk_id;
   gulong finish_id;
+
+  /* Chunk being parsed, data inside it is notified without copying */
+  SoupBuffer *chunk;
+
+  guint64 received_bytes;
+  guint64 copied_bytes;
 };
 
 /* class initialization */
@@ -63,6 +88,8 @@ enum {
   PROP_0,
 
   PROP_MESSAGE,
+  PROP_RECEIVED_BYTES,
+  PROP_COPIED_BYTES,
   N_PROPERTIES
 };
 
@@ -99,6 +126,7 @@ kms_http_post_concat_previous_buffer (KmsHttpPost *self, const char **start,
   memmove (self->priv->multipart->tmp_buff + self->priv->multipart->len,
            *start, *end - *start);
   self->priv->multipart->len += (*end - *start);
+  self->priv->copied_bytes += (*end - *start);
 
   *start = self->priv->multipart->tmp_buff;
   *end = self->priv->multipart->tmp_buff + self->priv->multipart->len;
@@ -107,9 +135,19 @@ kms_http_post_concat_previous_buffer (KmsHttpPost *self, const char **start,
 static void
 kms_notify_buffer_data (KmsHttpPost *self, const char *start, const char *end)
 {
+  SoupBuffer *chunk = self->priv->chunk;
   SoupBuffer *buffer;
 
-  buffer = soup_buffer_new (SOUP_MEMORY_STATIC, start, end - start);
+  if (chunk != NULL && start >= chunk->data &&
+      end <= chunk->data + chunk->length) {
+    /* Sub-range keeping the chunk alive, no data is copied */
+    buffer = soup_buffer_new_subbuffer (chunk, start - chunk->data,
+                                        end - start);
+  } else {
+    /* Data carried over from previous chunks */
+    buffer = soup_buffer_new (SOUP_MEMORY_COPY, start, end - start);
+    self->priv->copied_bytes += end - start;
+  }
 
   g_signal_emit (G_OBJECT (self), obj_signals[GOT_DATA], 0, buffer);
 
@@ -146,6 +184,7 @@ kms_http_post_skip_preamble (KmsHttpPost *self, const char **start,
 
     self->priv->multipart->tmp_buff = (gchar *) g_memdup (b, *end - b);
     self->priv->multipart->len = *end - b;
+    self->priv->copied_bytes += *end - b;
 
     if (mem != NULL) {
       g_free (mem);
@@ -192,88 +231,169 @@ kms_http_post_skip_preamble (KmsHttpPost *self, const char **start,
   *start = *end;
 }
 
+/* Looks for the first delimiter in [start, end). BOUNDARY_PARTIAL is
+ * returned when data ends before a candidate can be checked entirely */
+static BoundaryMatch
+kms_http_post_find_boundary (KmsHttpPostMultipart *multipart,
+                             const char *start, const char *end, const char **pos)
+{
+  const char *delimiter = multipart->delimiter;
+  gsize m = multipart->delimiter_len;
+  gsize len = end - start;
+  gsize i = 0;
+
+  while (i + m <= len) {
+    const char *p = start + i;
+
+    if (p[m - 1] == delimiter[m - 1] && memcmp (p, delimiter, m - 1) == 0) {
+      *pos = p;
+
+      if (i + m + BOUNDARY_TRAILER_LEN > len) {
+        return BOUNDARY_PARTIAL;
+      }
+
+      if ( (p[m] == '-' && p[m + 1] == '-') ||
+           (p[m] == '\r' && p[m + 1] == '\n') ) {
+        return BOUNDARY_FOUND;
+      }
+    }
+
+    i += multipart->skip[ (guchar) p[m - 1]];
+  }
+
+  /* Positions skipped above cannot start a delimiter prefix either, so only
+   * the remaining tail needs to be checked */
+  while (i < len) {
+    const char *p = (const char *) memchr (start + i, '\r', len - i);
+
+    if (p == NULL) {
+      break;
+    }
+
+    i = p - start;
+
+    if (memcmp (p, delimiter, len - i) == 0) {
+      *pos = p;
+      return BOUNDARY_PARTIAL;
+    }
+
+    i++;
+  }
+
+  return BOUNDARY_NOT_FOUND;
+}
+
+static void
+kms_http_post_end_part (KmsHttpPost *self, const char *delimiter)
+{
+  if (delimiter[self->priv->multipart->delimiter_len] == '\r') {
+    /* End of this body part */
+    self->priv->multipart->state = MULTIPART_READ_HEADERS;
+  } else {
+    /* Double hyphens at the end of the boundary marks the end */
+    /* of the multipart post requets */
+    self->priv->multipart->state = MULTIPART_FINISHED;
+  }
+}
+
 static void
 kms_http_post_read_until_boundary (KmsHttpPost *self, const char **start,
                                    const char **end, gboolean ignore)
 {
-  const char *boundary = self->priv->multipart->boundary;
-  int boundary_len = strlen (boundary);
+  KmsHttpPostMultipart *multipart = self->priv->multipart;
+  guint match_len = multipart->delimiter_len + BOUNDARY_TRAILER_LEN;
+  BoundaryMatch match;
   const char *b;
 
-  if (self->priv->multipart->tmp_buff != NULL) {
+  if (multipart->tmp_buff != NULL) {
     kms_http_post_concat_previous_buffer (self, start, end);
   }
 
-  for (b = (const char *) memchr (*start, '\r', *end - *start); b != NULL;
-       b = (const char *) memchr (b + 1, '\r', *end - (b + 1) ) ) {
+  if (multipart->window_len > 0) {
+    guint carried = multipart->window_len;
+    guint n = MIN ( (gsize) (*end - *start), match_len);
 
-    if (b + boundary_len + 6 > *end) {
-      /* boundary does not fit in this buffer */
-      gchar *mem = NULL;
+    /* Append just enough data to tell if the delimiter candidate is real */
+    memcpy (multipart->window + carried, *start, n);
+    self->priv->copied_bytes += n;
+    multipart->window_len = 0;
 
-      if (self->priv->multipart->tmp_buff != NULL) {
-        mem = self->priv->multipart->tmp_buff;
-      }
+    match = kms_http_post_find_boundary (multipart, multipart->window,
+                                         multipart->window + carried + n, &b);
 
-      self->priv->multipart->tmp_buff = (gchar *) g_memdup (b, *end - b);
-      self->priv->multipart->len = *end - b;
+    if (match != BOUNDARY_NOT_FOUND && b < multipart->window + carried) {
+      if (!ignore && b > multipart->window) {
+        kms_notify_buffer_data (self, multipart->window, b);
+      }
 
-      /* Notify data read so far */
-      if (!ignore && *start < b) {
-        kms_notify_buffer_data (self, *start, b );
+      if (match == BOUNDARY_PARTIAL) {
+        /* Still undecided, the whole chunk has been appended */
+        multipart->window_len = multipart->window + carried + n - b;
+        memmove (multipart->window, b, multipart->window_len);
+        goto end;
       }
 
-      if (mem != NULL) {
-        g_free (mem);
+      kms_http_post_end_part (self, b);
+      *start += (b + match_len) - (multipart->window + carried);
+
+      if (*start < *end) {
+        return;
       }
 
-      /* Move start pointer up to the end */
-      *start = *end;
-      return;
+      goto end;
     }
 
-    /* Check for "\r\n--boundary" */
-    if (b[1] != '\n' || b[2] != '-' || b[3] != '-' ||
-        memcmp (b + 4, boundary, boundary_len) != 0) {
-      continue;
+    /* Carried over data was not a delimiter */
+    if (!ignore) {
+      kms_notify_buffer_data (self, multipart->window,
+                              multipart->window + carried);
     }
+  }
 
-    /* Check for "--" or "\r\n" after boundary */
-    if ( (b[boundary_len + 4] == '-' && b[boundary_len + 5] == '-') ||
-         (b[boundary_len + 4] == '\r' && b[boundary_len + 5] == '\n') ) {
+  match = kms_http_post_find_boundary (multipart, *start, *end, &b);
 
-      if (b[boundary_len + 4] == '\r' && b[boundary_len + 5] == '\n') {
-        /* End of this body part */
-        self->priv->multipart->state = MULTIPART_READ_HEADERS;
-      } else {
-        /* Double hyphens at the end of the boundary marks the end */
-        /* of the multipart post requets */
-        self->priv->multipart->state = MULTIPART_FINISHED;
-      }
+  switch (match) {
+  case BOUNDARY_FOUND:
 
-      /* Notify data read so far */
-      if (!ignore && *start < b) {
-        kms_notify_buffer_data (self, *start, b);
-      }
+    /* Notify data read so far */
+    if (!ignore && *start < b) {
+      kms_notify_buffer_data (self, *start, b);
+    }
 
-      if (*end <= b + boundary_len + 6) {
-        /* Free temporal buffer */
-        break;
-      }
+    kms_http_post_end_part (self, b);
+    *start = b + match_len;
 
-      *start = b + boundary_len + 6;
+    if (*start < *end) {
       return;
     }
-  }
 
-  /* Notify data */
-  if (!ignore && b == NULL) {
-    kms_notify_buffer_data (self, *start, *end);
+    break;
+
+  case BOUNDARY_PARTIAL:
+
+    /* Notify data read so far and keep the candidate for the next chunk */
+    if (!ignore && *start < b) {
+      kms_notify_buffer_data (self, *start, b);
+    }
+
+    multipart->window_len = *end - b;
+    memcpy (multipart->window, b, multipart->window_len);
+    self->priv->copied_bytes += multipart->window_len;
+    break;
+
+  case BOUNDARY_NOT_FOUND:
+    if (!ignore) {
+      kms_notify_buffer_data (self, *start, *end);
+    }
+
+    break;
   }
 
-  if (self->priv->multipart->tmp_buff != NULL) {
-    g_free (self->priv->multipart->tmp_buff);
-    self->priv->multipart->tmp_buff = NULL;
+end:
+
+  if (multipart->tmp_buff != NULL) {
+    g_free (multipart->tmp_buff);
+    multipart->tmp_buff = NULL;
   }
 
   /* Move start pointer up to the end */
@@ -359,6 +479,7 @@ kms_http_post_read_headers (KmsHttpPost *self, const char **start,
 
       self->priv->multipart->tmp_buff = (gchar *) g_memdup (b, *end - b);
       self->priv->multipart->len = *end - b;
+      self->priv->copied_bytes += *end - b;
 
       if (mem != NULL) {
         g_free (mem);
@@ -514,14 +635,18 @@ got_chunk_cb (SoupMessage *msg, SoupBuffer *chunk, gpointer data)
 {
   KmsHttpPost *self = KMS_HTTP_POST (data);
 
+  self->priv->received_bytes += chunk->length;
+
   if (self->priv->multipart != NULL) {
     /* Extract data from body parts */
+    self->priv->chunk = chunk;
     kms_http_post_parse_multipart_data (self, chunk->data,
                                         chunk->data + chunk->length);
+    self->priv->chunk = NULL;
   } else {
     /* Data received in a non multipart POST request is */
     /* provided as it is without any further processing */
-    kms_notify_buffer_data (self, chunk->data, chunk->data + chunk->length);
+    g_signal_emit (G_OBJECT (self), obj_signals[GOT_DATA], 0, chunk);
   }
 }
 
@@ -539,6 +664,8 @@ kms_http_post_destroy_multipart (KmsHttpPost *self)
   }
 
   g_free (self->priv->multipart->tmp_buff);
+  g_free (self->priv->multipart->delimiter);
+  g_free (self->priv->multipart->window);
 
   g_slice_free (KmsHttpPostMultipart, self->priv->multipart);
   self->priv->multipart = NULL;
@@ -557,6 +684,25 @@ kms_http_post_init_multipart (KmsHttpPost *self)
     soup_message_headers_new (SOUP_MESSAGE_HEADERS_MULTIPART);
 }
 
+static void
+kms_http_post_init_boundary (KmsHttpPost *self)
+{
+  KmsHttpPostMultipart *multipart = self->priv->multipart;
+  guint i, m;
+
+  multipart->delimiter = g_strconcat ("\r\n--", multipart->boundary, NULL);
+  multipart->delimiter_len = m = strlen (multipart->delimiter);
+  multipart->window = (gchar *) g_malloc (2 * (m + BOUNDARY_TRAILER_LEN) );
+
+  for (i = 0; i < G_N_ELEMENTS (multipart->skip); i++) {
+    multipart->skip[i] = m;
+  }
+
+  for (i = 0; i < m - 1; i++) {
+    multipart->skip[ (guchar) multipart->delimiter[i]] = m - 1 - i;
+  }
+}
+
 static void
 kms_http_post_release_message (KmsHttpPost *self)
 {
@@ -618,6 +764,8 @@ kms_http_post_configure_msg (KmsHttpPost *self)
         soup_message_set_status (self->priv->msg, SOUP_STATUS_NOT_ACCEPTABLE);
         goto end;
       }
+
+      kms_http_post_init_boundary (self);
     } else {
       GST_WARNING ("Unsupported multipart format: %s", content_type);
       soup_message_set_status (self->priv->msg, SOUP_STATUS_NOT_ACCEPTABLE);
@@ -679,6 +827,14 @@ kms_http_post_get_property (GObject *obj, guint prop_id, GValue *value,
     g_value_set_object (value, self->priv->msg);
     break;
 
+  case PROP_RECEIVED_BYTES:
+    g_value_set_uint64 (value, self->priv->received_bytes);
+    break;
+
+  case PROP_COPIED_BYTES:
+    g_value_set_uint64 (value, self->priv->copied_bytes);
+    break;
+
   default:
     /* We don't have any other property... */
     G_OBJECT_WARN_INVALID_PROPERTY_ID (obj, prop_id, pspec);
@@ -725,6 +881,20 @@ kms_http_post_class_init (KmsHttpPostClass *klass)
                          SOUP_TYPE_MESSAGE,
                          (GParamFlags) (G_PARAM_READWRITE) );
 
+  obj_properties[PROP_RECEIVED_BYTES] =
+    g_param_spec_uint64 ("received-bytes",
+                         "Received bytes",
+                         "Bytes of body received so far",
+                         0, G_MAXUINT64, 0,
+                         (GParamFlags) (G_PARAM_READABLE) );
+
+  obj_properties[PROP_COPIED_BYTES] =
+    g_param_spec_uint64 ("copied-bytes",
+                         "Copied bytes",
+                         "Bytes of body copied while parsing it",
+                         0, G_MAXUINT64, 0,
+                         (GParamFlags) (G_PARAM_READABLE) );
+
   g_object_class_install_properties (gobject_class,
                                      N_PROPERTIES,
                                      obj_properties);
@@ -29,6 +29,7 @@ GST_DEBUG_CATEGORY_STATIC (GST_CAT_DEFAULT);
 static const std::string HTTP_SERVICE_ADDRESS = "serverAddress";
 static const std::string HTTP_SERVICE_PORT = "serverPort";
 static const std::string HTTP_SERVICE_ANNOUNCED_ADDRESS = "announcedAddress";
+static const std::string HTTP_SERVICE_LOOPS = "serverLoops";
 
 namespace kurento
 {
@@ -321,7 +322,8 @@ HttpEndpointImpl::HttpEndpointImpl (const boost::property_tree::ptree &conf,
                  HttpEndPointServer::DEFAULT_PORT),
              getConfigValue<std::string, HttpEndpoint> (HTTP_SERVICE_ADDRESS, ""),
              getConfigValue<std::string, HttpEndpoint> (HTTP_SERVICE_ANNOUNCED_ADDRESS,
-                 "") );
+                 ""),
+             getConfigValue<int, HttpEndpoint> (HTTP_SERVICE_LOOPS, 1) );
 
   if (server == NULL) {
     throw KurentoException (HTTP_END_POINT_REGISTRATION_ERROR ,
@@ -0,0 +1,118 @@
+/*
+ * (C) Copyright 2016 Kurento (http://kurento.org/)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+#include <gst/gst.h>
+#include "MediaPipeline.hpp"
+#include "MediaProfileSpecType.hpp"
+#include <HttpGetEndpointImplFactory.hpp>
+#include "HttpGetEndpointImpl.hpp"
+#include <jsonrpc/JsonSerializer.hpp>
+#include <KurentoException.hpp>
+#include <commons/kmsrecordingprofile.h>
+
+#define DROP_SLOW_CLIENTS "drop-slow-clients"
+
+#define GST_CAT_DEFAULT kurento_http_get_endpoint_impl
+GST_DEBUG_CATEGORY_STATIC (GST_CAT_DEFAULT);
+#define GST_DEFAULT_NAME "KurentoHttpGetEndpointImpl"
+
+#define FACTORY_NAME "httpgetendpoint"
+
+namespace kurento
+{
+
+HttpGetEndpointImpl::HttpGetEndpointImpl (const boost::property_tree::ptree
+    &conf, std::shared_ptr<MediaPipeline>
+    mediaPipeline, int disconnectionTimeout,
+    std::shared_ptr<MediaProfileSpecType> mediaProfile,
+    bool dropSlowClients) : HttpEndpointImpl (conf,
+          std::dynamic_pointer_cast< MediaObjectImpl > (mediaPipeline),
+          disconnectionTimeout, FACTORY_NAME)
+{
+  g_object_set (G_OBJECT (element), DROP_SLOW_CLIENTS, dropSlowClients, NULL);
+
+  switch (mediaProfile->getValue() ) {
+  case MediaProfileSpecType::WEBM:
+    g_object_set ( G_OBJECT (element), "profile", KMS_RECORDING_PROFILE_WEBM, NULL);
+    GST_INFO ("Set WEBM profile");
+    break;
+
+  /* HTTP streams are always fragmented */
+  case MediaProfileSpecType::MP4:
+  case MediaProfileSpecType::MP4_FRAGMENTED:
+    g_object_set ( G_OBJECT (element), "profile", KMS_RECORDING_PROFILE_MP4, NULL);
+    GST_INFO ("Set MP4 profile");
+    break;
+
+  case MediaProfileSpecType::WEBM_VIDEO_ONLY:
+    g_object_set ( G_OBJECT (element), "profile",
+                   KMS_RECORDING_PROFILE_WEBM_VIDEO_ONLY, NULL);
+    GST_INFO ("Set WEBM VIDEO ONLY profile");
+    break;
+
+  case MediaProfileSpecType::WEBM_AUDIO_ONLY:
+    g_object_set ( G_OBJECT (element), "profile",
+                   KMS_RECORDING_PROFILE_WEBM_AUDIO_ONLY, NULL);
+    GST_INFO ("Set WEBM AUDIO ONLY profile");
+    break;
+
+  case MediaProfileSpecType::MP4_VIDEO_ONLY:
+  case MediaProfileSpecType::MP4_FRAGMENTED_VIDEO_ONLY:
+    g_object_set ( G_OBJECT (element), "profile",
+                   KMS_RECORDING_PROFILE_MP4_VIDEO_ONLY, NULL);
+    GST_INFO ("Set MP4 VIDEO ONLY profile");
+    break;
+
+  case MediaProfileSpecType::MP4_AUDIO_ONLY:
+  case MediaProfileSpecType::MP4_FRAGMENTED_AUDIO_ONLY:
+    g_object_set ( G_OBJECT (element), "profile",
+                   KMS_RECORDING_PROFILE_MP4_AUDIO_ONLY, NULL);
+    GST_INFO ("Set MP4 AUDIO ONLY profile");
+    break;
+
+  default:
+    throw KurentoException (MEDIA_OBJECT_ILLEGAL_PARAM_ERROR,
+                            "Media profile can not be streamed over HTTP");
+  }
+
+  register_end_point();
+
+  if (!is_registered() ) {
+    throw KurentoException (HTTP_END_POINT_REGISTRATION_ERROR,
+                            "Cannot register HttpGetEndPoint");
+  }
+}
+
+MediaObjectImpl *
+HttpGetEndpointImplFactory::createObject (const boost::property_tree::ptree
+    &conf, std::shared_ptr<MediaPipeline>
+    mediaPipeline, int disconnectionTimeout,
+    std::shared_ptr<MediaProfileSpecType> mediaProfile,
+    bool dropSlowClients) const
+{
+  return new HttpGetEndpointImpl (conf, mediaPipeline, disconnectionTimeout,
+                                  mediaProfile, dropSlowClients);
+}
+
+HttpGetEndpointImpl::StaticConstructor HttpGetEndpointImpl::staticConstructor;
+
+HttpGetEndpointImpl::StaticConstructor::StaticConstructor()
+{
+  GST_DEBUG_CATEGORY_INIT (GST_CAT_DEFAULT, GST_DEFAULT_NAME, 0,
+                           GST_DEFAULT_NAME);
+}
+
+} /* kurento */
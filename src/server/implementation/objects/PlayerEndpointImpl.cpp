@@ -35,6 +35,12 @@ GST_DEBUG_CATEGORY_STATIC (GST_CAT_DEFAULT);
 #define PIPELINE "pipeline"
 #define SET_POSITION "set-position"
 #define NS_TO_MS 1000000
+#define PASSTHROUGH "passthrough"
+#define SHARED_DECODE "sharedDecode"
+#define MMAP_FILES "mmapFiles"
+#define FILE_BLOCK_SIZE "fileBlockSize"
+#define SEEK_TO_KEYFRAME "seekToKeyframe"
+#define ADAPTIVE_NETWORK_CACHE "adaptiveNetworkCache"
 
 namespace kurento
 {
@@ -104,7 +110,19 @@ PlayerEndpointImpl::PlayerEndpointImpl (const boost::property_tree::ptree &conf,
   GstElement *element = getGstreamerElement();
 
   g_object_set (G_OBJECT (element), "use-encoded-media", useEncodedMedia,
-                "network-cache", networkCache, NULL);
+                "network-cache", networkCache, "passthrough",
+                getConfigValue <bool, PlayerEndpoint> (PASSTHROUGH, false),
+                "shared-decode",
+                getConfigValue <bool, PlayerEndpoint> (SHARED_DECODE, false),
+                "mmap-files",
+                getConfigValue <bool, PlayerEndpoint> (MMAP_FILES, false),
+                "file-block-size",
+                getConfigValue <guint, PlayerEndpoint> (FILE_BLOCK_SIZE, 0),
+                "seek-to-keyframe",
+                getConfigValue <bool, PlayerEndpoint> (SEEK_TO_KEYFRAME, false),
+                "adaptive-network-cache",
+                getConfigValue <bool, PlayerEndpoint> (ADAPTIVE_NETWORK_CACHE, false),
+                NULL);
 }
 
 PlayerEndpointImpl::~PlayerEndpointImpl()
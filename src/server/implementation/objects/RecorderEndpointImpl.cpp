@@ -32,6 +32,7 @@
 
 #include <SignalHandler.hpp>
 #include <functional>
+#include <mutex>
 
 #define GST_CAT_DEFAULT kurento_recorder_endpoint_impl
 GST_DEBUG_CATEGORY_STATIC (GST_CAT_DEFAULT);
@@ -51,6 +52,7 @@ typedef enum {
 } KmsUriEndPointState;
 
 bool RecorderEndpointImpl::support_ksr;
+static std::once_flag muxer_pool_flag;
 
 static bool
 check_support_for_ksr ()
@@ -67,16 +69,64 @@ check_support_for_ksr ()
   return supported;
 }
 
+#define OVERFLOW_POLICY "overflowPolicy"
+#define OVERFLOW_MAX_BYTES "overflowMaxBytes"
+#define OVERFLOW_MAX_TIME "overflowMaxTime"
+#define SPILL_DIRECTORY "spillDirectory"
+#define SPILL_MAX_BYTES "spillMaxBytes"
+#define MUXER_POOL_SIZE "muxerPoolSize"
+#define GOP_CACHE "gopCache"
+#define STOP_TIMEOUT "stopTimeout"
+
 RecorderEndpointImpl::RecorderEndpointImpl (const boost::property_tree::ptree
     &conf,
     std::shared_ptr<MediaPipeline> mediaPipeline, const std::string &uri,
     std::shared_ptr<MediaProfileSpecType> mediaProfile,
-    bool stopOnEndOfStream) : UriEndpointImpl (conf,
+    bool stopOnEndOfStream, int segmentDuration, int64_t segmentSize,
+    const std::string &segmentTemplate,
+    int fragmentDuration) : UriEndpointImpl (conf,
           std::dynamic_pointer_cast<MediaObjectImpl> (mediaPipeline), FACTORY_NAME, uri)
 {
   g_object_set (G_OBJECT (getGstreamerElement() ), "accept-eos",
                 stopOnEndOfStream, NULL);
 
+  if (segmentDuration < 0 || segmentSize < 0) {
+    throw KurentoException (MEDIA_OBJECT_ILLEGAL_PARAM_ERROR,
+                            "Segment duration and size can not be negative");
+  }
+
+  if (fragmentDuration <= 0) {
+    throw KurentoException (MEDIA_OBJECT_ILLEGAL_PARAM_ERROR,
+                            "Fragment duration must be positive");
+  }
+
+  /* Segments are configured when the profile creates the muxer */
+  g_object_set (G_OBJECT (element), "segment-duration",
+                (guint64) segmentDuration * GST_MSECOND, "segment-size",
+                (guint64) segmentSize, NULL);
+
+  if (!segmentTemplate.empty() ) {
+    g_object_set (G_OBJECT (element), "segment-template",
+                  segmentTemplate.c_str(), NULL);
+  }
+
+  configureOverflow ();
+
+  /* The pipeline closes recordings that take longer than this to stop */
+  stopTimeout = getConfigValue <guint, RecorderEndpoint> (STOP_TIMEOUT, 0);
+  g_object_set (G_OBJECT (element), "stop-timeout", stopTimeout, NULL);
+
+  /* Pads are created with the profile when the cache is enabled */
+  g_object_set (G_OBJECT (element), "gop-cache",
+                getConfigValue <bool, RecorderEndpoint> (GOP_CACHE, false), NULL);
+
+  /* The pool is shared by every recorder */
+  std::call_once (muxer_pool_flag, [this] () {
+    g_object_set (G_OBJECT (element), "muxer-pool-size",
+                  getConfigValue <guint, RecorderEndpoint> (MUXER_POOL_SIZE, 0),
+                  NULL);
+  });
+
   switch (mediaProfile->getValue() ) {
   case MediaProfileSpecType::WEBM:
     g_object_set ( G_OBJECT (element), "profile", KMS_RECORDING_PROFILE_WEBM, NULL);
@@ -127,7 +177,78 @@ RecorderEndpointImpl::RecorderEndpointImpl (const boost::property_tree::ptree
     g_object_set ( G_OBJECT (element), "profile", KMS_RECORDING_PROFILE_KSR, NULL);
     GST_INFO ("Set KSR profile");
     break;
+
+  case MediaProfileSpecType::MP4_FRAGMENTED:
+    g_object_set ( G_OBJECT (element), "fragment-duration", fragmentDuration,
+                   "profile", KMS_RECORDING_PROFILE_MP4, NULL);
+    GST_INFO ("Set MP4 FRAGMENTED profile");
+    break;
+
+  case MediaProfileSpecType::MP4_FRAGMENTED_VIDEO_ONLY:
+    g_object_set ( G_OBJECT (element), "fragment-duration", fragmentDuration,
+                   "profile", KMS_RECORDING_PROFILE_MP4_VIDEO_ONLY, NULL);
+    GST_INFO ("Set MP4 FRAGMENTED VIDEO ONLY profile");
+    break;
+
+  case MediaProfileSpecType::MP4_FRAGMENTED_AUDIO_ONLY:
+    g_object_set ( G_OBJECT (element), "fragment-duration", fragmentDuration,
+                   "profile", KMS_RECORDING_PROFILE_MP4_AUDIO_ONLY, NULL);
+    GST_INFO ("Set MP4 FRAGMENTED AUDIO ONLY profile");
+    break;
+  }
+}
+
+void
+RecorderEndpointImpl::configureOverflow ()
+{
+  std::string policy;
+  std::string spillDirectory;
+  uint64_t maxBytes, maxTime;
+  GParamSpec *pspec;
+
+  policy = getConfigValue <std::string, RecorderEndpoint> (OVERFLOW_POLICY, "");
+
+  if (!policy.empty() ) {
+    pspec = g_object_class_find_property (G_OBJECT_GET_CLASS (element),
+                                          "overflow-policy");
+
+    if (g_enum_get_value_by_nick (G_PARAM_SPEC_ENUM (pspec)->enum_class,
+                                  policy.c_str() ) == NULL) {
+      GST_WARNING ("Unknown overflow policy '%s', media will be queued",
+                   policy.c_str() );
+    } else {
+      gst_util_set_object_arg (G_OBJECT (element), "overflow-policy",
+                               policy.c_str() );
+    }
   }
+
+  maxBytes = getConfigValue <uint64_t, RecorderEndpoint>
+             (OVERFLOW_MAX_BYTES, 0);
+  maxTime = getConfigValue <uint64_t, RecorderEndpoint>
+            (OVERFLOW_MAX_TIME, 0);
+
+  if (!policy.empty() && policy != "block" && maxBytes == 0 && maxTime == 0) {
+    /* The element applies a default budget, media would queue without limit
+     * otherwise as the appsrc never blocks with these policies */
+    GST_WARNING ("Overflow policy '%s' without overflowMaxBytes nor "
+                 "overflowMaxTime, using the default budget of 16 MiB per "
+                 "track", policy.c_str() );
+  }
+
+  g_object_set (G_OBJECT (element), "overflow-max-bytes", (guint64) maxBytes,
+                "overflow-max-time", (guint64) maxTime * GST_MSECOND, NULL);
+
+  spillDirectory = getConfigValue <std::string, RecorderEndpoint>
+                   (SPILL_DIRECTORY, "");
+
+  if (!spillDirectory.empty() ) {
+    g_object_set (G_OBJECT (element), "spill-directory",
+                  spillDirectory.c_str(), NULL);
+  }
+
+  g_object_set (G_OBJECT (element), "spill-max-bytes",
+                (guint64) getConfigValue <uint64_t, RecorderEndpoint>
+                (SPILL_MAX_BYTES, 1073741824), NULL);
 }
 
 void RecorderEndpointImpl::postConstructor()
@@ -141,6 +262,45 @@ void RecorderEndpointImpl::postConstructor()
                                       std::placeholders::_2) ),
                           std::dynamic_pointer_cast<RecorderEndpointImpl>
                           (shared_from_this() ) );
+
+  handlerOnSegmentClosed = register_signal_handler (G_OBJECT (element),
+                           "segment-closed",
+                           std::function <void (GstElement *, gchar *) >
+                           (std::bind (&RecorderEndpointImpl::onSegmentClosed, this,
+                                       std::placeholders::_2) ),
+                           std::dynamic_pointer_cast<RecorderEndpointImpl>
+                           (shared_from_this() ) );
+
+  handlerOnRecordingFinished = register_signal_handler (G_OBJECT (element),
+                               "recording-finished",
+                               std::function <void (GstElement *, guint64, guint64, gboolean) >
+                               (std::bind (&RecorderEndpointImpl::onRecordingFinished, this,
+                                   std::placeholders::_2, std::placeholders::_3,
+                                   std::placeholders::_4) ),
+                               std::dynamic_pointer_cast<RecorderEndpointImpl>
+                               (shared_from_this() ) );
+}
+
+void
+RecorderEndpointImpl::onSegmentClosed (const gchar *uri)
+{
+  GST_DEBUG_OBJECT (element, "Segment closed: %s", uri);
+
+  SegmentClosed event (shared_from_this(), SegmentClosed::getName(), uri);
+  signalSegmentClosed (event);
+}
+
+void
+RecorderEndpointImpl::onRecordingFinished (guint64 size, guint64 duration,
+    gboolean timedOut)
+{
+  GST_DEBUG_OBJECT (element, "Recording finished: %" G_GUINT64_FORMAT
+                    " bytes, %" GST_TIME_FORMAT "%s", size, GST_TIME_ARGS (duration),
+                    timedOut ? " (timed out)" : "");
+
+  RecordingFinished event (shared_from_this(), RecordingFinished::getName(),
+                           (int64_t) size, (int64_t) (duration / GST_MSECOND), timedOut);
+  signalRecordingFinished (event);
 }
 
 void
@@ -180,10 +340,17 @@ RecorderEndpointImpl::onStateChanged (gint newState)
 void RecorderEndpointImpl::waitForStateChange (gint expectedState)
 {
   std::unique_lock<std::mutex> lck (mtx);
+  std::chrono::milliseconds timeout = std::chrono::seconds (TIMEOUT);
 
-  if (!cv.wait_for (lck, std::chrono::seconds (TIMEOUT), [&] {return expectedState == state;}) ) {
-    GST_ERROR_OBJECT (element, "STATE did not changed to %d in %d seconds",
-                      expectedState, TIMEOUT);
+  /* Stops can not take longer than the pipeline allows them: one timeout to
+   * force EOS and another one to close the recording */
+  if (expectedState == KMS_URI_END_POINT_STATE_STOP && stopTimeout > 0) {
+    timeout += std::chrono::milliseconds (2 * (gint64) stopTimeout);
+  }
+
+  if (!cv.wait_for (lck, timeout, [&] {return expectedState == state;}) ) {
+    GST_ERROR_OBJECT (element, "STATE did not changed to %d in %lld ms",
+                      expectedState, (long long) timeout.count() );
   }
 }
 
@@ -212,6 +379,14 @@ RecorderEndpointImpl::~RecorderEndpointImpl()
     unregister_signal_handler (element, handlerOnStateChanged);
   }
 
+  if (handlerOnSegmentClosed > 0) {
+    unregister_signal_handler (element, handlerOnSegmentClosed);
+  }
+
+  if (handlerOnRecordingFinished > 0) {
+    unregister_signal_handler (element, handlerOnRecordingFinished);
+  }
+
   g_object_get (getGstreamerElement(), "state", &state, NULL);
 
   if (state != 0 /* stop */) {
@@ -294,10 +469,12 @@ RecorderEndpointImplFactory::createObject (const boost::property_tree::ptree
     &conf, std::shared_ptr<MediaPipeline>
     mediaPipeline, const std::string &uri,
     std::shared_ptr<MediaProfileSpecType> mediaProfile,
-    bool stopOnEndOfStream) const
+    bool stopOnEndOfStream, int segmentDuration, int64_t segmentSize,
+    const std::string &segmentTemplate, int fragmentDuration) const
 {
   return new RecorderEndpointImpl (conf, mediaPipeline, uri, mediaProfile,
-                                   stopOnEndOfStream);
+                                   stopOnEndOfStream, segmentDuration, segmentSize, segmentTemplate,
+                                   fragmentDuration);
 }
 
 RecorderEndpointImpl::StaticConstructor RecorderEndpointImpl::staticConstructor;
@@ -40,7 +40,9 @@ public:
 
   RecorderEndpointImpl (const boost::property_tree::ptree &conf,
                         std::shared_ptr<MediaPipeline> mediaPipeline, const std::string &uri,
-                        std::shared_ptr<MediaProfileSpecType> mediaProfile, bool stopOnEndOfStream);
+                        std::shared_ptr<MediaProfileSpecType> mediaProfile, bool stopOnEndOfStream,
+                        int segmentDuration, int64_t segmentSize,
+                        const std::string &segmentTemplate, int fragmentDuration);
 
   virtual ~RecorderEndpointImpl ();
 
@@ -55,6 +57,8 @@ public:
   sigc::signal<void, Recording> signalRecording;
   sigc::signal<void, Paused> signalPaused;
   sigc::signal<void, Stopped> signalStopped;
+  sigc::signal<void, SegmentClosed> signalSegmentClosed;
+  sigc::signal<void, RecordingFinished> signalRecordingFinished;
 
   virtual void invoke (std::shared_ptr<MediaObjectImpl> obj,
                        const std::string &methodName, const Json::Value &params,
@@ -73,11 +77,17 @@ protected:
 private:
   static bool support_ksr;
   gulong handlerOnStateChanged = 0;
+  gulong handlerOnSegmentClosed = 0;
+  gulong handlerOnRecordingFinished = 0;
   std::mutex mtx;
   std::condition_variable cv;
   gint state;
+  guint stopTimeout;
 
   void onStateChanged (gint state);
+  void onSegmentClosed (const gchar *uri);
+  void onRecordingFinished (guint64 size, guint64 duration, gboolean timedOut);
+  void configureOverflow ();
   void waitForStateChange (gint state);
 
   void collectEndpointStats (std::map <std::string, std::shared_ptr<Stats>>
@@ -29,6 +29,7 @@
 #include <IceComponentState.hpp>
 #include <SignalHandler.hpp>
 #include <webrtcendpoint/kmsicebaseagent.h>
+#include <webrtcendpoint/kmswebrtcendpoint.h>
 
 #include <StatsType.hpp>
 #include <RTCDataChannelState.hpp>
@@ -56,7 +57,7 @@ namespace kurento
 
 static const uint DEFAULT_STUN_PORT = 3478;
 
-std::once_flag check_openh264, certificates_flag;
+std::once_flag check_openh264, certificates_flag, event_loops_flag;
 std::string defaultCertificateRSA, defaultCertificateECDSA;
 std::vector<std::string> supported_codecs = { "VP8", "opus", "PCMU" };
 
@@ -163,6 +164,22 @@ WebRtcEndpointImpl::generateDefaultCertificates ()
   }
 }
 
+void
+WebRtcEndpointImpl::configureEventLoops ()
+{
+  uint eventLoops;
+
+  try {
+    eventLoops = getConfigValue <uint, WebRtcEndpoint> ("eventLoops");
+  } catch (boost::property_tree::ptree_error &) {
+    GST_INFO ("Number of event loops not found in config;"
+              " using one per CPU core");
+    eventLoops = 0;
+  }
+
+  kms_webrtc_endpoint_set_event_loops (eventLoops);
+}
+
 void WebRtcEndpointImpl::checkUri (std::string &uri)
 {
   //Check if uri is an absolute or relative path.
@@ -440,6 +457,8 @@ WebRtcEndpointImpl::WebRtcEndpointImpl (const boost::property_tree::ptree &conf,
   std::call_once (check_openh264, check_support_for_h264);
   std::call_once (certificates_flag,
                   std::bind (&WebRtcEndpointImpl::generateDefaultCertificates, this) );
+  std::call_once (event_loops_flag,
+                  std::bind (&WebRtcEndpointImpl::configureEventLoops, this) );
 
   if (useDataChannels) {
     g_object_set (element, "use-data-channels", TRUE, NULL);
@@ -124,6 +124,7 @@ private:
   void checkUri (std::string &uri);
   std::string getCerficateFromFile (std::string &path);
   void generateDefaultCertificates ();
+  void configureEventLoops ();
 
   std::map < std::string, std::shared_ptr<IceCandidatePair >> candidatePairs;
   std::map < std::string, std::shared_ptr<IceConnection>> iceConnectionState;
@@ -0,0 +1,185 @@
+/*
+ * (C) Copyright 2016 Kurento (http://kurento.org/)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+#include <gst/check/gstcheck.h>
+#include <gst/gst.h>
+#include <glib/gstdio.h>
+#include <string.h>
+
+#define LOCATION "/tmp/check_async_file_sink.dat"
+#define HEADER_SIZE 32
+#define DATA_SIZE (3 * 1024 * 1024 + 17)
+
+static GstStaticPadTemplate srctemplate = GST_STATIC_PAD_TEMPLATE ("src",
+    GST_PAD_SRC,
+    GST_PAD_ALWAYS,
+    GST_STATIC_CAPS_ANY);
+
+static GstElement *
+setup_sink (guint block_size, guint buffer_size, GstPad ** srcpad)
+{
+  GstElement *sink;
+
+  g_remove (LOCATION);
+
+  sink = gst_check_setup_element ("kmsasyncfilesink");
+  g_object_set (sink, "location", LOCATION, "block-size", block_size,
+      "buffer-size", buffer_size, NULL);
+
+  *srcpad = gst_check_setup_src_pad (sink, &srctemplate);
+  gst_pad_set_active (*srcpad, TRUE);
+
+  fail_unless (gst_element_set_state (sink, GST_STATE_PLAYING) ==
+      GST_STATE_CHANGE_ASYNC);
+
+  gst_pad_push_event (*srcpad, gst_event_new_stream_start ("test"));
+
+  return sink;
+}
+
+static void
+cleanup_sink (GstElement * sink)
+{
+  gst_element_set_state (sink, GST_STATE_NULL);
+  gst_check_teardown_src_pad (sink);
+  gst_check_teardown_element (sink);
+}
+
+static void
+push_segment (GstPad * srcpad, guint64 start)
+{
+  GstSegment segment;
+
+  gst_segment_init (&segment, GST_FORMAT_BYTES);
+  segment.start = start;
+  segment.time = start;
+
+  fail_unless (gst_pad_push_event (srcpad, gst_event_new_segment (&segment)));
+}
+
+/* Pushes @data in buffers of random size */
+static void
+push_data (GstPad * srcpad, const guint8 * data, gsize size)
+{
+  gsize offset = 0;
+
+  while (offset < size) {
+    gsize len = MIN (size - offset, g_random_int_range (1, 64 * 1024));
+
+    fail_unless_equals_int (gst_pad_push (srcpad,
+            gst_buffer_new_wrapped (g_memdup (data + offset, len), len)),
+        GST_FLOW_OK);
+    offset += len;
+  }
+}
+
+GST_START_TEST (write_and_rewrite_header)
+{
+  guint8 *data = g_malloc (DATA_SIZE);
+  GstStructure *stats;
+  GstElement *sink;
+  GstPad *srcpad;
+  guint64 written;
+  gchar *contents;
+  gsize len, i;
+
+  for (i = 0; i < DATA_SIZE; i++) {
+    data[i] = g_random_int_range (0, 256);
+  }
+
+  sink = setup_sink (64 * 1024, 256 * 1024, &srcpad);
+
+  /* Like muxers, write a placeholder header and seek back to fill it */
+  push_segment (srcpad, 0);
+  fail_unless_equals_int (gst_pad_push (srcpad,
+          gst_buffer_new_wrapped (g_malloc0 (HEADER_SIZE), HEADER_SIZE)),
+      GST_FLOW_OK);
+  push_data (srcpad, data + HEADER_SIZE, DATA_SIZE - HEADER_SIZE);
+  push_segment (srcpad, 0);
+  push_data (srcpad, data, HEADER_SIZE);
+
+  fail_unless (gst_pad_push_event (srcpad, gst_event_new_eos ()));
+
+  /* EOS is handled once the data is in the file */
+  fail_unless (g_file_get_contents (LOCATION, &contents, &len, NULL));
+  fail_unless_equals_int (len, DATA_SIZE);
+  fail_unless (memcmp (contents, data, DATA_SIZE) == 0);
+  g_free (contents);
+
+  g_object_get (sink, "stats", &stats, NULL);
+  GST_INFO ("Stats: %" GST_PTR_FORMAT, stats);
+  fail_unless (gst_structure_get_uint64 (stats, "bytes-written", &written));
+  /* Header is written twice, as a placeholder and when it is filled */
+  fail_unless_equals_uint64 (written, DATA_SIZE + HEADER_SIZE);
+  gst_structure_free (stats);
+
+  cleanup_sink (sink);
+  g_remove (LOCATION);
+  g_free (data);
+}
+
+GST_END_TEST;
+
+/* Write-behind buffer of two blocks, so the streaming thread must wait */
+GST_START_TEST (bounded_queue)
+{
+  guint8 *data = g_malloc0 (DATA_SIZE);
+  guint64 max_depth, stalls;
+  GstStructure *stats;
+  GstElement *sink;
+  GstPad *srcpad;
+  GStatBuf st;
+
+  sink = setup_sink (4096, 0, &srcpad);
+
+  push_segment (srcpad, 0);
+  push_data (srcpad, data, DATA_SIZE);
+  fail_unless (gst_pad_push_event (srcpad, gst_event_new_eos ()));
+
+  g_object_get (sink, "stats", &stats, NULL);
+  GST_INFO ("Stats: %" GST_PTR_FORMAT, stats);
+  fail_unless (gst_structure_get_uint64 (stats, "max-queue-depth",
+          &max_depth));
+  fail_unless (gst_structure_get_uint64 (stats, "stalls", &stalls));
+  fail_unless (max_depth <= 2 * 4096);
+  GST_INFO ("Streaming thread stalled %" G_GUINT64_FORMAT " times", stalls);
+  gst_structure_free (stats);
+
+  fail_unless (g_stat (LOCATION, &st) == 0);
+  fail_unless_equals_int (st.st_size, DATA_SIZE);
+
+  cleanup_sink (sink);
+  g_remove (LOCATION);
+  g_free (data);
+}
+
+GST_END_TEST;
+
+static Suite *
+asyncfilesink_suite (void)
+{
+  Suite *s = suite_create ("asyncfilesink");
+  TCase *tc_chain = tcase_create ("element");
+
+  suite_add_tcase (s, tc_chain);
+
+  tcase_add_test (tc_chain, write_and_rewrite_header);
+  tcase_add_test (tc_chain, bounded_queue);
+
+  return s;
+}
+
+GST_CHECK_MAIN (asyncfilesink);
@@ -328,6 +328,222 @@ GST_START_TEST (check_emit_encoded_media)
   g_main_loop_unref (loop);
 }
 
+GST_END_TEST
+static void
+remove_on_unlinked (GstPad * pad, GstPad * peer, gpointer data)
+{
+  GstElement *parent = gst_pad_get_parent_element (pad);
+
+  if (parent != NULL) {
+    gst_element_release_request_pad (parent, pad);
+    g_object_unref (parent);
+  }
+}
+
+static void
+connect_sink (GstElement * element, GstPad * pad, gpointer user_data)
+{
+  GstElement *agnosticbin = GST_ELEMENT (user_data);
+  GstPad *src;
+
+  if (g_strcmp0 (GST_OBJECT_NAME (pad), "sink_video_default")) {
+    return;
+  }
+
+  src = gst_element_get_request_pad (agnosticbin, "src_%u");
+  g_signal_connect (src, "unlinked", G_CALLBACK (remove_on_unlinked), NULL);
+  gst_element_link_pads (agnosticbin, GST_OBJECT_NAME (src), element,
+      GST_OBJECT_NAME (pad));
+  g_object_unref (src);
+}
+
+static void
+get_new_buffer_cb (GstElement * httpep, GstBuffer * buffer, gpointer data)
+{
+  guint *buffers = data;
+
+  /* Muxer sends stream headers before any media */
+  if (g_atomic_int_add (buffers, 1) == 0) {
+    fail_unless (GST_BUFFER_FLAG_IS_SET (buffer, GST_BUFFER_FLAG_HEADER));
+  }
+
+  if (g_atomic_int_get (buffers) == 20) {
+    g_idle_add ((GSourceFunc) g_main_loop_quit, loop);
+  }
+}
+
+GST_START_TEST (check_get_new_buffer)
+{
+  GstElement *pipeline, *videotestsrc, *vencoder, *agnosticbin;
+  guint bus_watch_id, buffers = 0;
+  gchar *mime_type;
+  GstBus *bus;
+
+  loop = g_main_loop_new (NULL, FALSE);
+
+  pipeline = gst_pipeline_new ("get-pipeline");
+  videotestsrc = gst_element_factory_make ("videotestsrc", NULL);
+  vencoder = gst_element_factory_make ("vp8enc", NULL);
+  agnosticbin = gst_element_factory_make ("agnosticbin", NULL);
+  httpep = gst_element_factory_make ("httpgetendpoint", NULL);
+
+  g_object_set (G_OBJECT (videotestsrc), "is-live", TRUE, NULL);
+  g_object_set (G_OBJECT (vencoder), "deadline", G_GINT64_CONSTANT (200000),
+      NULL);
+
+  /* Sink pads are added when the profile is set */
+  g_signal_connect (httpep, "pad-added", G_CALLBACK (connect_sink),
+      agnosticbin);
+  g_object_set (G_OBJECT (httpep), "profile", 2 /* WEBM_VIDEO_ONLY */ , NULL);
+
+  g_object_get (G_OBJECT (httpep), "mime-type", &mime_type, NULL);
+  fail_unless (g_strcmp0 (mime_type, "video/webm") == 0);
+  g_free (mime_type);
+
+  g_signal_connect (httpep, "new-buffer", G_CALLBACK (get_new_buffer_cb),
+      &buffers);
+
+  bus = gst_pipeline_get_bus (GST_PIPELINE (pipeline));
+  bus_watch_id = gst_bus_add_watch (bus, gst_bus_async_signal_func, NULL);
+  g_signal_connect (bus, "message", G_CALLBACK (bus_msg_cb), pipeline);
+  g_object_unref (bus);
+
+  gst_bin_add_many (GST_BIN (pipeline), videotestsrc, vencoder, agnosticbin,
+      httpep, NULL);
+  gst_element_link_many (videotestsrc, vencoder, agnosticbin, NULL);
+
+  /* Muxing only starts once a client requests the stream */
+  g_object_set (G_OBJECT (httpep), "start", TRUE, NULL);
+
+  gst_element_set_state (pipeline, GST_STATE_PLAYING);
+
+  g_main_loop_run (loop);
+
+  fail_unless (g_atomic_int_get (&buffers) >= 20);
+
+  g_object_set (G_OBJECT (httpep), "start", FALSE, NULL);
+
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+  gst_object_unref (GST_OBJECT (pipeline));
+
+  g_source_remove (bus_watch_id);
+  g_main_loop_unref (loop);
+}
+
+GST_END_TEST
+#define LATE_JOIN_BUFFERS 10
+#define LATE_JOIN_MAX_BUFFERS 200
+typedef struct _LateJoiner
+{
+  guint buffers;
+  gboolean synced;
+  guint fragments;
+} LateJoiner;
+
+static gboolean
+buffer_starts_moof (GstBuffer * buffer)
+{
+  guint8 data[8];
+
+  if (gst_buffer_extract (buffer, 0, data, sizeof (data)) != sizeof (data)) {
+    return FALSE;
+  }
+
+  return GST_READ_UINT32_LE (data + 4) == GST_MAKE_FOURCC ('m', 'o', 'o',
+      'f');
+}
+
+static void
+late_joiner_new_buffer_cb (GstElement * httpep, GstBuffer * buffer,
+    gpointer data)
+{
+  LateJoiner *joiner = data;
+  gboolean sync;
+
+  joiner->buffers++;
+
+  if (GST_BUFFER_FLAG_IS_SET (buffer, GST_BUFFER_FLAG_HEADER)) {
+    return;
+  }
+
+  sync = !GST_BUFFER_FLAG_IS_SET (buffer, GST_BUFFER_FLAG_DELTA_UNIT);
+
+  /* Any buffer a client may join at must start a fragment */
+  if (sync) {
+    fail_unless (buffer_starts_moof (buffer));
+  }
+
+  if (joiner->buffers < LATE_JOIN_BUFFERS) {
+    return;
+  }
+
+  /* Client joins here, it waits for the next fragment */
+  if (!joiner->synced && !sync) {
+    fail_if (joiner->buffers > LATE_JOIN_MAX_BUFFERS,
+        "No fragment start found for the late client");
+    return;
+  }
+
+  joiner->synced = TRUE;
+
+  if (sync && ++joiner->fragments == 2) {
+    g_idle_add ((GSourceFunc) g_main_loop_quit, loop);
+  }
+}
+
+GST_START_TEST (check_get_late_joiner_fragmented_mp4)
+{
+  GstElement *pipeline, *videotestsrc, *vencoder, *agnosticbin;
+  LateJoiner joiner = { 0, FALSE, 0 };
+  guint bus_watch_id;
+  GstBus *bus;
+
+  loop = g_main_loop_new (NULL, FALSE);
+
+  pipeline = gst_pipeline_new ("get-pipeline");
+  videotestsrc = gst_element_factory_make ("videotestsrc", NULL);
+  vencoder = gst_element_factory_make ("vp8enc", NULL);
+  agnosticbin = gst_element_factory_make ("agnosticbin", NULL);
+  httpep = gst_element_factory_make ("httpgetendpoint", NULL);
+
+  g_object_set (G_OBJECT (videotestsrc), "is-live", TRUE, NULL);
+  g_object_set (G_OBJECT (vencoder), "deadline", G_GINT64_CONSTANT (200000),
+      NULL);
+
+  g_signal_connect (httpep, "pad-added", G_CALLBACK (connect_sink),
+      agnosticbin);
+  g_object_set (G_OBJECT (httpep), "profile", 4 /* MP4_VIDEO_ONLY */ , NULL);
+
+  g_signal_connect (httpep, "new-buffer",
+      G_CALLBACK (late_joiner_new_buffer_cb), &joiner);
+
+  bus = gst_pipeline_get_bus (GST_PIPELINE (pipeline));
+  bus_watch_id = gst_bus_add_watch (bus, gst_bus_async_signal_func, NULL);
+  g_signal_connect (bus, "message", G_CALLBACK (bus_msg_cb), pipeline);
+  g_object_unref (bus);
+
+  gst_bin_add_many (GST_BIN (pipeline), videotestsrc, vencoder, agnosticbin,
+      httpep, NULL);
+  gst_element_link_many (videotestsrc, vencoder, agnosticbin, NULL);
+
+  g_object_set (G_OBJECT (httpep), "start", TRUE, NULL);
+
+  gst_element_set_state (pipeline, GST_STATE_PLAYING);
+
+  g_main_loop_run (loop);
+
+  fail_unless (joiner.synced);
+  fail_unless (joiner.fragments >= 2);
+
+  g_object_set (G_OBJECT (httpep), "start", FALSE, NULL);
+
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+  gst_object_unref (GST_OBJECT (pipeline));
+
+  g_source_remove (bus_watch_id);
+  g_main_loop_unref (loop);
+}
+
 GST_END_TEST
 /******************************/
 /* HttpEndpoint test suit */
@@ -346,6 +562,12 @@ httpendpoint_suite (void)
   /* Simulates POST behaviour with encoded media */
   tcase_add_test (tc_chain, check_emit_encoded_media);
 
+  /* Simulates GET behaviour, muxed stream is notified for all clients */
+  tcase_add_test (tc_chain, check_get_new_buffer);
+
+  /* Late GET clients join at the start of an MP4 fragment */
+  tcase_add_test (tc_chain, check_get_late_joiner_fragmented_mp4);
+
   return s;
 }
 
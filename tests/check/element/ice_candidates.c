@@ -16,8 +16,259 @@
  */
 
 #include <gst/check/gstcheck.h>
+#include <stdlib.h>
+#include <string.h>
 #include "webrtcendpoint/kmsicecandidate.h"
 
+#define BENCH_ITERATIONS 20000
+#define FUZZ_ITERATIONS 20000
+
+/* Regular expression used to parse candidates before the tokenizer */
+#define BYTE_STRING_ATTR_EXPR "([\\x01-\\x09]|[\\x0B-\\x0C]|[\\x0E-\\xFF])+"
+#define ALPHA_ATTR_EXPR "[\\x41-\\x5A]|[\\x61-\\x7A]"
+#define DIGIT_ATTR_EXPR "[\\x30-\\x39]"
+#define ICE_CHAR_ATTR_EXPR ALPHA_ATTR_EXPR "|" DIGIT_ATTR_EXPR "|\\x2B|\\x2F|\\x2D"
+
+#define EXTENSION_ATTR_EXP "( tcptype (?<tcptype>(active|passive|so)))?" \
+  "( " BYTE_STRING_ATTR_EXPR " " BYTE_STRING_ATTR_EXPR ")*$"
+
+#define CANDIDATE_EXPR "^candidate:" \
+  "(?<foundation>(" ICE_CHAR_ATTR_EXPR "){1,32})" \
+  " (?<cid>(" DIGIT_ATTR_EXPR "){1,5})" \
+  " (?<transport>(udp|UDP|tcp|TCP))" \
+  " (?<priority>(" DIGIT_ATTR_EXPR "){1,10})" \
+  " (?<addr>[0-9.:a-zA-Z]+)" \
+  " (?<port>[0-9]+)" \
+  " typ (?<type>(host|srflx|prflx|relay))" \
+  "( raddr (?<raddr>[0-9.:a-zA-Z]+))?" \
+  "( rport (?<rport>[0-9]+))?" \
+  EXTENSION_ATTR_EXP
+
+static const gchar *corpus[] = {
+  "candidate:1 1 TCP 1015022079 192.168.1.183 38907 typ host tcptype passive",
+  "candidate:2 1 UDP 2013266431 fe80::a00:27ff:fee0:4ebf 45067 typ relay",
+  "candidate:3 1 UDP 2013266431 192.168.1.183 55079 typ prflx",
+  "candidate:4 1 UDP 2013266431 192.168.1.183 55079 typ relay raddr 127.0.0.1 rport 9999 tcptype active",
+  "candidate:5 1 UDP 2013266431 192.168.1.183 55079 typ relay raddr 127.0.0.1 tcptype active",
+  "candidate:6 1 UDP 2013266431 192.168.1.183 55079 typ relay rport 9999 tcptype active",
+  "candidate:842163049 1 udp 1677729535 193.147.51.8 59803 typ srflx raddr 172.17.0.9 rport 59803 generation 0 ufrag B+z2Krpxf2R3uR0S",
+  "candidate:qwert+/456 1 TCP 935331583 fe80::a00:27ff:fee0:4ebf 38878 typ prflx tcptype active",
+  "candidate:3442447574 1 udp 2122260223 192.168.0.12 54598 typ host generation 0 ufrag 6dF4 network-id 1 network-cost 10",
+  "candidate:1061643234 1 tcp 1518280447 192.168.0.12 9 typ host tcptype active generation 0",
+  "candidate:0 1 UDP 2122252543 10.0.0.2 61765 typ host\n",
+  "candidate:0 1 UDP 2122252543 10.0.0.2 61765 typ host\r\n",
+  "candidate:0 1 UDP 2122252543 10.0.0.2 61765 typ host\n\n",
+  "candidate:1 1 UDP 1 fe80::1 1 typ relay raddr fe80::2%eth0 rport 5 a b",
+  "candidate:1 1 UDP 1 10.0.0.1 1 typ host raddr 0.0.0.0 rport 0 tcptype so x",
+  "candidate:1 1 UDP 1 10.0.0.1 1 typ host x",
+  "candidate:1 1 UDP 1 10.0.0.1 1 typ host  x",
+  "candidate:1 1 UDP 1 10.0.0.1 1 typ host x y",
+  "candidate:1 1 UDP 1 10.0.0.1 1 typ host tcptype activex y",
+  "candidate:1 1 UDP 1 10.0.0.1 1 typ hostx",
+  "candidate:1 1 UDP 4294967295 10.0.0.1 99999999999 typ host",
+  "candidate:123456789012345678901234567890123 1 UDP 1 10.0.0.1 1 typ host",
+  "candidate:12345678901234567890123456789012 123456 UDP 1 10.0.0.1 1 typ host",
+  "candidate:1 1 Udp 1 10.0.0.1 1 typ host",
+  "candidate:1 1 UDP 1 10.0.0.1 1 typ host k \xc3\xa9",
+  "candidate:1 1 UDP 1 10.0.0.1 1 typ host k \xe2\x82\xac",
+  "candidate:1 1 UDP 1 10.0.0.1 1 typ host k \xc3",
+  "candidate:1 1 UDP 1 10.0.0.1 1 typ host rport 1 raddr 2",
+  "candidate:1  1 UDP 1 10.0.0.1 1 typ host",
+  "a=candidate:1 1 UDP 1 10.0.0.1 1 typ host",
+  "",
+};
+
+static const gchar *fuzz_tokens[] = {
+  " ", "raddr", "rport", "tcptype", "active", "so", "passive", "1", "a", "%",
+  "\n", "\r", "\xc3\xa9", "x y", "  ", ":", "typ", "host", "relay", "udp",
+  "-",
+};
+
+typedef struct _ParsedCandidate
+{
+  gboolean valid;
+  gchar *foundation;
+  gchar *addr;
+  guint port;
+  guint priority;
+  KmsIceProtocol proto;
+  KmsIceCandidateType type;
+  KmsIceTcpCandidateType tcptype;
+  gchar *raddr;
+  gint rport;
+} ParsedCandidate;
+
+static void
+parsed_candidate_clear (ParsedCandidate * p)
+{
+  g_free (p->foundation);
+  g_free (p->addr);
+  g_free (p->raddr);
+}
+
+static gchar *
+fetch_optional (GMatchInfo * match_info, const gchar * name)
+{
+  gchar *tmp = g_match_info_fetch_named (match_info, name);
+
+  if (tmp != NULL && g_strcmp0 (tmp, "") == 0) {
+    g_free (tmp);
+    tmp = NULL;
+  }
+
+  return tmp;
+}
+
+/* What the regex based parser used to extract from @candidate */
+static void
+parse_with_regex (GRegex * regex, const gchar * candidate, ParsedCandidate * p)
+{
+  GMatchInfo *match_info;
+  gchar *tmp;
+
+  memset (p, 0, sizeof (ParsedCandidate));
+  p->rport = -1;
+
+  g_regex_match (regex, candidate, 0, &match_info);
+
+  if (!g_match_info_matches (match_info)) {
+    g_match_info_free (match_info);
+    return;
+  }
+
+  p->valid = TRUE;
+  p->foundation = g_match_info_fetch_named (match_info, "foundation");
+  p->addr = g_match_info_fetch_named (match_info, "addr");
+
+  tmp = g_match_info_fetch_named (match_info, "port");
+  p->port = atoi (tmp);
+  g_free (tmp);
+
+  tmp = g_match_info_fetch_named (match_info, "priority");
+  p->priority = atoi (tmp);
+  g_free (tmp);
+
+  tmp = g_match_info_fetch_named (match_info, "transport");
+  p->proto = g_ascii_strcasecmp (tmp, "tcp") == 0 ?
+      KMS_ICE_PROTOCOL_TCP : KMS_ICE_PROTOCOL_UDP;
+  g_free (tmp);
+
+  tmp = g_match_info_fetch_named (match_info, "type");
+  if (g_strcmp0 (tmp, "host") == 0) {
+    p->type = KMS_ICE_CANDIDATE_TYPE_HOST;
+  } else if (g_strcmp0 (tmp, "srflx") == 0) {
+    p->type = KMS_ICE_CANDIDATE_TYPE_SRFLX;
+  } else if (g_strcmp0 (tmp, "prflx") == 0) {
+    p->type = KMS_ICE_CANDIDATE_TYPE_PRFLX;
+  } else {
+    p->type = KMS_ICE_CANDIDATE_TYPE_RELAY;
+  }
+  g_free (tmp);
+
+  tmp = fetch_optional (match_info, "tcptype");
+  if (g_strcmp0 (tmp, "active") == 0) {
+    p->tcptype = KMS_ICE_TCP_CANDIDATE_TYPE_ACTIVE;
+  } else if (g_strcmp0 (tmp, "passive") == 0) {
+    p->tcptype = KMS_ICE_TCP_CANDIDATE_TYPE_PASSIVE;
+  } else if (g_strcmp0 (tmp, "so") == 0) {
+    p->tcptype = KMS_ICE_TCP_CANDIDATE_TYPE_SO;
+  } else {
+    p->tcptype = KMS_ICE_TCP_CANDIDATE_TYPE_NONE;
+  }
+  g_free (tmp);
+
+  p->raddr = fetch_optional (match_info, "raddr");
+
+  tmp = fetch_optional (match_info, "rport");
+  if (tmp != NULL) {
+    p->rport = atoi (tmp);
+  }
+  g_free (tmp);
+
+  g_match_info_free (match_info);
+}
+
+static void
+parse_with_tokenizer (const gchar * candidate, ParsedCandidate * p)
+{
+  KmsIceCandidate *c;
+
+  memset (p, 0, sizeof (ParsedCandidate));
+  p->rport = -1;
+
+  c = kms_ice_candidate_new (candidate, "test", 0, "0");
+  if (c == NULL) {
+    return;
+  }
+
+  p->valid = TRUE;
+  p->foundation = kms_ice_candidate_get_foundation (c);
+  p->addr = kms_ice_candidate_get_address (c);
+  p->port = kms_ice_candidate_get_port (c);
+  p->priority = kms_ice_candidate_get_priority (c);
+  p->proto = kms_ice_candidate_get_protocol (c);
+  p->type = kms_ice_candidate_get_candidate_type (c);
+  p->tcptype = kms_ice_candidate_get_candidate_tcp_type (c);
+  p->raddr = kms_ice_candidate_get_related_address (c);
+  p->rport = kms_ice_candidate_get_related_port (c);
+
+  g_object_unref (c);
+}
+
+static void
+check_same_parsing (GRegex * regex, const gchar * candidate)
+{
+  ParsedCandidate expected, got;
+
+  parse_with_regex (regex, candidate, &expected);
+  parse_with_tokenizer (candidate, &got);
+
+  GST_LOG ("Checking '%s' (valid: %d)", candidate, expected.valid);
+
+  fail_unless (expected.valid == got.valid, "Validity differs for '%s'",
+      candidate);
+
+  if (expected.valid) {
+    fail_unless (g_strcmp0 (expected.foundation, got.foundation) == 0);
+    fail_unless (g_strcmp0 (expected.addr, got.addr) == 0);
+    fail_unless_equals_int (expected.port, got.port);
+    fail_unless_equals_int (expected.priority, got.priority);
+    fail_unless_equals_int (expected.proto, got.proto);
+    fail_unless_equals_int (expected.type, got.type);
+    fail_unless_equals_int (expected.tcptype, got.tcptype);
+    fail_unless (g_strcmp0 (expected.raddr, got.raddr) == 0,
+        "raddr differs for '%s'", candidate);
+    fail_unless_equals_int (expected.rport, got.rport);
+  }
+
+  parsed_candidate_clear (&expected);
+  parsed_candidate_clear (&got);
+}
+
+static gchar *
+mutate_candidate (GRand * rand, const gchar * candidate)
+{
+  GString *str = g_string_new (candidate);
+  gint i, n = g_rand_int_range (rand, 0, 5);
+
+  for (i = 0; i < n; i++) {
+    gint op = g_rand_int_range (rand, 0, 10);
+    gint pos = g_rand_int_range (rand, 0, str->len + 1);
+
+    if (op < 4) {
+      g_string_insert (str, pos, fuzz_tokens[g_rand_int_range (rand, 0,
+                  G_N_ELEMENTS (fuzz_tokens))]);
+    } else if (op < 7) {
+      g_string_erase (str, pos, MIN (g_rand_int_range (rand, 1, 6),
+              str->len - pos));
+    } else {
+      g_string_truncate (str, pos);
+    }
+  }
+
+  return g_string_free (str, FALSE);
+}
+
 static void
 check_candidate (KmsIceCandidate * c, const gchar * mid, const gchar * addr,
     gint port, guint ipv, const gchar * stream_id, const gchar * foundation,
@@ -152,6 +403,86 @@ GST_START_TEST (test_expr)
 
 GST_END_TEST;
 
+GST_START_TEST (test_invalid_keeps_values)
+{
+  KmsIceCandidate *cand;
+
+  cand = kms_ice_candidate_new
+      ("candidate:1 1 TCP 1015022079 192.168.1.183 38907 typ host tcptype passive",
+      "test", 1, "8");
+  fail_if (cand == NULL);
+
+  /* Protocol, priority and port are valid, the type is not */
+  g_object_set (cand, "candidate",
+      "candidate:2 1 UDP 2013266431 10.0.0.1 9999 typ bogus", NULL);
+
+  check_candidate (cand, "test", "192.168.1.183", 38907, 4, "8", "1",
+      1015022079, KMS_ICE_PROTOCOL_TCP, KMS_ICE_CANDIDATE_TYPE_HOST,
+      KMS_ICE_TCP_CANDIDATE_TYPE_PASSIVE, NULL, -1);
+
+  g_object_unref (cand);
+}
+
+GST_END_TEST;
+
+GST_START_TEST (test_regex_equivalence)
+{
+  GRegex *regex = g_regex_new (CANDIDATE_EXPR, 0, 0, NULL);
+  GRand *rand = g_rand_new_with_seed (1);
+  guint i;
+
+  for (i = 0; i < G_N_ELEMENTS (corpus); i++) {
+    check_same_parsing (regex, corpus[i]);
+  }
+
+  /* Random edits of the well-formed candidates */
+  for (i = 0; i < FUZZ_ITERATIONS; i++) {
+    gchar *candidate = mutate_candidate (rand,
+        corpus[g_rand_int_range (rand, 0, 10)]);
+
+    check_same_parsing (regex, candidate);
+    g_free (candidate);
+  }
+
+  g_rand_free (rand);
+  g_regex_unref (regex);
+}
+
+GST_END_TEST;
+
+GST_START_TEST (bench_parsing)
+{
+  GRegex *regex;
+  ParsedCandidate p;
+  gint64 start, regex_time, tokenizer_time;
+  guint i;
+
+  /* Regex compiled per candidate, as the previous implementation did */
+  start = g_get_monotonic_time ();
+  for (i = 0; i < BENCH_ITERATIONS; i++) {
+    regex = g_regex_new (CANDIDATE_EXPR, 0, 0, NULL);
+    parse_with_regex (regex, corpus[i % 10], &p);
+    parsed_candidate_clear (&p);
+    g_regex_unref (regex);
+  }
+  regex_time = g_get_monotonic_time () - start;
+
+  start = g_get_monotonic_time ();
+  for (i = 0; i < BENCH_ITERATIONS; i++) {
+    KmsIceCandidate *c = kms_ice_candidate_new (corpus[i % 10], "test", 0, "0");
+
+    g_object_unref (c);
+  }
+  tokenizer_time = g_get_monotonic_time () - start;
+
+  GST_INFO ("Regex: %.0f candidates/s", BENCH_ITERATIONS *
+      (gdouble) G_USEC_PER_SEC / MAX (regex_time, 1));
+  GST_INFO ("Tokenizer: %.0f candidates/s", BENCH_ITERATIONS *
+      (gdouble) G_USEC_PER_SEC / MAX (tokenizer_time, 1));
+}
+
+GST_END_TEST;
+
 static Suite *
 ice_candidates_suite (void)
 {
@@ -160,6 +491,9 @@ ice_candidates_suite (void)
 
   suite_add_tcase (s, tc_chain);
   tcase_add_test (tc_chain, test_expr);
+  tcase_add_test (tc_chain, test_invalid_keeps_values);
+  tcase_add_test (tc_chain, test_regex_equivalence);
+  tcase_add_test (tc_chain, bench_parsing);
 
   return s;
 }
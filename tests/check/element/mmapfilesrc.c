@@ -0,0 +1,232 @@
+/*
+ * (C) Copyright 2016 Kurento (http://kurento.org/)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+#include <gst/check/gstcheck.h>
+#include <gst/gst.h>
+#include <glib/gstdio.h>
+#include <string.h>
+
+#define LOCATION_FORMAT "/tmp/check_mmap_file_src_%u.dat"
+#define DATA_SIZE (1024 * 1024 + 17)
+#define N_FILES 100
+#define BLOCK_SIZE (64 * 1024)
+
+static gchar *
+create_file (guint index, guint8 ** data)
+{
+  gchar *location = g_strdup_printf (LOCATION_FORMAT, index);
+  guint8 *contents = g_malloc (DATA_SIZE);
+  gsize i;
+
+  for (i = 0; i < DATA_SIZE; i++) {
+    contents[i] = g_random_int_range (0, 256);
+  }
+
+  fail_unless (g_file_set_contents (location, (gchar *) contents, DATA_SIZE,
+          NULL));
+
+  if (data != NULL) {
+    *data = contents;
+  } else {
+    g_free (contents);
+  }
+
+  return location;
+}
+
+static void
+check_buffer (GstElement * sink, GstBuffer * buffer, GstPad * pad,
+    gpointer data)
+{
+  guint64 offset = GST_BUFFER_OFFSET (buffer);
+  GstMapInfo info;
+
+  fail_unless (gst_buffer_map (buffer, &info, GST_MAP_READ));
+  fail_unless (offset + info.size <= DATA_SIZE);
+  fail_unless (memcmp (info.data, (guint8 *) data + offset, info.size) == 0);
+  gst_buffer_unmap (buffer, &info);
+}
+
+static GstElement *
+create_pipeline (const gchar * factory, const gchar * location,
+    GstElement ** src, GstElement ** sink)
+{
+  GstElement *pipeline = gst_pipeline_new (NULL);
+
+  *src = gst_element_factory_make (factory, NULL);
+  *sink = gst_element_factory_make ("fakesink", NULL);
+
+  g_object_set (*src, "location", location, "blocksize", BLOCK_SIZE, NULL);
+  g_object_set (*sink, "sync", FALSE, NULL);
+
+  gst_bin_add_many (GST_BIN (pipeline), *src, *sink, NULL);
+  fail_unless (gst_element_link (*src, *sink));
+
+  return pipeline;
+}
+
+static void
+wait_eos (GstElement * pipeline)
+{
+  GstBus *bus = gst_pipeline_get_bus (GST_PIPELINE (pipeline));
+  GstMessage *msg;
+
+  msg = gst_bus_timed_pop_filtered (bus, 10 * GST_SECOND,
+      GST_MESSAGE_EOS | GST_MESSAGE_ERROR);
+  fail_unless (msg != NULL);
+  fail_unless (GST_MESSAGE_TYPE (msg) == GST_MESSAGE_EOS);
+
+  gst_message_unref (msg);
+  g_object_unref (bus);
+}
+
+/* Read system calls made by the process, -1 if they are not available */
+static gint64
+get_read_syscalls (void)
+{
+  gchar *contents, *line;
+  gint64 syscr = -1;
+
+  if (!g_file_get_contents ("/proc/self/io", &contents, NULL, NULL)) {
+    return -1;
+  }
+
+  line = strstr (contents, "syscr:");
+  if (line != NULL) {
+    syscr = g_ascii_strtoll (line + strlen ("syscr:"), NULL, 10);
+  }
+
+  g_free (contents);
+
+  return syscr;
+}
+
+GST_START_TEST (read_file)
+{
+  GstElement *pipeline, *src, *sink;
+  guint64 bytes, syscalls;
+  GstStructure *stats;
+  gchar *location;
+  guint8 *data;
+
+  location = create_file (0, &data);
+  pipeline = create_pipeline ("kmsmmapfilesrc", location, &src, &sink);
+
+  g_object_set (sink, "signal-handoffs", TRUE, NULL);
+  g_signal_connect (sink, "handoff", G_CALLBACK (check_buffer), data);
+
+  gst_element_set_state (pipeline, GST_STATE_PLAYING);
+  wait_eos (pipeline);
+
+  g_object_get (src, "stats", &stats, NULL);
+  GST_INFO ("Stats: %" GST_PTR_FORMAT, stats);
+  fail_unless (gst_structure_get_uint64 (stats, "bytes-read", &bytes));
+  fail_unless (gst_structure_get_uint64 (stats, "syscalls", &syscalls));
+  fail_unless_equals_uint64 (bytes, DATA_SIZE);
+  /* open, fstat, mmap, two advices, close and the readahead requests */
+  fail_unless (syscalls < DATA_SIZE / BLOCK_SIZE);
+  gst_structure_free (stats);
+
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+  gst_object_unref (pipeline);
+
+  g_remove (location);
+  g_free (location);
+  g_free (data);
+}
+
+GST_END_TEST;
+
+/* Reads every file at once with @factory, returns the read system calls */
+static gint64
+read_files (const gchar * factory, gchar ** locations)
+{
+  GstElement *pipelines[N_FILES];
+  gint64 start, elapsed, syscr;
+  guint i;
+
+  syscr = get_read_syscalls ();
+  start = g_get_monotonic_time ();
+
+  for (i = 0; i < N_FILES; i++) {
+    GstElement *src, *sink;
+
+    pipelines[i] = create_pipeline (factory, locations[i], &src, &sink);
+    gst_element_set_state (pipelines[i], GST_STATE_PLAYING);
+  }
+
+  for (i = 0; i < N_FILES; i++) {
+    wait_eos (pipelines[i]);
+  }
+
+  elapsed = g_get_monotonic_time () - start;
+  if (syscr >= 0) {
+    syscr = get_read_syscalls () - syscr;
+  }
+
+  for (i = 0; i < N_FILES; i++) {
+    gst_element_set_state (pipelines[i], GST_STATE_NULL);
+    gst_object_unref (pipelines[i]);
+  }
+
+  GST_INFO ("%s: %u files read in %" G_GINT64_FORMAT " ms (%.1f MB/s), %"
+      G_GINT64_FORMAT " read system calls", factory, N_FILES,
+      elapsed / 1000, (gdouble) N_FILES * DATA_SIZE / MAX (elapsed, 1),
+      syscr);
+
+  return syscr;
+}
+
+GST_START_TEST (read_many_files)
+{
+  gchar *locations[N_FILES];
+  gint64 filesrc, mmapfilesrc;
+  guint i;
+
+  for (i = 0; i < N_FILES; i++) {
+    locations[i] = create_file (i, NULL);
+  }
+
+  filesrc = read_files ("filesrc", locations);
+  mmapfilesrc = read_files ("kmsmmapfilesrc", locations);
+
+  if (filesrc >= 0 && mmapfilesrc >= 0) {
+    fail_unless (mmapfilesrc < filesrc);
+  }
+
+  for (i = 0; i < N_FILES; i++) {
+    g_remove (locations[i]);
+    g_free (locations[i]);
+  }
+}
+
+GST_END_TEST;
+
+static Suite *
+mmapfilesrc_suite (void)
+{
+  Suite *s = suite_create ("mmapfilesrc");
+  TCase *tc_chain = tcase_create ("element");
+
+  suite_add_tcase (s, tc_chain);
+
+  tcase_add_test (tc_chain, read_file);
+  tcase_add_test (tc_chain, read_many_files);
+
+  return s;
+}
+
+GST_CHECK_MAIN (mmapfilesrc);
@@ -0,0 +1,187 @@
+/*
+ * (C) Copyright 2016 Kurento (http://kurento.org/)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+#include <gst/check/gstcheck.h>
+#include <gst/gst.h>
+#include <gst/rtp/gstrtpbuffer.h>
+
+#include "kmsnetworkcache.h"
+
+#define MIN_LATENCY 100
+#define MAX_LATENCY 2000
+
+#define CLOCK_RATE 90000
+#define PACKET_INTERVAL (20 * G_TIME_SPAN_MILLISECOND)
+#define RTP_INTERVAL (CLOCK_RATE / 50)
+
+/* The cache is updated once a second */
+#define UPDATE_PACKETS 50
+
+#define JITTER_MS 100
+#define LOSS_PERIOD 20
+
+/* Close to the wrap of the sequence numbers */
+#define BASE_SEQ 65000
+
+typedef struct _RtpStream
+{
+  GstPad *pad;
+  gint64 base;
+  guint count;
+} RtpStream;
+
+static GstPad *
+create_rtp_pad (void)
+{
+  GstPad *pad = gst_pad_new ("src", GST_PAD_SRC);
+  GstEvent *event;
+  GstCaps *caps;
+
+  fail_unless (gst_pad_set_active (pad, TRUE));
+
+  event = gst_event_new_stream_start (__FUNCTION__);
+  fail_unless (gst_pad_store_sticky_event (pad, event) == GST_FLOW_OK);
+  gst_event_unref (event);
+
+  caps = gst_caps_new_simple ("application/x-rtp", "clock-rate", G_TYPE_INT,
+      CLOCK_RATE, NULL);
+  event = gst_event_new_caps (caps);
+  fail_unless (gst_pad_store_sticky_event (pad, event) == GST_FLOW_OK);
+  gst_event_unref (event);
+  gst_caps_unref (caps);
+
+  return pad;
+}
+
+/* Packets are sent and arrive every 20 ms, so the last one of each call
+ * triggers an update. Every other packet is stamped @jitter_ms late and one
+ * in LOSS_PERIOD is lost when @loss is set. Returns whether the latency
+ * changed */
+static gboolean
+send_update_packets (KmsNetworkCache * cache, RtpStream * stream,
+    guint jitter_ms, gboolean loss)
+{
+  gboolean changed = FALSE;
+  guint i;
+
+  for (i = 0; i < UPDATE_PACKETS; i++) {
+    GstRTPBuffer rtp = GST_RTP_BUFFER_INIT;
+    guint n = ++stream->count;
+    GstBuffer *buffer;
+    guint32 rtptime;
+    guint latency;
+
+    /* Never the last packet of the call */
+    if (loss && n % LOSS_PERIOD == 1) {
+      continue;
+    }
+
+    rtptime = n * RTP_INTERVAL;
+    if (n % 2 == 1) {
+      rtptime += jitter_ms * (CLOCK_RATE / 1000);
+    }
+
+    buffer = gst_rtp_buffer_new_allocate (0, 0, 0);
+    fail_unless (gst_rtp_buffer_map (buffer, GST_MAP_WRITE, &rtp));
+    gst_rtp_buffer_set_payload_type (&rtp, 96);
+    gst_rtp_buffer_set_seq (&rtp, (guint16) (BASE_SEQ + n));
+    gst_rtp_buffer_set_timestamp (&rtp, rtptime);
+    gst_rtp_buffer_unmap (&rtp);
+
+    if (kms_network_cache_add_packet_at (cache, stream->pad, buffer,
+            stream->base + n * PACKET_INTERVAL, &latency)) {
+      fail_unless (latency >= MIN_LATENCY);
+      fail_unless (latency <= MAX_LATENCY);
+      changed = TRUE;
+    }
+
+    gst_buffer_unref (buffer);
+  }
+
+  return changed;
+}
+
+GST_START_TEST (check_network_cache_adapts)
+{
+  KmsNetworkCache *cache = kms_network_cache_new (MIN_LATENCY, MAX_LATENCY);
+  guint latency, previous, i;
+  RtpStream stream;
+
+  stream.pad = create_rtp_pad ();
+  stream.count = 0;
+
+  kms_network_cache_start (cache);
+  stream.base = g_get_monotonic_time ();
+
+  fail_unless_equals_int (kms_network_cache_get_latency (cache), MIN_LATENCY);
+
+  /* Jitter and loss grow the cache from the first update */
+  fail_unless (send_update_packets (cache, &stream, JITTER_MS, TRUE));
+  latency = kms_network_cache_get_latency (cache);
+  GST_INFO ("Latency after the first update: %u ms", latency);
+  fail_unless (latency > MIN_LATENCY);
+
+  /* Up to network-cache and no further */
+  for (i = 0; i < 30 && latency < MAX_LATENCY; i++) {
+    previous = latency;
+    send_update_packets (cache, &stream, JITTER_MS, TRUE);
+    latency = kms_network_cache_get_latency (cache);
+    fail_unless (latency >= previous);
+  }
+
+  GST_INFO ("Latency clamped after %u updates", i + 1);
+  fail_unless_equals_int (latency, MAX_LATENCY);
+
+  fail_if (send_update_packets (cache, &stream, JITTER_MS, TRUE));
+  fail_unless_equals_int (kms_network_cache_get_latency (cache), MAX_LATENCY);
+
+  /* A steady network shrinks it, but only after five updates */
+  for (i = 0; i < 5; i++) {
+    fail_if (send_update_packets (cache, &stream, 0, FALSE));
+    fail_unless_equals_int (kms_network_cache_get_latency (cache),
+        MAX_LATENCY);
+  }
+
+  fail_unless (send_update_packets (cache, &stream, 0, FALSE));
+  latency = kms_network_cache_get_latency (cache);
+  GST_INFO ("Latency after shrinking: %u ms", latency);
+  fail_unless (latency < MAX_LATENCY);
+  fail_unless (latency >= MAX_LATENCY * 8 / 10);
+
+  kms_network_cache_stop (cache);
+  kms_network_cache_free (cache);
+  gst_object_unref (stream.pad);
+}
+
+GST_END_TEST;
+
+/*
+ * End of test cases
+ */
+static Suite *
+networkcache_suite (void)
+{
+  Suite *s = suite_create ("networkcache");
+  TCase *tc_chain = tcase_create ("element");
+
+  suite_add_tcase (s, tc_chain);
+
+  tcase_add_test (tc_chain, check_network_cache_adapts);
+
+  return s;
+}
+
+GST_CHECK_MAIN (networkcache);
@@ -20,7 +20,9 @@
 
 #include <gst/check/gstcheck.h>
 #include <gst/gst.h>
+#include <sys/resource.h>
 #include <commons/kmsuriendpointstate.h>
+#include <looppool/kmslooppool.h>
 
 #include <kmstestutils.h>
 
@@ -467,6 +469,954 @@ GST_START_TEST (check_eos)
 
 GST_END_TEST
 
+#define N_PLAYERS 64
+
+GST_START_TEST (check_shared_housekeeping_loops)
+{
+  GstElement *players[N_PLAYERS];
+  GstStructure *stats, *loops;
+  guint i, size, users = 0;
+
+  for (i = 0; i < N_PLAYERS; i++) {
+    players[i] = gst_element_factory_make ("playerendpoint", NULL);
+  }
+
+  g_signal_emit_by_name (players[0], "stats", NULL, &stats);
+  fail_unless (stats != NULL);
+
+  fail_unless (gst_structure_get (stats, KMS_LOOP_POOL_STATISTICS_FIELD,
+          GST_TYPE_STRUCTURE, &loops, NULL));
+  fail_unless (gst_structure_get_uint (loops, "size", &size));
+
+  /* Thread count is bounded by the pool, not by the number of players */
+  fail_unless (gst_structure_n_fields (loops) <= size + 1);
+
+  for (i = 0; i < size; i++) {
+    GstStructure *loop_stats;
+    gchar *name;
+    guint loop_users;
+
+    name = g_strdup_printf ("loop-%u", i);
+
+    if (gst_structure_get (loops, name, GST_TYPE_STRUCTURE, &loop_stats, NULL)) {
+      fail_unless (gst_structure_get_uint (loop_stats, "users", &loop_users));
+      users += loop_users;
+      gst_structure_free (loop_stats);
+    }
+
+    g_free (name);
+  }
+
+  fail_unless (users == N_PLAYERS);
+
+  gst_structure_free (loops);
+  gst_structure_free (stats);
+
+  for (i = 0; i < N_PLAYERS; i++) {
+    g_object_unref (players[i]);
+  }
+}
+
+GST_END_TEST;
+
+static void
+count_buffer (GstElement * object, GstBuffer * buffer, GstPad * pad,
+    gpointer user_data)
+{
+  g_atomic_int_inc ((gint *) user_data);
+}
+
+static void
+connect_counting_sink (GstElement * playerep, GstPad * new_pad,
+    gpointer user_data)
+{
+  GstElement *sink, *pipe;
+  GstPad *sinkpad;
+
+  pipe = GST_ELEMENT (GST_OBJECT_PARENT (playerep));
+
+  sink = gst_element_factory_make ("fakesink", NULL);
+  g_object_set (G_OBJECT (sink), "async", FALSE, "sync", FALSE,
+      "signal-handoffs", TRUE, NULL);
+  g_signal_connect (sink, "handoff", G_CALLBACK (count_buffer), user_data);
+
+  gst_bin_add (GST_BIN (pipe), sink);
+
+  sinkpad = gst_element_get_static_pad (sink, "sink");
+  fail_if (gst_pad_link (new_pad, sinkpad) != GST_PAD_LINK_OK);
+  g_object_unref (sinkpad);
+
+  gst_element_sync_state_with_parent (sink);
+}
+
+#define N_SHARED_PLAYERS 2
+
+typedef struct _SharedPlayer
+{
+  GstElement *player;
+  gint buffers;
+  GstClockTime last_pts;
+  gboolean eos;
+} SharedPlayer;
+
+static SharedPlayer shared_players[N_SHARED_PLAYERS];
+
+/* Every player starts at a key frame and its timestamps never go back */
+static void
+shared_player_handoff (GstElement * sink, GstBuffer * buffer, GstPad * pad,
+    SharedPlayer * shared)
+{
+  G_LOCK (handoff_lock);
+
+  if (shared->buffers == 0) {
+    fail_if (GST_BUFFER_FLAG_IS_SET (buffer, GST_BUFFER_FLAG_DELTA_UNIT),
+        "First buffer of %s is not a key frame",
+        GST_ELEMENT_NAME (shared->player));
+  }
+
+  if (GST_BUFFER_PTS_IS_VALID (buffer)) {
+    fail_unless (shared->buffers == 0 ||
+        GST_BUFFER_PTS (buffer) > shared->last_pts,
+        "%s: PTS %" GST_TIME_FORMAT " after %" GST_TIME_FORMAT,
+        GST_ELEMENT_NAME (shared->player),
+        GST_TIME_ARGS (GST_BUFFER_PTS (buffer)),
+        GST_TIME_ARGS (shared->last_pts));
+    shared->last_pts = GST_BUFFER_PTS (buffer);
+  }
+
+  shared->buffers++;
+
+  G_UNLOCK (handoff_lock);
+}
+
+static void
+connect_shared_sink (GstElement * playerep, GstPad * new_pad,
+    SharedPlayer * shared)
+{
+  GstElement *sink;
+  GstPad *sinkpad;
+
+  sink = gst_element_factory_make ("fakesink", NULL);
+  g_object_set (G_OBJECT (sink), "async", FALSE, "sync", FALSE,
+      "signal-handoffs", TRUE, NULL);
+  g_signal_connect (sink, "handoff", G_CALLBACK (shared_player_handoff),
+      shared);
+
+  gst_bin_add (GST_BIN (pipeline), sink);
+
+  sinkpad = gst_element_get_static_pad (sink, "sink");
+  fail_if (gst_pad_link (new_pad, sinkpad) != GST_PAD_LINK_OK);
+  g_object_unref (sinkpad);
+
+  gst_element_sync_state_with_parent (sink);
+}
+
+static gint
+get_shared_buffers (SharedPlayer * shared)
+{
+  gint buffers;
+
+  G_LOCK (handoff_lock);
+  buffers = shared->buffers;
+  G_UNLOCK (handoff_lock);
+
+  return buffers;
+}
+
+static void
+shared_player_eos (GstElement * player, SharedPlayer * shared)
+{
+  guint i;
+
+  GST_DEBUG_OBJECT (player, "Eos received");
+  shared->eos = TRUE;
+
+  for (i = 0; i < N_SHARED_PLAYERS; i++) {
+    if (!shared_players[i].eos) {
+      return;
+    }
+  }
+
+  g_idle_add (quit_main_loop_idle, loop);
+}
+
+/* Encoded media, so late players have to wait for a key frame */
+static void
+create_shared_players (void)
+{
+  guint i;
+
+  loop = g_main_loop_new (NULL, FALSE);
+  pipeline = gst_pipeline_new (__FUNCTION__);
+
+  for (i = 0; i < N_SHARED_PLAYERS; i++) {
+    SharedPlayer *shared = &shared_players[i];
+    gchar *padname;
+
+    shared->buffers = 0;
+    shared->last_pts = GST_CLOCK_TIME_NONE;
+    shared->eos = FALSE;
+    shared->player = gst_element_factory_make ("playerendpoint", NULL);
+    g_object_set (G_OBJECT (shared->player), "uri", VIDEO_PATH2,
+        "use-encoded-media", TRUE, "shared-decode", TRUE, NULL);
+    g_signal_connect (shared->player, "pad-added",
+        G_CALLBACK (connect_shared_sink), shared);
+    g_signal_connect (shared->player, "eos", G_CALLBACK (shared_player_eos),
+        shared);
+
+    gst_bin_add (GST_BIN (pipeline), shared->player);
+
+    g_signal_emit_by_name (shared->player, "request-new-pad",
+        KMS_ELEMENT_PAD_TYPE_VIDEO, NULL, GST_PAD_SRC, &padname);
+    fail_if (padname == NULL);
+    g_free (padname);
+  }
+
+  gst_element_set_state (pipeline, GST_STATE_PLAYING);
+}
+
+static void
+destroy_shared_players (void)
+{
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+  gst_object_unref (GST_OBJECT (pipeline));
+  g_main_loop_unref (loop);
+}
+
+static gboolean
+start_late_player (gpointer data)
+{
+  GST_DEBUG ("Starting late player");
+  g_object_set (G_OBJECT (data), "state", KMS_URI_ENDPOINT_STATE_START, NULL);
+
+  return G_SOURCE_REMOVE;
+}
+
+/* Second player joins the decode of the first one while it is playing */
+GST_START_TEST (check_shared_decode)
+{
+  guint i;
+
+  create_shared_players ();
+
+  g_object_set (G_OBJECT (shared_players[0].player), "state",
+      KMS_URI_ENDPOINT_STATE_START, NULL);
+  g_timeout_add_seconds (1, start_late_player, shared_players[1].player);
+
+  g_main_loop_run (loop);
+
+  for (i = 0; i < N_SHARED_PLAYERS; i++) {
+    GST_INFO ("Player %u got %d buffers", i, shared_players[i].buffers);
+    fail_unless (get_shared_buffers (&shared_players[i]) > 0);
+  }
+
+  /* Late player has missed the beginning */
+  fail_unless (shared_players[1].buffers < shared_players[0].buffers);
+
+  destroy_shared_players ();
+}
+
+GST_END_TEST;
+
+static gint buffers_at_stop;
+
+static gboolean
+check_shared_player_goes_on (gpointer data)
+{
+  gint buffers = get_shared_buffers (&shared_players[1]);
+
+  GST_DEBUG ("Remaining player got %d buffers after the stop",
+      buffers - buffers_at_stop);
+  fail_unless (buffers > buffers_at_stop);
+  fail_if (shared_players[1].eos);
+
+  g_main_loop_quit (loop);
+
+  return G_SOURCE_REMOVE;
+}
+
+static gboolean
+stop_first_shared_player (gpointer data)
+{
+  GST_DEBUG ("Stopping first player");
+  g_object_set (G_OBJECT (shared_players[0].player), "state",
+      KMS_URI_ENDPOINT_STATE_STOP, NULL);
+  buffers_at_stop = get_shared_buffers (&shared_players[1]);
+
+  g_timeout_add_seconds (1, check_shared_player_goes_on, NULL);
+
+  return G_SOURCE_REMOVE;
+}
+
+/* A player leaves the shared decode while the other one keeps playing */
+GST_START_TEST (check_shared_decode_stop_one)
+{
+  guint i;
+
+  create_shared_players ();
+
+  for (i = 0; i < N_SHARED_PLAYERS; i++) {
+    g_object_set (G_OBJECT (shared_players[i].player), "state",
+        KMS_URI_ENDPOINT_STATE_START, NULL);
+  }
+
+  g_timeout_add_seconds (1, stop_first_shared_player, NULL);
+
+  g_main_loop_run (loop);
+
+  fail_unless (get_shared_buffers (&shared_players[0]) > 0);
+
+  destroy_shared_players ();
+}
+
+GST_END_TEST;
+
+#define LIST_SIZE 8
+#define LIST_BUFFERS (10 * LIST_SIZE)
+#define LIST_TIMEOUT 10         /* seconds */
+
+typedef struct _BufferListData
+{
+  GMutex mutex;
+  GstBufferList *pending;
+  GArray *pts;                  /* Original PTS of the buffers in lists */
+  guint received;
+  GstClockTimeDiff offset;
+  GstClockTime last;
+  gint64 deadline;
+} BufferListData;
+
+static gboolean
+pad_has_video_caps (GstPad * pad)
+{
+  gboolean video = FALSE;
+  GstCaps *caps;
+
+  caps = gst_pad_get_current_caps (pad);
+
+  if (caps != NULL) {
+    video = g_str_has_prefix (gst_structure_get_name
+        (gst_caps_get_structure (caps, 0)), "video/");
+    gst_caps_unref (caps);
+  }
+
+  return video;
+}
+
+static gboolean
+element_is (GstElement * element, const gchar * factory_name)
+{
+  GstElementFactory *factory = gst_element_get_factory (element);
+
+  return factory != NULL && g_strcmp0 (gst_plugin_feature_get_name
+      (GST_PLUGIN_FEATURE (factory)), factory_name) == 0;
+}
+
+/* Video reaches the appsink of the player in lists */
+static GstPadProbeReturn
+group_buffers_probe (GstPad * pad, GstPadProbeInfo * info, gpointer user_data)
+{
+  BufferListData *data = user_data;
+  GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER (info);
+  GstBufferList *list = NULL;
+  GstClockTime pts;
+  guint i;
+
+  if (!pad_has_video_caps (pad)) {
+    return GST_PAD_PROBE_OK;
+  }
+
+  g_mutex_lock (&data->mutex);
+
+  if (data->pts->len == LIST_BUFFERS) {
+    g_mutex_unlock (&data->mutex);
+    return GST_PAD_PROBE_DROP;
+  }
+
+  gst_buffer_list_add (data->pending, gst_buffer_ref (buffer));
+
+  if (gst_buffer_list_length (data->pending) == LIST_SIZE) {
+    list = data->pending;
+    data->pending = gst_buffer_list_new ();
+
+    for (i = 0; i < LIST_SIZE; i++) {
+      pts = GST_BUFFER_PTS (gst_buffer_list_get (list, i));
+      g_array_append_val (data->pts, pts);
+    }
+  }
+
+  g_mutex_unlock (&data->mutex);
+
+  if (list != NULL) {
+    gst_pad_chain_list (pad, list);
+  }
+
+  return GST_PAD_PROBE_DROP;
+}
+
+/* Every buffer of the lists leaves the player moved to its time line */
+static GstPadProbeReturn
+check_retimestamp_probe (GstPad * pad, GstPadProbeInfo * info,
+    gpointer user_data)
+{
+  BufferListData *data = user_data;
+  GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER (info);
+  GstClockTimeDiff offset;
+  GstClockTime pts;
+
+  if (!pad_has_video_caps (pad)) {
+    return GST_PAD_PROBE_OK;
+  }
+
+  g_mutex_lock (&data->mutex);
+
+  fail_unless (data->received < data->pts->len,
+      "Buffer %" GST_PTR_FORMAT " was not pushed in a list", buffer);
+  pts = g_array_index (data->pts, GstClockTime, data->received);
+  offset = GST_CLOCK_DIFF (pts, GST_BUFFER_PTS (buffer));
+
+  if (data->received > 0) {
+    fail_unless (GST_BUFFER_PTS (buffer) > data->last);
+  }
+
+  /* Base time is set again when playing after the preroll buffer */
+  if (data->received == 1) {
+    data->offset = offset;
+  } else if (data->received > 1) {
+    fail_unless (offset == data->offset, "Buffer %u moved %" G_GINT64_FORMAT
+        " instead of %" G_GINT64_FORMAT, data->received, offset, data->offset);
+  }
+
+  data->last = GST_BUFFER_PTS (buffer);
+  data->received++;
+
+  g_mutex_unlock (&data->mutex);
+
+  return GST_PAD_PROBE_OK;
+}
+
+static void
+internal_element_added (GstBin * bin, GstElement * element, gpointer data)
+{
+  GstPad *sinkpad;
+
+  if (!element_is (element, "appsink")) {
+    return;
+  }
+
+  sinkpad = gst_element_get_static_pad (element, "sink");
+  gst_pad_add_probe (sinkpad, GST_PAD_PROBE_TYPE_BUFFER, group_buffers_probe,
+      data, NULL);
+  g_object_unref (sinkpad);
+}
+
+static void
+player_element_added (GstBin * bin, GstElement * element, gpointer data)
+{
+  GstPad *srcpad;
+
+  if (!element_is (element, "appsrc")) {
+    return;
+  }
+
+  srcpad = gst_element_get_static_pad (element, "src");
+  gst_pad_add_probe (srcpad, GST_PAD_PROBE_TYPE_BUFFER,
+      check_retimestamp_probe, data, NULL);
+  g_object_unref (srcpad);
+}
+
+static gboolean
+check_lists_received (gpointer user_data)
+{
+  BufferListData *data = user_data;
+  gboolean done;
+
+  g_mutex_lock (&data->mutex);
+  done = data->received == LIST_BUFFERS;
+  g_mutex_unlock (&data->mutex);
+
+  if (done || g_get_monotonic_time () > data->deadline) {
+    g_main_loop_quit (loop);
+    return G_SOURCE_REMOVE;
+  }
+
+  return G_SOURCE_CONTINUE;
+}
+
+GST_START_TEST (check_buffer_list)
+{
+  BufferListData data = { 0 };
+  GstElement *internal;
+  gint buffers = 0;
+  gchar *padname;
+
+  g_mutex_init (&data.mutex);
+  data.pending = gst_buffer_list_new ();
+  data.pts = g_array_new (FALSE, FALSE, sizeof (GstClockTime));
+
+  loop = g_main_loop_new (NULL, FALSE);
+  pipeline = gst_pipeline_new (__FUNCTION__);
+  player = gst_element_factory_make ("playerendpoint", NULL);
+  g_object_set (G_OBJECT (player), "uri", VIDEO_PATH, NULL);
+
+  g_object_get (G_OBJECT (player), "pipeline", &internal, NULL);
+  g_signal_connect (internal, "element-added",
+      G_CALLBACK (internal_element_added), &data);
+  g_object_unref (internal);
+
+  g_signal_connect (player, "element-added",
+      G_CALLBACK (player_element_added), &data);
+  g_signal_connect (player, "pad-added", G_CALLBACK (connect_counting_sink),
+      &buffers);
+
+  gst_bin_add (GST_BIN (pipeline), player);
+
+  g_signal_emit_by_name (player, "request-new-pad",
+      KMS_ELEMENT_PAD_TYPE_VIDEO, NULL, GST_PAD_SRC, &padname);
+  fail_if (padname == NULL);
+  g_free (padname);
+
+  gst_element_set_state (pipeline, GST_STATE_PLAYING);
+  change_state (KMS_URI_ENDPOINT_STATE_START);
+
+  data.deadline = g_get_monotonic_time () + LIST_TIMEOUT * G_TIME_SPAN_SECOND;
+  g_timeout_add (100, check_lists_received, &data);
+
+  g_main_loop_run (loop);
+
+  GST_INFO ("%u buffers pushed in lists, %u received", data.pts->len,
+      data.received);
+  fail_unless (data.received == LIST_BUFFERS);
+  fail_unless (g_atomic_int_get (&buffers) > 0);
+
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+  gst_object_unref (GST_OBJECT (pipeline));
+  g_main_loop_unref (loop);
+
+  gst_buffer_list_unref (data.pending);
+  g_array_unref (data.pts);
+  g_mutex_clear (&data.mutex);
+}
+
+GST_END_TEST;
+
+#define SEEK_POSITION (2 * GST_SECOND)
+
+typedef struct _SeekLatency
+{
+  gint64 seek_time;
+  gint64 latency;
+  gint buffers;
+} SeekLatency;
+
+static void
+seek_latency_handoff (GstElement * object, GstBuffer * buffer, GstPad * pad,
+    SeekLatency * data)
+{
+  gboolean first = FALSE;
+
+  G_LOCK (handoff_lock);
+
+  data->buffers++;
+
+  if (data->seek_time != 0 && data->latency == 0) {
+    data->latency = g_get_monotonic_time () - data->seek_time;
+    first = TRUE;
+  }
+
+  G_UNLOCK (handoff_lock);
+
+  if (first) {
+    g_idle_add (quit_main_loop_idle, loop);
+  }
+}
+
+static void
+connect_seek_latency_sink (GstElement * playerep, GstPad * new_pad,
+    SeekLatency * data)
+{
+  GstElement *sink, *pipe;
+  GstPad *sinkpad;
+
+  pipe = GST_ELEMENT (GST_OBJECT_PARENT (playerep));
+
+  sink = gst_element_factory_make ("fakesink", NULL);
+  g_object_set (G_OBJECT (sink), "async", FALSE, "sync", FALSE,
+      "signal-handoffs", TRUE, NULL);
+  g_signal_connect (sink, "handoff", G_CALLBACK (seek_latency_handoff), data);
+
+  gst_bin_add (GST_BIN (pipe), sink);
+
+  sinkpad = gst_element_get_static_pad (sink, "sink");
+  fail_if (gst_pad_link (new_pad, sinkpad) != GST_PAD_LINK_OK);
+  g_object_unref (sinkpad);
+
+  gst_element_sync_state_with_parent (sink);
+}
+
+static gboolean
+seek_to_middle (gpointer user_data)
+{
+  SeekLatency *data = user_data;
+  gboolean ret;
+
+  G_LOCK (handoff_lock);
+  data->seek_time = g_get_monotonic_time ();
+  G_UNLOCK (handoff_lock);
+
+  g_signal_emit_by_name (player, "set-position", (gint64) SEEK_POSITION, &ret);
+  fail_unless (ret);
+
+  return G_SOURCE_REMOVE;
+}
+
+/* Microseconds from set-position to the next buffer out of the player */
+static gint64
+measure_seek_latency (gboolean seek_to_keyframe)
+{
+  SeekLatency data = { 0, 0, 0 };
+  guint bus_watch_id;
+  gulong eos_handler;
+  gchar *padname;
+  GstBus *bus;
+
+  loop = g_main_loop_new (NULL, FALSE);
+  pipeline = gst_pipeline_new (__FUNCTION__);
+  player = gst_element_factory_make ("playerendpoint", NULL);
+  bus = gst_pipeline_get_bus (GST_PIPELINE (pipeline));
+
+  bus_watch_id = gst_bus_add_watch (bus, gst_bus_async_signal_func, NULL);
+  g_signal_connect (bus, "message", G_CALLBACK (bus_msg), pipeline);
+  g_object_unref (bus);
+
+  g_object_set (G_OBJECT (player), "uri", VIDEO_PATH3, "seek-to-keyframe",
+      seek_to_keyframe, NULL);
+  g_signal_connect (player, "pad-added",
+      G_CALLBACK (connect_seek_latency_sink), &data);
+
+  gst_bin_add (GST_BIN (pipeline), player);
+
+  g_signal_emit_by_name (player, "request-new-pad",
+      KMS_ELEMENT_PAD_TYPE_VIDEO, NULL, GST_PAD_SRC, &padname);
+  fail_if (padname == NULL);
+  g_free (padname);
+
+  gst_element_set_state (pipeline, GST_STATE_PLAYING);
+
+  if (seek_to_keyframe) {
+    /* Key frames are indexed while the file is played to its end */
+    eos_handler = g_signal_connect (G_OBJECT (player), "eos",
+        G_CALLBACK (player_eos), loop);
+    change_state (KMS_URI_ENDPOINT_STATE_START);
+    g_main_loop_run (loop);
+    g_signal_handler_disconnect (player, eos_handler);
+  }
+
+  change_state (KMS_URI_ENDPOINT_STATE_START);
+  g_timeout_add (500, seek_to_middle, &data);
+  g_main_loop_run (loop);
+
+  fail_unless (data.buffers > 0);
+
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+  gst_object_unref (GST_OBJECT (pipeline));
+  g_source_remove (bus_watch_id);
+  g_main_loop_unref (loop);
+
+  return data.latency;
+}
+
+GST_START_TEST (check_seek_to_keyframe_latency)
+{
+  gint64 accurate, keyframe;
+
+  accurate = measure_seek_latency (FALSE);
+  keyframe = measure_seek_latency (TRUE);
+
+  GST_INFO ("Seek latency: accurate %" G_GINT64_FORMAT " us, to key frame %"
+      G_GINT64_FORMAT " us", accurate, keyframe);
+
+  fail_unless (accurate > 0);
+  fail_unless (keyframe > 0);
+}
+
+GST_END_TEST;
+
+#define PASSTHROUGH_BUFFERS 10
+#define PASSTHROUGH_TIMEOUT 20  /* seconds */
+
+typedef enum
+{
+  PASSTHROUGH_PLAYING,
+  PASSTHROUGH_PAUSED,
+  PASSTHROUGH_RESUMED,
+  PASSTHROUGH_SEEKED,
+  PASSTHROUGH_RESTARTED
+} PassthroughPhase;
+
+typedef struct _PassthroughData
+{
+  GMutex mutex;
+  PassthroughPhase phase;
+  GstClockTime last;
+  guint buffers;
+  guint phase_start;
+  gboolean eos;
+  gint64 deadline;
+} PassthroughData;
+
+/* Running time seen downstream of the bridge never goes back */
+static void
+check_running_time_handoff (GstElement * sink, GstBuffer * buffer,
+    GstPad * pad, PassthroughData * data)
+{
+  GstClockTime running_time;
+  const GstSegment *segment;
+  GstEvent *event;
+
+  event = gst_pad_get_sticky_event (pad, GST_EVENT_SEGMENT, 0);
+  fail_unless (event != NULL);
+  gst_event_parse_segment (event, &segment);
+  running_time = gst_segment_to_running_time (segment, GST_FORMAT_TIME,
+      GST_BUFFER_PTS (buffer));
+  gst_event_unref (event);
+
+  fail_unless (GST_CLOCK_TIME_IS_VALID (running_time));
+
+  g_mutex_lock (&data->mutex);
+
+  if (data->buffers > 0) {
+    fail_unless (running_time > data->last, "Running time %" GST_TIME_FORMAT
+        " after %" GST_TIME_FORMAT " in phase %d", GST_TIME_ARGS (running_time),
+        GST_TIME_ARGS (data->last), data->phase);
+  }
+
+  data->last = running_time;
+  data->buffers++;
+
+  g_mutex_unlock (&data->mutex);
+}
+
+static void
+connect_running_time_sink (GstElement * playerep, GstPad * new_pad,
+    PassthroughData * data)
+{
+  GstElement *sink;
+  GstPad *sinkpad;
+
+  sink = gst_element_factory_make ("fakesink", NULL);
+  g_object_set (G_OBJECT (sink), "async", FALSE, "sync", FALSE,
+      "signal-handoffs", TRUE, NULL);
+  g_signal_connect (sink, "handoff", G_CALLBACK (check_running_time_handoff),
+      data);
+
+  gst_bin_add (GST_BIN (pipeline), sink);
+
+  sinkpad = gst_element_get_static_pad (sink, "sink");
+  fail_if (gst_pad_link (new_pad, sinkpad) != GST_PAD_LINK_OK);
+  g_object_unref (sinkpad);
+
+  gst_element_sync_state_with_parent (sink);
+}
+
+static void
+passthrough_player_eos (GstElement * player, PassthroughData * data)
+{
+  GST_DEBUG ("Eos received");
+
+  g_mutex_lock (&data->mutex);
+  data->eos = TRUE;
+  g_mutex_unlock (&data->mutex);
+}
+
+/* Goes to the next phase once the current one has pushed enough buffers
+ * through the bridge */
+static gboolean
+passthrough_next_phase (gpointer user_data)
+{
+  PassthroughData *data = user_data;
+  gboolean done, ret;
+
+  fail_unless (g_get_monotonic_time () < data->deadline,
+      "Timed out in phase %d", data->phase);
+
+  g_mutex_lock (&data->mutex);
+
+  switch (data->phase) {
+    case PASSTHROUGH_PAUSED:
+      /* Prerolled buffer */
+      done = data->buffers > data->phase_start;
+      break;
+    case PASSTHROUGH_SEEKED:
+      done = data->eos;
+      break;
+    default:
+      done = data->buffers >= data->phase_start + PASSTHROUGH_BUFFERS;
+      break;
+  }
+
+  if (done) {
+    data->phase++;
+    data->phase_start = data->buffers;
+  }
+
+  g_mutex_unlock (&data->mutex);
+
+  if (!done) {
+    return G_SOURCE_CONTINUE;
+  }
+
+  GST_DEBUG ("Phase %d after %u buffers", data->phase, data->phase_start);
+
+  switch (data->phase) {
+    case PASSTHROUGH_PAUSED:
+      /* Base time is reset by the preroll */
+      change_state (KMS_URI_ENDPOINT_STATE_PAUSE);
+      break;
+    case PASSTHROUGH_RESUMED:
+      change_state (KMS_URI_ENDPOINT_STATE_START);
+      break;
+    case PASSTHROUGH_SEEKED:
+      /* Flushes the private pipeline only */
+      g_signal_emit_by_name (player, "set-position", (gint64) SEEK_POSITION,
+          &ret);
+      fail_unless (ret);
+      break;
+    case PASSTHROUGH_RESTARTED:
+      /* Bridge is flushed after the EOS to play again */
+      change_state (KMS_URI_ENDPOINT_STATE_STOP);
+      change_state (KMS_URI_ENDPOINT_STATE_START);
+      break;
+    default:
+      g_main_loop_quit (loop);
+      return G_SOURCE_REMOVE;
+  }
+
+  return G_SOURCE_CONTINUE;
+}
+
+/* Buffers leaving a passthrough player keep their running time increasing
+ * when it is prerolled, resumed, flushed by a seek and played after EOS */
+GST_START_TEST (check_passthrough_running_time)
+{
+  PassthroughData data = { 0 };
+  guint bus_watch_id;
+  gchar *padname;
+  GstBus *bus;
+
+  g_mutex_init (&data.mutex);
+  data.phase = PASSTHROUGH_PLAYING;
+
+  loop = g_main_loop_new (NULL, FALSE);
+  pipeline = gst_pipeline_new (__FUNCTION__);
+  player = gst_element_factory_make ("playerendpoint", NULL);
+  bus = gst_pipeline_get_bus (GST_PIPELINE (pipeline));
+
+  bus_watch_id = gst_bus_add_watch (bus, gst_bus_async_signal_func, NULL);
+  g_signal_connect (bus, "message", G_CALLBACK (bus_msg), pipeline);
+  g_object_unref (bus);
+
+  g_object_set (G_OBJECT (player), "uri", VIDEO_PATH3, "use-encoded-media",
+      TRUE, "passthrough", TRUE, NULL);
+  g_signal_connect (player, "pad-added",
+      G_CALLBACK (connect_running_time_sink), &data);
+  g_signal_connect (player, "eos", G_CALLBACK (passthrough_player_eos),
+      &data);
+
+  gst_bin_add (GST_BIN (pipeline), player);
+
+  g_signal_emit_by_name (player, "request-new-pad",
+      KMS_ELEMENT_PAD_TYPE_VIDEO, NULL, GST_PAD_SRC, &padname);
+  fail_if (padname == NULL);
+  g_free (padname);
+
+  gst_element_set_state (pipeline, GST_STATE_PLAYING);
+  change_state (KMS_URI_ENDPOINT_STATE_START);
+
+  data.deadline = g_get_monotonic_time () +
+      PASSTHROUGH_TIMEOUT * G_TIME_SPAN_SECOND;
+  g_timeout_add (100, passthrough_next_phase, &data);
+
+  g_main_loop_run (loop);
+
+  GST_INFO ("%u buffers went through the bridge", data.buffers);
+
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+  gst_object_unref (GST_OBJECT (pipeline));
+  g_source_remove (bus_watch_id);
+  g_main_loop_unref (loop);
+  g_mutex_clear (&data.mutex);
+}
+
+GST_END_TEST;
+
+static void
+check_network_cache_stats (GstElement * player, GMainLoop * loop)
+{
+  GstStructure *stats, *cache;
+  gint64 startup_latency;
+  guint latency, stalls;
+
+  g_signal_emit_by_name (player, "stats", NULL, &stats);
+  fail_unless (stats != NULL);
+
+  fail_unless (gst_structure_get (stats, "network-cache", GST_TYPE_STRUCTURE,
+          &cache, NULL));
+  GST_INFO ("Network cache: %" GST_PTR_FORMAT, cache);
+
+  /* The file is downloaded over HTTP, no RTP is received so the latency is
+   * not adapted, only startup and stalls are measured. The controller itself
+   * is checked with synthetic RTP in the networkcache test */
+  fail_unless (gst_structure_get_uint (cache, "latency", &latency));
+  fail_unless (latency < 2000);
+  fail_unless (gst_structure_get_uint (cache, "stalls", &stalls));
+  fail_unless (stalls == 0);
+  fail_unless (gst_structure_get_int64 (cache, "startup-latency",
+          &startup_latency));
+  fail_unless (gst_structure_has_field (cache, "jitter"));
+  fail_unless (gst_structure_has_field (cache, "packet-loss"));
+  fail_unless (gst_structure_has_field (cache, "stall-frequency"));
+
+  gst_structure_free (cache);
+  gst_structure_free (stats);
+
+  g_idle_add (quit_main_loop_idle, loop);
+}
+
+GST_START_TEST (check_adaptive_network_cache)
+{
+  guint bus_watch_id;
+  GstBus *bus;
+
+  loop = g_main_loop_new (NULL, FALSE);
+  pipeline = gst_pipeline_new (__FUNCTION__);
+  player = gst_element_factory_make ("playerendpoint", NULL);
+  bus = gst_pipeline_get_bus (GST_PIPELINE (pipeline));
+
+  bus_watch_id = gst_bus_add_watch (bus, gst_bus_async_signal_func, NULL);
+  g_signal_connect (bus, "message", G_CALLBACK (bus_msg), pipeline);
+  g_object_unref (bus);
+
+  g_object_set (G_OBJECT (player), "uri", VIDEO_PATH3,
+      "adaptive-network-cache", TRUE, NULL);
+  g_signal_connect (G_OBJECT (player), "eos",
+      G_CALLBACK (check_network_cache_stats), loop);
+
+  gst_bin_add (GST_BIN (pipeline), player);
+
+  gst_element_set_state (pipeline, GST_STATE_PLAYING);
+  change_state (KMS_URI_ENDPOINT_STATE_START);
+
+  g_main_loop_run (loop);
+
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+  gst_object_unref (GST_OBJECT (pipeline));
+  g_source_remove (bus_watch_id);
+  g_main_loop_unref (loop);
+}
+
+GST_END_TEST;
+
 #ifdef ENABLE_EXPERIMENTAL_TESTS
 
 GST_START_TEST (check_set_encoded_media)
@@ -515,6 +1465,101 @@ GST_START_TEST (check_set_encoded_media)
 
 GST_END_TEST;
 
+#define BENCHMARK_PLAYERS 16
+#define BENCHMARK_DURATION 4    /* seconds */
+
+static gint64
+get_cpu_time (void)
+{
+  struct rusage usage;
+
+  getrusage (RUSAGE_SELF, &usage);
+
+  return (gint64) (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) *
+      G_USEC_PER_SEC + usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+}
+
+static gboolean
+quit_benchmark (gpointer data)
+{
+  g_main_loop_quit (data);
+
+  return G_SOURCE_REMOVE;
+}
+
+/* Plays the same encoded file in many players and returns how many of them
+ * one core can run. CPU time includes demuxing the files. */
+static gdouble
+get_encoded_players_per_core (gboolean passthrough)
+{
+  GMainLoop *loop = g_main_loop_new (NULL, FALSE);
+  GstElement *pipe, *players[BENCHMARK_PLAYERS];
+  gint64 wall_start, cpu_start, wall_time, cpu_time;
+  gint buffers = 0;
+  gdouble cores;
+  guint i;
+
+  pipe = gst_pipeline_new (__FUNCTION__);
+
+  for (i = 0; i < BENCHMARK_PLAYERS; i++) {
+    gchar *padname;
+
+    players[i] = gst_element_factory_make ("playerendpoint", NULL);
+    g_object_set (G_OBJECT (players[i]), "uri", VIDEO_PATH2,
+        "use-encoded-media", TRUE, "passthrough", passthrough, NULL);
+    g_signal_connect (players[i], "pad-added",
+        G_CALLBACK (connect_counting_sink), &buffers);
+
+    gst_bin_add (GST_BIN (pipe), players[i]);
+
+    g_signal_emit_by_name (players[i], "request-new-pad",
+        KMS_ELEMENT_PAD_TYPE_VIDEO, NULL, GST_PAD_SRC, &padname);
+    fail_if (padname == NULL);
+    g_free (padname);
+  }
+
+  gst_element_set_state (pipe, GST_STATE_PLAYING);
+
+  wall_start = g_get_monotonic_time ();
+  cpu_start = get_cpu_time ();
+
+  for (i = 0; i < BENCHMARK_PLAYERS; i++) {
+    g_object_set (G_OBJECT (players[i]), "state",
+        KMS_URI_ENDPOINT_STATE_START, NULL);
+  }
+
+  g_timeout_add_seconds (BENCHMARK_DURATION, quit_benchmark, loop);
+  g_main_loop_run (loop);
+
+  wall_time = g_get_monotonic_time () - wall_start;
+  cpu_time = get_cpu_time () - cpu_start;
+
+  fail_unless (g_atomic_int_get (&buffers) > 0);
+
+  gst_element_set_state (pipe, GST_STATE_NULL);
+  gst_object_unref (GST_OBJECT (pipe));
+  g_main_loop_unref (loop);
+
+  cores = (gdouble) cpu_time / wall_time;
+  GST_INFO ("%u players (passthrough: %d) pushed %d buffers using %.2f cores",
+      BENCHMARK_PLAYERS, passthrough, buffers, cores);
+
+  return cores > 0 ? BENCHMARK_PLAYERS / cores : 0.0;
+}
+
+GST_START_TEST (check_encoded_players_per_core)
+{
+  gdouble bridged, passthrough;
+
+  bridged = get_encoded_players_per_core (FALSE);
+  passthrough = get_encoded_players_per_core (TRUE);
+
+  GST_INFO ("Encoded players per core: %.1f with appsink and appsrc, %.1f "
+      "with passthrough", bridged, passthrough);
+}
+
+GST_END_TEST;
+
 #endif // ENABLE_EXPERIMENTAL_TESTS
 
 /* Define test suite */
@@ -529,8 +1574,16 @@ playerendpoint_suite (void)
   tcase_add_test (tc_chain, check_states);
   tcase_add_test (tc_chain, check_live_stream);
   tcase_add_test (tc_chain, check_eos);
+  tcase_add_test (tc_chain, check_shared_housekeeping_loops);
+  tcase_add_test (tc_chain, check_shared_decode);
+  tcase_add_test (tc_chain, check_shared_decode_stop_one);
+  tcase_add_test (tc_chain, check_buffer_list);
+  tcase_add_test (tc_chain, check_seek_to_keyframe_latency);
+  tcase_add_test (tc_chain, check_passthrough_running_time);
+  tcase_add_test (tc_chain, check_adaptive_network_cache);
 #ifdef ENABLE_EXPERIMENTAL_TESTS
   tcase_add_test (tc_chain, check_set_encoded_media);
+  tcase_add_test (tc_chain, check_encoded_players_per_core);
 #endif
 
   return s;
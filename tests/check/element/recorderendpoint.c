@@ -17,6 +17,9 @@
 #include <gst/check/gstcheck.h>
 #include <gst/gst.h>
 #include <glib.h>
+#include <glib/gstdio.h>
+#include <string.h>
+#include <sys/resource.h>
 #include <valgrind/valgrind.h>
 
 #include <commons/kmsuriendpointstate.h>
@@ -709,6 +712,1092 @@ GST_START_TEST (check_ksm_sink_request)
   g_main_loop_unref (loop);
 }
 
+GST_END_TEST;
+
+#define KSR_TRACKS 32
+#define KSR_DURATION 4          /* seconds */
+
+typedef struct _KsrBenchmarkData
+{
+  GstElement *agnosticbin;
+  RequestPadData pads;
+  gint64 wall_start;
+  gint64 cpu_start;
+  gint64 wall_time;
+  gint64 cpu_time;
+} KsrBenchmarkData;
+
+static gint64
+get_cpu_time (void)
+{
+  struct rusage usage;
+
+  getrusage (RUSAGE_SELF, &usage);
+
+  return (gint64) (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) *
+      G_USEC_PER_SEC + usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+}
+
+static void
+ksr_track_added (GstElement * element, GstPad * new_pad, gpointer user_data)
+{
+  KsrBenchmarkData *data = user_data;
+
+  if (!is_pad_requested (new_pad, data->pads.pads, data->pads.n)) {
+    return;
+  }
+
+  connect_pads_and_remove_on_unlinked (data->agnosticbin, element,
+      GST_OBJECT_NAME (new_pad));
+}
+
+static gboolean
+stop_ksr_benchmark (gpointer user_data)
+{
+  KsrBenchmarkData *data = user_data;
+
+  data->wall_time = g_get_monotonic_time () - data->wall_start;
+  data->cpu_time = get_cpu_time () - data->cpu_start;
+
+  return stop_recorder (NULL);
+}
+
+static void
+state_changed_ksr_benchmark (GstElement * recorder,
+    KmsUriEndpointState newState, gpointer user_data)
+{
+  KsrBenchmarkData *data = user_data;
+
+  if (newState != KMS_URI_ENDPOINT_STATE_START) {
+    return;
+  }
+
+  data->wall_start = g_get_monotonic_time ();
+  data->cpu_start = get_cpu_time ();
+  g_timeout_add_seconds (KSR_DURATION * (RUNNING_ON_VALGRIND ? 5 : 1),
+      stop_ksr_benchmark, data);
+}
+
+/* Records one encoded video into many KSR tracks. CPU time is the rusage of
+ * the whole test process: it includes the source, the encoder and every
+ * other thread, not only the muxer path, so it is just a rough figure. */
+GST_START_TEST (check_ksr_many_tracks)
+{
+  GstElement *pipeline, *videotestsrc, *vencoder;
+  KsrBenchmarkData data = { 0 };
+  GMainLoop *loop = g_main_loop_new (NULL, FALSE);
+  guint bus_watch_id;
+  gdouble cores;
+  GstBus *bus;
+  guint i;
+
+  expected_warnings = FALSE;
+
+  data.pads.n = KSR_TRACKS;
+  data.pads.pads = g_new0 (gchar *, KSR_TRACKS);
+
+  pipeline = gst_pipeline_new (__FUNCTION__);
+  videotestsrc = gst_element_factory_make ("videotestsrc", NULL);
+  vencoder = gst_element_factory_make ("vp8enc", NULL);
+  data.agnosticbin = gst_element_factory_make ("agnosticbin", NULL);
+  recorder = gst_element_factory_make ("recorderendpoint", NULL);
+
+  g_object_set (G_OBJECT (videotestsrc), "is-live", TRUE, "do-timestamp", TRUE,
+      NULL);
+  g_object_set (G_OBJECT (vencoder), "deadline", G_GINT64_CONSTANT (1), NULL);
+  g_object_set (G_OBJECT (recorder), "uri", "file:///tmp/check_ksr_tracks.ksr",
+      "profile", 6 /* KMS_RECORDING_PROFILE_KSR */ , NULL);
+
+  bus = gst_pipeline_get_bus (GST_PIPELINE (pipeline));
+  bus_watch_id = gst_bus_add_watch (bus, gst_bus_async_signal_func, NULL);
+  g_signal_connect (bus, "message", G_CALLBACK (bus_msg), pipeline);
+  g_object_unref (bus);
+
+  gst_bin_add_many (GST_BIN (pipeline), videotestsrc, vencoder,
+      data.agnosticbin, recorder, NULL);
+  gst_element_link_many (videotestsrc, vencoder, data.agnosticbin, NULL);
+
+  g_signal_connect (recorder, "pad-added", G_CALLBACK (ksr_track_added),
+      &data);
+  g_signal_connect (recorder, "state-changed",
+      G_CALLBACK (state_changed_ksr_benchmark), &data);
+  g_signal_connect (recorder, "state-changed", G_CALLBACK (state_changed_ksr),
+      loop);
+
+  for (i = 0; i < KSR_TRACKS; i++) {
+    gchar *id = g_strdup_printf ("participant_%u", i);
+
+    g_signal_emit_by_name (recorder, "request-new-pad",
+        KMS_ELEMENT_PAD_TYPE_VIDEO, id, GST_PAD_SINK, &data.pads.pads[i]);
+    g_free (id);
+  }
+
+  g_object_set (G_OBJECT (recorder), "state", KMS_URI_ENDPOINT_STATE_START,
+      NULL);
+  gst_element_set_state (pipeline, GST_STATE_PLAYING);
+
+  g_main_loop_run (loop);
+
+  fail_unless (data.wall_time > 0);
+  cores = (gdouble) data.cpu_time / data.wall_time;
+  GST_INFO ("Process used %.2f cores while recording %u KSR tracks",
+      cores, KSR_TRACKS);
+
+  for (i = 0; i < KSR_TRACKS; i++) {
+    g_free (data.pads.pads[i]);
+  }
+
+  g_free (data.pads.pads);
+
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+  gst_object_unref (GST_OBJECT (pipeline));
+
+  g_source_remove (bus_watch_id);
+  g_main_loop_unref (loop);
+}
+
+GST_END_TEST;
+
+#define CONTENTION_RECORDERS 16
+#define CONTENTION_FRAMERATE 60
+#define CONTENTION_DURATION 4   /* seconds */
+#define CONTENTION_MAX_START (100 * GST_MSECOND)
+
+typedef struct _ContentionData
+{
+  GMainLoop *loop;
+  GstElement *recorders[CONTENTION_RECORDERS];
+  guint started;
+  gboolean stopping;
+  guint stopped;
+  guint next;
+  gint64 end_time;
+  guint transitions;
+  gint64 total_latency;
+  gint64 max_latency;
+} ContentionData;
+
+static gboolean
+toggle_recorder (gpointer user_data)
+{
+  ContentionData *data = user_data;
+  KmsUriEndpointState current, next;
+  GstElement *rec;
+  gint64 start, latency;
+  guint i;
+
+  if (g_get_monotonic_time () >= data->end_time) {
+    data->stopping = TRUE;
+
+    for (i = 0; i < CONTENTION_RECORDERS; i++) {
+      g_object_get (G_OBJECT (data->recorders[i]), "state", &current, NULL);
+
+      if (current == KMS_URI_ENDPOINT_STATE_STOP) {
+        data->stopped++;
+      } else {
+        g_object_set (G_OBJECT (data->recorders[i]), "state",
+            KMS_URI_ENDPOINT_STATE_STOP, NULL);
+      }
+    }
+
+    if (data->stopped == CONTENTION_RECORDERS) {
+      g_idle_add (quit_main_loop_idle, data->loop);
+    }
+
+    return G_SOURCE_REMOVE;
+  }
+
+  /* Recorders are paused in even rounds and stopped in odd ones */
+  rec = data->recorders[data->next % CONTENTION_RECORDERS];
+  g_object_get (G_OBJECT (rec), "state", &current, NULL);
+
+  if (current != KMS_URI_ENDPOINT_STATE_START) {
+    next = KMS_URI_ENDPOINT_STATE_START;
+  } else if ((data->next / CONTENTION_RECORDERS) % 2) {
+    next = KMS_URI_ENDPOINT_STATE_STOP;
+  } else {
+    next = KMS_URI_ENDPOINT_STATE_PAUSE;
+  }
+
+  data->next++;
+
+  /* State changes compete with the streaming threads of every recorder */
+  start = g_get_monotonic_time ();
+  g_object_set (G_OBJECT (rec), "state", next, NULL);
+  latency = g_get_monotonic_time () - start;
+
+  data->transitions++;
+  data->total_latency += latency;
+  data->max_latency = MAX (data->max_latency, latency);
+
+  return G_SOURCE_CONTINUE;
+}
+
+static void
+state_changed_contention (GstElement * recorder, KmsUriEndpointState newState,
+    gpointer user_data)
+{
+  ContentionData *data = user_data;
+
+  if (newState == KMS_URI_ENDPOINT_STATE_START &&
+      data->end_time == 0 && ++data->started == CONTENTION_RECORDERS) {
+    GST_DEBUG ("All recorders started");
+    data->end_time = g_get_monotonic_time () + CONTENTION_DURATION *
+        G_TIME_SPAN_SECOND * (RUNNING_ON_VALGRIND ? 5 : 1);
+    g_timeout_add (1000 / CONTENTION_FRAMERATE, toggle_recorder, data);
+  } else if (newState == KMS_URI_ENDPOINT_STATE_STOP && data->stopping &&
+      ++data->stopped == CONTENTION_RECORDERS) {
+    g_idle_add (quit_main_loop_idle, data->loop);
+  }
+}
+
+typedef struct _RecordingTimestamps
+{
+  GstClockTime first;
+  GstClockTime last;
+  guint buffers;
+} RecordingTimestamps;
+
+static void
+recording_timestamps_handoff (GstElement * sink, GstBuffer * buffer,
+    GstPad * pad, gpointer user_data)
+{
+  RecordingTimestamps *ts = user_data;
+
+  if (!GST_BUFFER_PTS_IS_VALID (buffer)) {
+    return;
+  }
+
+  if (ts->buffers++ == 0) {
+    ts->first = GST_BUFFER_PTS (buffer);
+  } else {
+    fail_if (GST_BUFFER_PTS (buffer) < ts->last,
+        "Timestamp %" GST_TIME_FORMAT " after %" GST_TIME_FORMAT,
+        GST_TIME_ARGS (GST_BUFFER_PTS (buffer)), GST_TIME_ARGS (ts->last));
+  }
+
+  ts->last = GST_BUFFER_PTS (buffer);
+}
+
+/* Demuxes the WebM file at @location checking that its timestamps never go
+ * backwards. Returns the timestamp of the first frame and, in @frames, how
+ * many there are */
+static GstClockTime
+get_recording_start (const gchar * location, guint * frames)
+{
+  RecordingTimestamps ts = { GST_CLOCK_TIME_NONE, GST_CLOCK_TIME_NONE, 0 };
+  GstElement *pipeline, *sink;
+  GstMessage *msg;
+  GstBus *bus;
+  gchar *desc;
+
+  desc = g_strdup_printf ("filesrc location=%s ! matroskademux ! "
+      "fakesink name=sink sync=false signal-handoffs=true", location);
+  pipeline = gst_parse_launch (desc, NULL);
+  g_free (desc);
+  fail_unless (pipeline != NULL);
+
+  sink = gst_bin_get_by_name (GST_BIN (pipeline), "sink");
+  g_signal_connect (sink, "handoff", G_CALLBACK (recording_timestamps_handoff),
+      &ts);
+  g_object_unref (sink);
+
+  gst_element_set_state (pipeline, GST_STATE_PLAYING);
+
+  bus = gst_pipeline_get_bus (GST_PIPELINE (pipeline));
+  msg = gst_bus_timed_pop_filtered (bus, GST_CLOCK_TIME_NONE,
+      GST_MESSAGE_EOS | GST_MESSAGE_ERROR);
+  fail_unless (GST_MESSAGE_TYPE (msg) == GST_MESSAGE_EOS,
+      "Can not read %s", location);
+  gst_message_unref (msg);
+  g_object_unref (bus);
+
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+  gst_object_unref (pipeline);
+
+  fail_unless (ts.buffers > 0, "No frames in %s", location);
+
+  if (frames != NULL) {
+    *frames = ts.buffers;
+  }
+
+  return ts.first;
+}
+
+GST_START_TEST (check_recorders_contention)
+{
+  GstElement *pipeline, *videotestsrc, *capsfilter, *vencoder, *agnosticbin;
+  ContentionData data = { 0 };
+  guint bus_watch_id;
+  GstCaps *caps;
+  GstBus *bus;
+  guint i;
+
+  data.loop = g_main_loop_new (NULL, FALSE);
+  expected_warnings = FALSE;
+
+  pipeline = gst_pipeline_new (__FUNCTION__);
+  videotestsrc = gst_element_factory_make ("videotestsrc", NULL);
+  capsfilter = gst_element_factory_make ("capsfilter", NULL);
+  vencoder = gst_element_factory_make ("vp8enc", NULL);
+  agnosticbin = gst_element_factory_make ("agnosticbin", NULL);
+
+  caps = gst_caps_new_simple ("video/x-raw", "width", G_TYPE_INT, 320,
+      "height", G_TYPE_INT, 240, "framerate", GST_TYPE_FRACTION,
+      CONTENTION_FRAMERATE, 1, NULL);
+  g_object_set (G_OBJECT (capsfilter), "caps", caps, NULL);
+  gst_caps_unref (caps);
+
+  g_object_set (G_OBJECT (videotestsrc), "is-live", TRUE, "do-timestamp", TRUE,
+      NULL);
+  g_object_set (G_OBJECT (vencoder), "deadline", G_GINT64_CONSTANT (1), NULL);
+
+  bus = gst_pipeline_get_bus (GST_PIPELINE (pipeline));
+  bus_watch_id = gst_bus_add_watch (bus, gst_bus_async_signal_func, NULL);
+  g_signal_connect (bus, "message", G_CALLBACK (bus_msg), pipeline);
+  g_object_unref (bus);
+
+  gst_bin_add_many (GST_BIN (pipeline), videotestsrc, capsfilter, vencoder,
+      agnosticbin, NULL);
+  gst_element_link_many (videotestsrc, capsfilter, vencoder, agnosticbin, NULL);
+
+  for (i = 0; i < CONTENTION_RECORDERS; i++) {
+    gchar *uri = g_strdup_printf ("file:///tmp/check_contention_%u.webm", i);
+    GstElement *rec = gst_element_factory_make ("recorderendpoint", NULL);
+    GstPad *sink;
+
+    g_object_set (G_OBJECT (rec), "uri", uri, "profile",
+        2 /* WEBM_VIDEO_ONLY */ , NULL);
+    g_free (uri);
+
+    g_signal_connect (rec, "state-changed",
+        G_CALLBACK (state_changed_contention), &data);
+
+    gst_bin_add (GST_BIN (pipeline), rec);
+    connect_sink_async (rec, agnosticbin, SINK_VIDEO_STREAM);
+
+    sink = gst_element_get_static_pad (rec, SINK_VIDEO_STREAM);
+    if (sink != NULL) {
+      connect_pads_and_remove_on_unlinked (agnosticbin, rec, SINK_VIDEO_STREAM);
+      g_object_unref (sink);
+    }
+
+    g_object_set (G_OBJECT (rec), "state", KMS_URI_ENDPOINT_STATE_START, NULL);
+    data.recorders[i] = rec;
+  }
+
+  gst_element_set_state (pipeline, GST_STATE_PLAYING);
+
+  g_main_loop_run (data.loop);
+
+  fail_unless (data.transitions > 0);
+  GST_INFO ("%u recorders at %u fps: %u state changes, avg latency %"
+      G_GINT64_FORMAT " us, max latency %" G_GINT64_FORMAT " us",
+      CONTENTION_RECORDERS, CONTENTION_FRAMERATE, data.transitions,
+      data.total_latency / data.transitions, data.max_latency);
+
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+  gst_object_unref (GST_OBJECT (pipeline));
+
+  /* Last recording of each file starts at 0, not at the base time of one
+   * stopped before */
+  for (i = 0; i < CONTENTION_RECORDERS; i++) {
+    gchar *location = g_strdup_printf ("/tmp/check_contention_%u.webm", i);
+    GstClockTime start = get_recording_start (location, NULL);
+
+    GST_DEBUG ("%s starts at %" GST_TIME_FORMAT, location,
+        GST_TIME_ARGS (start));
+    fail_if (start > CONTENTION_MAX_START, "%s starts at %" GST_TIME_FORMAT,
+        location, GST_TIME_ARGS (start));
+    g_free (location);
+  }
+
+  g_source_remove (bus_watch_id);
+  g_main_loop_unref (data.loop);
+}
+
+GST_END_TEST;
+
+#define LIST_SIZE 8
+#define LIST_BUFFERS (10 * LIST_SIZE)
+#define LIST_TIMESTAMP_OFFSET (10 * GST_SECOND)
+
+typedef struct _BufferListData
+{
+  GMainLoop *loop;
+  GstBufferList *pending;
+  gboolean recording;
+  guint pushed;
+} BufferListData;
+
+static gboolean
+stop_recorder_after_lists (gpointer user_data)
+{
+  /* Let the last list reach the muxer before stopping */
+  g_timeout_add (RUNNING_ON_VALGRIND ? 5000 : 1000, stop_recorder, NULL);
+
+  return G_SOURCE_REMOVE;
+}
+
+/* Groups the buffers of @pad in lists once the recording has started */
+static GstPadProbeReturn
+group_buffers_probe (GstPad * pad, GstPadProbeInfo * info, gpointer user_data)
+{
+  BufferListData *data = user_data;
+  GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER (info);
+  GstBufferList *list;
+
+  if (!g_atomic_int_get (&data->recording) || data->pushed == LIST_BUFFERS) {
+    return GST_PAD_PROBE_DROP;
+  }
+
+  gst_buffer_list_add (data->pending, gst_buffer_ref (buffer));
+
+  if (gst_buffer_list_length (data->pending) < LIST_SIZE) {
+    return GST_PAD_PROBE_DROP;
+  }
+
+  list = data->pending;
+  data->pending = gst_buffer_list_new ();
+  data->pushed += LIST_SIZE;
+
+  fail_unless (gst_pad_push_list (pad, list) == GST_FLOW_OK);
+
+  if (data->pushed == LIST_BUFFERS) {
+    g_idle_add (stop_recorder_after_lists, NULL);
+  }
+
+  return GST_PAD_PROBE_DROP;
+}
+
+static void
+state_changed_buffer_list (GstElement * recorder,
+    KmsUriEndpointState newState, gpointer user_data)
+{
+  BufferListData *data = user_data;
+
+  GST_DEBUG ("State changed %s.", state2string (newState));
+
+  if (newState == KMS_URI_ENDPOINT_STATE_START) {
+    g_atomic_int_set (&data->recording, TRUE);
+  } else if (newState == KMS_URI_ENDPOINT_STATE_STOP) {
+    g_idle_add (quit_main_loop_idle, data->loop);
+  }
+}
+
+GST_START_TEST (check_video_buffer_list)
+{
+  GstElement *pipeline, *videotestsrc, *vencoder;
+  BufferListData data = { 0 };
+  GstClockTime start;
+  guint bus_watch_id, frames;
+  GstPad *srcpad;
+  GstBus *bus;
+
+  data.loop = g_main_loop_new (NULL, FALSE);
+  data.pending = gst_buffer_list_new ();
+  expected_warnings = FALSE;
+
+  g_remove ("/tmp/check_video_buffer_list.webm");
+
+  pipeline = gst_pipeline_new (__FUNCTION__);
+  videotestsrc = gst_element_factory_make ("videotestsrc", NULL);
+  vencoder = gst_element_factory_make ("vp8enc", NULL);
+  recorder = gst_element_factory_make ("recorderendpoint", NULL);
+
+  /* Timestamps far from 0 show whether buffers were re-based */
+  g_object_set (G_OBJECT (videotestsrc), "is-live", TRUE, "timestamp-offset",
+      (gint64) LIST_TIMESTAMP_OFFSET, NULL);
+  /* Every frame is a key frame, so none of them is waited for */
+  g_object_set (G_OBJECT (vencoder), "deadline", G_GINT64_CONSTANT (1),
+      "keyframe-max-dist", 1, NULL);
+  g_object_set (G_OBJECT (recorder), "uri",
+      "file:///tmp/check_video_buffer_list.webm", "profile",
+      2 /* WEBM_VIDEO_ONLY */ , NULL);
+
+  bus = gst_pipeline_get_bus (GST_PIPELINE (pipeline));
+  bus_watch_id = gst_bus_add_watch (bus, gst_bus_async_signal_func, NULL);
+  g_signal_connect (bus, "message", G_CALLBACK (bus_msg), pipeline);
+  g_object_unref (bus);
+
+  gst_bin_add_many (GST_BIN (pipeline), videotestsrc, vencoder, recorder,
+      NULL);
+  gst_element_link (videotestsrc, vencoder);
+
+  srcpad = gst_element_get_static_pad (vencoder, "src");
+  gst_pad_add_probe (srcpad, GST_PAD_PROBE_TYPE_BUFFER, group_buffers_probe,
+      &data, NULL);
+  g_object_unref (srcpad);
+
+  link_to_recorder (recorder, vencoder, pipeline, SINK_VIDEO_STREAM);
+
+  g_signal_connect (recorder, "state-changed",
+      G_CALLBACK (state_changed_buffer_list), &data);
+
+  g_object_set (G_OBJECT (recorder), "state",
+      KMS_URI_ENDPOINT_STATE_START, NULL);
+  gst_element_set_state (pipeline, GST_STATE_PLAYING);
+
+  g_main_loop_run (data.loop);
+
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+  gst_object_unref (GST_OBJECT (pipeline));
+
+  /* Every buffer of every list is recorded, starting at 0 */
+  fail_unless (data.pushed == LIST_BUFFERS);
+  start = get_recording_start ("/tmp/check_video_buffer_list.webm", &frames);
+  GST_DEBUG ("%u frames recorded from %" GST_TIME_FORMAT, frames,
+      GST_TIME_ARGS (start));
+  fail_unless (frames == LIST_BUFFERS, "%u frames recorded out of %u", frames,
+      LIST_BUFFERS);
+  fail_unless (start <= CONTENTION_MAX_START, "Recording starts at %"
+      GST_TIME_FORMAT, GST_TIME_ARGS (start));
+
+  gst_buffer_list_unref (data.pending);
+  g_source_remove (bus_watch_id);
+  g_main_loop_unref (data.loop);
+}
+
+GST_END_TEST;
+
+static void
+segment_closed_cb (GstElement * recorder, const gchar * uri, gpointer data)
+{
+  gint *segments = data;
+
+  GST_DEBUG ("Segment closed: %s", uri);
+
+  fail_unless (g_str_has_prefix (uri, "file:///tmp/check_video_segments-"));
+  g_atomic_int_inc (segments);
+}
+
+GST_START_TEST (check_video_segments)
+{
+  GstElement *pipeline, *videotestsrc, *vencoder;
+  guint bus_watch_id;
+  gint segments = 0;
+  GstBus *bus;
+
+  GMainLoop *loop = g_main_loop_new (NULL, FALSE);
+
+  expected_warnings = FALSE;
+
+  pipeline = gst_pipeline_new ("recorderendpoint-segments-test");
+  videotestsrc = gst_element_factory_make ("videotestsrc", NULL);
+  vencoder = gst_element_factory_make ("vp8enc", NULL);
+  recorder = gst_element_factory_make ("recorderendpoint", NULL);
+
+  /* Segments must be configured before the profile */
+  g_object_set (G_OBJECT (recorder), "uri",
+      "file:///tmp/check_video_segments.webm", "segment-duration",
+      GST_SECOND, "segment-template",
+      "file:///tmp/check_video_segments-{index}.webm", NULL);
+  g_object_set (G_OBJECT (recorder), "profile", 2 /* WEBM_VIDEO_ONLY */ ,
+      NULL);
+
+  bus = gst_pipeline_get_bus (GST_PIPELINE (pipeline));
+
+  bus_watch_id = gst_bus_add_watch (bus, gst_bus_async_signal_func, NULL);
+  g_signal_connect (bus, "message", G_CALLBACK (bus_msg), pipeline);
+  g_object_unref (bus);
+
+  gst_bin_add_many (GST_BIN (pipeline), videotestsrc, vencoder, recorder,
+      NULL);
+  gst_element_link (videotestsrc, vencoder);
+
+  link_to_recorder (recorder, vencoder, pipeline, SINK_VIDEO_STREAM);
+
+  g_signal_connect (recorder, "state-changed", G_CALLBACK (state_changed_cb3),
+      loop);
+  g_signal_connect (recorder, "segment-closed",
+      G_CALLBACK (segment_closed_cb), &segments);
+
+  g_object_set (G_OBJECT (videotestsrc), "is-live", TRUE, "do-timestamp", TRUE,
+      NULL);
+  /* Key frames every half second so that segments can be cut */
+  g_object_set (G_OBJECT (vencoder), "keyframe-max-dist", 15, "deadline",
+      G_GINT64_CONSTANT (1), NULL);
+
+  g_object_set (G_OBJECT (recorder), "state",
+      KMS_URI_ENDPOINT_STATE_START, NULL);
+  gst_element_set_state (pipeline, GST_STATE_PLAYING);
+
+  g_main_loop_run (loop);
+
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+
+  /* Every segment, including the last one, is closed once stopped */
+  GST_INFO ("Recorded %d segments", g_atomic_int_get (&segments));
+  fail_unless (g_atomic_int_get (&segments) >= 2);
+
+  gst_object_unref (GST_OBJECT (pipeline));
+
+  g_source_remove (bus_watch_id);
+  g_main_loop_unref (loop);
+}
+
+GST_END_TEST;
+
+static gboolean
+file_contains_box (const gchar * path, const gchar * box)
+{
+  gchar *contents;
+  gboolean found = FALSE;
+  gsize len, i;
+
+  if (!g_file_get_contents (path, &contents, &len, NULL)) {
+    return FALSE;
+  }
+
+  for (i = 0; i + 4 <= len && !found; i++) {
+    found = memcmp (contents + i, box, 4) == 0;
+  }
+
+  g_free (contents);
+
+  return found;
+}
+
+GST_START_TEST (check_mp4_fragmented)
+{
+  GstElement *pipeline, *videotestsrc, *vencoder;
+  guint bus_watch_id;
+  GstBus *bus;
+
+  GMainLoop *loop = g_main_loop_new (NULL, FALSE);
+
+  expected_warnings = FALSE;
+
+  g_remove ("/tmp/check_mp4_fragmented.mp4");
+
+  pipeline = gst_pipeline_new ("recorderendpoint-fragmented-test");
+  videotestsrc = gst_element_factory_make ("videotestsrc", NULL);
+  vencoder = gst_element_factory_make ("vp8enc", NULL);
+  recorder = gst_element_factory_make ("recorderendpoint", NULL);
+
+  g_object_set (G_OBJECT (recorder), "uri",
+      "file:///tmp/check_mp4_fragmented.mp4", "fragment-duration", 500, NULL);
+  g_object_set (G_OBJECT (recorder), "profile", 4 /* MP4_VIDEO_ONLY */ ,
+      NULL);
+
+  bus = gst_pipeline_get_bus (GST_PIPELINE (pipeline));
+
+  bus_watch_id = gst_bus_add_watch (bus, gst_bus_async_signal_func, NULL);
+  g_signal_connect (bus, "message", G_CALLBACK (bus_msg), pipeline);
+  g_object_unref (bus);
+
+  gst_bin_add_many (GST_BIN (pipeline), videotestsrc, vencoder, recorder,
+      NULL);
+  gst_element_link (videotestsrc, vencoder);
+
+  link_to_recorder (recorder, vencoder, pipeline, SINK_VIDEO_STREAM);
+
+  g_signal_connect (recorder, "state-changed", G_CALLBACK (state_changed_cb3),
+      loop);
+
+  g_object_set (G_OBJECT (videotestsrc), "is-live", TRUE, "do-timestamp", TRUE,
+      NULL);
+  g_object_set (G_OBJECT (vencoder), "deadline", G_GINT64_CONSTANT (1), NULL);
+
+  g_object_set (G_OBJECT (recorder), "state",
+      KMS_URI_ENDPOINT_STATE_START, NULL);
+  gst_element_set_state (pipeline, GST_STATE_PLAYING);
+
+  g_main_loop_run (loop);
+
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+
+  /* Fragmented files declare their fragments in the header */
+  fail_unless (file_contains_box ("/tmp/check_mp4_fragmented.mp4", "mvex"));
+  fail_unless (file_contains_box ("/tmp/check_mp4_fragmented.mp4", "moof"));
+
+  gst_object_unref (GST_OBJECT (pipeline));
+
+  g_source_remove (bus_watch_id);
+  g_main_loop_unref (loop);
+}
+
+GST_END_TEST
+/* A one byte budget makes the recorder spill nearly every buffer to disk */
+GST_START_TEST (check_video_spill)
+{
+  GstElement *pipeline, *videotestsrc, *vencoder;
+  guint bus_watch_id;
+  GStatBuf st;
+  GstBus *bus;
+
+  GMainLoop *loop = g_main_loop_new (NULL, FALSE);
+
+  expected_warnings = FALSE;
+
+  g_remove ("/tmp/check_video_spill.webm");
+
+  pipeline = gst_pipeline_new ("recorderendpoint-spill-test");
+  videotestsrc = gst_element_factory_make ("videotestsrc", NULL);
+  vencoder = gst_element_factory_make ("vp8enc", NULL);
+  recorder = gst_element_factory_make ("recorderendpoint", NULL);
+
+  g_object_set (G_OBJECT (recorder), "uri",
+      "file:///tmp/check_video_spill.webm", NULL);
+  gst_util_set_object_arg (G_OBJECT (recorder), "overflow-policy", "spill");
+  g_object_set (G_OBJECT (recorder), "overflow-max-bytes",
+      G_GUINT64_CONSTANT (1), "profile", 2 /* WEBM_VIDEO_ONLY */ , NULL);
+
+  bus = gst_pipeline_get_bus (GST_PIPELINE (pipeline));
+
+  bus_watch_id = gst_bus_add_watch (bus, gst_bus_async_signal_func, NULL);
+  g_signal_connect (bus, "message", G_CALLBACK (bus_msg), pipeline);
+  g_object_unref (bus);
+
+  gst_bin_add_many (GST_BIN (pipeline), videotestsrc, vencoder, recorder,
+      NULL);
+  gst_element_link (videotestsrc, vencoder);
+
+  link_to_recorder (recorder, vencoder, pipeline, SINK_VIDEO_STREAM);
+
+  g_signal_connect (recorder, "state-changed", G_CALLBACK (state_changed_cb3),
+      loop);
+
+  g_object_set (G_OBJECT (videotestsrc), "is-live", TRUE, "do-timestamp", TRUE,
+      NULL);
+  g_object_set (G_OBJECT (vencoder), "deadline", G_GINT64_CONSTANT (1), NULL);
+
+  g_object_set (G_OBJECT (recorder), "state",
+      KMS_URI_ENDPOINT_STATE_START, NULL);
+  gst_element_set_state (pipeline, GST_STATE_PLAYING);
+
+  /* Recorder stops once the spilled media has reached the file */
+  g_main_loop_run (loop);
+
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+
+  fail_unless (g_stat ("/tmp/check_video_spill.webm", &st) == 0);
+  fail_unless (st.st_size > 0);
+
+  gst_object_unref (GST_OBJECT (pipeline));
+
+  g_source_remove (bus_watch_id);
+  g_main_loop_unref (loop);
+}
+
+GST_END_TEST
+typedef struct _GopCacheData
+{
+  GMainLoop *loop;
+  gboolean recording;
+  gint key_frame_requests;
+} GopCacheData;
+
+static GstPadProbeReturn
+count_key_frame_requests (GstPad * pad, GstPadProbeInfo * info,
+    gpointer user_data)
+{
+  GstEvent *event = GST_PAD_PROBE_INFO_EVENT (info);
+  GopCacheData *data = user_data;
+
+  if (GST_EVENT_TYPE (event) == GST_EVENT_CUSTOM_UPSTREAM &&
+      gst_event_has_name (event, "GstForceKeyUnit") &&
+      g_atomic_int_get (&data->recording)) {
+    GST_DEBUG_OBJECT (pad, "Key frame requested while recording");
+    g_atomic_int_inc (&data->key_frame_requests);
+  }
+
+  return GST_PAD_PROBE_OK;
+}
+
+static gboolean
+start_recorder_with_gop_cache (gpointer user_data)
+{
+  GopCacheData *data = user_data;
+
+  g_atomic_int_set (&data->recording, TRUE);
+  g_object_set (G_OBJECT (recorder), "state", KMS_URI_ENDPOINT_STATE_START,
+      NULL);
+
+  return G_SOURCE_REMOVE;
+}
+
+static void
+state_changed_gop_cache (GstElement * recorder, KmsUriEndpointState newState,
+    gpointer user_data)
+{
+  GopCacheData *data = user_data;
+
+  if (newState == KMS_URI_ENDPOINT_STATE_START) {
+    g_timeout_add (2000, stop_recorder, NULL);
+  } else if (newState == KMS_URI_ENDPOINT_STATE_STOP) {
+    g_idle_add (quit_main_loop_idle, data->loop);
+  }
+}
+
+/* Encoder only produces key frames when asked for them */
+GST_START_TEST (check_video_gop_cache)
+{
+  GstElement *pipeline, *videotestsrc, *vencoder;
+  GopCacheData data = { 0 };
+  guint bus_watch_id;
+  GstPad *srcpad;
+  GStatBuf st;
+  GstBus *bus;
+
+  data.loop = g_main_loop_new (NULL, FALSE);
+  expected_warnings = FALSE;
+
+  g_remove ("/tmp/check_video_gop_cache.webm");
+
+  pipeline = gst_pipeline_new (__FUNCTION__);
+  videotestsrc = gst_element_factory_make ("videotestsrc", NULL);
+  vencoder = gst_element_factory_make ("vp8enc", NULL);
+  recorder = gst_element_factory_make ("recorderendpoint", NULL);
+
+  g_object_set (G_OBJECT (recorder), "uri",
+      "file:///tmp/check_video_gop_cache.webm", "gop-cache", TRUE, NULL);
+  g_object_set (G_OBJECT (recorder), "profile", 2 /* WEBM_VIDEO_ONLY */ ,
+      NULL);
+
+  bus = gst_pipeline_get_bus (GST_PIPELINE (pipeline));
+  bus_watch_id = gst_bus_add_watch (bus, gst_bus_async_signal_func, NULL);
+  g_signal_connect (bus, "message", G_CALLBACK (bus_msg), pipeline);
+  g_object_unref (bus);
+
+  gst_bin_add_many (GST_BIN (pipeline), videotestsrc, vencoder, recorder,
+      NULL);
+  gst_element_link (videotestsrc, vencoder);
+
+  /* Pads are available before recording */
+  link_to_recorder (recorder, vencoder, pipeline, SINK_VIDEO_STREAM);
+
+  srcpad = gst_element_get_static_pad (vencoder, "src");
+  gst_pad_add_probe (srcpad, GST_PAD_PROBE_TYPE_EVENT_UPSTREAM,
+      count_key_frame_requests, &data, NULL);
+  g_object_unref (srcpad);
+
+  g_signal_connect (recorder, "state-changed",
+      G_CALLBACK (state_changed_gop_cache), &data);
+
+  g_object_set (G_OBJECT (videotestsrc), "is-live", TRUE, "do-timestamp", TRUE,
+      NULL);
+  g_object_set (G_OBJECT (vencoder), "deadline", G_GINT64_CONSTANT (1),
+      "keyframe-max-dist", 10000, NULL);
+
+  gst_element_set_state (pipeline, GST_STATE_PLAYING);
+
+  /* Let the first group of pictures be cached */
+  g_timeout_add (1500, start_recorder_with_gop_cache, &data);
+
+  g_main_loop_run (data.loop);
+
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+
+  fail_unless_equals_int (g_atomic_int_get (&data.key_frame_requests), 0);
+  fail_unless (g_stat ("/tmp/check_video_gop_cache.webm", &st) == 0);
+  fail_unless (st.st_size > 0);
+
+  gst_object_unref (GST_OBJECT (pipeline));
+  g_source_remove (bus_watch_id);
+  g_main_loop_unref (data.loop);
+}
+
+GST_END_TEST
+#define POOL_RECORDINGS 4
+typedef struct _StartLatencyData
+{
+  GMainLoop *loop;
+  gint64 start_requested;
+  gint64 latency;
+} StartLatencyData;
+
+static void
+state_changed_start_latency (GstElement * recorder,
+    KmsUriEndpointState newState, gpointer user_data)
+{
+  StartLatencyData *data = user_data;
+
+  if (newState == KMS_URI_ENDPOINT_STATE_START) {
+    data->latency = g_get_monotonic_time () - data->start_requested;
+    g_timeout_add (1000, stop_recorder, NULL);
+  } else if (newState == KMS_URI_ENDPOINT_STATE_STOP) {
+    g_idle_add (quit_main_loop_idle, data->loop);
+  }
+}
+
+static gint64
+record_and_get_start_latency (guint n)
+{
+  GstElement *pipeline, *videotestsrc, *vencoder;
+  StartLatencyData data = { 0 };
+  guint bus_watch_id;
+  GStatBuf st;
+  GstBus *bus;
+  gchar *uri;
+
+  data.loop = g_main_loop_new (NULL, FALSE);
+
+  pipeline = gst_pipeline_new (__FUNCTION__);
+  videotestsrc = gst_element_factory_make ("videotestsrc", NULL);
+  vencoder = gst_element_factory_make ("vp8enc", NULL);
+  recorder = gst_element_factory_make ("recorderendpoint", NULL);
+
+  uri = g_strdup_printf ("file:///tmp/check_muxer_pool_%u.webm", n);
+  g_remove (uri + strlen ("file://"));
+  g_object_set (G_OBJECT (recorder), "uri", uri, "profile",
+      2 /* WEBM_VIDEO_ONLY */ , NULL);
+
+  bus = gst_pipeline_get_bus (GST_PIPELINE (pipeline));
+  bus_watch_id = gst_bus_add_watch (bus, gst_bus_async_signal_func, NULL);
+  g_signal_connect (bus, "message", G_CALLBACK (bus_msg), pipeline);
+  g_object_unref (bus);
+
+  gst_bin_add_many (GST_BIN (pipeline), videotestsrc, vencoder, recorder,
+      NULL);
+  gst_element_link (videotestsrc, vencoder);
+  link_to_recorder (recorder, vencoder, pipeline, SINK_VIDEO_STREAM);
+
+  g_signal_connect (recorder, "state-changed",
+      G_CALLBACK (state_changed_start_latency), &data);
+
+  g_object_set (G_OBJECT (videotestsrc), "is-live", TRUE, "do-timestamp", TRUE,
+      NULL);
+  g_object_set (G_OBJECT (vencoder), "deadline", G_GINT64_CONSTANT (1), NULL);
+
+  gst_element_set_state (pipeline, GST_STATE_PLAYING);
+
+  data.start_requested = g_get_monotonic_time ();
+  g_object_set (G_OBJECT (recorder), "state", KMS_URI_ENDPOINT_STATE_START,
+      NULL);
+
+  g_main_loop_run (data.loop);
+
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+
+  fail_unless (g_stat (uri + strlen ("file://"), &st) == 0);
+  fail_unless (st.st_size > 0);
+  g_free (uri);
+
+  gst_object_unref (GST_OBJECT (pipeline));
+  g_source_remove (bus_watch_id);
+  g_main_loop_unref (data.loop);
+
+  return data.latency;
+}
+
+GST_START_TEST (check_muxer_pool_start_latency)
+{
+  GstElement *config = gst_element_factory_make ("recorderendpoint", NULL);
+  guint size, hits, first_hits, i;
+
+  expected_warnings = FALSE;
+
+  g_object_set (G_OBJECT (config), "muxer-pool-size", 2, NULL);
+  g_object_get (G_OBJECT (config), "muxer-pool-size", &size,
+      "muxer-pool-hits", &first_hits, NULL);
+  fail_unless_equals_int (size, 2);
+
+  /* First recording of a profile starts filling the pool, the rest take
+   * their muxer from it */
+  for (i = 0; i < POOL_RECORDINGS; i++) {
+    GST_INFO ("Recording %u started in %" G_GINT64_FORMAT " us", i,
+        record_and_get_start_latency (i));
+    g_object_get (G_OBJECT (config), "muxer-pool-hits", &hits, NULL);
+    fail_unless_equals_int (hits - first_hits, i);
+    g_usleep (G_USEC_PER_SEC / 2);
+  }
+
+  gst_object_unref (config);
+
+  config = gst_element_factory_make ("recorderendpoint", NULL);
+  g_object_set (G_OBJECT (config), "muxer-pool-size", 0, NULL);
+  gst_object_unref (config);
+}
+
+GST_END_TEST
+typedef struct _RecordingFinishedData
+{
+  gboolean finished;
+  guint64 size;
+  guint64 duration;
+  gboolean timed_out;
+} RecordingFinishedData;
+
+static void
+recording_finished_cb (GstElement * recorder, guint64 size, guint64 duration,
+    gboolean timed_out, gpointer user_data)
+{
+  RecordingFinishedData *data = user_data;
+
+  GST_INFO ("Recording finished: %" G_GUINT64_FORMAT " bytes, %"
+      GST_TIME_FORMAT, size, GST_TIME_ARGS (duration));
+
+  data->finished = TRUE;
+  data->size = size;
+  data->duration = duration;
+  data->timed_out = timed_out;
+}
+
+GST_START_TEST (check_recording_finished)
+{
+  GstElement *pipeline, *videotestsrc, *vencoder;
+  RecordingFinishedData data = { FALSE, 0, 0, FALSE };
+  guint bus_watch_id;
+  GStatBuf st;
+  GstBus *bus;
+
+  GMainLoop *loop = g_main_loop_new (NULL, FALSE);
+
+  expected_warnings = FALSE;
+
+  g_remove ("/tmp/check_recording_finished.webm");
+
+  pipeline = gst_pipeline_new ("recorderendpoint-finished-test");
+  videotestsrc = gst_element_factory_make ("videotestsrc", NULL);
+  vencoder = gst_element_factory_make ("vp8enc", NULL);
+  recorder = gst_element_factory_make ("recorderendpoint", NULL);
+
+  g_object_set (G_OBJECT (recorder), "uri",
+      "file:///tmp/check_recording_finished.webm", "stop-timeout", 5000,
+      "profile", 2 /* WEBM_VIDEO_ONLY */ , NULL);
+
+  bus = gst_pipeline_get_bus (GST_PIPELINE (pipeline));
+
+  bus_watch_id = gst_bus_add_watch (bus, gst_bus_async_signal_func, NULL);
+  g_signal_connect (bus, "message", G_CALLBACK (bus_msg), pipeline);
+  g_object_unref (bus);
+
+  gst_bin_add_many (GST_BIN (pipeline), videotestsrc, vencoder, recorder,
+      NULL);
+  gst_element_link (videotestsrc, vencoder);
+
+  link_to_recorder (recorder, vencoder, pipeline, SINK_VIDEO_STREAM);
+
+  g_signal_connect (recorder, "state-changed", G_CALLBACK (state_changed_cb3),
+      loop);
+  g_signal_connect (recorder, "recording-finished",
+      G_CALLBACK (recording_finished_cb), &data);
+
+  g_object_set (G_OBJECT (videotestsrc), "is-live", TRUE, "do-timestamp", TRUE,
+      NULL);
+  g_object_set (G_OBJECT (vencoder), "deadline", G_GINT64_CONSTANT (1), NULL);
+
+  g_object_set (G_OBJECT (recorder), "state",
+      KMS_URI_ENDPOINT_STATE_START, NULL);
+  gst_element_set_state (pipeline, GST_STATE_PLAYING);
+
+  g_main_loop_run (loop);
+
+  /* Reported along with the stop, once the file is complete */
+  fail_unless (data.finished);
+  fail_if (data.timed_out);
+  fail_unless (g_stat ("/tmp/check_recording_finished.webm", &st) == 0);
+  fail_unless_equals_uint64 (data.size, st.st_size);
+  fail_unless (data.duration >= GST_SECOND);
+
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+  gst_object_unref (GST_OBJECT (pipeline));
+
+  g_source_remove (bus_watch_id);
+  g_main_loop_unref (loop);
+}
+
 GST_END_TEST
 /******************************/
 /* RecorderEndpoint test suit */
@@ -726,9 +1815,18 @@ recorderendpoint_suite (void)
   tcase_add_test (tc_chain, check_audio_only);
   tcase_add_test (tc_chain, check_states_pipeline);
   tcase_add_test (tc_chain, warning_pipeline);
+  tcase_add_test (tc_chain, check_recorders_contention);
+  tcase_add_test (tc_chain, check_video_buffer_list);
+  tcase_add_test (tc_chain, check_video_segments);
+  tcase_add_test (tc_chain, check_mp4_fragmented);
+  tcase_add_test (tc_chain, check_video_spill);
+  tcase_add_test (tc_chain, check_muxer_pool_start_latency);
+  tcase_add_test (tc_chain, check_video_gop_cache);
+  tcase_add_test (tc_chain, check_recording_finished);
 
   if (check_support_for_ksr ()) {
     tcase_add_test (tc_chain, check_ksm_sink_request);
+    tcase_add_test (tc_chain, check_ksr_many_tracks);
   } else {
     GST_WARNING ("No ksr profile supported. Test skipped");
   }
@@ -0,0 +1,501 @@
+/*
+ * (C) Copyright 2016 Kurento (http://kurento.org/)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+#include <gst/check/gstcheck.h>
+#include <gst/check/gstharness.h>
+#include <gst/rtp/gstrtpbuffer.h>
+#include <gst/rtp/gstrtcpbuffer.h>
+
+#include "kmsrtcpclassifier.h"
+
+#define RTP_PT 96
+#define RTP_SSRC 0x01BADBAD
+#define RTP_PAYLOAD_SIZE 160
+#define RTCP_LOCAL_SSRC 0x02BADBAD
+
+#define BENCH_PACKETS 100000
+#define BENCH_RTCP_EVERY 50
+#define BENCH_LIST_SIZE 32
+
+static GstBuffer *
+generate_rtp_buffer (guint seq_num, gboolean marker)
+{
+  GstRTPBuffer rtp = GST_RTP_BUFFER_INIT;
+  GstBuffer *buf;
+
+  buf = gst_rtp_buffer_new_allocate (RTP_PAYLOAD_SIZE, 0, 0);
+
+  gst_rtp_buffer_map (buf, GST_MAP_READWRITE, &rtp);
+  gst_rtp_buffer_set_payload_type (&rtp, RTP_PT);
+  gst_rtp_buffer_set_marker (&rtp, marker);
+  gst_rtp_buffer_set_seq (&rtp, seq_num);
+  gst_rtp_buffer_set_ssrc (&rtp, RTP_SSRC);
+  gst_rtp_buffer_unmap (&rtp);
+
+  return buf;
+}
+
+/* No report block is added if @local_ssrc is 0 */
+static GstBuffer *
+generate_rtcp_rr_buffer_full (guint32 remote_ssrc, guint32 local_ssrc)
+{
+  GstRTCPBuffer rtcp = GST_RTCP_BUFFER_INIT;
+  GstRTCPPacket packet;
+  GstBuffer *buf;
+
+  buf = gst_rtcp_buffer_new (1400);
+
+  gst_rtcp_buffer_map (buf, GST_MAP_READWRITE, &rtcp);
+  fail_unless (gst_rtcp_buffer_add_packet (&rtcp, GST_RTCP_TYPE_RR, &packet));
+  gst_rtcp_packet_rr_set_ssrc (&packet, remote_ssrc);
+  if (local_ssrc != 0) {
+    fail_unless (gst_rtcp_packet_add_rb (&packet, local_ssrc, 0, 0, 0, 0, 0,
+            0));
+  }
+  gst_rtcp_buffer_unmap (&rtcp);
+
+  return buf;
+}
+
+static GstBuffer *
+generate_rtcp_rr_buffer (guint32 remote_ssrc)
+{
+  return generate_rtcp_rr_buffer_full (remote_ssrc, RTCP_LOCAL_SSRC);
+}
+
+/* SR + SDES + RR, as sent by a peer that is both sending and receiving */
+static GstBuffer *
+generate_rtcp_compound_buffer (guint32 remote_ssrc)
+{
+  GstRTCPBuffer rtcp = GST_RTCP_BUFFER_INIT;
+  GstRTCPPacket packet;
+  GstBuffer *buf;
+
+  buf = gst_rtcp_buffer_new (1400);
+
+  gst_rtcp_buffer_map (buf, GST_MAP_READWRITE, &rtcp);
+  fail_unless (gst_rtcp_buffer_add_packet (&rtcp, GST_RTCP_TYPE_SR, &packet));
+  gst_rtcp_packet_sr_set_sender_info (&packet, remote_ssrc, 0, 0, 0, 0);
+  fail_unless (gst_rtcp_buffer_add_packet (&rtcp, GST_RTCP_TYPE_SDES,
+          &packet));
+  fail_unless (gst_rtcp_packet_sdes_add_item (&packet, remote_ssrc));
+  fail_unless (gst_rtcp_packet_sdes_add_entry (&packet, GST_RTCP_SDES_CNAME, 4,
+          (const guint8 *) "test"));
+  fail_unless (gst_rtcp_buffer_add_packet (&rtcp, GST_RTCP_TYPE_RR, &packet));
+  gst_rtcp_packet_rr_set_ssrc (&packet, remote_ssrc);
+  fail_unless (gst_rtcp_packet_add_rb (&packet, RTCP_LOCAL_SSRC, 0, 0, 0, 0, 0,
+          0));
+  gst_rtcp_buffer_unmap (&rtcp);
+
+  return buf;
+}
+
+static guint
+get_ssrc_map_stat (GstElement * rtcpdemux, const gchar * field)
+{
+  GstStructure *stats;
+  guint value;
+
+  g_object_get (rtcpdemux, "ssrc-map-stats", &stats, NULL);
+  fail_unless (gst_structure_get_uint (stats, field, &value));
+  gst_structure_free (stats);
+
+  return value;
+}
+
+/* How the demuxer used to tell RTP from RTCP */
+static gboolean
+legacy_buffer_is_rtcp (GstBuffer * buffer)
+{
+  GstRTPBuffer rtp_buffer = GST_RTP_BUFFER_INIT;
+
+  if (!gst_rtp_buffer_map (buffer, GST_MAP_READ, &rtp_buffer)) {
+    return TRUE;
+  }
+
+  gst_rtp_buffer_unmap (&rtp_buffer);
+  return FALSE;
+}
+
+/* Returns the microseconds taken to classify every buffer */
+static gint64
+time_classifier (gboolean (*is_rtcp) (GstBuffer *), GstBuffer ** buffers,
+    guint expected_rtcp)
+{
+  guint i, n_rtcp = 0;
+  gint64 start;
+
+  start = g_get_monotonic_time ();
+  for (i = 0; i < BENCH_PACKETS; i++) {
+    if (is_rtcp (buffers[i])) {
+      n_rtcp++;
+    }
+  }
+
+  /* Marked RTP packets with PT 96 are not classified as RTCP either way */
+  fail_unless_equals_int (n_rtcp, expected_rtcp);
+
+  return g_get_monotonic_time () - start;
+}
+
+static GstBuffer **
+generate_bench_buffers (void)
+{
+  GstBuffer **buffers;
+  guint i;
+
+  buffers = g_new (GstBuffer *, BENCH_PACKETS);
+
+  for (i = 0; i < BENCH_PACKETS; i++) {
+    if (i % BENCH_RTCP_EVERY == 0) {
+      buffers[i] = generate_rtcp_rr_buffer (RTP_SSRC);
+    } else {
+      buffers[i] = generate_rtp_buffer (i, i % 2 == 0);
+    }
+  }
+
+  return buffers;
+}
+
+static void
+free_bench_buffers (GstBuffer ** buffers)
+{
+  guint i;
+
+  for (i = 0; i < BENCH_PACKETS; i++) {
+    gst_buffer_unref (buffers[i]);
+  }
+
+  g_free (buffers);
+}
+
+static gdouble
+packets_per_second (guint packets, gint64 elapsed)
+{
+  return packets * (gdouble) G_USEC_PER_SEC / MAX (elapsed, 1);
+}
+
+static void
+drain_harness (GstHarness * h, guint expected)
+{
+  guint i;
+
+  fail_unless_equals_int (gst_harness_buffers_received (h), expected);
+
+  for (i = 0; i < expected; i++) {
+    gst_buffer_unref (gst_harness_pull (h));
+  }
+}
+
+GST_START_TEST (test_classification)
+{
+  GstElement *rtcpdemux = gst_element_factory_make ("rtcpdemux", NULL);
+  GstHarness *h_rtp, *h_rtcp;
+  guint local_ssrc;
+
+  h_rtp = gst_harness_new_with_element (rtcpdemux, "sink", "rtp_src");
+  h_rtcp = gst_harness_new_with_element (rtcpdemux, NULL, "rtcp_src");
+
+  gst_harness_set_src_caps_str (h_rtp, "application/x-rtcp-mux");
+
+  /* PT 96 with the marker bit set (0xE0) is above the RTCP range */
+  fail_unless (gst_harness_push (h_rtp, generate_rtp_buffer (1,
+              FALSE)) == GST_FLOW_OK);
+  fail_unless (gst_harness_push (h_rtp, generate_rtp_buffer (2,
+              TRUE)) == GST_FLOW_OK);
+  fail_unless (gst_harness_push (h_rtp,
+          generate_rtcp_rr_buffer (RTP_SSRC)) == GST_FLOW_OK);
+
+  fail_unless_equals_int (gst_harness_buffers_received (h_rtp), 2);
+  fail_unless_equals_int (gst_harness_buffers_received (h_rtcp), 1);
+
+  g_signal_emit_by_name (rtcpdemux, "get-local-rr-ssrc-pair", RTP_SSRC,
+      &local_ssrc);
+  fail_unless_equals_int (local_ssrc, RTCP_LOCAL_SSRC);
+
+  gst_harness_teardown (h_rtcp);
+  gst_harness_teardown (h_rtp);
+  g_object_unref (rtcpdemux);
+}
+
+GST_END_TEST;
+
+GST_START_TEST (test_chain_list)
+{
+  GstElement *rtcpdemux = gst_element_factory_make ("rtcpdemux", NULL);
+  GstHarness *h_rtp, *h_rtcp;
+  GstBufferList *list;
+  guint i;
+
+  h_rtp = gst_harness_new_with_element (rtcpdemux, "sink", "rtp_src");
+  h_rtcp = gst_harness_new_with_element (rtcpdemux, NULL, "rtcp_src");
+
+  gst_harness_set_src_caps_str (h_rtp, "application/x-rtcp-mux");
+
+  list = gst_buffer_list_new ();
+
+  for (i = 0; i < BENCH_LIST_SIZE; i++) {
+    if (i % 4 == 0) {
+      gst_buffer_list_add (list, generate_rtcp_rr_buffer (RTP_SSRC));
+    } else {
+      gst_buffer_list_add (list, generate_rtp_buffer (i, FALSE));
+    }
+  }
+
+  fail_unless (gst_pad_push_list (h_rtp->srcpad, list) == GST_FLOW_OK);
+
+  fail_unless_equals_int (gst_harness_buffers_received (h_rtp),
+      BENCH_LIST_SIZE - BENCH_LIST_SIZE / 4);
+  fail_unless_equals_int (gst_harness_buffers_received (h_rtcp),
+      BENCH_LIST_SIZE / 4);
+
+  gst_harness_teardown (h_rtcp);
+  gst_harness_teardown (h_rtp);
+  g_object_unref (rtcpdemux);
+}
+
+GST_END_TEST;
+
+GST_START_TEST (test_compound_rr)
+{
+  GstElement *rtcpdemux = gst_element_factory_make ("rtcpdemux", NULL);
+  GstHarness *h_rtp, *h_rtcp;
+  guint local_ssrc;
+
+  h_rtp = gst_harness_new_with_element (rtcpdemux, "sink", "rtp_src");
+  h_rtcp = gst_harness_new_with_element (rtcpdemux, NULL, "rtcp_src");
+
+  gst_harness_set_src_caps_str (h_rtp, "application/x-rtcp-mux");
+
+  fail_unless (gst_harness_push (h_rtp,
+          generate_rtcp_compound_buffer (RTP_SSRC)) == GST_FLOW_OK);
+  fail_unless_equals_int (gst_harness_buffers_received (h_rtcp), 1);
+
+  /* The RR is the third packet of the compound */
+  g_signal_emit_by_name (rtcpdemux, "get-local-rr-ssrc-pair", RTP_SSRC,
+      &local_ssrc);
+  fail_unless_equals_int (local_ssrc, RTCP_LOCAL_SSRC);
+
+  g_signal_emit_by_name (rtcpdemux, "get-local-rr-ssrc-pair", RTP_SSRC + 1,
+      &local_ssrc);
+  fail_unless_equals_int (local_ssrc, 0);
+
+  fail_unless_equals_int (get_ssrc_map_stat (rtcpdemux, "hits"), 1);
+  fail_unless_equals_int (get_ssrc_map_stat (rtcpdemux, "misses"), 1);
+
+  gst_harness_teardown (h_rtcp);
+  gst_harness_teardown (h_rtp);
+  g_object_unref (rtcpdemux);
+}
+
+GST_END_TEST;
+
+GST_START_TEST (test_rr_first_pair_wins)
+{
+  GstElement *rtcpdemux = gst_element_factory_make ("rtcpdemux", NULL);
+  GstHarness *h_rtp, *h_rtcp;
+  guint local_ssrc;
+
+  h_rtp = gst_harness_new_with_element (rtcpdemux, "sink", "rtp_src");
+  h_rtcp = gst_harness_new_with_element (rtcpdemux, NULL, "rtcp_src");
+
+  gst_harness_set_src_caps_str (h_rtp, "application/x-rtcp-mux");
+
+  fail_unless (gst_harness_push (h_rtp,
+          generate_rtcp_rr_buffer (RTP_SSRC)) == GST_FLOW_OK);
+  fail_unless (gst_harness_push (h_rtp,
+          generate_rtcp_rr_buffer_full (RTP_SSRC,
+              RTCP_LOCAL_SSRC + 1)) == GST_FLOW_OK);
+  fail_unless_equals_int (gst_harness_buffers_received (h_rtcp), 2);
+
+  /* Later reports of the remote ssrc do not change its pair */
+  g_signal_emit_by_name (rtcpdemux, "get-local-rr-ssrc-pair", RTP_SSRC,
+      &local_ssrc);
+  fail_unless_equals_int (local_ssrc, RTCP_LOCAL_SSRC);
+
+  gst_harness_teardown (h_rtcp);
+  gst_harness_teardown (h_rtp);
+  g_object_unref (rtcpdemux);
+}
+
+GST_END_TEST;
+
+GST_START_TEST (test_empty_rr_from_unknown_ssrc)
+{
+  GstElement *rtcpdemux = gst_element_factory_make ("rtcpdemux", NULL);
+  GstHarness *h_rtp, *h_rtcp;
+  guint local_ssrc;
+
+  h_rtp = gst_harness_new_with_element (rtcpdemux, "sink", "rtp_src");
+  h_rtcp = gst_harness_new_with_element (rtcpdemux, NULL, "rtcp_src");
+
+  gst_harness_set_src_caps_str (h_rtp, "application/x-rtcp-mux");
+
+  /* Nothing can be learned from it, so it is dropped */
+  fail_unless (gst_harness_push (h_rtp,
+          generate_rtcp_rr_buffer_full (RTP_SSRC, 0)) == GST_FLOW_OK);
+  fail_unless_equals_int (gst_harness_buffers_received (h_rtcp), 0);
+
+  g_signal_emit_by_name (rtcpdemux, "get-local-rr-ssrc-pair", RTP_SSRC,
+      &local_ssrc);
+  fail_unless_equals_int (local_ssrc, 0);
+
+  /* Once the remote ssrc is known its empty reports go through */
+  fail_unless (gst_harness_push (h_rtp,
+          generate_rtcp_rr_buffer (RTP_SSRC)) == GST_FLOW_OK);
+  fail_unless (gst_harness_push (h_rtp,
+          generate_rtcp_rr_buffer_full (RTP_SSRC, 0)) == GST_FLOW_OK);
+  fail_unless_equals_int (gst_harness_buffers_received (h_rtcp), 2);
+
+  gst_harness_teardown (h_rtcp);
+  gst_harness_teardown (h_rtp);
+  g_object_unref (rtcpdemux);
+}
+
+GST_END_TEST;
+
+GST_START_TEST (test_ssrc_map_bounded)
+{
+  GstElement *rtcpdemux = gst_element_factory_make ("rtcpdemux", NULL);
+  GstHarness *h_rtp, *h_rtcp;
+  guint i, n_ssrcs, capacity, entries, evictions, local_ssrc;
+
+  h_rtp = gst_harness_new_with_element (rtcpdemux, "sink", "rtp_src");
+  h_rtcp = gst_harness_new_with_element (rtcpdemux, NULL, "rtcp_src");
+
+  gst_harness_set_src_caps_str (h_rtp, "application/x-rtcp-mux");
+
+  capacity = get_ssrc_map_stat (rtcpdemux, "capacity");
+  n_ssrcs = capacity * 4;
+
+  /* Simulate remote ssrcs changing over time */
+  for (i = 0; i < n_ssrcs; i++) {
+    fail_unless (gst_harness_push (h_rtp,
+            generate_rtcp_rr_buffer (RTP_SSRC + i)) == GST_FLOW_OK);
+    gst_buffer_unref (gst_harness_pull (h_rtcp));
+
+    /* Reports of known ssrcs refresh them instead of using more room */
+    fail_unless (gst_harness_push (h_rtp,
+            generate_rtcp_rr_buffer (RTP_SSRC + i)) == GST_FLOW_OK);
+    gst_buffer_unref (gst_harness_pull (h_rtcp));
+  }
+
+  entries = get_ssrc_map_stat (rtcpdemux, "entries");
+  evictions = get_ssrc_map_stat (rtcpdemux, "evictions");
+
+  fail_unless (entries <= capacity);
+  fail_unless (evictions > 0);
+  fail_unless_equals_int (entries + evictions, n_ssrcs);
+
+  /* The last reported ssrc is never the one evicted */
+  g_signal_emit_by_name (rtcpdemux, "get-local-rr-ssrc-pair",
+      RTP_SSRC + n_ssrcs - 1, &local_ssrc);
+  fail_unless_equals_int (local_ssrc, RTCP_LOCAL_SSRC);
+
+  gst_harness_teardown (h_rtcp);
+  gst_harness_teardown (h_rtp);
+  g_object_unref (rtcpdemux);
+}
+
+GST_END_TEST;
+
+GST_START_TEST (bench_classification)
+{
+  GstElement *rtcpdemux = gst_element_factory_make ("rtcpdemux", NULL);
+  GstHarness *h_rtp, *h_rtcp;
+  GstBuffer **buffers;
+  guint i, n_rtcp_expected;
+  gint64 start, legacy, peek, single, list;
+
+  buffers = generate_bench_buffers ();
+  n_rtcp_expected = (BENCH_PACKETS + BENCH_RTCP_EVERY - 1) / BENCH_RTCP_EVERY;
+
+  /* Previous and current classifiers, on their own */
+  legacy = time_classifier (legacy_buffer_is_rtcp, buffers, n_rtcp_expected);
+  peek = time_classifier (kms_rtcp_demux_buffer_is_rtcp, buffers,
+      n_rtcp_expected);
+
+  h_rtp = gst_harness_new_with_element (rtcpdemux, "sink", "rtp_src");
+  h_rtcp = gst_harness_new_with_element (rtcpdemux, NULL, "rtcp_src");
+  gst_harness_set_src_caps_str (h_rtp, "application/x-rtcp-mux");
+
+  /* Whole element, one buffer at a time */
+  start = g_get_monotonic_time ();
+  for (i = 0; i < BENCH_PACKETS; i++) {
+    gst_harness_push (h_rtp, gst_buffer_ref (buffers[i]));
+  }
+  single = g_get_monotonic_time () - start;
+
+  drain_harness (h_rtp, BENCH_PACKETS - n_rtcp_expected);
+  drain_harness (h_rtcp, n_rtcp_expected);
+
+  /* Whole element, batched in buffer lists */
+  start = g_get_monotonic_time ();
+  for (i = 0; i < BENCH_PACKETS; i += BENCH_LIST_SIZE) {
+    GstBufferList *blist = gst_buffer_list_new_sized (BENCH_LIST_SIZE);
+    guint j;
+
+    for (j = i; j < i + BENCH_LIST_SIZE && j < BENCH_PACKETS; j++) {
+      gst_buffer_list_add (blist, gst_buffer_ref (buffers[j]));
+    }
+
+    gst_pad_push_list (h_rtp->srcpad, blist);
+  }
+  list = g_get_monotonic_time () - start;
+
+  drain_harness (h_rtp, BENCH_PACKETS - n_rtcp_expected);
+  drain_harness (h_rtcp, n_rtcp_expected);
+
+  GST_INFO ("Classifier, RTP mapping (previous): %.0f packets/s",
+      packets_per_second (BENCH_PACKETS, legacy));
+  GST_INFO ("Classifier, payload type peek (current): %.0f packets/s",
+      packets_per_second (BENCH_PACKETS, peek));
+  GST_INFO ("Demuxer, chain: %.0f packets/s",
+      packets_per_second (BENCH_PACKETS, single));
+  GST_INFO ("Demuxer, chain list (%u): %.0f packets/s", BENCH_LIST_SIZE,
+      packets_per_second (BENCH_PACKETS, list));
+
+  gst_harness_teardown (h_rtcp);
+  gst_harness_teardown (h_rtp);
+  g_object_unref (rtcpdemux);
+
+  free_bench_buffers (buffers);
+}
+
+GST_END_TEST;
+
+/*
+ * End of test cases
+ */
+static Suite *
+rtcpdemux_suite (void)
+{
+  Suite *s = suite_create ("rtcpdemux");
+  TCase *tc_chain = tcase_create ("element");
+
+  suite_add_tcase (s, tc_chain);
+  tcase_add_test (tc_chain, test_classification);
+  tcase_add_test (tc_chain, test_chain_list);
+  tcase_add_test (tc_chain, test_compound_rr);
+  tcase_add_test (tc_chain, test_rr_first_pair_wins);
+  tcase_add_test (tc_chain, test_empty_rr_from_unknown_ssrc);
+  tcase_add_test (tc_chain, test_ssrc_map_bounded);
+  tcase_add_test (tc_chain, bench_classification);
+
+  return s;
+}
+
+GST_CHECK_MAIN (rtcpdemux);
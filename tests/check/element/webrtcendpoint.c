@@ -18,6 +18,9 @@
 #include <gst/check/gstcheck.h>
 #include <gst/sdp/gstsdpmessage.h>
 #include <webrtcendpoint/kmsicecandidate.h>
+#include <webrtcendpoint/kmswebrtcendpoint.h>
+#include <looppool/kmslooppool.h>
+#include <webrtcendpoint/kmsrelaydescriptor.h>
 
 #include <commons/kmselementpadtype.h>
 
@@ -2027,6 +2030,61 @@ GST_START_TEST (test_session_creation)
 
 GST_END_TEST;
 
+#define LOOP_POOL_SIZE 2
+#define LOOP_POOL_ENDPOINTS 8
+
+GST_START_TEST (test_shared_event_loops)
+{
+  GstElement *endpoints[LOOP_POOL_ENDPOINTS];
+  GstStructure *stats, *loops;
+  guint i, size, users = 0;
+
+  kms_webrtc_endpoint_set_event_loops (LOOP_POOL_SIZE);
+
+  for (i = 0; i < LOOP_POOL_ENDPOINTS; i++) {
+    endpoints[i] = gst_element_factory_make ("webrtcendpoint", NULL);
+  }
+
+  g_signal_emit_by_name (endpoints[0], "stats", NULL, &stats);
+  fail_unless (stats != NULL);
+
+  fail_unless (gst_structure_get (stats, KMS_LOOP_POOL_STATISTICS_FIELD,
+          GST_TYPE_STRUCTURE, &loops, NULL));
+  fail_unless (gst_structure_get_uint (loops, "size", &size));
+  fail_unless (size == LOOP_POOL_SIZE);
+
+  /* "size" field plus one field per running loop */
+  fail_unless (gst_structure_n_fields (loops) <= LOOP_POOL_SIZE + 1);
+
+  for (i = 0; i < LOOP_POOL_SIZE; i++) {
+    GstStructure *loop;
+    gchar *name;
+    guint loop_users;
+
+    name = g_strdup_printf ("loop-%u", i);
+    fail_unless (gst_structure_get (loops, name, GST_TYPE_STRUCTURE, &loop,
+            NULL));
+    fail_unless (gst_structure_get_uint (loop, "users", &loop_users));
+    GST_DEBUG ("Loop %s has %u users", name, loop_users);
+    users += loop_users;
+    gst_structure_free (loop);
+    g_free (name);
+  }
+
+  fail_unless (users == LOOP_POOL_ENDPOINTS);
+
+  gst_structure_free (loops);
+  gst_structure_free (stats);
+
+  for (i = 0; i < LOOP_POOL_ENDPOINTS; i++) {
+    g_object_unref (endpoints[i]);
+  }
+
+  kms_webrtc_endpoint_set_event_loops (0);
+}
+
+GST_END_TEST;
+
 typedef struct _CandidateRangeData
 {
   guint min_port;
@@ -2050,6 +2108,62 @@ on_ice_candidate_range (GstElement * self, gchar * sess_id,
   }
 }
 
+GST_START_TEST (test_relay_descriptor)
+{
+  const gchar *url = "user:pass@10.0.0.1:3478,"
+      "user:p:ss@10.0.0.2:443?transport=tls, user2:pass@10.0.0.3:80?transport=tcp";
+  KmsRelayDescriptor *relays, *other;
+  const KmsRelayServer *server;
+
+  relays = kms_relay_descriptor_get (url);
+  fail_unless (relays != NULL);
+  fail_unless_equals_int (kms_relay_descriptor_get_n_servers (relays), 3);
+
+  server = kms_relay_descriptor_get_server (relays, 0);
+  fail_unless_equals_string (server->user, "user");
+  fail_unless_equals_string (server->password, "pass");
+  fail_unless_equals_string (server->address, "10.0.0.1");
+  fail_unless_equals_int (server->port, 3478);
+  fail_unless_equals_int (server->transport, TURN_PROTOCOL_UDP);
+
+  server = kms_relay_descriptor_get_server (relays, 1);
+  fail_unless_equals_string (server->user, "user:p");
+  fail_unless_equals_string (server->password, "ss");
+  fail_unless_equals_int (server->port, 443);
+  fail_unless_equals_int (server->transport, TURN_PROTOCOL_TLS);
+
+  server = kms_relay_descriptor_get_server (relays, 2);
+  fail_unless_equals_string (server->user, "user2");
+  fail_unless_equals_string (server->address, "10.0.0.3");
+  fail_unless_equals_int (server->transport, TURN_PROTOCOL_TCP);
+
+  /* The same URL is parsed only once */
+  other = kms_relay_descriptor_get (url);
+  fail_unless (other == relays);
+  kms_relay_descriptor_unref (other);
+
+  /* Credentials can contain the separator */
+  other = kms_relay_descriptor_get
+      ("us,er:pa,ss@10.0.0.4:3478,user:pass@10.0.0.5:3478");
+  fail_unless (other != NULL);
+  fail_unless_equals_int (kms_relay_descriptor_get_n_servers (other), 2);
+  server = kms_relay_descriptor_get_server (other, 0);
+  fail_unless_equals_string (server->user, "us,er");
+  fail_unless_equals_string (server->password, "pa,ss");
+  fail_unless_equals_string (server->address, "10.0.0.4");
+  server = kms_relay_descriptor_get_server (other, 1);
+  fail_unless_equals_string (server->address, "10.0.0.5");
+  kms_relay_descriptor_unref (other);
+
+  fail_unless (kms_relay_descriptor_get ("user@10.0.0.1:3478") == NULL);
+  fail_unless (kms_relay_descriptor_get
+      ("user:pass@10.0.0.1:3478,turn.example.com:3478") == NULL);
+
+  kms_relay_descriptor_unref (relays);
+}
+
+GST_END_TEST;
+
 GST_START_TEST (test_port_range)
 {
   GArray *codecs_array;
@@ -2287,6 +2401,8 @@ webrtcendpoint_test_suite (void)
   tcase_add_test (tc_chain, test_remb_params);
 
   tcase_add_test (tc_chain, test_session_creation);
+  tcase_add_test (tc_chain, test_shared_event_loops);
+  tcase_add_test (tc_chain, test_relay_descriptor);
   tcase_add_test (tc_chain, test_port_range);
   tcase_add_test (tc_chain, test_not_enough_ports);
 
@@ -0,0 +1,278 @@
+/*
+ * (C) Copyright 2016 Kurento (http://kurento.org/)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#define BOOST_TEST_STATIC_LINK
+#define BOOST_TEST_PROTECTED_VIRTUAL
+
+#include <boost/test/included/unit_test.hpp>
+#include <libsoup/soup.h>
+#include <KmsHttpPost.h>
+
+#include <string>
+
+using namespace boost::unit_test;
+
+#define BOUNDARY "----KurentoTestBoundary"
+#define PAYLOAD_SIZE (8 * 1024 * 1024)
+#define CHUNK_SIZE (64 * 1024)
+
+struct GF {
+  GF();
+};
+
+BOOST_GLOBAL_FIXTURE (GF)
+
+GF::GF()
+{
+  gst_init (NULL, NULL);
+}
+
+static void
+got_data_cb (KmsHttpPost *post, SoupBuffer *buffer, gpointer data)
+{
+  std::string *received = (std::string *) data;
+
+  received->append (buffer->data, buffer->length);
+}
+
+static std::string
+generate_payload ()
+{
+  std::string payload;
+
+  payload.reserve (PAYLOAD_SIZE);
+
+  /* Random data without CR so that only the closing boundary is matched */
+  for (guint i = 0; i < PAYLOAD_SIZE; i++) {
+    payload += (gchar) g_random_int_range ('a', 'z' + 1);
+  }
+
+  return payload;
+}
+
+static SoupMessage *
+create_message (const gchar *content_type, const gchar *boundary)
+{
+  SoupMessage *msg;
+  GHashTable *params = NULL;
+
+  msg = soup_message_new ("POST", "http://localhost/");
+
+  if (boundary != NULL) {
+    params = g_hash_table_new (g_str_hash, g_str_equal);
+    g_hash_table_insert (params, (gpointer) "boundary", (gpointer) boundary);
+  }
+
+  soup_message_headers_set_content_type (msg->request_headers, content_type,
+                                         params);
+
+  if (params != NULL) {
+    g_hash_table_unref (params);
+  }
+
+  return msg;
+}
+
+/* Feeds @body in chunks of @max_chunk bytes, or random sizes up to it if
+ * @rand is given, and returns the ratio of bytes copied per byte uploaded */
+static gdouble
+upload (SoupMessage *msg, const std::string &body, std::string &received,
+        GRand *rand = NULL, gsize max_chunk = CHUNK_SIZE)
+{
+  KmsHttpPost *post = kms_http_post_new ();
+  guint64 received_bytes, copied_bytes;
+
+  g_object_set (post, "soup-message", msg, NULL);
+  g_signal_connect (post, "got-data", G_CALLBACK (got_data_cb), &received);
+
+  for (gsize offset = 0, len; offset < body.size (); offset += len) {
+    SoupBuffer *chunk;
+
+    len = rand != NULL ? g_rand_int_range (rand, 1, max_chunk + 1) : max_chunk;
+    len = MIN (len, body.size () - offset);
+    chunk = soup_buffer_new (SOUP_MEMORY_COPY, body.data () + offset, len);
+
+    g_signal_emit_by_name (msg, "got-chunk", chunk);
+    soup_buffer_free (chunk);
+  }
+
+  g_object_get (post, "received-bytes", &received_bytes, "copied-bytes",
+                &copied_bytes, NULL);
+  g_object_unref (post);
+
+  BOOST_CHECK_EQUAL (received_bytes, body.size () );
+  BOOST_TEST_MESSAGE ("Copied " << copied_bytes << " of " << received_bytes <<
+                      " bytes uploaded");
+
+  return (gdouble) copied_bytes / received_bytes;
+}
+
+static void
+plain_post ()
+{
+  SoupMessage *msg = create_message ("application/octet-stream", NULL);
+  std::string payload = generate_payload ();
+  std::string received;
+  gdouble ratio;
+
+  ratio = upload (msg, payload, received);
+
+  BOOST_CHECK (received == payload);
+  BOOST_CHECK_EQUAL (ratio, 0.0);
+
+  g_object_unref (msg);
+}
+
+/* Payload full of CRs and boundary look-alikes that are not boundaries */
+static std::string
+generate_tricky_payload (GRand *rand, gsize size)
+{
+  std::string boundary = BOUNDARY;
+  std::string payload;
+
+  while (payload.size () < size) {
+    switch (g_rand_int_range (rand, 0, 8) ) {
+    case 0:
+    case 1:
+      /* Without the last char of the boundary so it cannot be completed */
+      payload += (gchar) g_rand_int_range (rand, 'a', 'y');
+      break;
+
+    case 2:
+      payload += "\r";
+      break;
+
+    case 3:
+      payload += "\r\n";
+      break;
+
+    case 4:
+      payload += "\r\n--";
+      break;
+
+    case 5:
+      payload += "\r\n--" + boundary.substr (0, g_rand_int_range (rand, 0,
+                 boundary.size () ) );
+      break;
+
+    case 6:
+      payload += "\r\n--" + boundary + "x";
+      break;
+
+    case 7:
+      payload += "\r\n--" + boundary + "-x";
+      break;
+    }
+  }
+
+  return payload;
+}
+
+static std::string
+generate_body (const std::string &payload)
+{
+  return "--" BOUNDARY "\r\n"
+         "Content-Disposition: form-data; name=\"field\"\r\n"
+         "\r\n"
+         "value\r\n"
+         "--" BOUNDARY "\r\n"
+         "Content-Disposition: form-data; name=\"file\"; filename=\"a.webm\"\r\n"
+         "Content-Type: video/webm\r\n"
+         "\r\n" + payload + "\r\n--" BOUNDARY "--\r\n";
+}
+
+static void
+multipart_post ()
+{
+  SoupMessage *msg = create_message ("multipart/form-data", BOUNDARY);
+  std::string payload = generate_payload ();
+  std::string body, received;
+  gdouble ratio;
+
+  body = generate_body (payload);
+
+  ratio = upload (msg, body, received);
+
+  BOOST_CHECK (received == payload);
+  /* Only bytes around the closing boundary can be carried over */
+  BOOST_CHECK_LT (ratio, 0.01);
+
+  g_object_unref (msg);
+}
+
+static void
+multipart_random_splits ()
+{
+  GRand *rand = g_rand_new_with_seed (g_random_int () );
+  gsize max_chunks[] = { 1, 8, 64, 4096 };
+
+  for (guint i = 0; i < 400; i++) {
+    SoupMessage *msg = create_message ("multipart/form-data", BOUNDARY);
+    std::string payload = generate_tricky_payload (rand,
+                          g_rand_int_range (rand, 0, 32 * 1024) );
+    std::string received;
+
+    upload (msg, generate_body (payload), received, rand,
+            max_chunks[i % G_N_ELEMENTS (max_chunks)]);
+
+    BOOST_REQUIRE (received == payload);
+
+    g_object_unref (msg);
+  }
+
+  g_rand_free (rand);
+}
+
+static void
+multipart_throughput ()
+{
+  GRand *rand = g_rand_new ();
+  std::string payload = generate_tricky_payload (rand, PAYLOAD_SIZE);
+  std::string body = generate_body (payload);
+  std::string received;
+  gint64 start, elapsed;
+
+  for (guint i = 0; i < 4; i++) {
+    SoupMessage *msg = create_message ("multipart/form-data", BOUNDARY);
+
+    received.clear ();
+    start = g_get_monotonic_time ();
+    upload (msg, body, received);
+    elapsed = g_get_monotonic_time () - start;
+
+    BOOST_CHECK (received == payload);
+    BOOST_TEST_MESSAGE ("Parsed " << body.size () << " bytes in " << elapsed <<
+                        " us (" << body.size () / MAX (elapsed, 1) << " MB/s)");
+
+    g_object_unref (msg);
+  }
+
+  g_rand_free (rand);
+}
+
+test_suite *
+init_unit_test_suite ( int , char *[] )
+{
+  test_suite *test = BOOST_TEST_SUITE ( "HttpPost" );
+
+  test->add (BOOST_TEST_CASE ( &plain_post ), 0, /* timeout */ 100);
+  test->add (BOOST_TEST_CASE ( &multipart_post ), 0, /* timeout */ 100);
+  test->add (BOOST_TEST_CASE ( &multipart_random_splits ), 0, /* timeout */ 100);
+  test->add (BOOST_TEST_CASE ( &multipart_throughput ), 0, /* timeout */ 100);
+
+  return test;
+}